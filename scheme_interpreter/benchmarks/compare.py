@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+"""
+Compares the benchmarks of two builds of bench_schemelang.
+
+Both binaries are run in alternating rounds, so drift in the machine's speed lands on both builds alike.
+Each round adds a few repetitions of every benchmark that is not yet stable, and a benchmark is stable
+once the 95% confidence interval of its mean is within the tolerance for both builds. The report gives
+each benchmark's change with a confidence interval, and flags a regression when the candidate is slower
+by more than the threshold and the interval rules out no change at all.
+
+Usage: compare.py BASELINE CANDIDATE [--threshold 5] [--tolerance 2] [--filter REGEX] [--json out.json]
+
+Exits with 1 if any benchmark regressed, so it can gate a change to the evaluator's hot paths.
+"""
+
+import argparse
+import json
+import math
+import re
+import subprocess
+import sys
+
+# Two-sided 95% critical values of Student's t distribution by degrees of freedom
+T_TABLE = [
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+]
+
+TIME_UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def t_critical(df):
+    if df < 1:
+        return float("inf")
+    index = int(df) - 1
+    return T_TABLE[index] if index < len(T_TABLE) else 1.96
+
+
+def mean_and_variance(samples):
+    mean = sum(samples) / len(samples)
+    if len(samples) < 2:
+        return mean, float("inf")
+    return mean, sum((x - mean) ** 2 for x in samples) / (len(samples) - 1)
+
+
+def half_width(samples):
+    """Half width of the 95% confidence interval of the mean"""
+    mean, variance = mean_and_variance(samples)
+    return t_critical(len(samples) - 1) * math.sqrt(variance / len(samples))
+
+
+def is_stable(samples, tolerance, min_samples):
+    if len(samples) < min_samples:
+        return False
+    mean = sum(samples) / len(samples)
+    return mean > 0 and half_width(samples) / mean <= tolerance
+
+
+def run_benchmarks(binary, names, repetitions, metric, min_time):
+    """Runs a binary once, returning the time of every repetition in nanoseconds by benchmark name"""
+    pattern = "^(" + "|".join(re.escape(name) for name in names) + ")$"
+    command = [
+        binary,
+        "--benchmark_filter=" + pattern,
+        "--benchmark_repetitions=%d" % repetitions,
+        "--benchmark_format=json",
+    ]
+    if min_time:
+        command.append("--benchmark_min_time=%s" % min_time)
+
+    output = subprocess.run(command, check=True, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL).stdout
+    times = {}
+    for entry in json.loads(output)["benchmarks"]:
+        if entry.get("run_type") != "iteration" or entry.get("error_occurred"):
+            continue
+        scale = TIME_UNITS[entry.get("time_unit", "ns")]
+        times.setdefault(entry["run_name"], []).append(entry[metric] * scale)
+    return times
+
+
+def list_benchmarks(binary, name_filter):
+    command = [binary, "--benchmark_list_tests=true"]
+    if name_filter:
+        command.append("--benchmark_filter=" + name_filter)
+    output = subprocess.run(command, check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+    return [line.strip() for line in output.splitlines() if line.strip()]
+
+
+def compare(baseline, candidate):
+    """Relative change of the candidate's mean with a 95% interval, from Welch's t-test"""
+    base_mean, base_var = mean_and_variance(baseline)
+    cand_mean, cand_var = mean_and_variance(candidate)
+    base_se = base_var / len(baseline)
+    cand_se = cand_var / len(candidate)
+
+    denominator = base_se ** 2 / (len(baseline) - 1) + cand_se ** 2 / (len(candidate) - 1)
+    df = (base_se + cand_se) ** 2 / denominator if denominator > 0 else len(baseline) + len(candidate) - 2
+    margin = t_critical(df) * math.sqrt(base_se + cand_se)
+
+    delta = cand_mean - base_mean
+    return delta / base_mean, (delta - margin) / base_mean, (delta + margin) / base_mean
+
+
+def format_time(ns):
+    for unit, scale in (("s", 1e9), ("ms", 1e6), ("us", 1e3)):
+        if ns >= scale:
+            return "%.3g %s" % (ns / scale, unit)
+    return "%.3g ns" % ns
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare the benchmarks of two builds")
+    parser.add_argument("baseline", help="bench_schemelang of the build to compare against")
+    parser.add_argument("candidate", help="bench_schemelang of the build being tested")
+    parser.add_argument("--threshold", type=float, default=5.0, help="percent slowdown counted as a regression")
+    parser.add_argument("--tolerance", type=float, default=2.0, help="percent half width of a stable mean's interval")
+    parser.add_argument("--batch", type=int, default=5, help="repetitions added per round")
+    parser.add_argument("--min-samples", type=int, default=10, help="repetitions needed before a benchmark can be stable")
+    parser.add_argument("--max-rounds", type=int, default=10, help="rounds before giving up on stability")
+    parser.add_argument("--metric", choices=("cpu_time", "real_time"), default="cpu_time")
+    parser.add_argument("--min-time", help="passed on as --benchmark_min_time")
+    parser.add_argument("--filter", help="regex of the benchmarks to run")
+    parser.add_argument("--json", help="file to write the comparison to")
+    args = parser.parse_args()
+
+    if not args.baseline:
+        print("No baseline given, configure with -DBENCHMARK_BASELINE=<path to bench_schemelang>", file=sys.stderr)
+        return 2
+
+    names = list_benchmarks(args.candidate, args.filter)
+    baseline_names = set(list_benchmarks(args.baseline, args.filter))
+    missing = [name for name in names if name not in baseline_names]
+    names = [name for name in names if name in baseline_names]
+    if not names:
+        print("The builds have no benchmarks in common", file=sys.stderr)
+        return 2
+
+    samples = {name: ([], []) for name in names}
+    pending = list(names)
+    for round_index in range(args.max_rounds):
+        # Alternate which build goes first, so neither always runs on a warmer machine
+        order = [(0, args.baseline), (1, args.candidate)]
+        if round_index % 2:
+            order.reverse()
+        for side, binary in order:
+            for name, times in run_benchmarks(binary, pending, args.batch, args.metric, args.min_time).items():
+                if name in samples:
+                    samples[name][side].extend(times)
+
+        tolerance = args.tolerance / 100
+        pending = [name for name in pending
+                   if not all(is_stable(s, tolerance, args.min_samples) for s in samples[name])]
+        print("Round %d: %d of %d benchmarks stable" % (round_index + 1, len(names) - len(pending), len(names)),
+              file=sys.stderr)
+        if not pending:
+            break
+
+    threshold = args.threshold / 100
+    results = []
+    header = "%-28s %22s %22s %24s" % ("Benchmark", "Baseline", "Candidate", "Change (95% CI)")
+    print(header)
+    print("-" * len(header))
+    for name in names:
+        baseline, candidate = samples[name]
+        if len(baseline) < 2 or len(candidate) < 2:
+            print("%-28s failed to run" % name)
+            continue
+
+        change, low, high = compare(baseline, candidate)
+        if change > threshold and low > 0:
+            verdict = "REGRESSION"
+        elif change < -threshold and high < 0:
+            verdict = "improved"
+        elif low > 0 or high < 0:
+            verdict = "changed"
+        else:
+            verdict = ""
+        if name in pending:
+            verdict += " (unstable)"
+
+        base_mean = sum(baseline) / len(baseline)
+        cand_mean = sum(candidate) / len(candidate)
+        print("%-28s %12s +- %5.1f%% %12s +- %5.1f%% %+7.1f%% [%+.1f, %+.1f] %s" % (
+            name,
+            format_time(base_mean), 100 * half_width(baseline) / base_mean,
+            format_time(cand_mean), 100 * half_width(candidate) / cand_mean,
+            100 * change, 100 * low, 100 * high, verdict))
+
+        results.append({
+            "name": name,
+            "baseline_ns": base_mean,
+            "candidate_ns": cand_mean,
+            "baseline_samples": len(baseline),
+            "candidate_samples": len(candidate),
+            "change": change,
+            "change_low": low,
+            "change_high": high,
+            "stable": name not in pending,
+            "regression": verdict.startswith("REGRESSION"),
+        })
+
+    for name in missing:
+        print("%-28s only in the candidate" % name)
+
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump({"metric": args.metric, "threshold": threshold, "benchmarks": results}, out, indent=2)
+
+    regressions = [result["name"] for result in results if result["regression"]]
+    if regressions:
+        print("\n%d regression(s) above %.1f%%: %s" % (len(regressions), args.threshold, ", ".join(regressions)))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,116 @@
+#include <lang/hash_table.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+using namespace environment;
+
+/**
+ * Compares the Scheme hash table against std::unordered_map for inserts followed by lookups of every
+ * inserted key. The key count defaults to ten million and can be passed as the first argument
+*/
+
+using Clock = std::chrono::steady_clock;
+
+static void report(const char* name, const char* phase, Clock::time_point start, Clock::time_point end, std::size_t count)
+{
+	double seconds = std::chrono::duration<double>(end - start).count();
+	std::printf("%-28s %-8s %8.1f ns/op %8.2f Mops/s\n", name, phase, seconds * 1e9 / count, count / seconds / 1e6);
+}
+
+static std::vector<int> make_int_keys(std::size_t count)
+{
+	std::vector<int> keys(count);
+	for (std::size_t i = 0; i < count; i++) keys[i] = static_cast<int>(i);
+	std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+	return keys;
+}
+
+static void bench_int_keys(const std::vector<int>& keys)
+{
+	// Look keys up in a different order than they were inserted, so node based tables don't get
+	// a free ride from their allocation order
+	auto lookups = keys;
+	std::shuffle(lookups.begin(), lookups.end(), std::mt19937(7));
+
+	std::size_t found = 0;
+	{
+		HashTable table(Equivalence::EQV);
+
+		auto start = Clock::now();
+		for (auto key : keys) table.insert(Slot(key), Slot(key));
+		auto mid = Clock::now();
+		for (auto key : lookups) found += table.find(Slot(key)) != nullptr;
+		auto end = Clock::now();
+
+		report("HashTable<int>", "insert", start, mid, keys.size());
+		report("HashTable<int>", "lookup", mid, end, keys.size());
+	}
+	{
+		std::unordered_map<int, int> table;
+
+		auto start = Clock::now();
+		for (auto key : keys) table[key] = key;
+		auto mid = Clock::now();
+		for (auto key : lookups) found += table.find(key) != table.end();
+		auto end = Clock::now();
+
+		report("std::unordered_map<int>", "insert", start, mid, keys.size());
+		report("std::unordered_map<int>", "lookup", mid, end, keys.size());
+	}
+	if (found != keys.size() * 2) std::printf("lookup mismatch: %zu\n", found);
+}
+
+static void bench_string_keys(const std::vector<int>& ints)
+{
+	std::vector<std::string> keys;
+	keys.reserve(ints.size());
+	for (auto key : ints) keys.push_back("key-" + std::to_string(key));
+
+	std::vector<Slot> slot_keys;
+	slot_keys.reserve(keys.size());
+	for (auto& key : keys) slot_keys.push_back(Slot::from_variable(std::make_unique<String>(key)));
+
+	std::vector<std::size_t> lookups(keys.size());
+	for (std::size_t i = 0; i < lookups.size(); i++) lookups[i] = i;
+	std::shuffle(lookups.begin(), lookups.end(), std::mt19937(7));
+
+	std::size_t found = 0;
+	{
+		HashTable table(Equivalence::STRING);
+
+		auto start = Clock::now();
+		for (std::size_t i = 0; i < slot_keys.size(); i++) table.insert(slot_keys[i], Slot(ints[i]));
+		auto mid = Clock::now();
+		for (auto i : lookups) found += table.find(slot_keys[i]) != nullptr;
+		auto end = Clock::now();
+
+		report("HashTable<string>", "insert", start, mid, keys.size());
+		report("HashTable<string>", "lookup", mid, end, keys.size());
+	}
+	{
+		std::unordered_map<std::string, int> table;
+
+		auto start = Clock::now();
+		for (std::size_t i = 0; i < keys.size(); i++) table[keys[i]] = ints[i];
+		auto mid = Clock::now();
+		for (auto i : lookups) found += table.find(keys[i]) != table.end();
+		auto end = Clock::now();
+
+		report("std::unordered_map<string>", "insert", start, mid, keys.size());
+		report("std::unordered_map<string>", "lookup", mid, end, keys.size());
+	}
+	if (found != keys.size() * 2) std::printf("lookup mismatch: %zu\n", found);
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t count = argc > 1 ? std::stoul(argv[1]) : 10'000'000;
+	auto keys = make_int_keys(count);
+
+	bench_int_keys(keys);
+	bench_string_keys(keys);
+}
@@ -0,0 +1,118 @@
+#include <lang/places.hpp>
+#include <lang/persistent.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Message passing benchmarks for places, run on the mailboxes and message copying that places use.
+ *
+ * ping-pong: round trips between two threads over a pair of mailboxes, reporting latency percentiles
+ * fan-out: one producer sending round robin to several consumers, reporting messages per second, once
+ * with a vector that is copied deeply and once with a persistent vector that is shared
+ *
+ * Usage: bench_places [round trips] [consumers] [messages]
+*/
+
+using Clock = std::chrono::steady_clock;
+using places::Mailbox;
+
+static double percentile(const std::vector<double>& sorted, double fraction)
+{
+	if (sorted.empty()) return 0;
+	auto idx = static_cast<std::size_t>(fraction * (sorted.size() - 1));
+	return sorted[idx];
+}
+
+static void ping_pong(std::size_t round_trips)
+{
+	Mailbox to_echo;
+	Mailbox to_main;
+
+	std::thread echo([&]() {
+		while (true)
+		{
+			Slot message = to_echo.pop();
+			bool last = message.i_value < 0;
+			to_main.push(std::move(message));
+			if (last) break;
+		}
+	});
+
+	std::vector<double> latencies;
+	latencies.reserve(round_trips);
+
+	for (std::size_t i = 0; i < round_trips; i++)
+	{
+		auto sent = Clock::now();
+		to_echo.push(Slot(static_cast<int>(i)));
+		to_main.pop();
+		latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+	}
+	to_echo.push(Slot(-1));
+	to_main.pop();
+	echo.join();
+
+	std::sort(latencies.begin(), latencies.end());
+	std::printf("ping-pong    %zu round trips\n", round_trips);
+	std::printf("p50 latency  %.2f us\n", percentile(latencies, 0.50));
+	std::printf("p99 latency  %.2f us\n", percentile(latencies, 0.99));
+}
+
+static void fan_out(const char* label, const Slot& payload, std::size_t consumers, std::size_t messages)
+{
+	std::vector<std::unique_ptr<Mailbox>> boxes;
+	std::vector<std::thread> threads;
+	std::vector<std::size_t> received(consumers, 0);
+
+	for (std::size_t i = 0; i < consumers; i++)
+	{
+		boxes.push_back(std::make_unique<Mailbox>());
+		threads.emplace_back([&, i]() {
+			while (true)
+			{
+				Slot message = boxes[i]->pop();
+				if (message.type == Variable::Type::BOOL) break;
+				received[i]++;
+			}
+		});
+	}
+
+	auto start = Clock::now();
+	for (std::size_t i = 0; i < messages; i++)
+	{
+		Slot copy;
+		places::copy_message(payload, copy);
+		boxes[i % consumers]->push(std::move(copy));
+	}
+	for (auto& box : boxes) box->push(Slot(false));
+	for (auto& thread : threads) thread.join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::size_t total = 0;
+	for (auto count : received) total += count;
+	std::printf("fan-out %-10s %zu consumers, %zu messages, %.0f msg/s\n", label, consumers, total, total / seconds);
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t round_trips = argc > 1 ? std::stoul(argv[1]) : 100000;
+	std::size_t consumers = argc > 2 ? std::stoul(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+	std::size_t messages = argc > 3 ? std::stoul(argv[3]) : 200000;
+
+	ping_pong(round_trips);
+
+	auto vec = std::make_unique<Vector>(64, Slot(0));
+	auto persistent = std::make_unique<PersistentVector>();
+	for (int i = 0; i < 64; i++)
+	{
+		vec->set(i, Slot(i));
+		*persistent = persistent->push(Slot(i));
+	}
+
+	fan_out("vector", Slot::from_variable(std::move(vec)), consumers, messages);
+	fan_out("persistent", Slot::from_variable(std::move(persistent)), consumers, messages);
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include <lang/evaluate.hpp>
+#include <lang/region.hpp>
+#include <benchmark/benchmark.h>
+#include <string>
+
+using namespace eval;
+using namespace environment;
+using namespace parser;
+using namespace lexer;
+
+/**
+ * Classic Scheme benchmark programs ported to the dialect, along with microbenchmarks of each stage of
+ * evaluation. Every program is defined once, then only its call is timed, each call in a region scope the
+ * same way the repl evaluates a form. Results are checked before timing starts so a broken evaluator
+ * cannot report a fast time.
+ *
+ * Usage: bench_schemelang [--benchmark_filter=regex] [--benchmark_out=results.json --benchmark_out_format=json]
+*/
+
+static const char* fib_source =
+	"(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))";
+
+static const char* tak_source =
+	"(define tak (lambda (x y z) (if (< y x) (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)) z)))";
+
+static const char* ack_source =
+	"(define ack (lambda (m n) (if (= m 0) (+ n 1) (if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1)))))))";
+
+// There are no boolean literals, (= 0 0) stands in for true
+static const char* nqueens_source =
+	"(define queens (make-vector 8 0))"
+	"(define safe (lambda (row col i)"
+	"  (if (= i row) (= 0 0)"
+	"    (if (= (vector-ref queens i) col) (= 0 1)"
+	"      (if (= (abs (- (vector-ref queens i) col)) (- row i)) (= 0 1)"
+	"        (safe row col (+ i 1)))))))"
+	"(define place-queens (lambda (row n) (if (= row n) 1 (try-cols row 0 n))))"
+	"(define try-cols (lambda (row col n)"
+	"  (if (= col n) 0"
+	"    (+ (if (safe row col 0) (begin (vector-set! queens row col) (place-queens (+ row 1) n)) 0)"
+	"       (try-cols row (+ col 1) n)))))";
+
+static const char* sieve_source =
+	"(define sieve-mark (lambda (v i step n) (if (< i n) (begin (vector-set! v i 0) (sieve-mark v (+ i step) step n)) 0)))"
+	"(define sieve-count (lambda (v i n)"
+	"  (if (< i n)"
+	"    (if (= (vector-ref v i) 1)"
+	"      (begin (sieve-mark v (* i i) i n) (+ 1 (sieve-count v (+ i 1) n)))"
+	"      (sieve-count v (+ i 1) n))"
+	"    0)))"
+	"(define primes (lambda (n) (sieve-count (make-vector n 1) 2 n)))";
+
+static const char* string_source =
+	"(define build (lambda (s n) (if (= n 0) s (build (string-append s \"x\") (- n 1)))))";
+
+static const char* recursion_source =
+	"(define sum-to (lambda (n) (if (= n 0) 0 (+ n (sum-to (- n 1))))))";
+
+/**
+ * Defines a program, then times one call of it
+ *
+ * @param definitions: source defining the program
+ * @param call: expression to time
+ * @param expected: integer the call should produce
+*/
+static void run_program(benchmark::State& state, const char* definitions, const char* call, int expected)
+{
+	Interpreter interp;
+	eval_source(interp, definitions);
+	auto expr = construct_ast(tokenize(call));
+
+	{
+		region::Scope scope;
+		Slot result = eval_slot(interp, &expr);
+		if (result.type != Variable::Type::INT || result.i_value != expected)
+		{
+			state.SkipWithError("program produced the wrong result");
+			return;
+		}
+	}
+
+	for (auto _ : state)
+	{
+		region::Scope scope;
+		benchmark::DoNotOptimize(eval_slot(interp, &expr));
+	}
+}
+
+static void BM_Fib(benchmark::State& state)
+{
+	run_program(state, fib_source, "(fib 20)", 6765);
+}
+
+static void BM_Tak(benchmark::State& state)
+{
+	run_program(state, tak_source, "(tak 18 12 6)", 7);
+}
+
+static void BM_Ack(benchmark::State& state)
+{
+	run_program(state, ack_source, "(ack 2 9)", 21);
+}
+
+static void BM_NQueens(benchmark::State& state)
+{
+	run_program(state, nqueens_source, "(place-queens 0 8)", 92);
+}
+
+static void BM_Sieve(benchmark::State& state)
+{
+	run_program(state, sieve_source, "(primes 1000)", 168);
+}
+
+static void BM_StringBuild(benchmark::State& state)
+{
+	run_program(state, string_source, "(string-length (build \"\" 500))", 500);
+}
+
+static void BM_DeepRecursion(benchmark::State& state)
+{
+	run_program(state, recursion_source, "(sum-to 1000)", 500500);
+}
+
+BENCHMARK(BM_Fib)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tak)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Ack)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_NQueens)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Sieve)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_StringBuild)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_DeepRecursion)->Unit(benchmark::kMicrosecond);
+
+// Microbenchmarks, each stage of evaluation on its own
+
+static const std::string micro_source = "(+ (* 3 (- 10 4)) (/ 81 9) (vector-ref (vector 1 2 3) 2))";
+
+static void BM_Tokenize(benchmark::State& state)
+{
+	for (auto _ : state) benchmark::DoNotOptimize(tokenize(micro_source));
+}
+
+static void BM_ConstructAst(benchmark::State& state)
+{
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		auto tokens = tokenize(micro_source);
+		state.ResumeTiming();
+		benchmark::DoNotOptimize(construct_ast(std::move(tokens)));
+	}
+}
+
+static void BM_EvalExpr(benchmark::State& state)
+{
+	Interpreter interp;
+	auto expr = construct_ast(tokenize(micro_source));
+	for (auto _ : state)
+	{
+		region::Scope scope;
+		benchmark::DoNotOptimize(eval_expr(interp, &expr));
+	}
+}
+
+/**
+ * Looks up a global among a given number of definitions
+*/
+static void BM_GlobalLookup(benchmark::State& state)
+{
+	Interpreter interp;
+	std::string source;
+	for (long i = 0; i < state.range(0); i++) source += "(define var" + std::to_string(i) + " " + std::to_string(i) + ")";
+	eval_source(interp, source);
+
+	// The parser only accepts lists, so the symbol is evaluated straight from its token
+	auto tokens = tokenize("var" + std::to_string(state.range(0) / 2));
+	for (auto _ : state) benchmark::DoNotOptimize(eval_expr_atom(interp, tokens.front()));
+}
+
+BENCHMARK(BM_Tokenize);
+BENCHMARK(BM_ConstructAst);
+BENCHMARK(BM_EvalExpr);
+BENCHMARK(BM_GlobalLookup)->Arg(16)->Arg(1024)->Arg(65536);
+
+BENCHMARK_MAIN();
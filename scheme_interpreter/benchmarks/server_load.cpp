@@ -0,0 +1,107 @@
+#include <lang/server.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * Load generator for the evaluation server. Each client thread holds one connection and sends its
+ * requests back to back, timing every round trip. Reports throughput and latency percentiles.
+ *
+ * Usage: bench_server_load [socket path] [clients] [requests per client] [expression]
+ *
+ * When no socket path is given, or it is "-", a server with one worker per core is started in
+ * process on a temporary socket
+*/
+
+using Clock = std::chrono::steady_clock;
+
+static int connect_to(const std::string& path)
+{
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static double percentile(const std::vector<double>& sorted, double fraction)
+{
+	if (sorted.empty()) return 0;
+	auto idx = static_cast<std::size_t>(fraction * (sorted.size() - 1));
+	return sorted[idx];
+}
+
+int main(int argc, char** argv)
+{
+	std::string path = argc > 1 ? argv[1] : "-";
+	std::size_t clients = argc > 2 ? std::stoul(argv[2]) : 16;
+	std::size_t requests = argc > 3 ? std::stoul(argv[3]) : 2000;
+	std::string expr = argc > 4 ? argv[4] : "(define x 12) (* (+ x 1) (- x 1) (sqrt 16))";
+
+	std::unique_ptr<server::Server> local;
+	if (path == "-")
+	{
+		path = "/tmp/bench_server_load_" + std::to_string(getpid()) + ".sock";
+		local = std::make_unique<server::Server>(path, std::max(1u, std::thread::hardware_concurrency()), nullptr);
+		if (!local->start()) return 1;
+	}
+
+	std::vector<std::vector<double>> latencies(clients);
+	std::vector<std::thread> threads;
+	std::atomic<std::size_t> failures{ 0 };
+
+	auto start = Clock::now();
+	for (std::size_t i = 0; i < clients; i++)
+	{
+		threads.emplace_back([&, i]() {
+			int fd = connect_to(path);
+			if (fd < 0)
+			{
+				failures++;
+				return;
+			}
+
+			latencies[i].reserve(requests);
+			std::string response;
+			for (std::size_t j = 0; j < requests; j++)
+			{
+				auto sent = Clock::now();
+				if (!server::write_frame(fd, expr) || !server::read_frame(fd, response))
+				{
+					failures++;
+					break;
+				}
+				latencies[i].push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+			}
+			close(fd);
+		});
+	}
+	for (auto& thread : threads) thread.join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::vector<double> all;
+	for (auto& client : latencies) all.insert(all.end(), client.begin(), client.end());
+	std::sort(all.begin(), all.end());
+
+	std::printf("clients      %zu\n", clients);
+	std::printf("requests     %zu\n", all.size());
+	std::printf("failures     %zu\n", failures.load());
+	std::printf("throughput   %.0f req/s\n", all.size() / seconds);
+	std::printf("p50 latency  %.1f us\n", percentile(all, 0.50));
+	std::printf("p99 latency  %.1f us\n", percentile(all, 0.99));
+
+	if (local != nullptr) local->stop();
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <lang/continuation.hpp>
+#include <sstream>
+
+namespace environment
+{
+	/**
+	 * Error object made by `error` and by every built-in that fails, holding a message and the values
+	 * it concerns. Copies share their state, so a condition stays the same object wherever it is passed
+	*/
+	class Condition : public VarCopy<Condition>
+	{
+	public:
+		struct State
+		{
+			std::string message;
+			std::vector<Slot> irritants;
+		};
+
+		std::shared_ptr<const State> state;
+
+		Condition(std::string message, std::vector<Slot> irritants = {});
+
+		Slot call(Interpreter& interp, Span<Slot> args) override;
+	};
+
+	namespace builtins
+	{
+		/**
+		 * Raises any value, which does not return to the caller if it is caught
+		*/
+		Slot raise(Interpreter& interp, Span<Slot> args);
+
+		/**
+		 * Raises a value, and returns whatever the handler that takes it returns
+		*/
+		Slot raise_continuable(Interpreter& interp, Span<Slot> args);
+
+		/**
+		 * Raises a condition made from a message string followed by any number of irritants
+		*/
+		Slot error(Interpreter& interp, Span<Slot> args);
+
+		Slot is_error_object(Interpreter& interp, Span<Slot> args);
+
+		Slot error_object_message(Interpreter& interp, Span<Slot> args);
+
+		/**
+		 * Returns the irritants of a condition as a vector
+		*/
+		Slot error_object_irritants(Interpreter& interp, Span<Slot> args);
+
+		/**
+		 * Calls a thunk with a procedure of one argument installed as the handler of anything raised
+		 * while it runs. The handler is called where the raise happened, with the handlers outside its
+		 * own installed
+		*/
+		Slot with_exception_handler(Interpreter& interp, Span<Slot> args);
+	}
+}
+
+namespace eval
+{
+	/**
+	 * Escape point of every raise caught by a guard. Evaluation returns through each call without a
+	 * value, as it does for a continuation, until the innermost guard takes the raised value
+	*/
+	extern const std::shared_ptr<EscapePoint> raise_point;
+
+	/**
+	 * Raises a value. The innermost handler or guard takes it: a handler is called with the value right
+	 * away, while a guard is unwound to. Top-level forms and green threads run inside a guard of last
+	 * resort, see `catch_uncaught`. Elsewhere, with neither installed, the value is printed and an
+	 * invalid slot returned
+	 *
+	 * @param interp: interpreter the raise happens in
+	 * @param value: value to raise
+	 * @param continuable: whether a handler that returns gives its value back to the raise, rather than
+	 * raising a secondary error
+	 * @returns the handler's value for a continuable raise, otherwise an invalid slot
+	*/
+	Slot raise(Interpreter& interp, Slot value, bool continuable = false);
+
+	/**
+	 * Raises a condition with the parts streamed together as its message, for built-ins and special
+	 * forms given arguments they cannot use
+	 *
+	 * @returns an invalid slot, see `raise`
+	*/
+	template<typename... Parts>
+	Slot fail(Interpreter& interp, const Parts&... parts)
+	{
+		std::ostringstream message;
+		(message << ... << parts);
+		return raise(interp, Slot::from_variable(std::make_unique<Condition>(message.str())));
+	}
+
+	/**
+	 * Evaluates a body with a guard installed. A value raised while the body runs is bound to the
+	 * guard's variable and tested against each clause in turn, like the clauses of cond, and re-raised
+	 * if none accepts it
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param args: ASTExprs following the keyword, a list of the variable and its clauses, then the body
+	 * @returns the value of the body, or of the clause that accepted the raised value
+	*/
+	Slot guard(Interpreter& interp, Span<const ASTExpr> args);
+
+	/**
+	 * Writes a raised value the way it is reported when nothing catches it, a condition as its message
+	 * followed by its irritants
+	*/
+	void write_uncaught(std::ostream& out, const Slot& value);
+
+	/**
+	 * Runs a body with a guard of last resort installed, for the top of a chain of evaluation such as a
+	 * top-level form. A value that nothing inside catches unwinds everything the body was doing, so
+	 * evaluation never carries on past an error
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param raised: receives the value that reached the guard, left untouched if none did
+	 * @param body: called with no arguments, returning a slot
+	 * @returns the value of the body, or an invalid slot if a raised value reached the guard
+	*/
+	template<typename Body>
+	Slot catch_uncaught(Interpreter& interp, Slot& raised, Body&& body)
+	{
+		std::size_t depth = interp.handlers.size();
+		interp.handlers.push_back(Slot());
+		Slot result = body();
+		interp.handlers.resize(depth);
+		if (interp.escape != raise_point) return result;
+
+		interp.escape.reset();
+		raised = std::move(interp.escape_value);
+		return Slot();
+	}
+}
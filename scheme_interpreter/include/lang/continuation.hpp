@@ -0,0 +1,43 @@
+#pragma once
+
+#include <lang/evaluate.hpp>
+
+namespace eval
+{
+	/**
+	 * Place a continuation returns to, valid while the call that captured it is still running
+	*/
+	struct EscapePoint
+	{
+		const void* stack;		// Green thread the continuation was captured on, null for the interpreter's own stack
+		bool active = true;
+	};
+}
+
+namespace environment
+{
+	/**
+	 * Escape-only continuation captured by call/ec or call/cc. Calling it abandons whatever was evaluated
+	 * since the capture, and the capturing call returns the value it was passed. Capturing costs the same
+	 * however deep the evaluation is, as nothing is copied, and escaping returns through every call in
+	 * between so that each one cleans up after itself.
+	 *
+	 * The evaluator runs on the C++ stack, whose frames own values and cannot be copied or resumed, so a
+	 * continuation cannot be re-entered once the capturing call has returned. Generators are better
+	 * written with green threads and channels
+	*/
+	class Continuation : public VarCopy<Continuation>
+	{
+	public:
+		std::shared_ptr<eval::EscapePoint> point;
+
+		Continuation(std::shared_ptr<eval::EscapePoint> point);
+
+		Slot call(Interpreter& interp, Span<Slot> args) override;
+	};
+
+	namespace builtins
+	{
+		Slot call_ec(Interpreter& interp, Span<Slot> args);
+	}
+}
\ No newline at end of file
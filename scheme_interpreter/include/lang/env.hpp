@@ -1,15 +1,58 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include <cmath>
+#include <string_view>
 #include <lang/parser.hpp>
 
 using namespace parser;
 
+namespace eval
+{
+	class Interpreter;
+}
+
+namespace image
+{
+	class Image;
+}
+
 namespace environment
 {
 
+	using eval::Interpreter;
+
+	/**
+	 * Non-owning view over a contiguous run of elements, such as the arguments of a procedure call
+	*/
+	template<typename T>
+	struct Span
+	{
+		T* first = nullptr;
+		std::size_t count = 0;
+
+		Span() = default;
+
+		Span(T* first, std::size_t count) : first(first), count(count) {}
+
+		T* begin() const noexcept { return first; }
+
+		T* end() const noexcept { return first + count; }
+
+		std::size_t size() const noexcept { return count; }
+
+		bool empty() const noexcept { return count == 0; }
+
+		T& operator[] (std::size_t idx) const noexcept { return first[idx]; }
+	};
+
+	struct Slot;
+
 	class Variable
 	{
 	public:
@@ -24,18 +67,45 @@ namespace environment
 			STRING,
 			BOOL,
 			SYMBOL,
-			LIST
+			LIST,
+			VECTOR,
+			HASH_TABLE,
+			PERSISTENT_VECTOR,
+			PERSISTENT_MAP,
+			FUTURE,
+			CHANNEL,
+			PLACE_CHANNEL,
+			CONDITION
 		};
 
 		Type type = Type::INVALID;
 
 		Variable(Type type);
 
-		virtual ~Variable() = default;
+		Variable(const Variable& other);
+
+		Variable& operator= (const Variable& other) = default;
+
+		virtual ~Variable();
+
+		/**
+		 * Variables are carved out of the region of the top-level form being evaluated when there is one,
+		 * see region.hpp, and come from the heap otherwise
+		*/
+		static void* operator new(std::size_t size);
+
+		static void operator delete(void* ptr) noexcept;
 
 		virtual std::unique_ptr<Variable> copy() const = 0;
 
-		virtual std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) = 0;
+		/**
+		 * Invokes the variable as a procedure
+		 *
+		 * @param interp: interpreter the call is made from
+		 * @param args: arguments of the call, already evaluated
+		 * @returns the result of the call, or an invalid slot if the call failed or produced no value
+		*/
+		virtual Slot call(Interpreter& interp, Span<Slot> args) = 0;
 
 		friend bool operator== (const Token& lhs, const Token& rhs) noexcept;
 
@@ -43,6 +113,122 @@ namespace environment
 
 	bool operator== (const Variable& lhs, const Variable& rhs) noexcept;
 
+	/**
+	 * Compact tagged value used as the element type of collections. Numbers and booleans are stored
+	 * inline, every other variable is boxed on the heap and owned by the slot
+	*/
+	struct Slot
+	{
+		Variable::Type type = Variable::Type::INVALID;
+
+		union
+		{
+			int i_value;
+			double f_value;
+			bool b_value;
+			Variable* boxed;
+		};
+
+		Slot() : boxed(nullptr) {}
+
+		explicit Slot(int value) : type(Variable::Type::INT), i_value(value) {}
+
+		explicit Slot(double value) : type(Variable::Type::FLOAT), f_value(value) {}
+
+		explicit Slot(bool value) : type(Variable::Type::BOOL), b_value(value) {}
+
+		Slot(const Slot& other);
+
+		Slot(Slot&& other) noexcept : type(other.type), boxed(other.boxed)
+		{
+			other.type = Variable::Type::INVALID;
+		}
+
+		~Slot()
+		{
+			if (is_boxed()) delete boxed;
+		}
+
+		Slot& operator= (const Slot& other);
+
+		Slot& operator= (Slot&& other) noexcept
+		{
+			if (this == &other) return *this;
+
+			if (is_boxed()) delete boxed;
+			type = other.type;
+			boxed = other.boxed;	// Copies the inline value whichever member is active
+			other.type = Variable::Type::INVALID;
+			return *this;
+		}
+
+		/**
+		 * Whether the value lives on the heap rather than inline in the slot
+		*/
+		bool is_boxed() const noexcept
+		{
+			return type != Variable::Type::INVALID && type != Variable::Type::INT && type != Variable::Type::FLOAT && type != Variable::Type::BOOL;
+		}
+
+		/**
+		 * Creates a slot holding a copy of a variable
+		 *
+		 * @param var: variable to store
+		 * @returns a slot containing the variable's value
+		*/
+		static Slot from_variable(const Variable& var);
+
+		/**
+		 * Creates a slot that takes ownership of a variable, unboxing it if it is a number or boolean
+		 *
+		 * @param var: variable to store, may be null
+		 * @returns a slot containing the variable's value, or an invalid slot if `var` is null
+		*/
+		static Slot from_variable(std::unique_ptr<Variable> var);
+
+		/**
+		 * Creates a standalone variable from the value in the slot
+		 *
+		 * @returns a pointer to a copy of the value, or null if the slot is invalid
+		*/
+		std::unique_ptr<Variable> to_variable() const;
+
+		/**
+		 * Moves the value out of the slot into a standalone variable, leaving the slot invalid. Boxed
+		 * values are handed over without being copied
+		 *
+		 * @returns a pointer to the value, or null if the slot is invalid
+		*/
+		std::unique_ptr<Variable> into_variable();
+	};
+
+	/**
+	 * Holds the evaluated arguments of one procedure call. The first few arguments live inline in the
+	 * frame, which sits on the evaluator's stack, so typical calls make no heap allocation at all
+	*/
+	class ArgFrame
+	{
+	public:
+		static constexpr std::size_t inline_capacity = 8;
+
+		ArgFrame() = default;
+
+		ArgFrame(const ArgFrame& other) = delete;
+
+		ArgFrame& operator= (const ArgFrame& other) = delete;
+
+		void push_back(Slot value);
+
+		std::size_t size() const noexcept;
+
+		Span<Slot> span() noexcept;
+
+	private:
+		Slot inline_slots[inline_capacity];
+		std::vector<Slot> overflow;		// Takes over from the inline slots once a call has more arguments than fit
+		std::size_t count = 0;
+	};
+
 	template<typename T>
 	class VarCopy :
 		public Variable
@@ -60,7 +246,7 @@ namespace environment
 
 		Int(int value);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+		Slot call(Interpreter& interp, Span<Slot> args) override;
 	};
 
 	class Float : public VarCopy<Float>
@@ -70,7 +256,7 @@ namespace environment
 
 		Float(double value);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+		Slot call(Interpreter& interp, Span<Slot> args) override;
 	};
 
 	class String : public VarCopy<String>
@@ -80,7 +266,7 @@ namespace environment
 
 		String(std::string value);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+		Slot call(Interpreter& interp, Span<Slot> args) override;
 	};
 
 	class Bool : public VarCopy<Bool>
@@ -90,7 +276,7 @@ namespace environment
 
 		Bool(bool value);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+		Slot call(Interpreter& interp, Span<Slot> args) override;
 	};
 
 	class Symbol : public VarCopy<Symbol>
@@ -100,7 +286,7 @@ namespace environment
 
 		Symbol(std::string value);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+		Slot call(Interpreter& interp, Span<Slot> args) override;
 	};
 
 	class List : public Variable
@@ -110,210 +296,318 @@ namespace environment
 
 		List(std::vector<std::unique_ptr<Variable>> values);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot call(Interpreter& interp, Span<Slot> args) override;
+	};
+
+	/**
+	 * Equivalence predicates understood by procedures that compare values, such as hash tables
+	*/
+	enum class Equivalence
+	{
+		EQ,
+		EQV,
+		EQUAL,
+		STRING
+	};
+
+	/**
+	 * Compares two values under one of the Scheme equivalence predicates. Strings are copied each time
+	 * they are looked up and so have no identity of their own, which means eq? and eqv? compare them
+	 * by content. Vectors and hash tables compare by identity except under equal?
+	 *
+	 * @param lhs: first value to compare
+	 * @param rhs: second value to compare
+	 * @param equivalence: predicate to compare with
+	 * @returns whether the values are equivalent
+	*/
+	bool slots_equivalent(const Slot& lhs, const Slot& rhs, Equivalence equivalence);
+
+	/**
+	 * Hashes a value consistently with `slots_equivalent`
+	 *
+	 * @param slot: value to hash
+	 * @param equivalence: predicate the hash must agree with
+	 * @returns a well mixed hash, suitable for masking to a power of two table size
+	*/
+	std::size_t hash_slot(const Slot& slot, Equivalence equivalence);
+
+	/**
+	 * Fixed-size vector with O(1) indexed access. Copies share the underlying buffer, so a vector
+	 * behaves as a single mutable object no matter how many times it is looked up
+	*/
+	class Vector : public VarCopy<Vector>
+	{
+	public:
+		struct Buffer
+		{
+			std::vector<Slot> slots;
+			std::size_t boxed_count = 0;	// Number of boxed slots, zero means the buffer can be moved bytewise
+			std::atomic<std::uint32_t> frozen{ 0 };	// Number of freezes holding the buffer read-only, see Freeze
+			std::atomic<bool> outlives_form{ false };	// Reachable from outside the form that made it, so values stored in it are promoted
+		};
 
-	class Add : public VarCopy<Add>
-	{
-	public:
-		Add();
+		std::shared_ptr<Buffer> buffer;
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Vector(std::size_t size, const Slot& fill);
 
-	class Subtract : public VarCopy<Subtract>
-	{
-	public:
-		Subtract();
+		std::size_t size() const noexcept;
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		const Slot& at(std::size_t idx) const noexcept;
 
-	class Multiply : public VarCopy<Multiply>
-	{
-	public:
-		Multiply();
+		void set(std::size_t idx, Slot value);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		void fill(const Slot& value, std::size_t start, std::size_t end);
 
-	class Divide : public VarCopy<Divide>
-	{
-	public:
-		Divide();
+		/**
+		 * Copies `count` elements from `from` starting at `start` into this vector starting at `at`.
+		 * The ranges may overlap, including when both vectors share a buffer
+		*/
+		void copy_from(std::size_t at, const Vector& from, std::size_t start, std::size_t count);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+		Slot call(Interpreter& interp, Span<Slot> args) override;
 	};
 
-	class Mod : public VarCopy<Mod>
-	{
-	public:
-		Mod();
+	/**
+	 * Signature shared by every built-in procedure
+	*/
+	using BuiltinFn = Slot (*)(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+	struct BuiltinEntry
+	{
+		std::string_view name;
+		BuiltinFn fn;
 	};
 
-	class GreaterThan : public VarCopy<GreaterThan>
+	/**
+	 * Finds a built-in procedure in the static registry
+	 *
+	 * @param name: name the procedure is called by
+	 * @returns the registry entry, or null if no built-in has that name
+	*/
+	const BuiltinEntry* find_builtin(std::string_view name) noexcept;
+
+	/**
+	 * Reference to a built-in procedure, only created when a built-in is used as a value rather than called
+	*/
+	class Builtin : public VarCopy<Builtin>
 	{
 	public:
-		GreaterThan();
+		const BuiltinEntry* entry;
+
+		Builtin(const BuiltinEntry* entry);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+		Slot call(Interpreter& interp, Span<Slot> args) override;
 	};
 
-	class GreaterThanOrEq : public VarCopy<GreaterThanOrEq>
+	/**
+	 * Name bound to a value captured by a closure
+	*/
+	struct Binding
 	{
-	public:
-		GreaterThanOrEq();
-
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+		std::string name;
+		Slot value;
 	};
 
-	class LessThan : public VarCopy<LessThan>
+	/**
+	 * Procedure created by lambda. The parameters and body are shared by every copy of the closure,
+	 * while the local bindings visible where it was created are captured by value
+	*/
+	class Closure : public VarCopy<Closure>
 	{
 	public:
-		LessThan();
+		struct Code
+		{
+			std::vector<std::string> params;
+			std::vector<ASTExpr> body;
+		};
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		std::shared_ptr<const Code> code;
+		std::vector<Binding> captured;
+		std::string_view name;		// Name it was first defined under, for the profiler, empty if never defined
 
-	class LessThanOrEq : public VarCopy<LessThanOrEq>
-	{
-	public:
-		LessThanOrEq();
+		Closure(std::shared_ptr<const Code> code, std::vector<Binding> captured);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+		Slot call(Interpreter& interp, Span<Slot> args) override;
 	};
 
-	class Equals : public VarCopy<Equals>
+	class Environment;
+
+	/**
+	 * Keeps vectors and hash tables read-only while other threads may be reading them. Each container
+	 * reachable from the values added counts this freeze once, and becomes writable again when the
+	 * last freeze counting it is released, so freezes held by different callers nest
+	*/
+	class Freeze
 	{
 	public:
-		Equals();
+		Freeze() = default;
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Freeze(const Freeze& other) = delete;
 
-	class Absolute : public VarCopy<Absolute>
-	{
-	public:
-		Absolute();
+		Freeze& operator= (const Freeze& other) = delete;
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		~Freeze();
 
-	class Cons : public VarCopy<Cons>
-	{
-	public:
-		Cons();
+		/**
+		 * Freezes every vector and hash table reachable from a value. Containers this freeze already
+		 * counts are not visited again, which also ends cycles
+		 *
+		 * @param var: value to freeze
+		 * @param on_closure: called with every closure reached, whose body may name further values
+		*/
+		void add(const Variable& var, const std::function<void(const Closure&)>& on_closure = nullptr);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		/**
+		 * Freezes the values of an environment and of its parents, stopping at a layer that holds its
+		 * own freeze, whose parents were frozen along with it
+		*/
+		void add(const Environment& env);
 
-	class Car : public VarCopy<Car>
-	{
-	public:
-		Car();
+		/**
+		 * Lets go of every container this freeze counts
+		*/
+		void release();
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
+	private:
+		void add_slot(const Slot& slot, const std::function<void(const Closure&)>& on_closure);
+
+		std::vector<std::shared_ptr<std::atomic<std::uint32_t>>> counts;	// Each shares ownership of its container
+		std::unordered_set<const std::atomic<std::uint32_t>*> seen;
 	};
 
-	class Cdr : public VarCopy<Cdr>
+	namespace builtins
 	{
-	public:
-		Cdr();
+		/**
+		 * Reads an index argument. Negative values wrap around to very large ones, so a single comparison
+		 * against the size of a vector rejects both ends of the range
+		 *
+		 * @returns false if the argument is not an integer
+		*/
+		inline bool get_index(const Slot& slot, std::size_t& idx)
+		{
+			if (slot.type != Variable::Type::INT) return false;
+			idx = static_cast<std::size_t>(slot.i_value);
+			return true;
+		}
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot add(Interpreter& interp, Span<Slot> args);
 
-	class Exponent : public VarCopy<Exponent>
-	{
-	public:
-		Exponent();
+		Slot subtract(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot multiply(Interpreter& interp, Span<Slot> args);
 
-	class Length : public VarCopy<Length>
-	{
-	public:
-		Length();
+		Slot divide(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot modulo(Interpreter& interp, Span<Slot> args);
 
-	class Sin : public VarCopy<Sin>
-	{
-	public:
-		Sin();
+		Slot exponent(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot absolute(Interpreter& interp, Span<Slot> args);
 
-	class Cos : public VarCopy<Cos>
-	{
-	public:
-		Cos();
+		Slot greater_than(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot greater_than_or_eq(Interpreter& interp, Span<Slot> args);
 
-	class Tan : public VarCopy<Tan>
-	{
-	public:
-		Tan();
+		Slot less_than(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot less_than_or_eq(Interpreter& interp, Span<Slot> args);
 
-	class Sqrt : public VarCopy<Sqrt>
-	{
-	public:
-		Sqrt();
+		Slot equals(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot cons(Interpreter& interp, Span<Slot> args);
 
-	class Define : public VarCopy<Define>
-	{
-	public:
-		Define();
+		Slot car(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot cdr(Interpreter& interp, Span<Slot> args);
 
-	class If : public VarCopy<If>
-	{
-	public:
-		If();
+		Slot length(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot sine(Interpreter& interp, Span<Slot> args);
 
-	class Begin : public VarCopy<Begin>
-	{
-	public:
-		Begin();
+		Slot cosine(Interpreter& interp, Span<Slot> args);
 
-		std::unique_ptr<Variable> call(std::vector<ASTExpr>* args) override;
-	};
+		Slot tangent(Interpreter& interp, Span<Slot> args);
 
+		Slot square_root(Interpreter& interp, Span<Slot> args);
 
-	std::string get_var_type_as_string(const Variable& var);
+		Slot make_vector(Interpreter& interp, Span<Slot> args);
+
+		Slot vector(Interpreter& interp, Span<Slot> args);
+
+		Slot vector_length(Interpreter& interp, Span<Slot> args);
+
+		Slot vector_ref(Interpreter& interp, Span<Slot> args);
 
-	std::vector<std::unique_ptr<Variable>> get_variable_args(std::vector<ASTExpr>* args);
+		Slot vector_set(Interpreter& interp, Span<Slot> args);
 
-	std::string get_result_type(const std::vector<std::unique_ptr<Variable>>& args);
+		Slot vector_fill(Interpreter& interp, Span<Slot> args);
 
+		Slot vector_copy(Interpreter& interp, Span<Slot> args);
+
+		Slot is_eq(Interpreter& interp, Span<Slot> args);
+
+		Slot is_eqv(Interpreter& interp, Span<Slot> args);
+
+		Slot is_equal(Interpreter& interp, Span<Slot> args);
+
+		Slot is_string_equal(Interpreter& interp, Span<Slot> args);
+
+		Slot string_append(Interpreter& interp, Span<Slot> args);
+
+		Slot string_length(Interpreter& interp, Span<Slot> args);
+	}
+
+	std::string get_var_type_as_string(const Variable& var);
+
+	std::string get_type_as_string(Variable::Type type);
+
+	/**
+	 * Determines the type of the result of an arithmetic operation
+	 *
+	 * @param args: operands of the operation
+	 * @returns INT if every operand is an integer, FLOAT if they are all numbers and at least one is a float,
+	 * or the type of the first operand that is not a number
+	*/
+	Variable::Type get_result_type(Span<Slot> args);
+
+	/**
+	 * Definitions made by a program. Built-in procedures live in a static registry, see `find_builtin`,
+	 * so a fresh environment starts out empty
+	*/
 	class Environment
 	{
 	public:
+		std::unordered_map<std::string, std::unique_ptr<Variable>> env_map;
+
+		std::shared_ptr<const Environment> parent;	// Definitions shared with other environments, read but never modified through this one
+
+		std::shared_ptr<const image::Image> image;	// Definitions mapped from an image file, looked up after env_map
+
+		mutable std::unique_ptr<Freeze> frozen;		// Holds the values of this layer and its parents read-only for as long as the layer lives, see freeze_values
+
 		/**
-		 * Initialize the environment with the built-in functions
+		 * Looks a name up in this environment, then in its image, and then in its parents
 		 *
+		 * @param name: name to look up
+		 * @returns the bound variable, or null if the name is not defined
 		*/
-		Environment();
+		const Variable* find(const std::string& name) const;
 
-		std::unordered_map<std::string, std::unique_ptr<Variable>> env_map;
+		/**
+		 * Snapshot of every definition made so far, for evaluation that runs alongside this environment.
+		 * The current definitions, along with any image, move into a new read-only parent layer, and later
+		 * definitions land in a fresh map that the snapshot never sees. Nothing is frozen, the caller
+		 * freezes what the other threads can reach for as long as they run
+		 *
+		 * @returns the layer holding the definitions, may be null if there are none
+		*/
+		std::shared_ptr<const Environment> snapshot();
+
+		/**
+		 * Freezes the values of this layer and of its parents for as long as the layers live, for layers
+		 * shared with other threads from then on. Layers that are already frozen are skipped
+		*/
+		void freeze_values() const;
 	};
 	
 	
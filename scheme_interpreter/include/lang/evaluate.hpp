@@ -5,49 +5,274 @@
 
 using namespace environment;
 
+namespace green
+{
+	class Scheduler;
+}
+
 namespace eval
 {
+	struct EscapePoint;
+
+	/**
+	 * Local bindings of one procedure call, the values its closure captured followed by its parameters
+	 * and anything defined in its body. Later bindings shadow earlier ones
+	*/
+	struct Frame
+	{
+		struct Local
+		{
+			const std::string* name;	// Owned by the closure or its body, both outlive the call
+			Slot value;
+		};
+
+		std::vector<Local> locals;
+
+		/**
+		 * Looks a name up among the locals, newest first
+		 *
+		 * @param name: name to look up
+		 * @returns the bound value, or null if the name is not local
+		*/
+		const Slot* find(const std::string& name) const;
+	};
+
+	constexpr std::size_t call_stack_bytes = 4096;		// Stack set aside for each nested procedure call, with room for the builtins and special forms it goes through
+	constexpr std::size_t stack_reserve_bytes = 64 * 1024;	// Stack kept free below the deepest call for whatever that call runs
+
+	/**
+	 * Number of procedure calls that can nest on what is left of the calling thread's stack
+	 *
+	 * @returns the depth limit for an interpreter running from this point of the stack
+	*/
+	std::size_t depth_limit();
+
+	/**
+	 * Lowest stack address at which the calling thread may still start a procedure call, which
+	 * catches bodies that use more than `call_stack_bytes` before the depth limit is reached
+	 *
+	 * @returns the address, or 0 if the bounds of the stack are unknown
+	*/
+	std::uintptr_t stack_limit();
+
+	/**
+	 * Number of procedure calls that can nest on a stack of the given size
+	 *
+	 * @param stack_size: size of the stack in bytes
+	 * @returns the depth limit for an interpreter running on a fresh stack of that size
+	*/
+	std::size_t depth_limit(std::size_t stack_size);
+
+	/**
+	 * State of one interpreter. Instances share nothing with each other, so any number of them can run
+	 * side by side, one per thread, as long as a single instance is only used from one thread at a time
+	*/
+	class Interpreter
+	{
+	public:
+		Environment env;
+
+		Frame* frame = nullptr;		// Innermost procedure call being evaluated, null at the top level
+
+		std::shared_ptr<green::Scheduler> scheduler;	// Green threads started by this interpreter, created on first use
+
+		std::shared_ptr<EscapePoint> escape;	// Continuation being escaped to, evaluation unwinds without a value while set
+
+		Slot escape_value;		// Value the escape delivers to the call that captured the continuation
+
+		std::vector<Slot> handlers;		// Exception handlers installed, innermost last, with an invalid slot for each guard
+
+		std::size_t depth = 0;		// Procedure calls currently nested
+
+		std::size_t max_depth = depth_limit();		// Nesting at which a call raises instead of overflowing the stack it runs on
+
+		std::uintptr_t stack_floor = stack_limit();		// A call made below this address raises, whatever the depth
+	};
+
 	/**
 	 * Evaluates an atom
 	 *
-	 * @param exprs: token containing the value of the atom
-	 * @returns a pointer to a Variable containing the value of the atom
+	 * @param interp: interpreter to evaluate in
+	 * @param tk: token containing the value of the atom
+	 * @returns a slot containing the value of the atom
 	*/
-	std::unique_ptr<environment::Variable> eval_expr_atom(const Token& tk);
+	Slot eval_expr_atom(Interpreter& interp, const Token& tk);
 
 	/**
-	 * Evaluates a list expression by calling a procedure based on the first value, and using the rest as arguments
+	 * Evaluates a list expression by calling a procedure based on the first value, and using the rest as arguments.
+	 * The arguments are evaluated into a frame on the stack and the expression itself is left untouched
 	 *
+	 * @param interp: interpreter to evaluate in
 	 * @param exprs: vector of ASTExprs to be evaluated
-	 * @returns a pointer to a Variable containing the result of the list evaluation
+	 * @returns a slot containing the result of the list evaluation, or an invalid slot if there is no result
+	*/
+	Slot eval_expr_list(Interpreter& interp, const std::vector<ASTExpr>* exprs);
+
+	/**
+	 * Evaluates an expression depending on its type, keeping numbers and booleans inline
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param expr: expression to evaluate
+	 * @returns a slot containing the value of the expression, or an invalid slot if there is no result
 	*/
-	std::unique_ptr<environment::Variable> eval_expr_list(std::vector<ASTExpr>* exprs);
+	Slot eval_slot(Interpreter& interp, const ASTExpr* expr);
 
 	/**
 	 * Evaluates an expression depending on its type
 	 *
+	 * @param interp: interpreter to evaluate in
 	 * @param expr: expression to evaluate
 	 * @returns a pointer to a Variable that either contains a value or performs a procedure
 	*/
-	std::unique_ptr<environment::Variable> eval_expr(ASTExpr* expr);
+	std::unique_ptr<environment::Variable> eval_expr(Interpreter& interp, const ASTExpr* expr);
+
+	/**
+	 * Associate a keyword with an expression, which will be added to the environment for later usage in the program.
+	 * Inside a procedure body the definition is local to the call instead
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param args: ASTExprs following the keyword, where the first one should be an atom containing a symbol token not present in the environment
+	 * @returns an invalid slot, definitions produce no value
+	*/
+	Slot define(Interpreter& interp, Span<const ASTExpr> args);
+
+	/**
+	 * Evaluates a condition and then only the branch that it selects
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param args: ASTExprs following the keyword, a condition, a then branch, and an else branch
+	 * @returns a slot containing the value of the selected branch
+	*/
+	Slot conditional(Interpreter& interp, Span<const ASTExpr> args);
+
+	/**
+	 * Creates a closure from a parameter list and a body. The body is copied out of the expression, so
+	 * the closure outlives the program text it was read from
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param args: ASTExprs following the keyword, a list of parameter symbols followed by one or more body expressions
+	 * @returns a slot containing the closure
+	*/
+	Slot lambda(Interpreter& interp, Span<const ASTExpr> args);
+
+	/**
+	 * Copies the locals visible at this point of the evaluation, for a closure or anything else that
+	 * evaluates code later on. Globals are not captured, they are looked up when the code runs
+	 *
+	 * @param interp: interpreter to capture from
+	 * @returns the locals of the innermost call, oldest first, or nothing at the top level
+	*/
+	std::vector<Binding> capture_locals(const Interpreter& interp);
+
+	/**
+	 * Evaluates expressions in order
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param args: ASTExprs following the keyword
+	 * @returns a slot containing the value of the last expression
+	*/
+	Slot sequence(Interpreter& interp, Span<const ASTExpr> args);
+
+	/**
+	 * Evaluates an expression and prints how long it took in real and CPU time, with the bytes and
+	 * number of variables it allocated. CPU time and allocations are those of the calling thread, so
+	 * work handed to futures only shows in the real time
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param args: ASTExprs following the keyword, the expression to measure
+	 * @returns a slot containing the value of the expression
+	*/
+	Slot timed(Interpreter& interp, Span<const ASTExpr> args);
+
+	/**
+	 * Evaluates every top level form in a piece of source text, in order
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param source: text containing any number of forms
+	 * @returns a slot containing the value of the last form, or an invalid slot if it produced none
+	*/
+	Slot eval_source(Interpreter& interp, const std::string& source);
 
 	/**
-	 * Associate a keyword with an expression, which will be added to the environment for later usage in the program
+	 * Evaluates every top level form in a piece of source text, in order, up to the first error that
+	 * nothing catches
 	 *
-	 * @param args: vector of ASTExprs, where the first one should be an atom containing a symbol token not present in the environment
-	 * @returns a pointer to a Variable containing the expression that was added to the environment
+	 * @param interp: interpreter to evaluate in
+	 * @param source: text containing any number of forms
+	 * @param raised: receives the value of that error, rather than it being printed
+	 * @returns a slot containing the value of the last form, or an invalid slot if it produced none or
+	 * an error ended the evaluation
 	*/
-	std::unique_ptr<Variable> define(std::vector<ASTExpr>* args);
+	Slot eval_source(Interpreter& interp, const std::string& source, Slot& raised);
 
 	/**
 	 * Evaluates a Scheme file passed in from the command line
 	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param path: path of the file to evaluate
+	 * @returns whether the file could be read
+	*/
+	bool eval_file(Interpreter& interp, const std::string& path);
+
+	/**
+	 * Writes a value in the form the REPL prints it
+	 *
+	 * @param out: stream to write to
+	 * @param slot: value to write
+	*/
+	void write_slot(std::ostream& out, const Slot& slot);
+
+	constexpr std::size_t pipeline_block_size = 1 << 16;
+
+	/**
+	 * Finds where the complete top-level forms of source text end, as more of the text arrives. A form
+	 * may span any number of lines and blocks, it is complete once its brackets balance outside strings
+	 * and comments, or for a bare atom once something follows it
+	*/
+	struct FormScanner
+	{
+		std::size_t scanned = 0;		// Characters of the text looked at so far
+		std::size_t complete = 0;		// Length of the longest prefix of the text holding only complete forms
+		std::vector<std::size_t> ends;	// Where each complete form ends, in order, a stray closing bracket counting as one
+		int depth = 0;
+		bool in_string = false;
+		bool in_comment = false;
+		bool in_atom = false;			// Whether a top-level atom has started and not yet ended
+
+		/**
+		 * Looks at the characters added to the text since the last call
+		*/
+		void scan(const std::string& text);
+
+		/**
+		 * Forgets the first characters of the text once they have been taken off its front, along with
+		 * the forms that ended within them
+		 *
+		 * @param count: characters taken, at most `complete`
+		*/
+		void consume(std::size_t count);
+
+	private:
+		void end_atom();
+	};
+
+	/**
+	 * Evaluates forms read from a descriptor without prompting, for input piped in from another program.
+	 * The input is read in large blocks, and forms are evaluated as soon as they are complete, wherever
+	 * the lines and blocks break. The value of every form that produces one is written on a line of its
+	 * own. Reading stops at the end of the input or at a bare `exit` form
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param fd: descriptor to read the source from
+	 * @param out: stream the results are written to
+	 * @returns false if the input could not be read
 	*/
-	void eval_file(ASTExpr* expr);
+	bool pipeline(Interpreter& interp, int fd, std::ostream& out);
 
 	/**
 	 * Function for beginning a read-eval-print loop, taking user input line-by-line, evaluating it, and printing the result to stdout
 	 *
+	 * @param interp: interpreter to evaluate in
 	*/
-	void repl();
+	void repl(Interpreter& interp);
 }
\ No newline at end of file
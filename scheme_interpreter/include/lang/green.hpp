@@ -0,0 +1,193 @@
+#pragma once
+
+#include <lang/evaluate.hpp>
+#include <lang/profile.hpp>
+#include <deque>
+#include <functional>
+#include <ucontext.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace green
+{
+	/**
+	 * Green thread with a stack of its own. The scheduler's root context, the code that started the
+	 * interpreter, is represented by a fiber without a stack
+	*/
+	struct Fiber
+	{
+		ucontext_t context;
+		void* stack = nullptr;
+		Slot procedure;
+		eval::Frame* frame = nullptr;	// Innermost call of this fiber while another one is running
+		profile::Stack calls;			// Procedures this fiber is in, for the profiler
+		std::vector<Slot> handlers;		// Exception handlers of this fiber while another one is running
+		std::size_t depth = 0;			// Calls nested in this fiber while another one is running
+		std::size_t max_depth = 0;		// Depth limit that fits this fiber's stack
+		std::uintptr_t stack_floor = 0;	// Lowest address this fiber may start a call at
+		bool done = false;
+		bool woken = false;
+		bool fd_closed = false;			// Set when the descriptor this fiber waits on is closed by another one
+	};
+
+	/**
+	 * Runs the green threads of one interpreter on the thread that owns it. Threads switch only when they
+	 * yield, wait on a channel, or wait for a file descriptor, and whichever of those the root context is
+	 * doing drives the scheduler. Descriptors are waited on with a single epoll instance.
+	 *
+	 * Threads that are still parked when the interpreter goes away are dropped without unwinding, so
+	 * values on their stacks are never freed
+	*/
+	class Scheduler
+	{
+	public:
+		static constexpr std::size_t stack_size = 8 * 1024 * 1024;	// As deep as the main thread's usual stack, only the pages a thread touches are committed
+
+		explicit Scheduler(Interpreter& interp);
+
+		Scheduler(const Scheduler& other) = delete;
+
+		Scheduler& operator= (const Scheduler& other) = delete;
+
+		~Scheduler();
+
+		/**
+		 * Creates a green thread that calls `procedure` with no arguments, it first runs the next time the
+		 * current thread gives way
+		*/
+		void spawn(Slot procedure);
+
+		/**
+		 * Lets every other runnable thread run once before the current one continues
+		*/
+		void yield();
+
+		/**
+		 * Suspends the current thread until something calls `wake` on it
+		 *
+		 * @returns false if nothing is left that could wake it
+		*/
+		bool park();
+
+		/**
+		 * Makes a parked thread runnable again
+		*/
+		void wake(Fiber* fiber);
+
+		/**
+		 * Suspends the current thread until a descriptor is ready. Only one thread waits on a descriptor
+		 * at a time
+		 *
+		 * @param fd: descriptor to wait on, in non-blocking mode
+		 * @param events: EPOLLIN or EPOLLOUT
+		 * @returns false with errno set if the descriptor cannot be waited on, another thread is already
+		 * waiting on it, or it was closed while waiting
+		*/
+		bool wait_fd(int fd, std::uint32_t events);
+
+		/**
+		 * Forgets a descriptor that is about to be closed, waking the thread waiting on it with an error
+		*/
+		void forget_fd(int fd);
+
+		/**
+		 * Runs threads until none is runnable or waiting on a descriptor, only called from the root context
+		*/
+		void run();
+
+		Fiber* current() const noexcept;
+
+		bool in_root() const noexcept;
+
+	private:
+		/**
+		 * Resumes threads from the root context until `done` holds
+		 *
+		 * @returns false if no thread can make progress while `done` still does not hold
+		*/
+		bool run_until(const std::function<bool()>& done);
+
+		void resume(Fiber* fiber);
+
+		/**
+		 * Exchanges the interpreter's call depth and its limits with the ones kept in `fiber`
+		*/
+		void swap_depth(Fiber* fiber);
+
+		void suspend();
+
+		void poll(int timeout);
+
+		static void entry(unsigned int high, unsigned int low);
+
+		Interpreter& interp;
+		Fiber root;
+		Fiber* running = &root;
+		std::deque<Fiber*> ready;
+		std::unordered_set<Fiber*> fibers;
+
+		int epoll_fd = -1;
+		std::unordered_map<int, Fiber*> registered;		// Descriptors added to the epoll instance, with the thread waiting on each
+		std::size_t fd_waiters = 0;
+	};
+
+	/**
+	 * Scheduler of an interpreter, created the first time it is needed
+	*/
+	Scheduler& scheduler_for(Interpreter& interp);
+}
+
+namespace environment
+{
+	/**
+	 * Bounded queue between green threads of one interpreter. Every thread of a scheduler runs on the
+	 * same OS thread, so the ring buffer needs neither locks nor atomics
+	*/
+	class Channel : public VarCopy<Channel>
+	{
+	public:
+		struct State
+		{
+			green::Scheduler* owner;
+			std::vector<Slot> ring;
+			std::size_t head = 0;
+			std::size_t count = 0;
+			std::deque<green::Fiber*> senders;		// Threads waiting for room
+			std::deque<green::Fiber*> receivers;	// Threads waiting for a value
+		};
+
+		std::shared_ptr<State> state;
+
+		/**
+		 * @param capacity: number of values the channel holds, at least 1
+		*/
+		Channel(green::Scheduler* owner, std::size_t capacity);
+
+		Slot call(Interpreter& interp, Span<Slot> args) override;
+	};
+
+	namespace builtins
+	{
+		Slot spawn(Interpreter& interp, Span<Slot> args);
+
+		Slot yield(Interpreter& interp, Span<Slot> args);
+
+		Slot run_threads(Interpreter& interp, Span<Slot> args);
+
+		Slot make_channel(Interpreter& interp, Span<Slot> args);
+
+		Slot channel_send(Interpreter& interp, Span<Slot> args);
+
+		Slot channel_receive(Interpreter& interp, Span<Slot> args);
+
+		Slot make_pipe(Interpreter& interp, Span<Slot> args);
+
+		Slot open_file(Interpreter& interp, Span<Slot> args);
+
+		Slot fd_read(Interpreter& interp, Span<Slot> args);
+
+		Slot fd_write(Interpreter& interp, Span<Slot> args);
+
+		Slot fd_close(Interpreter& interp, Span<Slot> args);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <lang/env.hpp>
+#include <cstdint>
+
+namespace environment
+{
+
+	/**
+	 * Hash table using open addressing with Robin Hood probing. Each entry caches the hash of its key,
+	 * so probing only compares keys whose hashes already match. Copies share the underlying table
+	*/
+	class HashTable : public VarCopy<HashTable>
+	{
+	public:
+		struct Entry
+		{
+			std::uint32_t hash = 0;		// Low bits of the key's hash, enough to index any table that fits in memory
+			std::uint32_t probe = 0;	// Distance from the home bucket plus one, zero marks an empty entry
+			Slot key;
+			Slot value;
+		};
+
+		struct Table
+		{
+			std::vector<Entry> entries;
+			std::size_t count = 0;
+			Equivalence equivalence;
+			std::atomic<std::uint32_t> frozen{ 0 };		// Number of freezes holding the table read-only, see Freeze
+			std::atomic<bool> outlives_form{ false };	// Reachable from outside the form that made it, so values stored in it are promoted
+		};
+
+		std::shared_ptr<Table> table;
+
+		HashTable(Equivalence equivalence, std::size_t capacity = 0);
+
+		std::size_t size() const noexcept;
+
+		/**
+		 * Looks up the value associated with a key
+		 *
+		 * @param key: key to search for
+		 * @returns a pointer to the stored value, or null if the key is not present
+		*/
+		const Slot* find(const Slot& key) const;
+
+		/**
+		 * Associates a value with a key, replacing any previous value
+		*/
+		void insert(Slot key, Slot value);
+
+		/**
+		 * Removes a key and its value, shifting later entries back so no tombstones are left behind
+		 *
+		 * @returns whether the key was present
+		*/
+		bool erase(const Slot& key);
+
+		/**
+		 * Makes room for at least `count` entries without exceeding the maximum load factor
+		*/
+		void reserve(std::size_t count);
+
+		Slot call(Interpreter& interp, Span<Slot> args) override;
+
+	private:
+
+		std::size_t find_index(const Slot& key, std::uint32_t hash) const;
+
+		void insert_hashed(Slot key, Slot value, std::uint32_t hash);
+	};
+
+	namespace builtins
+	{
+		Slot make_hash_table(Interpreter& interp, Span<Slot> args);
+
+		Slot hash_table_set(Interpreter& interp, Span<Slot> args);
+
+		Slot hash_table_ref(Interpreter& interp, Span<Slot> args);
+
+		Slot hash_table_ref_default(Interpreter& interp, Span<Slot> args);
+
+		Slot hash_table_delete(Interpreter& interp, Span<Slot> args);
+
+		Slot hash_table_exists(Interpreter& interp, Span<Slot> args);
+
+		Slot hash_table_size(Interpreter& interp, Span<Slot> args);
+	}
+
+}
\ No newline at end of file
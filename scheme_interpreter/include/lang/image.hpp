@@ -0,0 +1,106 @@
+#pragma once
+
+#include <lang/evaluate.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string_view>
+
+namespace image
+{
+	/**
+	 * Writes every definition visible from an environment, including those of its parent layers, to
+	 * an image file. The file only holds offsets relative to its own start, so it can be mapped at any
+	 * address and read without fixing anything up. Vectors and hash tables are written once however
+	 * many definitions refer to them, which keeps their sharing and any cycles
+	 *
+	 * @param env: environment to write
+	 * @param path: file to write, replaced once the image is complete
+	 * @returns false if a value cannot be written, such as a future or a channel, or the file cannot be
+	 * created
+	*/
+	bool dump_image(const Environment& env, const std::string& path);
+
+	/**
+	 * Definitions read from an image file mapped into memory. Opening an image only maps and checks the
+	 * file, each definition is decoded the first time it is looked up and kept from then on, so startup
+	 * costs the same however many definitions the image holds. Lookups may come from several threads
+	 * at once
+	*/
+	class Image
+	{
+	public:
+		/**
+		 * Maps an image file
+		 *
+		 * @param path: file written by `dump_image`
+		 * @returns the image, or null if the file cannot be mapped or is not a valid image
+		*/
+		static std::shared_ptr<const Image> open(const std::string& path);
+
+		Image(const Image& other) = delete;
+
+		Image& operator= (const Image& other) = delete;
+
+		~Image();
+
+		/**
+		 * Looks a definition up, decoding it if this is the first time it is needed
+		 *
+		 * @param name: name to look up
+		 * @returns the bound variable, or null if the image does not define the name
+		*/
+		const Variable* find(const std::string& name) const;
+
+		std::size_t size() const noexcept;
+
+		/**
+		 * Calls `fn` with the name of every definition in the image
+		*/
+		void for_each_name(const std::function<void(std::string_view)>& fn) const;
+
+		/**
+		 * Freezes every value decoded so far and every value decoded from now on, once the image is
+		 * read by more than one thread. They stay frozen for as long as the image lives
+		*/
+		void freeze() const;
+
+	private:
+		Image() = default;
+
+		/**
+		 * Decodes the container with the given id, or copies it if it was decoded before. Only called
+		 * with `decode_mutex` held. A container that fails to decode is not kept
+		 *
+		 * @returns a copy sharing the container's storage, or null if the image is damaged
+		*/
+		std::unique_ptr<Variable> decode_object(std::uint64_t id, unsigned depth) const;
+
+		friend class Decoder;
+
+		const char* data = nullptr;
+		std::size_t length = 0;
+
+		std::uint64_t entry_count = 0;
+		std::uint64_t index_capacity = 0;		// Power of two, each bucket a hash and an entry offset
+		const char* index = nullptr;
+		std::uint64_t object_count = 0;
+		const char* objects = nullptr;			// Offsets of the vectors and hash tables
+
+		std::unique_ptr<std::atomic<Variable*>[]> decoded;		// Per index bucket, owned by the image
+		mutable std::mutex decode_mutex;
+		mutable std::vector<std::unique_ptr<Variable>> decoded_objects;
+		mutable std::vector<std::uint64_t> pending_objects;		// Ids registered while decoding the current definition
+		mutable bool frozen = false;		// Guarded by decode_mutex, as is frozen_objects
+		mutable environment::Freeze frozen_objects;	// Holds the decoded values read-only once the image is frozen, for as long as it lives
+	};
+
+	/**
+	 * Opens an image as a read-only environment layer, to be the parent of an interpreter's environment
+	 *
+	 * @param path: file written by `dump_image`
+	 * @returns the layer, or null after printing an error if the image cannot be opened
+	*/
+	std::shared_ptr<const Environment> load_image(const std::string& path);
+}
\ No newline at end of file
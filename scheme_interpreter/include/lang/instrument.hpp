@@ -0,0 +1,67 @@
+#pragma once
+
+#include <lang/env.hpp>
+#include <chrono>
+#include <ostream>
+#include <string_view>
+
+namespace instrument
+{
+	/**
+	 * Whether calls are counted, set by configuring with -DSCHEME_INSTRUMENT=ON. Without it the
+	 * instrumentation macros expand to nothing and the evaluator is unchanged
+	*/
+#ifdef SCHEME_INSTRUMENT
+	constexpr bool enabled = true;
+#else
+	constexpr bool enabled = false;
+#endif
+
+	struct Counters;
+
+#ifdef SCHEME_INSTRUMENT
+	/**
+	 * Counts one call of a built-in, special form or procedure while alive. Time and allocations are
+	 * inclusive of everything the call does, and a procedure that recurses into itself is only timed
+	 * by its outermost call, so its time is never counted twice
+	*/
+	class Call
+	{
+	public:
+		Call(std::string_view name);
+
+		Call(const Call& other) = delete;
+
+		Call& operator= (const Call& other) = delete;
+
+		~Call();
+
+	private:
+		Counters* counters;
+		bool outermost;
+		std::chrono::steady_clock::time_point start;
+		std::size_t allocations;
+	};
+
+#define SCHEME_INSTRUMENT_CALL(name) instrument::Call instrumented_call(name)
+#else
+#define SCHEME_INSTRUMENT_CALL(name) ((void)0)
+#endif
+
+	/**
+	 * Writes the counters of every thread, the most time consuming first
+	*/
+	void print_stats(std::ostream& out);
+}
+
+namespace environment
+{
+	namespace builtins
+	{
+		/**
+		 * Returns a vector holding a vector of name, calls, microseconds and allocations for every
+		 * built-in, special form and procedure called so far, the most time consuming first
+		*/
+		Slot runtime_stats(Interpreter& interp, Span<Slot> args);
+	}
+}
\ No newline at end of file
@@ -17,7 +17,8 @@ namespace lexer
 			SYMBOL,
 			STRING,
 			INT,
-			FLOAT
+			FLOAT,
+			ERROR		// Text that could not be read, such as a number out of range, with the reason held in `symbol`
 		};
 
 		Type type = Type::INVALID;
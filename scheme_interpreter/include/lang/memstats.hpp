@@ -0,0 +1,129 @@
+#pragma once
+
+#include <lang/env.hpp>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+namespace memstats
+{
+	using environment::Variable;
+
+	constexpr std::size_t type_count = static_cast<std::size_t>(Variable::Type::CONDITION) + 1;
+	constexpr std::size_t token_kind = type_count;
+	constexpr std::size_t expr_kind = type_count + 1;
+	constexpr std::size_t kind_count = type_count + 2;
+
+	struct Count
+	{
+		std::int64_t live = 0;
+		std::uint64_t total = 0;
+	};
+
+	/**
+	 * Counts summed over every thread, including those that have exited
+	*/
+	struct Snapshot
+	{
+		Count variables[type_count];	// Indexed by Variable::Type, copies included
+		Count tokens;
+		Count exprs;
+		std::int64_t variable_bytes = 0;		// Storage of the live variables, headers included
+		std::uint64_t forms = 0;
+		std::uint64_t largest_form_peak = 0;	// Most variable storage any one top-level form had in use at once
+		std::uint64_t last_form_peak = 0;
+	};
+
+	extern std::atomic<bool> enabled;
+
+	/**
+	 * Starts counting. Tokens are created and moved often enough that counting them costs the lexer and
+	 * parser a third of their speed, so nothing is counted unless asked for, and objects that already
+	 * exist are not included. Called before anything is evaluated, the live counts are exact
+	*/
+	void enable() noexcept;
+
+	void count_created(std::size_t kind) noexcept;
+
+	void count_destroyed(std::size_t kind) noexcept;
+
+	void count_allocated(std::size_t size) noexcept;
+
+	void count_freed(std::size_t size) noexcept;
+
+	// Called as the objects are constructed and destroyed, moves and copies included
+
+	inline void variable_created(Variable::Type type) noexcept
+	{
+		if (enabled.load(std::memory_order_relaxed)) count_created(static_cast<std::size_t>(type));
+	}
+
+	inline void variable_destroyed(Variable::Type type) noexcept
+	{
+		if (enabled.load(std::memory_order_relaxed)) count_destroyed(static_cast<std::size_t>(type));
+	}
+
+	inline void token_created() noexcept
+	{
+		if (enabled.load(std::memory_order_relaxed)) count_created(token_kind);
+	}
+
+	inline void token_destroyed() noexcept
+	{
+		if (enabled.load(std::memory_order_relaxed)) count_destroyed(token_kind);
+	}
+
+	inline void expr_created() noexcept
+	{
+		if (enabled.load(std::memory_order_relaxed)) count_created(expr_kind);
+	}
+
+	inline void expr_destroyed() noexcept
+	{
+		if (enabled.load(std::memory_order_relaxed)) count_destroyed(expr_kind);
+	}
+
+	// Called by the allocator for the storage of every variable, including its header
+
+	inline void bytes_allocated(std::size_t size) noexcept
+	{
+		if (enabled.load(std::memory_order_relaxed)) count_allocated(size);
+	}
+
+	inline void bytes_freed(std::size_t size) noexcept
+	{
+		if (enabled.load(std::memory_order_relaxed)) count_freed(size);
+	}
+
+	/**
+	 * Marks the start and end of a top-level form on the calling thread. The form's peak is the most
+	 * variable storage allocated and not yet freed by this thread at any point while it ran, beyond what
+	 * was already in use when it started
+	*/
+	void form_started() noexcept;
+
+	void form_finished() noexcept;
+
+	/**
+	 * Peak of the form currently running on the calling thread, so far
+	*/
+	std::uint64_t current_form_peak() noexcept;
+
+	Snapshot snapshot();
+
+	void print_stats(std::ostream& out);
+}
+
+namespace environment
+{
+	namespace builtins
+	{
+		/**
+		 * Returns a vector holding a vector of name, live and total count for every kind of variable,
+		 * token and expression created so far, followed by a vector of "Form peak bytes", the peak of
+		 * the form being evaluated so far, and the largest peak of any earlier form. Empty if counting
+		 * is not enabled
+		*/
+		Slot memory_stats(Interpreter& interp, Span<Slot> args);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <lang/env.hpp>
+#include <cstddef>
+#include <ostream>
+
+namespace output
+{
+	constexpr std::size_t batch_buffer_size = 1 << 16;
+
+	/**
+	 * Sets how standard output is buffered for the rest of the process, and must be called before
+	 * anything is written. Interactive sessions stay line buffered so each result shows as soon as it is
+	 * printed. Otherwise output collects in a large buffer that is only written out when it fills, when
+	 * the program ends, or when asked with `flush`, so a batch printing many results makes few system calls
+	 *
+	 * @param interactive: whether a person is reading the output as it is written
+	*/
+	void configure(bool interactive);
+
+	/**
+	 * Writes out everything buffered for standard output
+	*/
+	void flush();
+
+	/**
+	 * Writes a number the way an ostream does by default, through std::to_chars rather than the locale
+	 * aware formatting of the stream
+	*/
+	void write_int(std::ostream& out, int value);
+
+	void write_float(std::ostream& out, double value);
+}
+
+namespace environment
+{
+	namespace builtins
+	{
+		/**
+		 * Writes out everything buffered for standard output, for a script that wants its output seen
+		 * before it finishes
+		*/
+		Slot flush_output(Interpreter& interp, Span<Slot> args);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <lang/evaluate.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+namespace parallel
+{
+	/**
+	 * Unit of work queued on the pool. Whoever runs a task deletes it afterwards
+	*/
+	struct Task
+	{
+		virtual ~Task() = default;
+
+		virtual void run() = 0;
+	};
+
+	/**
+	 * Chase-Lev work-stealing deque with a fixed capacity. The owning thread pushes and pops at the
+	 * bottom without locking, and any other thread may steal from the top
+	*/
+	class TaskDeque
+	{
+	public:
+		static constexpr std::size_t capacity = 1024;
+
+		TaskDeque();
+
+		TaskDeque(const TaskDeque& other) = delete;
+
+		TaskDeque& operator= (const TaskDeque& other) = delete;
+
+		/**
+		 * Adds a task at the bottom, only called by the owner
+		 *
+		 * @param task: task to add
+		 * @returns false if the deque is full, in which case the caller keeps the task
+		*/
+		bool push(Task* task);
+
+		/**
+		 * Takes the most recently pushed task, only called by the owner
+		 *
+		 * @returns the task, or null if the deque is empty or a thief won the last task
+		*/
+		Task* pop();
+
+		/**
+		 * Takes the oldest task, may be called by any thread
+		 *
+		 * @returns the task, or null if the deque is empty or another thread took it first
+		*/
+		Task* steal();
+
+		/**
+		 * Whether the deque looked empty at the time of the call
+		*/
+		bool empty() const;
+
+	private:
+		alignas(64) std::atomic<std::int64_t> top{ 0 };
+		alignas(64) std::atomic<std::int64_t> bottom{ 0 };
+		std::atomic<Task*> tasks[capacity];
+	};
+
+	/**
+	 * Number of threads that take part in parallel work, the calling thread included
+	*/
+	std::size_t concurrency();
+
+	/**
+	 * Runs `body` over the whole of [0, count) in chunks, spread across the process-wide work-stealing pool.
+	 * The range is split lazily: a thread only gives away half of what it has left when its own deque is
+	 * empty, which is when other threads may be out of work. A busy pool therefore sees a few large chunks
+	 * and an idle one many small ones, down to `grain` elements. The calling thread runs chunks too, and
+	 * keeps doing so until every chunk has finished. Calls may be nested
+	 *
+	 * @param count: number of elements in the range
+	 * @param grain: smallest number of elements worth handing to another thread
+	 * @param body: called with the bounds of each chunk, from any thread in the pool
+	*/
+	void parallel_for(std::size_t count, std::size_t grain, const std::function<void(std::size_t, std::size_t)>& body);
+
+	/**
+	 * Queues a task on the calling thread's deque, where idle threads can steal it. The task runs on
+	 * the calling thread straight away if the deque is full
+	 *
+	 * @param task: task to run, deleted once it has run
+	*/
+	void submit(Task* task);
+
+	/**
+	 * Runs queued tasks on the calling thread, including ones stolen from other threads, until `pending`
+	 * reaches zero
+	 *
+	 * @param pending: count that whoever finishes the awaited work brings to zero
+	*/
+	void wait(const std::atomic<std::size_t>& pending);
+}
+
+namespace environment
+{
+	/**
+	 * Expression being evaluated in the background, shared by every copy of the future that refers to it
+	*/
+	struct FutureState
+	{
+		ASTExpr expr;
+		std::shared_ptr<const Environment> globals;		// Snapshot of the definitions when the future was made
+		std::vector<Binding> captured;
+		Freeze frozen;		// Holds what the expression can reach read-only until it has been evaluated
+		Slot value;
+		Slot raised;		// Error that nothing in the expression caught, raised again by every touch
+
+		std::atomic<bool> started{ false };
+		std::atomic<std::size_t> pending{ 1 };		// Drops to zero once `value` or `raised` holds the result
+
+		/**
+		 * Evaluates the expression, unless a thread has already started on it
+		*/
+		void run();
+	};
+
+	class Future : public VarCopy<Future>
+	{
+	public:
+		std::shared_ptr<FutureState> state;
+
+		Future(std::shared_ptr<FutureState> state);
+
+		Slot call(Interpreter& interp, Span<Slot> args) override;
+	};
+}
+
+namespace eval
+{
+	/**
+	 * Starts evaluating an expression on the pool and returns straight away. The expression sees the
+	 * definitions and locals as they are at this point, later definitions by the caller stay invisible to
+	 * it, and anything it defines itself is discarded with its result
+	 *
+	 * @param interp: interpreter to evaluate in
+	 * @param args: ASTExprs following the keyword, the single expression to evaluate
+	 * @returns a slot containing the future
+	*/
+	Slot future(Interpreter& interp, Span<const ASTExpr> args);
+}
+
+namespace environment
+{
+	namespace builtins
+	{
+		Slot pmap(Interpreter& interp, Span<Slot> args);
+
+		Slot pfor_each(Interpreter& interp, Span<Slot> args);
+
+		Slot preduce(Interpreter& interp, Span<Slot> args);
+
+		Slot touch(Interpreter& interp, Span<Slot> args);
+	}
+}
\ No newline at end of file
@@ -66,6 +66,23 @@ namespace parser
 	 */
 	ASTExpr construct_ast(std::vector<Token>&& token_arr);
 
+	/**
+	 * Splits a stream of tokens into its top level forms, such as the definitions in a file
+	 *
+	 * @param token_arr: vector containing Tokens returned from the tokenize function
+	 * @returns one ASTExpr per top level list or atom, in the order they appear
+	 */
+	std::vector<ASTExpr> construct_program(std::vector<Token>&& token_arr);
+
+	/**
+	 * Finds the bracket that closes the expression opened at `start`
+	 *
+	 * @param start: iterator of the token for the opening bracket of an expression
+	 * @param end: iterator past the last token that may be searched
+	 * @returns iterator of the matching closing bracket, or `end` if there is none
+	 */
+	Iter find_closing_bracket(Iter start, Iter end);
+
 	/**
 	 * Used to construct an expression using recursive descent
 	 *
@@ -75,6 +92,15 @@ namespace parser
 	 */
 	ASTExpr parse_expr(Iter start, Iter end);
 
+	/**
+	 * Makes a deep copy of an expression, used when a procedure has to keep its body after the
+	 * program it was read from is gone
+	 *
+	 * @param expr: expression to copy
+	 * @returns an independent ASTExpr equal to `expr`
+	 */
+	ASTExpr copy_ast(const ASTExpr& expr);
+
 	/**
 	* Very rough function for printing an AST, used for debugging purposes
 	*/
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <lang/env.hpp>
+#include <cstdint>
+#include <functional>
+
+namespace environment
+{
+
+	/**
+	 * Immutable vector stored as a 32-way trie with a separate tail, in the style of Clojure's vectors.
+	 * Updates copy only the path from the root to the changed leaf, so every version shares all of its
+	 * untouched nodes with the versions it was derived from
+	*/
+	class PersistentVector : public VarCopy<PersistentVector>
+	{
+	public:
+		static constexpr unsigned bits = 5;
+		static constexpr std::size_t width = std::size_t(1) << bits;
+		static constexpr std::size_t mask = width - 1;
+
+		struct Node
+		{
+			std::vector<std::shared_ptr<const Node>> children;	// Populated for interior nodes
+			std::vector<Slot> values;							// Populated for leaves
+		};
+
+		std::size_t count = 0;
+		unsigned shift = bits;
+		std::shared_ptr<const Node> root;
+		std::shared_ptr<const Node> tail;
+
+		PersistentVector();
+
+		std::size_t size() const noexcept;
+
+		const Slot& at(std::size_t idx) const noexcept;
+
+		/**
+		 * @returns a new vector with the element at `idx` replaced by `value`
+		*/
+		PersistentVector set(std::size_t idx, Slot value) const;
+
+		/**
+		 * @returns a new vector with `value` appended to the end
+		*/
+		PersistentVector push(Slot value) const;
+
+		Slot call(Interpreter& interp, Span<Slot> args) override;
+
+	private:
+
+		std::size_t tail_offset() const noexcept;
+
+		std::shared_ptr<const Node> push_tail(unsigned level, const Node& parent, std::shared_ptr<const Node> tail_node) const;
+	};
+
+	/**
+	 * Immutable map stored as a hash array mapped trie. Keys are compared with equal? and each level of
+	 * the trie consumes five bits of the key's hash, giving O(log32 n) lookups and updates
+	*/
+	class PersistentMap : public VarCopy<PersistentMap>
+	{
+	public:
+		struct Node;
+
+		struct Entry
+		{
+			std::size_t hash = 0;
+			std::shared_ptr<const Node> child;	// Set when the entry points at a sub-trie rather than holding a pair
+			Slot key;
+			Slot value;
+		};
+
+		struct Node
+		{
+			std::uint32_t bitmap = 0;	// Which of the 32 hash fragments at this level have an entry
+			bool collision = false;		// Entries all share one full hash and are searched linearly
+			std::vector<Entry> entries;
+		};
+
+		std::size_t count = 0;
+		std::shared_ptr<const Node> root;
+
+		PersistentMap();
+
+		std::size_t size() const noexcept;
+
+		/**
+		 * @returns a pointer to the value associated with `key`, or null if the key is not present
+		*/
+		const Slot* find(const Slot& key) const;
+
+		/**
+		 * @returns a new map in which `key` is associated with `value`
+		*/
+		PersistentMap set(Slot key, Slot value) const;
+
+		/**
+		 * @returns a new map without `key`, sharing the original if the key was not present
+		*/
+		PersistentMap erase(const Slot& key) const;
+
+		/**
+		 * Calls `fn` with every key and value in the map, in no particular order
+		*/
+		void for_each(const std::function<void(const Slot&, const Slot&)>& fn) const;
+
+		Slot call(Interpreter& interp, Span<Slot> args) override;
+	};
+
+	namespace builtins
+	{
+		Slot persistent_vector(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_vector_length(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_vector_ref(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_vector_set(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_vector_push(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_map(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_map_count(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_map_ref(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_map_set(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_map_delete(Interpreter& interp, Span<Slot> args);
+
+		Slot persistent_map_contains(Interpreter& interp, Span<Slot> args);
+	}
+
+}
\ No newline at end of file
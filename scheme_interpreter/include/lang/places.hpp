@@ -0,0 +1,122 @@
+#pragma once
+
+#include <lang/evaluate.hpp>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace places
+{
+	/**
+	 * Unbounded multi-producer single-consumer queue after Vyukov. Any thread may push without locking,
+	 * only the place that owns the mailbox pops. A consumer with nothing to read sleeps on a futex, and
+	 * producers only make the wake up call when a consumer is actually asleep
+	*/
+	class Mailbox
+	{
+	public:
+		Mailbox();
+
+		Mailbox(const Mailbox& other) = delete;
+
+		Mailbox& operator= (const Mailbox& other) = delete;
+
+		~Mailbox();
+
+		/**
+		 * Adds a message, may be called from any thread
+		*/
+		void push(Slot message);
+
+		/**
+		 * Takes the oldest message if there is one, only called by the owner
+		 *
+		 * @param message: receives the message
+		 * @returns whether there was a message
+		*/
+		bool try_pop(Slot& message);
+
+		/**
+		 * Takes the oldest message, waiting for one to arrive if necessary, only called by the owner
+		*/
+		Slot pop();
+
+	private:
+		struct Node
+		{
+			std::atomic<Node*> next{ nullptr };
+			Slot value;
+		};
+
+		alignas(64) std::atomic<Node*> head;	// Most recently pushed node, where producers append
+		alignas(64) Node* tail;					// Node before the oldest message, only touched by the consumer
+		std::atomic<std::uint32_t> signal{ 0 };
+		std::atomic<bool> waiting{ false };
+	};
+
+	/**
+	 * Copies a value so that it can be handed to another place without sharing anything mutable. Vectors
+	 * and hash tables are copied deeply, keeping any sharing and cycles within the value. Persistent
+	 * vectors and maps whose elements are all immutable are shared as they are, at the cost of a
+	 * reference count
+	 *
+	 * @param value: value to copy
+	 * @param copy: receives the copy
+	 * @returns false if the value is tied to its interpreter, such as a future or a green thread channel
+	*/
+	bool copy_message(const Slot& value, Slot& copy);
+
+	/**
+	 * Copies every definition visible from an environment into a new place's environment, the way
+	 * messages are copied, so the place shares nothing mutable with its creator. Definitions mapped
+	 * from an image stay in the image, which is frozen and shared. Definitions that cannot be copied,
+	 * such as futures, are left out
+	 *
+	 * @param env: creator's environment
+	 * @param target: empty environment of the place
+	*/
+	void copy_globals(const Environment& env, Environment& target);
+
+	/**
+	 * Thread of a place and the value its procedure returned
+	*/
+	struct PlaceThread
+	{
+		std::thread thread;
+		std::mutex join_mutex;		// Creator ends can be sent to other places, so several may try to join at once
+		Slot result;
+
+		~PlaceThread();
+	};
+}
+
+namespace environment
+{
+	/**
+	 * One end of the pair of mailboxes between a place and the place that created it. Copies refer to
+	 * the same mailboxes, and any number of places may send on an end but only one should receive on it
+	*/
+	class PlaceChannel : public VarCopy<PlaceChannel>
+	{
+	public:
+		std::shared_ptr<places::Mailbox> in;
+		std::shared_ptr<places::Mailbox> out;
+		std::shared_ptr<places::PlaceThread> thread;	// Set on the creator's end only
+
+		PlaceChannel(std::shared_ptr<places::Mailbox> in, std::shared_ptr<places::Mailbox> out, std::shared_ptr<places::PlaceThread> thread);
+
+		Slot call(Interpreter& interp, Span<Slot> args) override;
+	};
+
+	namespace builtins
+	{
+		Slot place(Interpreter& interp, Span<Slot> args);
+
+		Slot place_send(Interpreter& interp, Span<Slot> args);
+
+		Slot place_receive(Interpreter& interp, Span<Slot> args);
+
+		Slot place_wait(Interpreter& interp, Span<Slot> args);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace profile
+{
+	constexpr std::size_t max_depth = 64;		// Deeper calls are counted but left out of samples
+
+	/**
+	 * Shadow stack of the Scheme procedures being called on one thread, or one green thread, oldest first.
+	 * The sampler reads it from a signal handler on the same thread, so it holds only names that live as
+	 * long as the process
+	*/
+	struct Stack
+	{
+		std::string_view frames[max_depth];
+		std::size_t depth = 0;
+	};
+
+	extern std::atomic<bool> active;
+
+	/**
+	 * Makes a stack the one calls are pushed onto on this thread, for a green thread being resumed
+	 *
+	 * @param stack: stack to switch to, or null for the thread's own
+	 * @returns the stack that was in use, to switch back to
+	*/
+	Stack* switch_stack(Stack* stack) noexcept;
+
+	/**
+	 * Records a procedure call on the thread's shadow stack while alive, if the profiler is running
+	*/
+	class Frame
+	{
+	public:
+		Frame(std::string_view name) noexcept
+		{
+			if (active.load(std::memory_order_relaxed)) push(name);
+		}
+
+		Frame(const Frame& other) = delete;
+
+		Frame& operator= (const Frame& other) = delete;
+
+		~Frame()
+		{
+			if (stack != nullptr) pop();
+		}
+
+	private:
+		void push(std::string_view name) noexcept;
+
+		void pop() noexcept;
+
+		Stack* stack = nullptr;
+	};
+
+	/**
+	 * Copies a procedure name into storage kept for the rest of the process, so frames can refer to it
+	 * after the closure is gone. Names are shared, interning one twice returns the same view
+	*/
+	std::string_view intern(const std::string& name);
+
+	/**
+	 * Starts sampling the shadow stacks of every thread running Scheme code, from a SIGPROF timer that
+	 * counts the CPU time of the process. The signal handler only copies the stack of the thread it
+	 * lands on into a preallocated buffer, and a background thread folds the samples together
+	 *
+	 * @param hz: samples per second of CPU time
+	 * @returns false if the profiler is already running or the timer cannot be set up
+	*/
+	bool start(int hz = 1000);
+
+	/**
+	 * Stops sampling and writes the samples as collapsed stacks, one line per distinct stack with its
+	 * procedures separated by semicolons and followed by a count, the input flamegraph tools expect
+	 *
+	 * @param path: file to write
+	 * @returns whether the file was written
+	*/
+	bool stop(const std::string& path);
+}
\ No newline at end of file
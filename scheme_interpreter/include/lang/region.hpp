@@ -0,0 +1,107 @@
+#pragma once
+
+#include <lang/env.hpp>
+#include <cstddef>
+#include <ostream>
+
+namespace region
+{
+	/**
+	 * Counts of the variables allocated by one thread
+	*/
+	struct Stats
+	{
+		std::size_t region_allocations = 0;		// Variables carved out of a region
+		std::size_t region_bytes = 0;
+		std::size_t heap_allocations = 0;		// Variables allocated from the global heap
+		std::size_t heap_bytes = 0;
+		std::size_t promotions = 0;				// Defined values copied out of a region
+		std::size_t forms = 0;					// Top-level forms evaluated in a region
+		std::size_t resets = 0;					// Forms that left nothing behind, so their chunk was reused
+		std::size_t chunks_allocated = 0;		// Chunks requested from the heap
+		std::size_t chunks_retired = 0;			// Chunks set aside because values carved out of them were still alive
+	};
+
+	/**
+	 * Evaluates one top-level form in a region. While a scope is alive, variables created on its thread
+	 * are carved out of fixed size chunks by bumping a pointer rather than allocated one at a time. When
+	 * the outermost scope ends and every variable from the current chunk has been destroyed, the chunk is
+	 * reused in full by the next form.
+	 *
+	 * Variables may outlive their form, they are freed one at a time like any other. A chunk still holding
+	 * live variables is retired instead of reused, and handed back once the last of them is destroyed, on
+	 * whichever thread that happens. Values bound with define are promoted to the heap so they do not keep
+	 * a chunk alive for the rest of the program
+	*/
+	class Scope
+	{
+	public:
+		Scope() noexcept;
+
+		Scope(const Scope& other) = delete;
+
+		Scope& operator= (const Scope& other) = delete;
+
+		~Scope();
+	};
+
+	/**
+	 * Sends the variables created on this thread to the heap while alive, even inside a region scope
+	*/
+	class HeapScope
+	{
+	public:
+		HeapScope() noexcept;
+
+		HeapScope(const HeapScope& other) = delete;
+
+		HeapScope& operator= (const HeapScope& other) = delete;
+
+		~HeapScope();
+	};
+
+	/**
+	 * Allocates the storage of a variable, from the thread's region if a scope is active
+	*/
+	void* allocate(std::size_t size);
+
+	/**
+	 * Releases storage returned by `allocate`, from any thread
+	*/
+	void deallocate(void* ptr) noexcept;
+
+	/**
+	 * Whether a variable was carved out of a region
+	*/
+	bool in_region(const environment::Variable* var) noexcept;
+
+	/**
+	 * Whether variables created on this thread right now are carved out of a region
+	*/
+	bool active() noexcept;
+
+	/**
+	 * Moves a value that is about to outlive its form out of the region. Vectors and hash tables that
+	 * nothing else refers to have their elements promoted too, while elements of shared containers stay
+	 * where they are, keeping their chunk alive
+	 *
+	 * @param var: value to promote
+	 * @returns the value, copied to the heap if it was in a region
+	*/
+	std::unique_ptr<environment::Variable> promote(std::unique_ptr<environment::Variable> var);
+
+	/**
+	 * Promotes a value that is about to be stored in a container that outlives the current form, which
+	 * would otherwise keep the value's chunk alive for as long as the container holds it
+	 *
+	 * @param slot: value to promote in place
+	*/
+	void promote(environment::Slot& slot);
+
+	/**
+	 * Counts for the calling thread
+	*/
+	const Stats& stats() noexcept;
+
+	void print_stats(std::ostream& out);
+}
\ No newline at end of file
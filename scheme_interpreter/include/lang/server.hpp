@@ -0,0 +1,184 @@
+#pragma once
+
+#include <lang/evaluate.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sys/types.h>
+#include <thread>
+
+namespace server
+{
+	/**
+	 * Largest request or response payload accepted, larger frames close the connection
+	*/
+	constexpr std::uint32_t max_frame_size = 16 * 1024 * 1024;
+
+	/**
+	 * Reads one frame, a 4 byte big-endian payload length followed by the payload
+	 *
+	 * @param fd: socket to read from
+	 * @param payload: receives the payload of the frame
+	 * @returns whether a complete frame was read
+	*/
+	bool read_frame(int fd, std::string& payload);
+
+	/**
+	 * Writes one frame, a 4 byte big-endian payload length followed by the payload
+	 *
+	 * @param fd: socket to write to
+	 * @param payload: payload of the frame
+	 * @returns whether the whole frame was written
+	*/
+	bool write_frame(int fd, const std::string& payload);
+
+	/**
+	 * Evaluates the forms of one request in a clean environment on top of the shared globals
+	 *
+	 * @param interp: interpreter owned by the calling worker
+	 * @param globals: definitions shared by every request, may be null
+	 * @param source: text of the request
+	 * @returns the printed value of the last form, or an empty string if it produced none. An error that
+	 * nothing catches ends the request, which returns `#<error message irritant ...>` instead
+	*/
+	std::string eval_request(eval::Interpreter& interp, const std::shared_ptr<const Environment>& globals, const std::string& source);
+
+	/**
+	 * Evaluates framed requests from any number of clients on a Unix domain socket. A single thread
+	 * waits on the non-blocking sockets, gathering each request as its bytes arrive, and hands every
+	 * complete one to a pool of workers, each of which owns an interpreter. A client that stops halfway
+	 * through a request holds up nobody else. A connection's next request is not handed out until the
+	 * response to the last one is written, so the responses on a connection come back in the order the
+	 * requests were sent.
+	 *
+	 * Every request starts from an empty environment whose parent is the shared globals. The globals
+	 * are frozen when the server is created, so a request that tries to change a vector or hash table
+	 * defined there gets an error instead of racing with the other requests.
+	*/
+	class Server
+	{
+	public:
+		/**
+		 * @param socket_path: path of the socket to listen on, an existing file at the path is replaced
+		 * @param workers: number of evaluation threads
+		 * @param globals: definitions visible to every request, may be null
+		*/
+		Server(std::string socket_path, std::size_t workers, std::shared_ptr<const Environment> globals);
+
+		Server(const Server& other) = delete;
+
+		Server& operator= (const Server& other) = delete;
+
+		~Server();
+
+		/**
+		 * Binds the socket and starts the polling and worker threads
+		 *
+		 * @returns whether the server is listening
+		*/
+		bool start();
+
+		/**
+		 * Stops accepting requests, finishes the ones already queued and closes every connection
+		*/
+		void stop();
+
+	private:
+		struct Job
+		{
+			int fd;
+			std::string payload;
+			std::string received;		// Bytes of later requests that arrived along with this one
+		};
+
+		void poll_loop();
+
+		void worker_loop();
+
+		void wake();
+
+		std::string socket_path;
+		std::size_t worker_count;
+		std::shared_ptr<const Environment> globals;
+
+		int listen_fd = -1;
+		int wake_fds[2] = { -1, -1 };	// Self pipe that interrupts poll when a connection is ready for reading again
+		std::atomic<bool> stopping{ false };
+
+		std::mutex mutex;
+		std::condition_variable job_ready;
+		std::deque<Job> jobs;
+		std::vector<Job> rearm;		// Connections whose responses were written, waiting to be polled again
+
+		std::thread poller;
+		std::vector<std::thread> workers;
+	};
+
+	/**
+	 * Serves the same protocol as Server from forked worker processes. The globals are loaded before
+	 * the socket is bound and the workers are forked, so every worker starts with them already in
+	 * memory, shared copy-on-write with the parent rather than evaluated again. Each worker accepts
+	 * connections from the listening socket it inherited, the kernel handing every new connection to
+	 * one of them, and serves that connection's requests until the client closes it.
+	 *
+	 * Only the forking thread is copied into a worker, so the globals should be loaded without the
+	 * parallel primitives, whose pool threads would be missing in the workers. Nothing is shared
+	 * between workers, so the globals are not frozen and each worker may change its own copy.
+	*/
+	class PreforkServer
+	{
+	public:
+		/**
+		 * @param socket_path: path of the socket to listen on, an existing file at the path is replaced
+		 * @param workers: number of worker processes
+		 * @param globals: definitions visible to every request, may be null
+		*/
+		PreforkServer(std::string socket_path, std::size_t workers, std::shared_ptr<const Environment> globals);
+
+		PreforkServer(const PreforkServer& other) = delete;
+
+		PreforkServer& operator= (const PreforkServer& other) = delete;
+
+		~PreforkServer();
+
+		/**
+		 * Binds the socket and forks the workers
+		 *
+		 * @returns whether the server is listening
+		*/
+		bool start();
+
+		/**
+		 * Collects workers that have exited and forks replacements for them
+		 *
+		 * @returns the number of workers replaced
+		*/
+		std::size_t reap();
+
+		/**
+		 * Terminates the workers, waits for them and closes the socket
+		*/
+		void stop();
+
+		const std::vector<pid_t>& worker_pids() const noexcept;
+
+	private:
+		/**
+		 * Forks one worker
+		 *
+		 * @returns the pid of the worker, or -1 if the fork failed
+		*/
+		pid_t fork_worker();
+
+		[[noreturn]] void worker_main();
+
+		std::string socket_path;
+		std::size_t worker_count;
+		std::shared_ptr<const Environment> globals;
+
+		int listen_fd = -1;
+		bool stopping = false;
+		std::vector<pid_t> pids;
+	};
+}
\ No newline at end of file
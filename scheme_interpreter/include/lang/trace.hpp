@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace trace
+{
+	extern std::atomic<bool> active;
+	extern std::atomic<std::int64_t> call_threshold;		// Shortest procedure call recorded in nanoseconds, negative to record none
+
+	inline std::int64_t now() noexcept
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	/**
+	 * Adds a finished event to the calling thread's ring buffer. Only the owning thread writes to a ring
+	 * and only the writer thread reads from it, so neither ever waits on the other. An event that finds
+	 * the ring full is dropped and counted
+	 *
+	 * @param name: name of the event, which must live as long as the process
+	 * @param category: "phase" or "procedure"
+	 * @param start: time the event started, from `now`
+	 * @param end: time the event ended
+	*/
+	void record(std::string_view name, const char* category, std::int64_t start, std::int64_t end) noexcept;
+
+	/**
+	 * Records the time from its construction to its destruction as one phase of evaluating a form,
+	 * if tracing is active
+	*/
+	class Phase
+	{
+	public:
+		Phase(const char* name) noexcept : name(name)
+		{
+			if (active.load(std::memory_order_relaxed)) start = now();
+		}
+
+		Phase(const Phase& other) = delete;
+
+		Phase& operator= (const Phase& other) = delete;
+
+		~Phase()
+		{
+			if (start != 0) record(name, "phase", start, now());
+		}
+
+	private:
+		const char* name;
+		std::int64_t start = 0;
+	};
+
+	/**
+	 * Records a procedure call if tracing covers calls and it lasts at least the threshold
+	*/
+	class Call
+	{
+	public:
+		Call(std::string_view name) noexcept : name(name)
+		{
+			if (active.load(std::memory_order_relaxed) && call_threshold.load(std::memory_order_relaxed) >= 0) start = now();
+		}
+
+		Call(const Call& other) = delete;
+
+		Call& operator= (const Call& other) = delete;
+
+		~Call()
+		{
+			if (start == 0) return;
+			auto end = now();
+			if (end - start >= call_threshold.load(std::memory_order_relaxed)) record(name, "procedure", start, end);
+		}
+
+	private:
+		std::string_view name;
+		std::int64_t start = 0;
+	};
+
+	/**
+	 * Starts tracing into a file of Chrome trace events, which Perfetto and chrome://tracing can open.
+	 * A background thread moves events from the ring buffers into the file as the program runs
+	 *
+	 * @param path: file to write
+	 * @param threshold: shortest procedure call to record in microseconds, or negative to leave calls out
+	 * @returns false if tracing is already active or the file cannot be created
+	*/
+	bool start(const std::string& path, std::int64_t threshold = -1);
+
+	/**
+	 * Stops tracing, writing the remaining events and closing the file
+	 *
+	 * @returns whether every event was written
+	*/
+	bool stop();
+}
\ No newline at end of file
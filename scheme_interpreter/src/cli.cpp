@@ -1,11 +1,172 @@
 #include <lang/evaluate.hpp>
+#include <lang/image.hpp>
+#include <lang/instrument.hpp>
+#include <lang/memstats.hpp>
+#include <lang/output.hpp>
+#include <lang/profile.hpp>
+#include <lang/region.hpp>
+#include <lang/server.hpp>
+#include <lang/trace.hpp>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
 
 using namespace environment;
 using namespace parser;
 using namespace lexer;
 using namespace eval;
 
+/**
+ * Runs the evaluation server until the process receives SIGINT or SIGTERM
+ *
+ * @param prelude: interpreter holding the definitions shared by every request
+*/
+static int serve(const std::string& socket_path, std::size_t workers, Interpreter& prelude)
+{
+	// Worker threads inherit the blocked mask, so only the sigwait below ever sees these signals
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	auto globals = std::make_shared<const Environment>(std::move(prelude.env));
+	server::Server server(socket_path, workers, globals);
+	if (!server.start()) return 1;
+
+	std::cout << "Serving on " << socket_path << " with " << workers << " workers" << std::endl;
+
+	int signal;
+	sigwait(&signals, &signal);
+	server.stop();
+	return 0;
+}
+
+/**
+ * Runs the evaluation server in forked worker processes until the process receives SIGINT or SIGTERM,
+ * replacing workers that exit in the meantime
+*/
+static int serve_prefork(const std::string& socket_path, std::size_t workers, Interpreter& prelude)
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGCHLD);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	auto globals = std::make_shared<const Environment>(std::move(prelude.env));
+	server::PreforkServer server(socket_path, workers, globals);
+	if (!server.start()) return 1;
+
+	std::cout << "Serving on " << socket_path << " with " << workers << " worker processes" << std::endl;
+
+	int signal;
+	while (sigwait(&signals, &signal) == 0 && signal == SIGCHLD) server.reap();
+	server.stop();
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
-	repl();
-}
\ No newline at end of file
+	std::string socket_path;
+	std::string prelude_path;
+	std::string image_path;
+	std::string dump_path;
+	std::string profile_path;
+	std::string trace_path;
+	std::int64_t trace_calls = -1;
+	std::string script_path;
+	std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
+	bool prefork = false;
+	bool alloc_stats = false;
+	bool runtime_stats = false;
+	bool mem_stats = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+
+		if (std::strcmp(argv[i], "--serve") == 0 && has_value) socket_path = argv[++i];
+		else if (std::strcmp(argv[i], "--workers") == 0 && has_value) workers = std::max(1, std::atoi(argv[++i]));
+		else if (std::strcmp(argv[i], "--prefork") == 0 && has_value)
+		{
+			prefork = true;
+			workers = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--prelude") == 0 && has_value) prelude_path = argv[++i];
+		else if (std::strcmp(argv[i], "--image") == 0 && has_value) image_path = argv[++i];
+		else if (std::strcmp(argv[i], "--dump-image") == 0 && has_value) dump_path = argv[++i];
+		else if (std::strcmp(argv[i], "--alloc-stats") == 0) alloc_stats = true;
+		else if (std::strcmp(argv[i], "--runtime-stats") == 0) runtime_stats = true;
+		else if (std::strcmp(argv[i], "--mem-stats") == 0) mem_stats = true;
+		else if (std::strncmp(argv[i], "--profile=", 10) == 0) profile_path = argv[i] + 10;
+		else if (std::strncmp(argv[i], "--trace=", 8) == 0) trace_path = argv[i] + 8;
+		else if (std::strncmp(argv[i], "--trace-calls=", 14) == 0) trace_calls = std::max(0, std::atoi(argv[i] + 14));
+		else if (argv[i][0] != '-' && script_path.empty()) script_path = argv[i];
+		else
+		{
+			std::cout << "Usage: scheme [--image <file>] [--prelude <file>] [--alloc-stats] [--runtime-stats] [--mem-stats] [--profile=<file>] [--trace=<file> [--trace-calls=<microseconds>]] [<script> | --dump-image <file> | --serve <socket path> [--workers <count> | --prefork <count>]]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (mem_stats) memstats::enable();
+
+	// A server runs until stopped and a terminal has someone watching, anything else is a batch
+	bool interactive = !socket_path.empty() || isatty(STDOUT_FILENO) || (script_path.empty() && isatty(STDIN_FILENO));
+	output::configure(interactive);
+
+	if (!profile_path.empty() && !socket_path.empty())
+	{
+		std::cout << "The profiler samples one process, it cannot be used with --serve" << std::endl;
+		return 1;
+	}
+
+	if (!trace_path.empty() && !socket_path.empty())
+	{
+		std::cout << "Tracing follows the forms of one interpreter, it cannot be used with --serve" << std::endl;
+		return 1;
+	}
+
+	// Started before anything is evaluated so the prelude is profiled too
+	if (!profile_path.empty() && !profile::start())
+	{
+		std::cout << "Could not start the profiler" << std::endl;
+		return 1;
+	}
+	if (!trace_path.empty() && !trace::start(trace_path, trace_calls)) return 1;
+
+	Interpreter interp;
+	if (!image_path.empty())
+	{
+		interp.env.parent = image::load_image(image_path);
+		if (interp.env.parent == nullptr) return 1;
+	}
+	if (!prelude_path.empty() && !eval_file(interp, prelude_path)) return 1;
+
+	if (!dump_path.empty())
+	{
+		bool dumped = image::dump_image(interp.env, dump_path);
+		if (!profile_path.empty() && !profile::stop(profile_path)) dumped = false;
+		if (!trace_path.empty() && !trace::stop()) dumped = false;
+		if (alloc_stats) region::print_stats(std::cerr);
+		if (runtime_stats) instrument::print_stats(std::cerr);
+		if (mem_stats) memstats::print_stats(std::cerr);
+		return dumped ? 0 : 1;
+	}
+	if (!socket_path.empty() && prefork) return serve_prefork(socket_path, workers, interp);
+	if (!socket_path.empty()) return serve(socket_path, workers, interp);
+
+	bool succeeded = true;
+	if (!script_path.empty()) succeeded = eval_file(interp, script_path);
+	else if (!isatty(STDIN_FILENO)) succeeded = pipeline(interp, STDIN_FILENO, std::cout);
+	else repl(interp);
+
+	if (!profile_path.empty() && !profile::stop(profile_path)) succeeded = false;
+	if (!trace_path.empty() && !trace::stop()) succeeded = false;
+	if (alloc_stats) region::print_stats(std::cerr);
+	if (runtime_stats) instrument::print_stats(std::cerr);
+	if (mem_stats) memstats::print_stats(std::cerr);
+	return succeeded ? 0 : 1;
+}
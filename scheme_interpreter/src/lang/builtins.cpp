@@ -0,0 +1,172 @@
+#include <lang/env.hpp>
+#include <lang/condition.hpp>
+#include <lang/continuation.hpp>
+#include <lang/green.hpp>
+#include <lang/hash_table.hpp>
+#include <lang/instrument.hpp>
+#include <lang/memstats.hpp>
+#include <lang/output.hpp>
+#include <lang/parallel.hpp>
+#include <lang/persistent.hpp>
+#include <lang/places.hpp>
+#include <cstdint>
+
+namespace environment
+{
+
+	using namespace builtins;
+
+	static constexpr BuiltinEntry builtin_table[] = {
+		{ "+", add },
+		{ "-", subtract },
+		{ "*", multiply },
+		{ "/", divide },
+		{ "%", modulo },
+		{ ">", greater_than },
+		{ ">=", greater_than_or_eq },
+		{ "<", less_than },
+		{ "<=", less_than_or_eq },
+		{ "=", equals },
+		{ "abs", absolute },
+		{ "cons", cons },
+		{ "car", car },
+		{ "cdr", cdr },
+		{ "expt", exponent },
+		{ "length", length },
+		{ "sin", sine },
+		{ "cos", cosine },
+		{ "tan", tangent },
+		{ "sqrt", square_root },
+		{ "make-vector", make_vector },
+		{ "vector", vector },
+		{ "vector-length", vector_length },
+		{ "vector-ref", vector_ref },
+		{ "vector-set!", vector_set },
+		{ "vector-fill!", vector_fill },
+		{ "vector-copy!", vector_copy },
+		{ "eq?", is_eq },
+		{ "eqv?", is_eqv },
+		{ "equal?", is_equal },
+		{ "string=?", is_string_equal },
+		{ "string-append", string_append },
+		{ "string-length", string_length },
+		{ "make-hash-table", make_hash_table },
+		{ "hash-table-set!", hash_table_set },
+		{ "hash-table-ref", hash_table_ref },
+		{ "hash-table-ref/default", hash_table_ref_default },
+		{ "hash-table-delete!", hash_table_delete },
+		{ "hash-table-exists?", hash_table_exists },
+		{ "hash-table-size", hash_table_size },
+		{ "persistent-vector", persistent_vector },
+		{ "persistent-vector-length", persistent_vector_length },
+		{ "persistent-vector-ref", persistent_vector_ref },
+		{ "persistent-vector-set", persistent_vector_set },
+		{ "persistent-vector-push", persistent_vector_push },
+		{ "persistent-map", persistent_map },
+		{ "persistent-map-count", persistent_map_count },
+		{ "persistent-map-ref", persistent_map_ref },
+		{ "persistent-map-set", persistent_map_set },
+		{ "persistent-map-delete", persistent_map_delete },
+		{ "persistent-map-contains?", persistent_map_contains },
+		{ "pmap", pmap },
+		{ "pfor-each", pfor_each },
+		{ "preduce", preduce },
+		{ "touch", touch },
+		{ "spawn", spawn },
+		{ "yield", yield },
+		{ "run-threads", run_threads },
+		{ "make-channel", make_channel },
+		{ "channel-send!", channel_send },
+		{ "channel-receive", channel_receive },
+		{ "make-pipe", make_pipe },
+		{ "open-file", open_file },
+		{ "fd-read", fd_read },
+		{ "fd-write", fd_write },
+		{ "fd-close", fd_close },
+		{ "place", place },
+		{ "place-send!", place_send },
+		{ "place-receive", place_receive },
+		{ "place-wait", place_wait },
+		{ "call/ec", call_ec },
+		{ "call-with-escape-continuation", call_ec },
+		{ "call/cc", call_ec },
+		{ "call-with-current-continuation", call_ec },
+		{ "raise", raise },
+		{ "raise-continuable", raise_continuable },
+		{ "error", error },
+		{ "error-object?", is_error_object },
+		{ "error-object-message", error_object_message },
+		{ "error-object-irritants", error_object_irritants },
+		{ "with-exception-handler", with_exception_handler },
+		{ "runtime-stats", runtime_stats },
+		{ "memory-stats", memory_stats },
+		{ "flush-output", flush_output },
+	};
+
+	static constexpr std::size_t builtin_count = sizeof(builtin_table) / sizeof(builtin_table[0]);
+
+	// Sparse enough that a seed without collisions turns up after a few hundred attempts at most. The
+	// chance of a seed working falls off with the square of the count, so the index grows faster than it
+	static constexpr std::size_t index_size = 1024;
+
+	static_assert(builtin_count < index_size / 8, "Built-in index is too dense, increase index_size");
+	static_assert(builtin_count < 255, "Built-in positions no longer fit in an index slot");
+
+	/**
+	 * Seeded FNV-1a, the seed is searched for at compile time so that no two built-ins share a slot
+	*/
+	static constexpr std::uint32_t hash_name(std::string_view name, std::uint32_t seed) noexcept
+	{
+		std::uint32_t hash = 2166136261u ^ seed;
+		for (char c : name)
+		{
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 16777619u;
+		}
+		return hash ^ (hash >> 16);
+	}
+
+	struct BuiltinIndex
+	{
+		std::uint32_t seed = 0;
+		std::uint8_t slots[index_size] = {};	// Position in builtin_table plus one, zero marks an empty slot
+	};
+
+	static constexpr BuiltinIndex build_index()
+	{
+		for (std::uint32_t seed = 0; ; seed++)
+		{
+			BuiltinIndex index;
+			index.seed = seed;
+			bool collision = false;
+
+			for (std::size_t i = 0; i < builtin_count && !collision; i++)
+			{
+				auto& slot = index.slots[hash_name(builtin_table[i].name, seed) % index_size];
+				if (slot != 0) collision = true;
+				slot = static_cast<std::uint8_t>(i + 1);
+			}
+			if (!collision) return index;
+		}
+	}
+
+	static constexpr BuiltinIndex builtin_index = build_index();
+
+	const BuiltinEntry* find_builtin(std::string_view name) noexcept
+	{
+		auto slot = builtin_index.slots[hash_name(name, builtin_index.seed) % index_size];
+		if (slot == 0) return nullptr;
+
+		auto entry = &builtin_table[slot - 1];
+		return entry->name == name ? entry : nullptr;
+	}
+
+	Builtin::Builtin(const BuiltinEntry* entry) : VarCopy(Variable::Type::PROCEDURE), entry(entry) {}
+
+	Slot Builtin::call(Interpreter& interp, Span<Slot> args)
+	{
+		SCHEME_INSTRUMENT_CALL(entry->name);
+		return entry->fn(interp, args);
+	}
+
+}
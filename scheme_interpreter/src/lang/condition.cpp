@@ -0,0 +1,192 @@
+#include <lang/condition.hpp>
+#include <lang/instrument.hpp>
+
+namespace environment
+{
+	Condition::Condition(std::string message, std::vector<Slot> irritants) :
+		VarCopy(Variable::Type::CONDITION), state(std::make_shared<State>(State{ std::move(message), std::move(irritants) })) {}
+
+	Slot Condition::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "Condition variable is not callable");
+	}
+
+	namespace builtins
+	{
+		Slot raise(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1) return eval::fail(interp, "Raise procedure expects 1 argument, received: ", args.size());
+			return eval::raise(interp, std::move(args[0]));
+		}
+
+		Slot raise_continuable(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1) return eval::fail(interp, "Raise continuable procedure expects 1 argument, received: ", args.size());
+			return eval::raise(interp, std::move(args[0]), true);
+		}
+
+		Slot error(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() == 0 || args[0].type != Variable::Type::STRING)
+			{
+				return eval::fail(interp, "Error procedure expects a message string followed by any number of irritants");
+			}
+
+			std::vector<Slot> irritants;
+			irritants.reserve(args.size() - 1);
+			for (std::size_t i = 1; i < args.size(); i++) irritants.push_back(std::move(args[i]));
+
+			auto& message = static_cast<String*>(args[0].boxed)->value;
+			return eval::raise(interp, Slot::from_variable(std::make_unique<Condition>(message, std::move(irritants))));
+		}
+
+		Slot is_error_object(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1) return eval::fail(interp, "Error object predicate expects 1 argument, received: ", args.size());
+			return Slot(args[0].type == Variable::Type::CONDITION);
+		}
+
+		Slot error_object_message(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1 || args[0].type != Variable::Type::CONDITION)
+			{
+				return eval::fail(interp, "Error object message procedure expects a condition");
+			}
+			return Slot::from_variable(std::make_unique<String>(static_cast<Condition*>(args[0].boxed)->state->message));
+		}
+
+		Slot error_object_irritants(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1 || args[0].type != Variable::Type::CONDITION)
+			{
+				return eval::fail(interp, "Error object irritants procedure expects a condition");
+			}
+
+			auto& irritants = static_cast<Condition*>(args[0].boxed)->state->irritants;
+			auto result = std::make_unique<Vector>(irritants.size(), Slot());
+			for (std::size_t i = 0; i < irritants.size(); i++) result->set(i, irritants[i]);
+			return Slot::from_variable(std::move(result));
+		}
+
+		Slot with_exception_handler(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2 || args[0].type != Variable::Type::PROCEDURE || args[1].type != Variable::Type::PROCEDURE)
+			{
+				return eval::fail(interp, "With exception handler procedure expects a handler and a thunk");
+			}
+
+			// Restoring the depth rather than popping also drops anything left behind by an escape
+			std::size_t depth = interp.handlers.size();
+			interp.handlers.push_back(std::move(args[0]));
+			Slot result = args[1].boxed->call(interp, Span<Slot>());
+			interp.handlers.resize(depth);
+			return result;
+		}
+	}
+}
+
+namespace eval
+{
+	const std::shared_ptr<EscapePoint> raise_point = std::make_shared<EscapePoint>(EscapePoint{ nullptr });
+
+	void write_uncaught(std::ostream& out, const Slot& value)
+	{
+		if (value.type != Variable::Type::CONDITION)
+		{
+			out << "Uncaught raise: ";
+			write_slot(out, value);
+			return;
+		}
+
+		auto& state = *static_cast<const Condition*>(value.boxed)->state;
+		out << state.message;
+		for (auto& irritant : state.irritants)
+		{
+			out << " ";
+			write_slot(out, irritant);
+		}
+	}
+
+	Slot raise(Interpreter& interp, Slot value, bool continuable)
+	{
+		if (interp.handlers.empty())
+		{
+			write_uncaught(std::cout, value);
+			std::cout << '\n';
+			return Slot();
+		}
+
+		// A guard takes the value once everything inside it has returned
+		if (interp.handlers.back().type == Variable::Type::INVALID)
+		{
+			interp.escape = raise_point;
+			interp.escape_value = std::move(value);
+			return Slot();
+		}
+
+		// The handler runs where the raise happened, but anything it raises goes to the handlers outside it
+		Slot handler = std::move(interp.handlers.back());
+		interp.handlers.pop_back();
+		Slot result = handler.boxed->call(interp, Span<Slot>(&value, 1));
+		if (interp.escape == nullptr && !continuable)
+		{
+			result = fail(interp, "Exception handler returned from a non-continuable raise");
+		}
+		interp.handlers.push_back(std::move(handler));
+		return result;
+	}
+
+	Slot guard(Interpreter& interp, Span<const ASTExpr> args)
+	{
+		SCHEME_INSTRUMENT_CALL("guard");
+
+		bool well_formed = args.size() >= 2 && args[0].type == ASTExpr::Type::LIST && !args[0].children.empty() &&
+			args[0].children[0].type == ASTExpr::Type::ATOM && args[0].children[0].leaf.type == Token::Type::SYMBOL;
+		if (!well_formed) return fail(interp, "Guard expects a variable followed by its clauses, and a body");
+
+		std::size_t depth = interp.handlers.size();
+		interp.handlers.push_back(Slot());
+		Slot result = sequence(interp, Span<const ASTExpr>(args.begin() + 1, args.size() - 1));
+		interp.handlers.resize(depth);
+		if (interp.escape != raise_point) return result;
+
+		interp.escape.reset();
+		Slot raised = std::move(interp.escape_value);
+
+		// Clauses see the locals of the guard along with the raised value
+		Frame frame;
+		if (interp.frame != nullptr) frame.locals = interp.frame->locals;
+		frame.locals.push_back({ &args[0].children[0].leaf.symbol, raised });
+		Frame* caller = interp.frame;
+		interp.frame = &frame;
+
+		auto& clauses = args[0].children;
+		bool accepted = false;
+		result = Slot();
+
+		for (std::size_t i = 1; i < clauses.size() && !accepted && interp.escape == nullptr; i++)
+		{
+			auto& clause = clauses[i];
+			if (clause.type != ASTExpr::Type::LIST || clause.children.empty()) continue;
+
+			auto& test = clause.children[0];
+			Span<const ASTExpr> body(clause.children.data() + 1, clause.children.size() - 1);
+
+			if (test.type == ASTExpr::Type::ATOM && test.leaf.type == Token::Type::SYMBOL && test.leaf.symbol == "else")
+			{
+				accepted = true;
+				result = sequence(interp, body);
+				continue;
+			}
+
+			// Anything other than false accepts the value, and a clause without a body gives back its test
+			Slot tested = eval_slot(interp, &test);
+			accepted = tested.type != Variable::Type::INVALID && !(tested.type == Variable::Type::BOOL && !tested.b_value);
+			if (accepted) result = body.size() == 0 ? std::move(tested) : sequence(interp, body);
+		}
+
+		interp.frame = caller;
+		if (!accepted && interp.escape == nullptr) return raise(interp, std::move(raised));
+		return result;
+	}
+}
@@ -0,0 +1,64 @@
+#include <lang/continuation.hpp>
+#include <lang/condition.hpp>
+#include <lang/green.hpp>
+
+namespace environment
+{
+	/**
+	 * Stack the interpreter is evaluating on, the green thread running or null for its own
+	*/
+	static const void* current_stack(const Interpreter& interp)
+	{
+		if (interp.scheduler == nullptr || interp.scheduler->in_root()) return nullptr;
+		return interp.scheduler->current();
+	}
+
+	Continuation::Continuation(std::shared_ptr<eval::EscapePoint> point) :
+		VarCopy(Variable::Type::PROCEDURE), point(std::move(point)) {}
+
+	Slot Continuation::call(Interpreter& interp, Span<Slot> args)
+	{
+		if (args.size() != 1)
+		{
+			return eval::fail(interp, "Continuation expects 1 argument, received: ", args.size());
+		}
+		if (!point->active)
+		{
+			return eval::fail(interp, "Continuation can only be called while the call that captured it is running");
+		}
+		if (point->stack != current_stack(interp))
+		{
+			return eval::fail(interp, "Continuation can only be called from the thread that captured it");
+		}
+
+		// Every call between here and the capture sees the pending escape and returns without a value
+		interp.escape = point;
+		interp.escape_value = std::move(args[0]);
+		return Slot();
+	}
+
+	namespace builtins
+	{
+		Slot call_ec(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1 || args[0].type != Variable::Type::PROCEDURE)
+			{
+				return eval::fail(interp, "Call with continuation procedure expects a procedure of one argument");
+			}
+
+			auto point = std::make_shared<eval::EscapePoint>();
+			point->stack = current_stack(interp);
+			Slot continuation = Slot::from_variable(std::make_unique<Continuation>(point));
+
+			Slot result = args[0].boxed->call(interp, Span<Slot>(&continuation, 1));
+			point->active = false;
+
+			if (interp.escape == point)
+			{
+				interp.escape.reset();
+				result = std::move(interp.escape_value);
+			}
+			return result;
+		}
+	}
+}
@@ -1,11 +1,37 @@
 #include <lang/env.hpp>
 #include <lang/evaluate.hpp>
+#include <lang/condition.hpp>
+#include <lang/green.hpp>
+#include <lang/hash_table.hpp>
+#include <lang/image.hpp>
+#include <lang/memstats.hpp>
+#include <lang/parallel.hpp>
+#include <lang/persistent.hpp>
+#include <lang/places.hpp>
+#include <lang/region.hpp>
 #include <cassert>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <typeinfo>
 
 namespace environment
 {
 
-	Variable::Variable(Type type) : type(type) {}
+	Variable::Variable(Type type) : type(type)
+	{
+		memstats::variable_created(type);
+	}
+
+	Variable::Variable(const Variable& other) : type(other.type)
+	{
+		memstats::variable_created(type);
+	}
+
+	Variable::~Variable()
+	{
+		memstats::variable_destroyed(type);
+	}
 
 	bool operator== (const Variable& lhs, const Variable& rhs) noexcept
 	{
@@ -22,748 +48,1103 @@ namespace environment
 		return false;
 	}
 
-	Int::Int(int value) : VarCopy(Variable::Type::INT), value(value) {}
-
-	std::unique_ptr<Variable> Int::call(std::vector<ASTExpr>* args)
+	Slot::Slot(const Slot& other) : type(other.type)
 	{
-		std::cout << "Integer variable is not callable" << std::endl;
-		return nullptr;
+		if (other.is_boxed()) boxed = other.boxed->copy().release();
+		else boxed = other.boxed;	// Copies the inline value whichever member is active
 	}
 
-	Float::Float(double value) : VarCopy(Variable::Type::FLOAT), value(value) {}
-
-	std::unique_ptr<Variable> Float::call(std::vector<ASTExpr>* args)
+	Slot& Slot::operator= (const Slot& other)
 	{
-		std::cout << "Float variable is not callable" << std::endl;
-		return nullptr;
-	}
+		if (this == &other) return *this;
 
-	String::String(std::string value) : VarCopy(Variable::Type::STRING), value(value) {}
+		this->~Slot();
+		new (this) Slot(other);
+		return *this;
+	}
 
-	std::unique_ptr<Variable> String::call(std::vector<ASTExpr>* args)
+	Slot Slot::from_variable(const Variable& var)
 	{
-		std::cout << "String variable is not callable" << std::endl;
-		return nullptr;
+		switch (var.type)
+		{
+		case Variable::Type::INT:
+			return Slot(static_cast<const Int&>(var).value);
+		case Variable::Type::FLOAT:
+			return Slot(static_cast<const Float&>(var).value);
+		case Variable::Type::BOOL:
+			return Slot(static_cast<const Bool&>(var).value);
+		default:
+			return from_variable(var.copy());
+		}
 	}
 
-	Bool::Bool(bool value) : VarCopy(Variable::Type::BOOL), value(value) {}
+	Slot Slot::from_variable(std::unique_ptr<Variable> var)
+	{
+		if (var == nullptr) return Slot();
 
-	std::unique_ptr<Variable> Bool::call(std::vector<ASTExpr>* args)
+		switch (var->type)
+		{
+		case Variable::Type::INT:
+			return Slot(static_cast<Int*>(var.get())->value);
+		case Variable::Type::FLOAT:
+			return Slot(static_cast<Float*>(var.get())->value);
+		case Variable::Type::BOOL:
+			return Slot(static_cast<Bool*>(var.get())->value);
+		default:
+		{
+			Slot slot;
+			slot.type = var->type;
+			slot.boxed = var.release();
+			return slot;
+		}
+		}
+	}
+
+	std::unique_ptr<Variable> Slot::to_variable() const
 	{
-		std::cout << "Boolean variable is not callable" << std::endl;
-		return nullptr;
+		switch (type)
+		{
+		case Variable::Type::INVALID:
+			return nullptr;
+		case Variable::Type::INT:
+			return std::make_unique<Int>(i_value);
+		case Variable::Type::FLOAT:
+			return std::make_unique<Float>(f_value);
+		case Variable::Type::BOOL:
+			return std::make_unique<Bool>(b_value);
+		default:
+			return boxed->copy();
+		}
 	}
 
-	Symbol::Symbol(std::string value) : VarCopy(Variable::Type::SYMBOL), value(value) {}
+	std::unique_ptr<Variable> Slot::into_variable()
+	{
+		switch (type)
+		{
+		case Variable::Type::INVALID:
+			return nullptr;
+		case Variable::Type::INT:
+			return std::make_unique<Int>(i_value);
+		case Variable::Type::FLOAT:
+			return std::make_unique<Float>(f_value);
+		case Variable::Type::BOOL:
+			return std::make_unique<Bool>(b_value);
+		default:
+		{
+			std::unique_ptr<Variable> var(boxed);
+			type = Variable::Type::INVALID;
+			boxed = nullptr;
+			return var;
+		}
+		}
+	}
 
-	std::unique_ptr<Variable> Symbol::call(std::vector<ASTExpr>* args)
+	void ArgFrame::push_back(Slot value)
 	{
-		std::cout << "Symbol variable is not callable" << std::endl;
-		return nullptr;
+		if (count < inline_capacity)
+		{
+			inline_slots[count++] = std::move(value);
+			return;
+		}
+
+		if (overflow.empty())
+		{
+			// Spill the inline arguments so the whole frame stays contiguous
+			overflow.reserve(inline_capacity * 2);
+			for (auto& slot : inline_slots) overflow.push_back(std::move(slot));
+		}
+		overflow.push_back(std::move(value));
+		count++;
 	}
 
-	List::List(std::vector<std::unique_ptr<Variable>> values) : Variable(Variable::Type::LIST), values(std::move(values)) {}
+	std::size_t ArgFrame::size() const noexcept
+	{
+		return count;
+	}
 
-	std::unique_ptr<Variable> List::call(std::vector<ASTExpr>* args)
+	Span<Slot> ArgFrame::span() noexcept
 	{
-		std::cout << "List variable is not callable" << std::endl;
-		return nullptr;
+		if (overflow.empty()) return Span<Slot>(inline_slots, count);
+		return Span<Slot>(overflow.data(), count);
 	}
 
-	std::vector<std::unique_ptr<Variable>> get_variable_args(std::vector<ASTExpr>* args)
+	/**
+	 * Vectors being compared by one call to `slots_equivalent`. Past a few levels every pair of buffers is
+	 * recorded, and a pair met again is taken to be equal: it is either still being compared further up,
+	 * which is how a cycle shows, or it already compared equal, since any difference ends the comparison
+	*/
+	struct Comparison
 	{
-		std::vector<std::unique_ptr<Variable>> var_args;
-		for (auto& arg : *args)
-		{
-			var_args.push_back(std::move(eval::eval_expr(&arg)));
-		}
-		return var_args;
+		static constexpr unsigned untracked_depth = 32;		// Nesting compared before pairs are recorded, enough for any value without cycles
+
+		unsigned depth = 0;
+		std::set<std::pair<const void*, const void*>> seen;
+	};
+
+	static bool equivalent(const Slot& lhs, const Slot& rhs, Equivalence equivalence, Comparison& comparison);
+
+	bool slots_equivalent(const Slot& lhs, const Slot& rhs, Equivalence equivalence)
+	{
+		Comparison comparison;
+		return equivalent(lhs, rhs, equivalence, comparison);
 	}
 
-	std::string get_result_type(const std::vector<std::unique_ptr<Variable>>& args)
+	static bool equivalent(const Slot& lhs, const Slot& rhs, Equivalence equivalence, Comparison& comparison)
 	{
-		std::string res_type{""};
+		if (lhs.type != rhs.type) return false;
 
-		for (int i = 0; i < args.size(); i++)
+		switch (lhs.type)
 		{
-			if (args[i]->type == Variable::Type::INT)
-			{
-				if (res_type != "float") res_type = "int";
-			}
-			else if (args[i]->type == Variable::Type::FLOAT)
+		case Variable::Type::INVALID:
+			return true;
+		case Variable::Type::INT:
+			return lhs.i_value == rhs.i_value;
+		case Variable::Type::FLOAT:
+			// Compared by bit pattern as R7RS eqv? does, so 0.0 and -0.0 differ and a NaN matches itself,
+			// which keeps this in step with hash_slot
+			return std::memcmp(&lhs.f_value, &rhs.f_value, sizeof(lhs.f_value)) == 0;
+		case Variable::Type::BOOL:
+			return lhs.b_value == rhs.b_value;
+		case Variable::Type::STRING:
+			return static_cast<const String*>(lhs.boxed)->value == static_cast<const String*>(rhs.boxed)->value;
+		case Variable::Type::SYMBOL:
+			return static_cast<const Symbol*>(lhs.boxed)->value == static_cast<const Symbol*>(rhs.boxed)->value;
+		case Variable::Type::VECTOR:
+		{
+			auto& lhs_buffer = static_cast<const Vector*>(lhs.boxed)->buffer;
+			auto& rhs_buffer = static_cast<const Vector*>(rhs.boxed)->buffer;
+
+			if (lhs_buffer == rhs_buffer) return true;
+			if (equivalence != Equivalence::EQUAL || lhs_buffer->slots.size() != rhs_buffer->slots.size()) return false;
+			if (comparison.depth >= Comparison::untracked_depth && !comparison.seen.emplace(lhs_buffer.get(), rhs_buffer.get()).second) return true;
+
+			comparison.depth++;
+			bool equal = true;
+			for (size_t i = 0; i < lhs_buffer->slots.size() && equal; i++)
 			{
-				res_type = "float";
+				equal = equivalent(lhs_buffer->slots[i], rhs_buffer->slots[i], equivalence, comparison);
 			}
-			else
+			comparison.depth--;
+			return equal;
+		}
+		case Variable::Type::HASH_TABLE:
+			return static_cast<const HashTable*>(lhs.boxed)->table == static_cast<const HashTable*>(rhs.boxed)->table;
+		case Variable::Type::PERSISTENT_VECTOR:
+		{
+			auto& lhs_vec = *static_cast<const PersistentVector*>(lhs.boxed);
+			auto& rhs_vec = *static_cast<const PersistentVector*>(rhs.boxed);
+
+			if (lhs_vec.root == rhs_vec.root && lhs_vec.tail == rhs_vec.tail) return true;
+			if (equivalence != Equivalence::EQUAL || lhs_vec.size() != rhs_vec.size()) return false;
+
+			for (size_t i = 0; i < lhs_vec.size(); i++)
 			{
-				return get_var_type_as_string(*args[i].get());
+				if (!equivalent(lhs_vec.at(i), rhs_vec.at(i), equivalence, comparison)) return false;
 			}
+			return true;
+		}
+		case Variable::Type::PERSISTENT_MAP:
+		{
+			auto& lhs_map = *static_cast<const PersistentMap*>(lhs.boxed);
+			auto& rhs_map = *static_cast<const PersistentMap*>(rhs.boxed);
+
+			if (lhs_map.root == rhs_map.root) return true;
+			if (equivalence != Equivalence::EQUAL || lhs_map.size() != rhs_map.size()) return false;
+
+			bool equal = true;
+			lhs_map.for_each([&](const Slot& key, const Slot& value) {
+				auto other = rhs_map.find(key);
+				if (equal && (other == nullptr || !equivalent(value, *other, equivalence, comparison))) equal = false;
+			});
+			return equal;
+		}
+		case Variable::Type::FUTURE:
+			return static_cast<const Future*>(lhs.boxed)->state == static_cast<const Future*>(rhs.boxed)->state;
+		case Variable::Type::CHANNEL:
+			return static_cast<const Channel*>(lhs.boxed)->state == static_cast<const Channel*>(rhs.boxed)->state;
+		case Variable::Type::PLACE_CHANNEL:
+			return static_cast<const PlaceChannel*>(lhs.boxed)->in == static_cast<const PlaceChannel*>(rhs.boxed)->in;
+		case Variable::Type::CONDITION:
+			return static_cast<const Condition*>(lhs.boxed)->state == static_cast<const Condition*>(rhs.boxed)->state;
+		case Variable::Type::PROCEDURE:
+		{
+			// Built-ins are copied each time they are looked up, so they compare by registry entry
+			auto lhs_builtin = dynamic_cast<const Builtin*>(lhs.boxed);
+			auto rhs_builtin = dynamic_cast<const Builtin*>(rhs.boxed);
+			if (lhs_builtin != nullptr && rhs_builtin != nullptr) return lhs_builtin->entry == rhs_builtin->entry;
+			return lhs.boxed == rhs.boxed;
+		}
+		default:
+			return typeid(*lhs.boxed) == typeid(*rhs.boxed);
 		}
-		return res_type;
 	}
 
-	std::string get_var_type_as_string(const Variable& var)
+	static std::size_t mix_hash(std::uint64_t x)
 	{
-		switch (var.type)
+		// Finalizer from splitmix64, spreads entropy into the low bits used for table indexing
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9ULL;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111ebULL;
+		x ^= x >> 31;
+		return static_cast<std::size_t>(x);
+	}
+
+	/**
+	 * Number of containers whose elements one call to `hash_slot` looks at. Any further ones hash by
+	 * their size alone, which bounds the work for cycles and shared elements. Elements are visited in a
+	 * fixed order, so equal values still hash the same
+	*/
+	constexpr std::size_t hash_budget = 256;
+
+	static std::size_t hash_bounded(const Slot& slot, Equivalence equivalence, std::size_t& budget);
+
+	std::size_t hash_slot(const Slot& slot, Equivalence equivalence)
+	{
+		std::size_t budget = hash_budget;
+		return hash_bounded(slot, equivalence, budget);
+	}
+
+	static std::size_t hash_bounded(const Slot& slot, Equivalence equivalence, std::size_t& budget)
+	{
+		std::uint64_t type_bits = static_cast<std::uint64_t>(slot.type) << 56;
+
+		switch (slot.type)
 		{
-		case Variable::Type::PROCEDURE:
-			return "Procedure";
-		case Variable::Type::BOOL:
-			return "Boolean";
-		case Variable::Type::FLOAT:
-			return "Float";
+		case Variable::Type::INVALID:
+			return mix_hash(type_bits);
 		case Variable::Type::INT:
-			return "Int";
+			return mix_hash(type_bits ^ static_cast<std::uint32_t>(slot.i_value));
+		case Variable::Type::FLOAT:
+		{
+			std::uint64_t bits;
+			std::memcpy(&bits, &slot.f_value, sizeof(bits));
+			return mix_hash(type_bits ^ bits);
+		}
+		case Variable::Type::BOOL:
+			return mix_hash(type_bits ^ static_cast<std::uint64_t>(slot.b_value));
 		case Variable::Type::STRING:
-			return "String";
-		case Variable::Type::INVALID:
-			return "Invalid";
-		case Variable::Type::DEFINITION:
-			return "Definition";
-		case Variable::Type::CONDITIONAL:
-			return "Conditional";
+			return mix_hash(type_bits ^ std::hash<std::string>()(static_cast<const String*>(slot.boxed)->value));
 		case Variable::Type::SYMBOL:
-			return "Symbol";
+			return mix_hash(type_bits ^ std::hash<std::string>()(static_cast<const Symbol*>(slot.boxed)->value));
+		case Variable::Type::VECTOR:
+		{
+			auto& buffer = static_cast<const Vector*>(slot.boxed)->buffer;
+			if (equivalence != Equivalence::EQUAL) return mix_hash(reinterpret_cast<std::uintptr_t>(buffer.get()));
+
+			std::uint64_t res = type_bits ^ buffer->slots.size();
+			if (budget == 0) return mix_hash(res);
+			budget--;
+			for (auto& elem : buffer->slots) res = res * 31 + hash_bounded(elem, equivalence, budget);
+			return mix_hash(res);
+		}
+		case Variable::Type::HASH_TABLE:
+			return mix_hash(reinterpret_cast<std::uintptr_t>(static_cast<const HashTable*>(slot.boxed)->table.get()));
+		case Variable::Type::PERSISTENT_VECTOR:
+		{
+			auto& vec = *static_cast<const PersistentVector*>(slot.boxed);
+			if (equivalence != Equivalence::EQUAL) return mix_hash(reinterpret_cast<std::uintptr_t>(vec.root.get()) ^ reinterpret_cast<std::uintptr_t>(vec.tail.get()));
+
+			std::uint64_t res = type_bits ^ vec.size();
+			if (budget == 0) return mix_hash(res);
+			budget--;
+			for (size_t i = 0; i < vec.size(); i++) res = res * 31 + hash_bounded(vec.at(i), equivalence, budget);
+			return mix_hash(res);
+		}
+		case Variable::Type::PERSISTENT_MAP:
+		{
+			auto& map = *static_cast<const PersistentMap*>(slot.boxed);
+			if (equivalence != Equivalence::EQUAL) return mix_hash(reinterpret_cast<std::uintptr_t>(map.root.get()));
+
+			// Summing the pair hashes keeps the result independent of the order entries are visited in, and
+			// so does giving each pair the same share of the budget
+			std::uint64_t res = type_bits ^ map.size();
+			if (budget == 0 || map.size() == 0) return mix_hash(res);
+			budget--;
+			std::size_t share = budget / map.size();
+			map.for_each([&](const Slot& key, const Slot& value) {
+				std::size_t remaining = share;
+				res += hash_bounded(key, equivalence, remaining) * 31;
+				res += hash_bounded(value, equivalence, remaining);
+			});
+			budget -= share * map.size();
+			return mix_hash(res);
+		}
+		case Variable::Type::FUTURE:
+			return mix_hash(reinterpret_cast<std::uintptr_t>(static_cast<const Future*>(slot.boxed)->state.get()));
+		case Variable::Type::CHANNEL:
+			return mix_hash(reinterpret_cast<std::uintptr_t>(static_cast<const Channel*>(slot.boxed)->state.get()));
+		case Variable::Type::PLACE_CHANNEL:
+			return mix_hash(reinterpret_cast<std::uintptr_t>(static_cast<const PlaceChannel*>(slot.boxed)->in.get()));
+		case Variable::Type::CONDITION:
+			return mix_hash(reinterpret_cast<std::uintptr_t>(static_cast<const Condition*>(slot.boxed)->state.get()));
+		case Variable::Type::PROCEDURE:
+		{
+			auto builtin = dynamic_cast<const Builtin*>(slot.boxed);
+			if (builtin != nullptr) return mix_hash(reinterpret_cast<std::uintptr_t>(builtin->entry));
+			return mix_hash(reinterpret_cast<std::uintptr_t>(slot.boxed));
+		}
 		default:
-			return "Unknown";
+			return mix_hash(type_bits ^ typeid(*slot.boxed).hash_code());
 		}
 	}
 
-	Add::Add() : VarCopy(Variable::Type::PROCEDURE) {}
+	Freeze::~Freeze()
+	{
+		release();
+	}
 
-	std::unique_ptr<Variable> Add::call(std::vector<ASTExpr>* args)
+	void Freeze::add(const Variable& var, const std::function<void(const Closure&)>& on_closure)
 	{
-		if ((*args).size() < 2)
+		// A container counted here keeps its storage alive until the freeze is released
+		auto count = [&](auto& owner, std::atomic<std::uint32_t>& frozen) {
+			if (!seen.insert(&frozen).second) return false;
+			frozen.fetch_add(1, std::memory_order_relaxed);
+			counts.emplace_back(owner, &frozen);
+			return true;
+		};
+
+		switch (var.type)
 		{
-			std::cout << "Add procedure expects at least 2 arguments, received: " << (*args).size() << std::endl;
-			return nullptr;
+		case Variable::Type::VECTOR:
+		{
+			auto& buffer = static_cast<const Vector&>(var).buffer;
+			if (!count(buffer, buffer->frozen)) return;
+			for (auto& elem : buffer->slots) add_slot(elem, on_closure);
+			return;
 		}
-
-		auto var_args = get_variable_args(args);
-		auto res_type = get_result_type(var_args);
-		
-		if (res_type == "int")
-		{ 
-			int res{ 0 };
-			for (size_t i = 0; i < var_args.size(); i++)
+		case Variable::Type::HASH_TABLE:
+		{
+			auto& table = static_cast<const HashTable&>(var).table;
+			if (!count(table, table->frozen)) return;
+			for (auto& entry : table->entries)
 			{
-				res += static_cast<Int*>(var_args[i].get())->value;
+				if (entry.probe == 0) continue;
+				add_slot(entry.key, on_closure);
+				add_slot(entry.value, on_closure);
 			}
-			return std::make_unique<Int>(res);
+			return;
 		}
-		else if (res_type == "float")
+		case Variable::Type::PERSISTENT_VECTOR:
 		{
-			double res{ 0 };
-			for (size_t i = 0; i < var_args.size(); i++)
-			{
-				if (var_args[i]->type == Type::INT) res += static_cast<Int*>(var_args[i].get())->value;
-				else if (var_args[i]->type == Type::FLOAT) res += static_cast<Float*>(var_args[i].get())->value;
-			}
-			return std::make_unique<Float>(res);
+			auto& vec = static_cast<const PersistentVector&>(var);
+			for (std::size_t i = 0; i < vec.size(); i++) add_slot(vec.at(i), on_closure);
+			return;
+		}
+		case Variable::Type::PERSISTENT_MAP:
+			static_cast<const PersistentMap&>(var).for_each([&](const Slot& key, const Slot& value) {
+				add_slot(key, on_closure);
+				add_slot(value, on_closure);
+			});
+			return;
+		case Variable::Type::PROCEDURE:
+		{
+			// Calls copy the captured values into the callee's locals, sharing their containers
+			auto closure = dynamic_cast<const Closure*>(&var);
+			if (closure == nullptr) return;
+			for (auto& binding : closure->captured) add_slot(binding.value, on_closure);
+			if (on_closure) on_closure(*closure);
+			return;
+		}
+		default:
+			return;
 		}
-		std::cout << "Invalid argument to add procedure, expected int or float and received: " << res_type << std::endl;
-		return nullptr;
 	}
 
-	Subtract::Subtract() : VarCopy(Variable::Type::PROCEDURE) {}
+	void Freeze::add_slot(const Slot& slot, const std::function<void(const Closure&)>& on_closure)
+	{
+		if (slot.is_boxed()) add(*slot.boxed, on_closure);
+	}
 
-	std::unique_ptr<Variable> Subtract::call(std::vector<ASTExpr>* args)
+	void Freeze::add(const Environment& env)
 	{
-		if ((*args).size() < 2)
+		for (auto layer = &env; layer != nullptr && layer->frozen == nullptr; layer = layer->parent.get())
 		{
-			std::cout << "Subtract procedure expects at least 2 arguments, received: " << (*args).size() << std::endl;
-			return nullptr;
+			for (auto& entry : layer->env_map) add(*entry.second);
+			if (layer->image != nullptr) layer->image->freeze();
 		}
+	}
 
-		auto var_args = get_variable_args(args);
-		auto res_type = get_result_type(var_args);
-
-		if (res_type == "int")
-		{
-			int res = static_cast<Int*>(var_args[0].get())->value;
-			for (size_t i = 1; i < var_args.size(); i++)
-			{
-				res -= static_cast<Int*>(var_args[i].get())->value;
-			}
-			return std::make_unique<Int>(res);
-		}
-		else if (res_type == "float")
-		{
+	void Freeze::release()
+	{
+		// Pairs with the acquire of the mutators, so reads made while frozen finish before any write
+		for (auto& frozen : counts) frozen->fetch_sub(1, std::memory_order_release);
+		counts.clear();
+		seen.clear();
+	}
 
-			double res{ 0 };
-			if (var_args[0]->type == Type::INT) res = static_cast<Int*>(var_args[0].get())->value;
-			else if (var_args[0]->type == Type::FLOAT) res = static_cast<Float*>(var_args[0].get())->value;
+	Int::Int(int value) : VarCopy(Variable::Type::INT), value(value) {}
 
-			for (size_t i = 1; i < var_args.size(); i++)
-			{
-				if (var_args[i]->type == Type::INT) res -= static_cast<Int*>(var_args[i].get())->value;
-				else if (var_args[i]->type == Type::FLOAT) res -= static_cast<Float*>(var_args[i].get())->value;
-			}
-			return std::make_unique<Float>(res);
-		}
-		std::cout << "Invalid argument to subtract procedure, expected int or float and received: " << res_type << std::endl;
-		return nullptr;
+	Slot Int::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "Integer variable is not callable");
 	}
 
-	Multiply::Multiply() : VarCopy(Variable::Type::PROCEDURE) {}
+	Float::Float(double value) : VarCopy(Variable::Type::FLOAT), value(value) {}
 
-	std::unique_ptr<Variable> Multiply::call(std::vector<ASTExpr>* args)
+	Slot Float::call(Interpreter& interp, Span<Slot> args)
 	{
-		if ((*args).size() < 2)
-		{
-			std::cout << "Multipy procedure expects at least 2 arguments, received: " << (*args).size() << std::endl;
-			return nullptr;
-		}
+		return eval::fail(interp, "Float variable is not callable");
+	}
 
-		auto var_args = get_variable_args(args);
-		auto res_type = get_result_type(var_args);
+	String::String(std::string value) : VarCopy(Variable::Type::STRING), value(value) {}
 
-		if (res_type == "int")
-		{
-			int res = static_cast<Int*>(var_args[0].get())->value;
-			for (size_t i = 1; i < var_args.size(); i++)
-			{
-				res *= static_cast<Int*>(var_args[i].get())->value;
-			}
-			return std::make_unique<Int>(res);
-		}
-		else if (res_type == "float")
-		{
+	Slot String::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "String variable is not callable");
+	}
 
-			double res{ 0 };
-			if (var_args[0]->type == Type::INT) res = static_cast<Int*>(var_args[0].get())->value;
-			else if (var_args[0]->type == Type::FLOAT) res = static_cast<Float*>(var_args[0].get())->value;
+	Bool::Bool(bool value) : VarCopy(Variable::Type::BOOL), value(value) {}
 
-			for (size_t i = 1; i < var_args.size(); i++)
-			{
-				if (var_args[i]->type == Type::INT) res *= static_cast<Int*>(var_args[i].get())->value;
-				else if (var_args[i]->type == Type::FLOAT) res *= static_cast<Float*>(var_args[i].get())->value;
-			}
-			return std::make_unique<Float>(res);
-		}
-		std::cout << "Invalid argument to multiply procedure, expected int or float and received: " << res_type << std::endl;
-		return nullptr;
+	Slot Bool::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "Boolean variable is not callable");
 	}
 
-	Divide::Divide() : VarCopy(Variable::Type::PROCEDURE) {}
+	Symbol::Symbol(std::string value) : VarCopy(Variable::Type::SYMBOL), value(value) {}
 
-	std::unique_ptr<Variable> Divide::call(std::vector<ASTExpr>* args)
+	Slot Symbol::call(Interpreter& interp, Span<Slot> args)
 	{
-		if ((*args).size() < 2)
-		{
-			std::cout << "Divide procedure expects at least 2 arguments, received: " << (*args).size() << std::endl;
-			return nullptr;
-		}
+		return eval::fail(interp, "Symbol variable is not callable");
+	}
 
-		auto var_args = get_variable_args(args);
-		auto res_type = get_result_type(var_args);
+	List::List(std::vector<std::unique_ptr<Variable>> values) : Variable(Variable::Type::LIST), values(std::move(values)) {}
 
-		if (res_type == "int")
-		{
-			int res = static_cast<Int*>(var_args[0].get())->value;
-			for (size_t i = 1; i < var_args.size(); i++)
-			{
-				res /= static_cast<Int*>(var_args[i].get())->value;
-			}
-			return std::make_unique<Int>(res);
-		}
-		else if (res_type == "float")
-		{
+	Slot List::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "List variable is not callable");
+	}
+	Vector::Vector(std::size_t size, const Slot& fill) : VarCopy(Variable::Type::VECTOR), buffer(std::make_shared<Buffer>())
+	{
+		buffer->outlives_form.store(!region::active(), std::memory_order_relaxed);
+		buffer->slots.assign(size, fill);
+		if (fill.is_boxed()) buffer->boxed_count = size;
+	}
 
-			double res{ 0 };
-			if (var_args[0]->type == Type::INT) res = static_cast<Int*>(var_args[0].get())->value;
-			else if (var_args[0]->type == Type::FLOAT) res = static_cast<Float*>(var_args[0].get())->value;
+	std::size_t Vector::size() const noexcept
+	{
+		return buffer->slots.size();
+	}
 
-			for (size_t i = 1; i < var_args.size(); i++)
-			{
-				if (var_args[i]->type == Type::INT) res /= static_cast<Int*>(var_args[i].get())->value;
-				else if (var_args[i]->type == Type::FLOAT) res /= static_cast<Float*>(var_args[i].get())->value;
-			}
-			return std::make_unique<Float>(res);
-		}
-		std::cout << "Invalid argument to divide procedure, expected int or float and received: " << res_type << std::endl;
-		return nullptr;
+	const Slot& Vector::at(std::size_t idx) const noexcept
+	{
+		return buffer->slots[idx];
 	}
 
-	Mod::Mod() : VarCopy(Variable::Type::PROCEDURE) {}
+	void Vector::set(std::size_t idx, Slot value)
+	{
+		Slot& slot = buffer->slots[idx];
+		buffer->boxed_count += static_cast<std::size_t>(value.is_boxed()) - static_cast<std::size_t>(slot.is_boxed());
+		slot = std::move(value);
+	}
+
+	void Vector::fill(const Slot& value, std::size_t start, std::size_t end)
+	{
+		for (std::size_t i = start; i < end; i++) set(i, value);
+	}
 
-	std::unique_ptr<Variable> Mod::call(std::vector<ASTExpr>* args)
+	void Vector::copy_from(std::size_t at, const Vector& from, std::size_t start, std::size_t count)
 	{
-		if ((*args).size() < 2)
+		if (count == 0) return;
+
+		Slot* dst = buffer->slots.data() + at;
+		const Slot* src = from.buffer->slots.data() + start;
+
+		if (buffer->boxed_count == 0 && from.buffer->boxed_count == 0)
 		{
-			std::cout << "Modulo procedure expects at least 2 arguments, received: " << (*args).size() << std::endl;
-			return nullptr;
+			// Inline values own no memory, so the whole range can be moved in one go
+			std::memmove(static_cast<void*>(dst), static_cast<const void*>(src), count * sizeof(Slot));
+			return;
 		}
-		
-		auto var_args = get_variable_args(args);
-		auto res_type = get_result_type(var_args);
 
-		if (res_type == "int")
+		// Boxed values must be deep copied, walking in the direction that keeps overlapping ranges intact
+		if (dst < src)
 		{
-			int res = static_cast<Int*>(var_args[0].get())->value;
-			for (size_t i = 1; i < var_args.size(); i++)
-			{
-				res %= static_cast<Int*>(var_args[i].get())->value;
-			}
-			return std::make_unique<Int>(res);
+			for (std::size_t i = 0; i < count; i++) set(at + i, src[i]);
 		}
-		else if (res_type == "float")
+		else if (dst > src)
 		{
-
-			double res{ 0 };
-			if (var_args[0]->type == Type::INT) res = static_cast<Int*>(var_args[0].get())->value;
-			else if (var_args[0]->type == Type::FLOAT) res = static_cast<Float*>(var_args[0].get())->value;
-
-			for (size_t i = 1; i < var_args.size(); i++)
-			{
-				if (var_args[i]->type == Type::INT) res = fmod(res, static_cast<Int*>(var_args[i].get())->value);
-				else if (var_args[i]->type == Type::FLOAT) res = fmod(res, static_cast<Float*>(var_args[i].get())->value);
-			}
-			return std::make_unique<Float>(res);
+			for (std::size_t i = count; i > 0; i--) set(at + i - 1, src[i - 1]);
 		}
-		std::cout << "Invalid argument to modulo procedure, expected int or float and received: " << res_type << std::endl;
-		return nullptr;
 	}
 
-	Exponent::Exponent() : VarCopy(Variable::Type::PROCEDURE) {}
-
-	std::unique_ptr<Variable> Exponent::call(std::vector<ASTExpr>* args)
+	Slot Vector::call(Interpreter& interp, Span<Slot> args)
 	{
-		if ((*args).size() < 2)
-		{
-			std::cout << "Exponent procedure expects at least 2 arguments, received: " << (*args).size() << std::endl;
-			return nullptr;
-		}
+		return eval::fail(interp, "Vector variable is not callable");
+	}
 
-		auto var_args = get_variable_args(args);
-		auto res_type = get_result_type(var_args);
+	Variable::Type get_result_type(Span<Slot> args)
+	{
+		Variable::Type res_type = Variable::Type::INVALID;
 
-		if (res_type == "int")
+		for (auto& arg : args)
 		{
-			int res = static_cast<Int*>(var_args[0].get())->value;
-			for (size_t i = 1; i < var_args.size(); i++)
+			if (arg.type == Variable::Type::INT)
 			{
-				res = pow(res, static_cast<Int*>(var_args[i].get())->value);
+				if (res_type != Variable::Type::FLOAT) res_type = Variable::Type::INT;
 			}
-			return std::make_unique<Int>(res);
-		}
-		else if (res_type == "float")
-		{
-
-			double res{ 0 };
-			if (var_args[0]->type == Type::INT) res = static_cast<Int*>(var_args[0].get())->value;
-			else if (var_args[0]->type == Type::FLOAT) res = static_cast<Float*>(var_args[0].get())->value;
-
-			for (size_t i = 1; i < var_args.size(); i++)
+			else if (arg.type == Variable::Type::FLOAT)
 			{
-				if (var_args[i]->type == Type::INT) res = pow(res, static_cast<Int*>(var_args[i].get())->value);
-				else if (var_args[i]->type == Type::FLOAT) res = pow(res, static_cast<Float*>(var_args[i].get())->value);
+				res_type = Variable::Type::FLOAT;
+			}
+			else
+			{
+				return arg.type;
 			}
-			std::cout << "Invalid argument to exponent procedure, expected int or float and received: " << res_type << std::endl;
-			return std::make_unique<Float>(res);
 		}
-		return nullptr;
+		return res_type;
 	}
 
-	Absolute::Absolute() : VarCopy(Variable::Type::PROCEDURE) {}
+	std::string get_var_type_as_string(const Variable& var)
+	{
+		return get_type_as_string(var.type);
+	}
 
-	std::unique_ptr<Variable> Absolute::call(std::vector<ASTExpr>* args)
+	std::string get_type_as_string(Variable::Type type)
 	{
-		if ((*args).size() != 1)
+		switch (type)
 		{
-			std::cout << "Absolute procedure expects one argument" << std::endl;
-			return nullptr;
+		case Variable::Type::PROCEDURE:
+			return "Procedure";
+		case Variable::Type::BOOL:
+			return "Boolean";
+		case Variable::Type::FLOAT:
+			return "Float";
+		case Variable::Type::INT:
+			return "Int";
+		case Variable::Type::STRING:
+			return "String";
+		case Variable::Type::INVALID:
+			return "Invalid";
+		case Variable::Type::DEFINITION:
+			return "Definition";
+		case Variable::Type::CONDITIONAL:
+			return "Conditional";
+		case Variable::Type::SYMBOL:
+			return "Symbol";
+		case Variable::Type::VECTOR:
+			return "Vector";
+		case Variable::Type::HASH_TABLE:
+			return "Hash table";
+		case Variable::Type::PERSISTENT_VECTOR:
+			return "Persistent vector";
+		case Variable::Type::PERSISTENT_MAP:
+			return "Persistent map";
+		case Variable::Type::FUTURE:
+			return "Future";
+		case Variable::Type::CHANNEL:
+			return "Channel";
+		case Variable::Type::PLACE_CHANNEL:
+			return "Place channel";
+		case Variable::Type::CONDITION:
+			return "Condition";
+		default:
+			return "Unknown";
 		}
-
-		auto arg = eval::eval_expr(&(*args)[0]);
-
-		if (arg.get()->type == Type::INT) return std::make_unique<Int>(abs(static_cast<Int*>(arg.get())->value));
-		else if (arg.get()->type == Type::FLOAT) return std::make_unique<Float>(abs(static_cast<Float*>(arg.get())->value));
-
-		std::cout << "Invalid argument: Absolute procedure expects a number" << std::endl;
-		return nullptr;
 	}
 
-	GreaterThan::GreaterThan() : VarCopy(Variable::Type::PROCEDURE) {}
+	/**
+	 * Reads a numeric argument as a double
+	*/
+	static double number_value(const Slot& slot)
+	{
+		return slot.type == Variable::Type::INT ? slot.i_value : slot.f_value;
+	}
 
-	std::unique_ptr<Variable> GreaterThan::call(std::vector<ASTExpr>* args)
+	/**
+	 * Folds the arguments of an arithmetic procedure from left to right
+	 *
+	 * @param args: operands, at least two are required
+	 * @param name: name of the procedure used in error messages
+	 * @param int_op: combines two integers when every operand is an integer
+	 * @param float_op: combines two doubles when at least one operand is a float
+	 * @returns the folded value, or an invalid slot if an operand was not a number
+	*/
+	template<typename IntOp, typename FloatOp>
+	static Slot fold_numbers(Interpreter& interp, Span<Slot> args, const char* name, IntOp int_op, FloatOp float_op)
 	{
-		if ((*args).size() != 2)
+		if (args.size() < 2)
 		{
-			std::cout << "Greater than procedure expects two arguments" << std::endl;
-			return nullptr;
+			return eval::fail(interp, name, " procedure expects at least 2 arguments, received: ", args.size());
 		}
 
-		auto arg0 = eval::eval_expr(&(*args)[0]);
-		auto arg1 = eval::eval_expr(&(*args)[1]);
+		auto res_type = get_result_type(args);
 
-		if (arg0.get()->type == Type::PROCEDURE || arg1.get()->type == Type::PROCEDURE)
+		if (res_type == Variable::Type::INT)
 		{
-			std::cout << "Greater than procedure does not accept procedure as an argument" << std::endl;
-			return nullptr;
+			int res = args[0].i_value;
+			for (std::size_t i = 1; i < args.size(); i++) res = int_op(res, args[i].i_value);
+			return Slot(res);
 		}
-		else if (arg0.get()->type == Type::INT && arg1.get()->type == Type::INT)
+		else if (res_type == Variable::Type::FLOAT)
 		{
-			return std::make_unique<Bool>(static_cast<Int*>(arg0.get())->value > static_cast<Int*>(arg1.get())->value);
+			double res = number_value(args[0]);
+			for (std::size_t i = 1; i < args.size(); i++) res = float_op(res, number_value(args[i]));
+			return Slot(res);
 		}
-		else if (arg0.get()->type == Type::FLOAT || arg1.get()->type == Type::FLOAT)
-		{
-			double lhs;
-			if (arg0->type == Type::INT) lhs = static_cast<Int*>(arg0.get())->value;
-			else if (arg0->type == Type::FLOAT) lhs = static_cast<Float*>(arg0.get())->value;
-			else return std::make_unique<Bool>(false);
-
-			double rhs;
-			if (arg1->type == Type::INT) rhs = static_cast<Int*>(arg1.get())->value;
-			else if (arg1->type == Type::FLOAT) rhs = static_cast<Float*>(arg1.get())->value;
-			else return std::make_unique<Bool>(false);
-
-			return std::make_unique<Bool>((lhs > rhs));
-		}
-		else return std::make_unique<Bool>(false);
+		return eval::fail(interp, "Invalid argument to ", name, " procedure, expected int or float and received: ", get_type_as_string(res_type));
 	}
 
-	GreaterThanOrEq::GreaterThanOrEq() : VarCopy(Variable::Type::PROCEDURE) {}
-
-	std::unique_ptr<Variable> GreaterThanOrEq::call(std::vector<ASTExpr>* args)
+	/**
+	 * Compares two numeric arguments. Comparisons involving anything other than numbers are false
+	 *
+	 * @param args: operands, exactly two are required
+	 * @param name: name of the procedure used in error messages
+	 * @param compare: comparison to apply, called with two ints or two doubles
+	 * @returns a boolean slot, or an invalid slot if the arguments were malformed
+	*/
+	template<typename Compare>
+	static Slot compare_numbers(Interpreter& interp, Span<Slot> args, const char* name, Compare compare)
 	{
-		if ((*args).size() != 2)
+		if (args.size() != 2)
 		{
-			std::cout << "Greater than or equals procedure expects two arguments" << std::endl;
-			return nullptr;
+			return eval::fail(interp, name, " procedure expects two arguments");
 		}
 
-		auto arg0 = eval::eval_expr(&(*args)[0]);
-		auto arg1 = eval::eval_expr(&(*args)[1]);
+		const Slot& lhs = args[0];
+		const Slot& rhs = args[1];
 
-		if (arg0.get()->type == Type::PROCEDURE || arg1.get()->type == Type::PROCEDURE)
+		if (lhs.type == Variable::Type::PROCEDURE || rhs.type == Variable::Type::PROCEDURE)
 		{
-			std::cout << "Greater than or equals procedure does not accept procedure as an argument" << std::endl;
-			return nullptr;
+			return eval::fail(interp, name, " procedure does not accept procedure as an argument");
 		}
-		else if (arg0.get()->type == Type::INT && arg1.get()->type == Type::INT)
+		else if (lhs.type == Variable::Type::INT && rhs.type == Variable::Type::INT)
 		{
-			return std::make_unique<Bool>(static_cast<Int*>(arg0.get())->value >= static_cast<Int*>(arg1.get())->value);
+			return Slot(compare(lhs.i_value, rhs.i_value));
 		}
-		else if (arg0.get()->type == Type::FLOAT || arg1.get()->type == Type::FLOAT)
+		else if (lhs.type == Variable::Type::FLOAT || rhs.type == Variable::Type::FLOAT)
 		{
-			double lhs;
-			if (arg0->type == Type::INT) lhs = static_cast<Int*>(arg0.get())->value;
-			else if (arg0->type == Type::FLOAT) lhs = static_cast<Float*>(arg0.get())->value;
-			else return std::make_unique<Bool>(false);
-
-			double rhs;
-			if (arg1->type == Type::INT) rhs = static_cast<Int*>(arg1.get())->value;
-			else if (arg1->type == Type::FLOAT) rhs = static_cast<Float*>(arg1.get())->value;
-			else return std::make_unique<Bool>(false);
+			bool numbers = (lhs.type == Variable::Type::INT || lhs.type == Variable::Type::FLOAT) &&
+				(rhs.type == Variable::Type::INT || rhs.type == Variable::Type::FLOAT);
+			if (!numbers) return Slot(false);
 
-			return std::make_unique<Bool>((lhs >= rhs));
+			return Slot(compare(number_value(lhs), number_value(rhs)));
 		}
-		else return std::make_unique<Bool>(false);
+		return Slot(false);
 	}
 
-	LessThan::LessThan() : VarCopy(Variable::Type::PROCEDURE) {}
-
-	std::unique_ptr<Variable> LessThan::call(std::vector<ASTExpr>* args)
+	namespace builtins
 	{
-		if ((*args).size() != 2)
+		using Type = Variable::Type;
+
+		Slot add(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "Less than procedure expects two arguments" << std::endl;
-			return nullptr;
+			return fold_numbers(interp, args, "Add", [](int lhs, int rhs) { return lhs + rhs; }, [](double lhs, double rhs) { return lhs + rhs; });
 		}
 
-		auto arg0 = eval::eval_expr(&(*args)[0]);
-		auto arg1 = eval::eval_expr(&(*args)[1]);
-
-		if (arg0.get()->type == Type::PROCEDURE || arg1.get()->type == Type::PROCEDURE)
+		Slot subtract(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "Less than procedure does not accept procedure as an argument" << std::endl;
-			return nullptr;
+			return fold_numbers(interp, args, "Subtract", [](int lhs, int rhs) { return lhs - rhs; }, [](double lhs, double rhs) { return lhs - rhs; });
 		}
-		else if (arg0.get()->type == Type::INT && arg1.get()->type == Type::INT)
+
+		Slot multiply(Interpreter& interp, Span<Slot> args)
 		{
-			return std::make_unique<Bool>(static_cast<Int*>(arg0.get())->value < static_cast<Int*>(arg1.get())->value);
+			return fold_numbers(interp, args, "Multiply", [](int lhs, int rhs) { return lhs * rhs; }, [](double lhs, double rhs) { return lhs * rhs; });
 		}
-		else if (arg0.get()->type == Type::FLOAT || arg1.get()->type == Type::FLOAT)
-		{
-			double lhs;
-			if (arg0->type == Type::INT) lhs = static_cast<Int*>(arg0.get())->value;
-			else if (arg0->type == Type::FLOAT) lhs = static_cast<Float*>(arg0.get())->value;
-			else return std::make_unique<Bool>(false);
 
-			double rhs;
-			if (arg1->type == Type::INT) rhs = static_cast<Int*>(arg1.get())->value;
-			else if (arg1->type == Type::FLOAT) rhs = static_cast<Float*>(arg1.get())->value;
-			else return std::make_unique<Bool>(false);
+		/**
+		 * Finds the reason dividing integer operands from left to right would trap, which the hardware
+		 * does for a zero divisor and for the one quotient too large for an int
+		 *
+		 * @param op: division or remainder, applied to the operands that do not trap
+		 * @returns the reason, or null if the division is safe or not between integers
+		*/
+		template<typename IntOp>
+		static const char* integer_division_trap(Span<Slot> args, IntOp op)
+		{
+			if (args.size() < 2 || get_result_type(args) != Variable::Type::INT) return nullptr;
 
-			return std::make_unique<Bool>((lhs < rhs));
+			int res = args[0].i_value;
+			for (std::size_t i = 1; i < args.size(); i++)
+			{
+				int divisor = args[i].i_value;
+				if (divisor == 0) return "integer division by zero";
+				if (divisor == -1 && res == std::numeric_limits<int>::min()) return "integer overflow";
+				res = op(res, divisor);
+			}
+			return nullptr;
 		}
-		else return std::make_unique<Bool>(false);
-	}
 
-	LessThanOrEq::LessThanOrEq() : VarCopy(Variable::Type::PROCEDURE) {}
-
-	std::unique_ptr<Variable> LessThanOrEq::call(std::vector<ASTExpr>* args)
-	{
-		if ((*args).size() != 2)
+		Slot divide(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "Less than or equals procedure expects two arguments" << std::endl;
-			return nullptr;
+			auto int_op = [](int lhs, int rhs) { return lhs / rhs; };
+			if (auto trap = integer_division_trap(args, int_op)) return eval::fail(interp, "Divide procedure failed: ", trap);
+			return fold_numbers(interp, args, "Divide", int_op, [](double lhs, double rhs) { return lhs / rhs; });
 		}
 
-		auto arg0 = eval::eval_expr(&(*args)[0]);
-		auto arg1 = eval::eval_expr(&(*args)[1]);
-
-		if (arg0.get()->type == Type::PROCEDURE || arg1.get()->type == Type::PROCEDURE)
+		Slot modulo(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "Less than or equals procedure does not accept procedure as an argument" << std::endl;
-			return nullptr;
+			auto int_op = [](int lhs, int rhs) { return lhs % rhs; };
+			if (auto trap = integer_division_trap(args, int_op)) return eval::fail(interp, "Modulo procedure failed: ", trap);
+			return fold_numbers(interp, args, "Modulo", int_op, [](double lhs, double rhs) { return fmod(lhs, rhs); });
 		}
-		else if (arg0.get()->type == Type::INT && arg1.get()->type == Type::INT)
+
+		Slot exponent(Interpreter& interp, Span<Slot> args)
 		{
-			return std::make_unique<Bool>(static_cast<Int*>(arg0.get())->value <= static_cast<Int*>(arg1.get())->value);
+			return fold_numbers(interp, args, "Exponent", [](int lhs, int rhs) { return static_cast<int>(pow(lhs, rhs)); }, [](double lhs, double rhs) { return pow(lhs, rhs); });
 		}
-		else if (arg0.get()->type == Type::FLOAT || arg1.get()->type == Type::FLOAT)
+
+		Slot absolute(Interpreter& interp, Span<Slot> args)
 		{
-			double lhs;
-			if (arg0->type == Type::INT) lhs = static_cast<Int*>(arg0.get())->value;
-			else if (arg0->type == Type::FLOAT) lhs = static_cast<Float*>(arg0.get())->value;
-			else return std::make_unique<Bool>(false);
+			if (args.size() != 1)
+			{
+				return eval::fail(interp, "Absolute procedure expects one argument");
+			}
 
-			double rhs;
-			if (arg1->type == Type::INT) rhs = static_cast<Int*>(arg1.get())->value;
-			else if (arg1->type == Type::FLOAT) rhs = static_cast<Float*>(arg1.get())->value;
-			else return std::make_unique<Bool>(false);
+			if (args[0].type == Type::INT) return Slot(abs(args[0].i_value));
+			else if (args[0].type == Type::FLOAT) return Slot(std::abs(args[0].f_value));
 
-			return std::make_unique<Bool>((lhs <= rhs));
+			return eval::fail(interp, "Invalid argument: Absolute procedure expects a number");
 		}
-		else return std::make_unique<Bool>(false);
-	}
 
-	Equals::Equals() : VarCopy(Variable::Type::PROCEDURE) {}
+		Slot greater_than(Interpreter& interp, Span<Slot> args)
+		{
+			return compare_numbers(interp, args, "Greater than", [](auto lhs, auto rhs) { return lhs > rhs; });
+		}
 
-	std::unique_ptr<Variable> Equals::call(std::vector<ASTExpr>* args)
-	{
-		if ((*args).size() != 2)
+		Slot greater_than_or_eq(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "Equals procedure expects two arguments" << std::endl;
-			return nullptr;
+			return compare_numbers(interp, args, "Greater than or equals", [](auto lhs, auto rhs) { return lhs >= rhs; });
 		}
 
-		auto arg0 = eval::eval_expr(&(*args)[0]);
-		auto arg1 = eval::eval_expr(&(*args)[1]);
+		Slot less_than(Interpreter& interp, Span<Slot> args)
+		{
+			return compare_numbers(interp, args, "Less than", [](auto lhs, auto rhs) { return lhs < rhs; });
+		}
 
-		if (arg0.get()->type == Type::PROCEDURE || arg1.get()->type == Type::PROCEDURE)
+		Slot less_than_or_eq(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "Equals procedure does not accept procedure as an argument" << std::endl;
-			return nullptr;
+			return compare_numbers(interp, args, "Less than or equals", [](auto lhs, auto rhs) { return lhs <= rhs; });
 		}
-		else if (arg0.get()->type == Type::INT && arg1.get()->type == Type::INT)
+
+		Slot equals(Interpreter& interp, Span<Slot> args)
 		{
-			return std::make_unique<Bool>(static_cast<Int*>(arg0.get())->value == static_cast<Int*>(arg1.get())->value);
+			if (args.size() == 2 && args[0].type == Type::STRING && args[1].type == Type::STRING)
+			{
+				return Slot(static_cast<String*>(args[0].boxed)->value == static_cast<String*>(args[1].boxed)->value);
+			}
+			return compare_numbers(interp, args, "Equals", [](auto lhs, auto rhs) { return lhs == rhs; });
 		}
-		else if (arg0.get()->type == Type::FLOAT || arg1.get()->type == Type::FLOAT)
+
+		Slot cons(Interpreter& interp, Span<Slot> args)
 		{
-			double lhs;
-			if (arg0->type == Type::INT) lhs = static_cast<Int*>(arg0.get())->value;
-			else if (arg0->type == Type::FLOAT) lhs = static_cast<Float*>(arg0.get())->value;
-			else return std::make_unique<Bool>(false);
+			return eval::fail(interp, "NOT IMPLEMENTED: cons");
+		}
 
-			double rhs;
-			if (arg1->type == Type::INT) rhs = static_cast<Int*>(arg1.get())->value;
-			else if (arg1->type == Type::FLOAT) rhs = static_cast<Float*>(arg1.get())->value;
-			else return std::make_unique<Bool>(false);
+		Slot car(Interpreter& interp, Span<Slot> args)
+		{
+			return eval::fail(interp, "NOT IMPLEMENTED: car");
+		}
 
-			return std::make_unique<Bool>((lhs == rhs));
+		Slot cdr(Interpreter& interp, Span<Slot> args)
+		{
+			return eval::fail(interp, "NOT IMPLEMENTED: cdr");
 		}
-		else if (arg0.get()->type == Type::STRING && arg1.get()->type == Type::STRING)
+
+		Slot length(Interpreter& interp, Span<Slot> args)
 		{
-			return std::make_unique<Bool>(static_cast<String*>(arg0.get())->value == static_cast<String*>(arg1.get())->value);
+			// TODO: This needs to get the length of the list in the first arg position
+			return Slot(static_cast<int>(args.size()));
 		}
-		else return std::make_unique<Bool>(false);
-	}
 
-	Cons::Cons() : VarCopy(Variable::Type::PROCEDURE) {}
+		/**
+		 * Applies a floating point function to a single numeric argument
+		*/
+		template<typename Fn>
+		static Slot apply_unary(Interpreter& interp, Span<Slot> args, const char* name, Fn fn)
+		{
+			if (args.size() != 1)
+			{
+				return eval::fail(interp, name, " procedure expects 1 argument");
+			}
 
-	std::unique_ptr<Variable> Cons::call(std::vector<ASTExpr>* args)
-	{
-		std::cout << "NOT IMPLEMENTED: cons" << std::endl;
-		return nullptr;
-	}
+			if (args[0].type == Variable::Type::INT || args[0].type == Variable::Type::FLOAT) return Slot(static_cast<double>(fn(number_value(args[0]))));
 
-	Car::Car() : VarCopy(Variable::Type::PROCEDURE) {}
+			return eval::fail(interp, name, " procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+		}
 
-	std::unique_ptr<Variable> Car::call(std::vector<ASTExpr>* args)
-	{
-		std::cout << "NOT IMPLEMENTED: car" << std::endl;
-		return nullptr;
-	}
+		Slot sine(Interpreter& interp, Span<Slot> args)
+		{
+			return apply_unary(interp, args, "Sin", [](double value) { return sin(value); });
+		}
 
-	Cdr::Cdr() : VarCopy(Variable::Type::PROCEDURE) {}
+		Slot cosine(Interpreter& interp, Span<Slot> args)
+		{
+			return apply_unary(interp, args, "Cos", [](double value) { return cos(value); });
+		}
 
-	std::unique_ptr<Variable> Cdr::call(std::vector<ASTExpr>* args)
-	{
-		std::cout << "NOT IMPLEMENTED: cdr" << std::endl;
-		return nullptr;
-	}
+		Slot tangent(Interpreter& interp, Span<Slot> args)
+		{
+			return apply_unary(interp, args, "Tan", [](double value) { return tan(value); });
+		}
 
-	Length::Length() : VarCopy(Variable::Type::PROCEDURE) {}
+		Slot square_root(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() == 1 && args[0].type == Type::INT)
+			{
+				int value = args[0].i_value;
+				auto sq_root_num = (long long)round((sqrt(value)));
+				if (sq_root_num * sq_root_num == value) return Slot(static_cast<int>(sq_root_num));
+				return Slot(sqrt(value));
+			}
+			return apply_unary(interp, args, "Square root", [](double value) { return sqrt(value); });
+		}
 
-	std::unique_ptr<Variable> Length::call(std::vector<ASTExpr>* args)
-	{
-		// TODO: This needs to get the length of the list in the first arg position
-		return std::make_unique<Int>((*args).size());
-	}
+		Slot make_vector(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1 && args.size() != 2)
+			{
+				return eval::fail(interp, "Make vector procedure expects a size and an optional fill value");
+			}
 
-	Sin::Sin() : VarCopy(Variable::Type::PROCEDURE) {}
+			if (args[0].type != Type::INT || args[0].i_value < 0)
+			{
+				return eval::fail(interp, "Make vector procedure expects a non-negative size");
+			}
 
-	std::unique_ptr<Variable> Sin::call(std::vector<ASTExpr>* args)
-	{
-		if ((*args).size() != 1)
-		{
-			std::cout << "Sin procedure expects 1 argument" << std::endl;
-			return nullptr;
+			Slot fill = args.size() == 2 ? std::move(args[1]) : Slot(0);
+			return Slot::from_variable(std::make_unique<Vector>(args[0].i_value, fill));
 		}
 
-		auto arg = eval::eval_expr(&(*args)[0]);
+		Slot vector(Interpreter& interp, Span<Slot> args)
+		{
+			auto vec = std::make_unique<Vector>(args.size(), Slot());
 
-		if ((*arg).type == Type::INT) return std::make_unique<Float>(sin(static_cast<Int*>(arg.get())->value));
-		if ((*arg).type == Type::FLOAT) return std::make_unique<Float>(sin(static_cast<Float*>(arg.get())->value));
+			for (size_t i = 0; i < args.size(); i++)
+			{
+				vec->set(i, std::move(args[i]));
+			}
+			return Slot::from_variable(std::move(vec));
+		}
 
-		std::cout << "Sin procedure received an invalid argument type: " << get_var_type_as_string((*arg)) << std::endl;
-		return nullptr;
-	}
+		Slot vector_length(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1)
+			{
+				return eval::fail(interp, "Vector length procedure expects 1 argument");
+			}
 
-	Cos::Cos() : VarCopy(Variable::Type::PROCEDURE) {}
+			if (args[0].type != Type::VECTOR)
+			{
+				return eval::fail(interp, "Vector length procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+			return Slot(static_cast<int>(static_cast<Vector*>(args[0].boxed)->size()));
+		}
 
-	std::unique_ptr<Variable> Cos::call(std::vector<ASTExpr>* args)
-	{
-		if ((*args).size() != 1)
+		Slot vector_ref(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "Cos procedure expects 1 argument1" << std::endl;
-			return nullptr;
-		}
+			std::size_t idx;
 
-		auto arg = eval::eval_expr(&(*args)[0]);
+			if (args.size() != 2 || args[0].type != Type::VECTOR || !get_index(args[1], idx))
+			{
+				return eval::fail(interp, "Vector ref procedure expects a vector and an index");
+			}
 
-		if ((*arg).type == Type::INT) return std::make_unique<Float>(cos(static_cast<Int*>(arg.get())->value));
-		if ((*arg).type == Type::FLOAT) return std::make_unique<Float>(cos(static_cast<Float*>(arg.get())->value));
+			auto vec = static_cast<Vector*>(args[0].boxed);
+			if (idx >= vec->size())
+			{
+				return eval::fail(interp, "Vector index out of range: ", args[1].i_value);
+			}
+			return vec->at(idx);
+		}
 
-		std::cout << "Cos procedure received an invalid argument type: " << get_var_type_as_string((*arg)) << std::endl;
-		return nullptr;
-	}
+		Slot vector_set(Interpreter& interp, Span<Slot> args)
+		{
+			std::size_t idx;
 
-	Tan::Tan() : VarCopy(Variable::Type::PROCEDURE) {}
+			if (args.size() != 3 || args[0].type != Type::VECTOR || !get_index(args[1], idx))
+			{
+				return eval::fail(interp, "Vector set procedure expects a vector, an index, and a value");
+			}
 
-	std::unique_ptr<Variable> Tan::call(std::vector<ASTExpr>* args)
-	{
-		if ((*args).size() != 1)
-		{
-			std::cout << "Tan procedure expects 1 argument" << std::endl;
-			return nullptr;
+			auto vec = static_cast<Vector*>(args[0].boxed);
+			if (idx >= vec->size())
+			{
+				return eval::fail(interp, "Vector index out of range: ", args[1].i_value);
+			}
+			if (vec->buffer->frozen.load(std::memory_order_acquire) != 0)
+			{
+				return eval::fail(interp, "Vector set procedure cannot change a frozen vector, other threads may be reading it");
+			}
+			if (vec->buffer->outlives_form.load(std::memory_order_relaxed)) region::promote(args[2]);
+			vec->set(idx, std::move(args[2]));
+			return Slot();
 		}
 
-		auto arg = eval::eval_expr(&(*args)[0]);
+		Slot vector_fill(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() < 2 || args.size() > 4)
+			{
+				return eval::fail(interp, "Vector fill procedure expects a vector, a value, and an optional start and end");
+			}
 
-		if ((*arg).type == Type::INT) return std::make_unique<Float>(tan(static_cast<Int*>(arg.get())->value));
-		if ((*arg).type == Type::FLOAT) return std::make_unique<Float>(tan(static_cast<Float*>(arg.get())->value));
+			if (args[0].type != Type::VECTOR)
+			{
+				return eval::fail(interp, "Vector fill procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
 
-		std::cout << "Tan procedure received an invalid argument type: " << get_var_type_as_string((*arg)) << std::endl;
-		return nullptr;
-	}
+			auto vec = static_cast<Vector*>(args[0].boxed);
+			std::size_t start = 0;
+			std::size_t end = vec->size();
 
-	Sqrt::Sqrt() : VarCopy(Variable::Type::PROCEDURE) {}
+			if ((args.size() > 2 && !get_index(args[2], start)) || (args.size() > 3 && !get_index(args[3], end)) ||
+				end > vec->size() || start > end)
+			{
+				return eval::fail(interp, "Vector fill procedure received an invalid range");
+			}
+			if (vec->buffer->frozen.load(std::memory_order_acquire) != 0)
+			{
+				return eval::fail(interp, "Vector fill procedure cannot change a frozen vector, other threads may be reading it");
+			}
+			if (vec->buffer->outlives_form.load(std::memory_order_relaxed))
+			{
+				// Every element gets a copy of its own, all of them made outside the region
+				region::promote(args[1]);
+				region::HeapScope heap;
+				vec->fill(args[1], start, end);
+				return Slot();
+			}
+			vec->fill(args[1], start, end);
+			return Slot();
+		}
 
-	std::unique_ptr<Variable> Sqrt::call(std::vector<ASTExpr>* args)
-	{
-		if ((*args).size() != 1)
+		Slot vector_copy(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "Square root procedure expects 1 argument" << std::endl;
-			return nullptr;
-		}
+			std::size_t at;
 
-		auto arg = eval::eval_expr(&(*args)[0]);
+			if (args.size() < 3 || args.size() > 5 || args[0].type != Type::VECTOR || !get_index(args[1], at) || args[2].type != Type::VECTOR)
+			{
+				return eval::fail(interp, "Vector copy procedure expects a target, an index, a source, and an optional start and end");
+			}
 
-		if ((*arg).type == Type::INT)
-		{
-			auto sq_root_num = (long long)round((sqrt(static_cast<Int*>(arg.get())->value)));
-			if (sq_root_num * sq_root_num == static_cast<Int*>(arg.get())->value) {
-				return std::make_unique<Int>(sqrt(static_cast<Int*>(arg.get())->value));
+			auto to = static_cast<Vector*>(args[0].boxed);
+			auto from = static_cast<Vector*>(args[2].boxed);
+			std::size_t start = 0;
+			std::size_t end = from->size();
+
+			if ((args.size() > 3 && !get_index(args[3], start)) || (args.size() > 4 && !get_index(args[4], end)) ||
+				end > from->size() || start > end || at > to->size() || end - start > to->size() - at)
+			{
+				return eval::fail(interp, "Vector copy procedure received an invalid range");
 			}
-			else {
-				return std::make_unique<Float>(sqrt(static_cast<Int*>(arg.get())->value));
+			if (to->buffer->frozen.load(std::memory_order_acquire) != 0)
+			{
+				return eval::fail(interp, "Vector copy procedure cannot change a frozen vector, other threads may be reading it");
 			}
+			if (to->buffer->outlives_form.load(std::memory_order_relaxed))
+			{
+				{
+					region::HeapScope heap;
+					to->copy_from(at, *from, start, end - start);
+				}
+				for (std::size_t i = at; i < at + (end - start); i++) region::promote(to->buffer->slots[i]);
+				return Slot();
+			}
+			to->copy_from(at, *from, start, end - start);
+			return Slot();
 		}
-		if ((*arg).type == Type::FLOAT)
+
+		/**
+		 * Compares two arguments under one of the equivalence predicates
+		*/
+		static Slot compare_equivalent(Interpreter& interp, Span<Slot> args, Equivalence equivalence)
 		{
-			return std::make_unique<Float>(sqrt(static_cast<Float*>(arg.get())->value));
-		}
+			if (args.size() != 2)
+			{
+				return eval::fail(interp, "Equivalence procedure expects two arguments");
+			}
 
-		std::cout << "Square root procedure received an invalid argument type: " << get_var_type_as_string((*arg)) << std::endl;
-		return nullptr;
-	}
+			if (equivalence == Equivalence::STRING && (args[0].type != Type::STRING || args[1].type != Type::STRING))
+			{
+				return eval::fail(interp, "String equals procedure expects two strings");
+			}
+			return Slot(slots_equivalent(args[0], args[1], equivalence));
+		}
 
-	Define::Define() : VarCopy(Variable::Type::DEFINITION) {}
+		Slot is_eq(Interpreter& interp, Span<Slot> args)
+		{
+			return compare_equivalent(interp, args, Equivalence::EQ);
+		}
 
-	std::unique_ptr<Variable> Define::call(std::vector<ASTExpr>* args)
-	{
-		std::cout << "Define variable is not callable" << std::endl;
-		return nullptr;
-	}
+		Slot is_eqv(Interpreter& interp, Span<Slot> args)
+		{
+			return compare_equivalent(interp, args, Equivalence::EQV);
+		}
 
-	If::If() : VarCopy(Variable::Type::CONDITIONAL) {}
+		Slot is_equal(Interpreter& interp, Span<Slot> args)
+		{
+			return compare_equivalent(interp, args, Equivalence::EQUAL);
+		}
 
-	std::unique_ptr<Variable> If::call(std::vector<ASTExpr>* args)
-	{
-		if ((*args).size() != 3)
+		Slot is_string_equal(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "If statement expects a condition, then, and an else" << std::endl;
-			return nullptr;
+			return compare_equivalent(interp, args, Equivalence::STRING);
 		}
 
-		auto test = eval::eval_expr(&(*args)[0]);
-		if (test->type != Variable::Type::BOOL)
+		Slot string_append(Interpreter& interp, Span<Slot> args)
 		{
-			std::cout << "If statement condition should evaluate to a boolean" << std::endl;
-			return nullptr;
+			std::size_t size = 0;
+			for (auto& arg : args)
+			{
+				if (arg.type != Type::STRING)
+				{
+					return eval::fail(interp, "String append procedure received an invalid argument type: ", get_type_as_string(arg.type));
+				}
+				size += static_cast<String*>(arg.boxed)->value.size();
+			}
+
+			std::string result;
+			result.reserve(size);
+			for (auto& arg : args) result += static_cast<String*>(arg.boxed)->value;
+			return Slot::from_variable(std::make_unique<String>(std::move(result)));
 		}
-		if (static_cast<Bool*>(test.get())->value == true)
+
+		Slot string_length(Interpreter& interp, Span<Slot> args)
 		{
-			return eval::eval_expr(&(*args)[1]);
+			if (args.size() != 1 || args[0].type != Type::STRING)
+			{
+				return eval::fail(interp, "String length procedure expects a string");
+			}
+			return Slot(static_cast<int>(static_cast<String*>(args[0].boxed)->value.size()));
 		}
-		return eval::eval_expr(&(*args)[2]);
 	}
 
-	Begin::Begin() : VarCopy(Variable::Type::PROCEDURE) {}
-
-	std::unique_ptr<Variable> Begin::call(std::vector<ASTExpr>* args)
+	const Variable* Environment::find(const std::string& name) const
 	{
-		std::cout << "NOT IMPLEMENTED: begin" << std::endl;
+		for (auto env = this; env != nullptr; env = env->parent.get())
+		{
+			auto it = env->env_map.find(name);
+			if (it != env->env_map.end()) return it->second.get();
+			if (env->image == nullptr) continue;
+
+			if (auto var = env->image->find(name)) return var;
+		}
 		return nullptr;
 	}
 
-	Environment::Environment()
-	{
-		// Built-In Procedures
-		env_map["+"] = std::make_unique<Add>();
-		env_map["-"] = std::make_unique<Subtract>();
-		env_map["*"] = std::make_unique<Multiply>();
-		env_map["/"] = std::make_unique<Divide>();
-		env_map["%"] = std::make_unique<Mod>();
-		env_map[">"] = std::make_unique<GreaterThan>();
-		env_map[">="] = std::make_unique<GreaterThanOrEq>();
-		env_map["<"] = std::make_unique<LessThan>();
-		env_map["<="] = std::make_unique<LessThanOrEq>();
-		env_map["="] = std::make_unique<Equals>();
-		env_map["abs"] = std::make_unique<Absolute>();
-		env_map["car"] = std::make_unique<Cons>();
-		env_map["car"] = std::make_unique<Car>();
-		env_map["cdr"] = std::make_unique<Cdr>();
-		env_map["expt"] = std::make_unique<Exponent>();
-		env_map["length"] = std::make_unique<Length>();
-		env_map["sin"] = std::make_unique<Sin>();
-		env_map["cos"] = std::make_unique<Cos>();
-		env_map["tan"] = std::make_unique<Tan>();
-		env_map["sqrt"] = std::make_unique<Sqrt>();
+	std::shared_ptr<const Environment> Environment::snapshot()
+	{
+		if (!env_map.empty() || image != nullptr)
+		{
+			auto layer = std::make_shared<Environment>();
+			layer->env_map = std::move(env_map);
+			layer->image = std::move(image);
+			layer->parent = std::move(parent);
+			env_map.clear();
+			parent = std::move(layer);
+		}
+		return parent;
+	}
+
+	void Environment::freeze_values() const
+	{
+		if (frozen != nullptr) return;
+
+		// Each layer holds the freeze of its own values, so the parents are frozen one by one
+		if (parent != nullptr) parent->freeze_values();
+		auto held = std::make_unique<Freeze>();
+		for (auto& entry : env_map) held->add(*entry.second);
+		if (image != nullptr) image->freeze();
+		frozen = std::move(held);
 	}
 }
\ No newline at end of file
@@ -1,154 +1,791 @@
 #include <lang/evaluate.hpp>
+#include <lang/condition.hpp>
+#include <lang/continuation.hpp>
+#include <lang/green.hpp>
+#include <lang/hash_table.hpp>
+#include <lang/instrument.hpp>
+#include <lang/output.hpp>
+#include <lang/parallel.hpp>
+#include <lang/persistent.hpp>
+#include <lang/profile.hpp>
+#include <lang/region.hpp>
+#include <lang/trace.hpp>
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <sstream>
+#include <unistd.h>
 
 using namespace environment;
 
 namespace eval
 {
-	Environment env = environment::Environment();
+	/**
+	 * Lowest address of the calling thread's stack, looked up once per thread
+	*/
+	static const char* stack_bottom()
+	{
+		thread_local const char* bottom = []() -> const char* {
+			pthread_attr_t attr;
+			void* address = nullptr;
+			std::size_t size = 0;
+			if (pthread_getattr_np(pthread_self(), &attr) != 0) return nullptr;
+			pthread_attr_getstack(&attr, &address, &size);
+			pthread_attr_destroy(&attr);
+			return static_cast<const char*>(address);
+		}();
+		return bottom;
+	}
+
+	std::size_t depth_limit(std::size_t stack_size)
+	{
+		if (stack_size <= stack_reserve_bytes) return 0;
+		return (stack_size - stack_reserve_bytes) / call_stack_bytes;
+	}
+
+	std::size_t depth_limit()
+	{
+		char marker;
+		const char* bottom = stack_bottom();
+		// Without the bounds of the stack assume the usual 8 MB from here on
+		if (bottom == nullptr || &marker < bottom) return depth_limit(8 * 1024 * 1024);
+		return depth_limit(static_cast<std::size_t>(&marker - bottom));
+	}
 
-	void print_variable(std::unique_ptr<Variable> var)
+	std::uintptr_t stack_limit()
 	{
-		switch (var->type)
+		const char* bottom = stack_bottom();
+		if (bottom == nullptr) return 0;
+		return reinterpret_cast<std::uintptr_t>(bottom) + stack_reserve_bytes;
+	}
+
+	/**
+	 * Containers being written by one call to `write_slot`, outermost first. A vector met again inside
+	 * itself is written as `...`, and so is anything nested deeper than `max_write_depth`
+	*/
+	struct Writing
+	{
+		static constexpr std::size_t max_write_depth = 256;
+
+		std::vector<const Vector::Buffer*> open;
+		std::size_t depth = 0;
+	};
+
+	static void write_slot(std::ostream& out, const Slot& slot, Writing& writing);
+
+	static void write_variable(std::ostream& out, const Variable& var, Writing& writing)
+	{
+		if (writing.depth >= Writing::max_write_depth)
+		{
+			out << "...";
+			return;
+		}
+
+		switch (var.type)
 		{
 		case Variable::Type::BOOL:
-			std::cout << static_cast<Bool*>(var.get())->value << std::endl;
+			out << static_cast<const Bool&>(var).value;
 			break;
 		case Variable::Type::INT:
-			std::cout << static_cast<Int*>(var.get())->value << std::endl;
+			output::write_int(out, static_cast<const Int&>(var).value);
 			break;
 		case Variable::Type::FLOAT:
-			std::cout << static_cast<Float*>(var.get())->value << std::endl;
+			output::write_float(out, static_cast<const Float&>(var).value);
 			break;
 		case Variable::Type::STRING:
-			std::cout << static_cast<String*>(var.get())->value << std::endl;
+			out << static_cast<const String&>(var).value;
+			break;
+		case Variable::Type::VECTOR:
+		{
+			auto& vec = static_cast<const Vector&>(var);
+			if (std::find(writing.open.begin(), writing.open.end(), vec.buffer.get()) != writing.open.end())
+			{
+				out << "...";
+				break;
+			}
+
+			writing.open.push_back(vec.buffer.get());
+			out << "#(";
+			for (size_t i = 0; i < vec.size(); i++)
+			{
+				if (i != 0) out << " ";
+				write_slot(out, vec.at(i), writing);
+			}
+			out << ")";
+			writing.open.pop_back();
+			break;
+		}
+		case Variable::Type::HASH_TABLE:
+			out << "#<hash-table " << static_cast<const HashTable&>(var).size() << ">";
+			break;
+		case Variable::Type::PERSISTENT_VECTOR:
+		{
+			auto& vec = static_cast<const PersistentVector&>(var);
+			out << "#<persistent-vector";
+			for (size_t i = 0; i < vec.size(); i++)
+			{
+				out << " ";
+				write_slot(out, vec.at(i), writing);
+			}
+			out << ">";
+			break;
+		}
+		case Variable::Type::PERSISTENT_MAP:
+			out << "#<persistent-map " << static_cast<const PersistentMap&>(var).size() << ">";
+			break;
+		case Variable::Type::FUTURE:
+			out << "#<future>";
+			break;
+		case Variable::Type::PLACE_CHANNEL:
+			out << "#<place-channel>";
+			break;
+		case Variable::Type::CONDITION:
+		{
+			auto& state = *static_cast<const Condition&>(var).state;
+			out << "#<condition " << state.message;
+			for (auto& irritant : state.irritants)
+			{
+				out << " ";
+				write_slot(out, irritant, writing);
+			}
+			out << ">";
+			break;
+		}
+		case Variable::Type::CHANNEL:
+		{
+			auto& state = *static_cast<const Channel&>(var).state;
+			out << "#<channel " << state.count << "/" << state.ring.size() << ">";
+			break;
+		}
+		case Variable::Type::PROCEDURE:
+		{
+			if (dynamic_cast<const Continuation*>(&var) != nullptr)
+			{
+				out << "#<continuation>";
+				break;
+			}
+
+			auto builtin = dynamic_cast<const Builtin*>(&var);
+			out << "#<procedure";
+			if (builtin != nullptr) out << " " << builtin->entry->name;
+			out << ">";
+			break;
+		}
+		default:
+			out << "Invalid result encountered";
+		}
+	}
+
+	static void write_slot(std::ostream& out, const Slot& slot, Writing& writing)
+	{
+		switch (slot.type)
+		{
+		case Variable::Type::BOOL:
+			out << slot.b_value;
+			break;
+		case Variable::Type::INT:
+			output::write_int(out, slot.i_value);
+			break;
+		case Variable::Type::FLOAT:
+			output::write_float(out, slot.f_value);
+			break;
+		case Variable::Type::INVALID:
+			out << "Invalid result encountered";
 			break;
 		default:
-			std::cout << "Invalid result encountered" << std::endl;
+			writing.depth++;
+			write_variable(out, *slot.boxed, writing);
+			writing.depth--;
 		}
 	}
 
-	std::unique_ptr<Variable> define(std::vector<ASTExpr>* args)
+	void write_slot(std::ostream& out, const Slot& slot)
+	{
+		Writing writing;
+		write_slot(out, slot, writing);
+	}
+
+	void print_slot(const Slot& slot)
 	{
-		if (args->size() != 2)
+		write_slot(std::cout, slot);
+		std::cout << '\n';
+	}
+
+	Slot define(Interpreter& interp, Span<const ASTExpr> args)
+	{
+		SCHEME_INSTRUMENT_CALL("define");
+
+		if (args.size() != 2)
+		{
+			return eval::fail(interp, "Definition expects two arguments, a name and a value");
+		}
+
+		bool is_symbol = args[0].type == ASTExpr::Type::ATOM && args[0].leaf.type == Token::Type::SYMBOL;
+
+		if (is_symbol)
+		{
+			auto& name = args[0].leaf.symbol;
+			// Locals may shadow global definitions, but never another local of the same call
+			bool taken = find_builtin(name) != nullptr ||
+				(interp.frame != nullptr ? interp.frame->find(name) != nullptr : interp.env.find(name) != nullptr);
+			is_symbol = !taken;
+		}
+
+		if (!is_symbol)
+		{
+			auto key_type = eval_slot(interp, &args[0]).type;
+			return eval::fail(interp, "Define expects a unique symbol as the first argument, received: ", get_type_as_string(key_type));
+		}
+
+		auto value = eval_slot(interp, &args[1]);
+		if (interp.escape != nullptr) return Slot();
+		if (value.type == Variable::Type::INVALID)
+		{
+			return eval::fail(interp, "Define expects a value for ", args[0].leaf.symbol, ", but its expression has none");
+		}
+
+		if (value.type == Variable::Type::PROCEDURE)
+		{
+			auto closure = dynamic_cast<Closure*>(value.boxed);
+			if (closure != nullptr && closure->name.empty()) closure->name = profile::intern(args[0].leaf.symbol);
+		}
+
+		if (interp.frame != nullptr)
+		{
+			interp.frame->locals.push_back({ &args[0].leaf.symbol, std::move(value) });
+			return Slot();
+		}
+
+		interp.env.env_map.emplace(args[0].leaf.symbol, region::promote(value.into_variable()));
+		return Slot();
+	}
+
+	Slot conditional(Interpreter& interp, Span<const ASTExpr> args)
+	{
+		SCHEME_INSTRUMENT_CALL("if");
+
+		if (args.size() != 3)
+		{
+			return eval::fail(interp, "If statement expects a condition, then, and an else");
+		}
+
+		auto test = eval_slot(interp, &args[0]);
+		if (interp.escape != nullptr) return Slot();
+		if (test.type != Variable::Type::BOOL)
+		{
+			return eval::fail(interp, "If statement condition should evaluate to a boolean");
+		}
+		return eval_slot(interp, test.b_value ? &args[1] : &args[2]);
+	}
+
+	Slot lambda(Interpreter& interp, Span<const ASTExpr> args)
+	{
+		SCHEME_INSTRUMENT_CALL("lambda");
+
+		if (args.size() < 2 || args[0].type != ASTExpr::Type::LIST)
+		{
+			return eval::fail(interp, "Lambda expects a list of parameters and a body");
+		}
+
+		auto code = std::make_shared<Closure::Code>();
+
+		for (auto& param : args[0].children)
+		{
+			if (param.type != ASTExpr::Type::ATOM || param.leaf.type != Token::Type::SYMBOL)
+			{
+				return eval::fail(interp, "Lambda parameters must be symbols");
+			}
+			code->params.push_back(param.leaf.symbol);
+		}
+
+		for (std::size_t i = 1; i < args.size(); i++)
+		{
+			code->body.push_back(copy_ast(args[i]));
+		}
+
+		return Slot::from_variable(std::make_unique<Closure>(std::move(code), capture_locals(interp)));
+	}
+
+	std::vector<Binding> capture_locals(const Interpreter& interp)
+	{
+		std::vector<Binding> captured;
+		if (interp.frame != nullptr)
+		{
+			captured.reserve(interp.frame->locals.size());
+			for (auto& local : interp.frame->locals) captured.push_back({ *local.name, local.value });
+		}
+		return captured;
+	}
+
+	Slot sequence(Interpreter& interp, Span<const ASTExpr> args)
+	{
+		SCHEME_INSTRUMENT_CALL("begin");
+
+		Slot result;
+
+		for (auto& arg : args)
 		{
-			std::cout << "Definition expects two arguments, a name and a value" << std::endl;
-			return nullptr;
+			result = eval_slot(interp, &arg);
+			if (interp.escape != nullptr) return Slot();
 		}
-		auto key = eval::eval_expr(&(*args)[0]);
-		auto value = eval::eval_expr(&(*args)[1]);
+		return result;
+	}
+
+	static double milliseconds(const timespec& start, const timespec& end)
+	{
+		return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+	}
+
+	Slot timed(Interpreter& interp, Span<const ASTExpr> args)
+	{
+		SCHEME_INSTRUMENT_CALL("time");
 
-		if (key->type != Variable::Type::SYMBOL)
+		if (args.size() != 1)
 		{
-			std::cout << "Define expects a unique symbol as the first argument, received: " << get_var_type_as_string((*key)) << std::endl;
-			return nullptr;
+			return eval::fail(interp, "Time expects one expression");
 		}
 
-		env.env_map.insert({static_cast<Symbol*>(key.get())->value, value->copy()});
+		auto& counts = region::stats();
+		std::size_t allocations = counts.region_allocations + counts.heap_allocations;
+		std::size_t bytes = counts.region_bytes + counts.heap_bytes;
+		timespec real_start, cpu_start;
+		clock_gettime(CLOCK_MONOTONIC, &real_start);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+		auto result = eval_slot(interp, &args[0]);
+
+		timespec real_end, cpu_end;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+		clock_gettime(CLOCK_MONOTONIC, &real_end);
+		allocations = counts.region_allocations + counts.heap_allocations - allocations;
+		bytes = counts.region_bytes + counts.heap_bytes - bytes;
+
+		char report[160];
+		std::snprintf(report, sizeof(report), "real time: %.3f ms, cpu time: %.3f ms, allocated: %zu bytes in %zu objects",
+			milliseconds(real_start, real_end), milliseconds(cpu_start, cpu_end), bytes, allocations);
+		std::cout << report << '\n';
+		return result;
+	}
+
+	const Slot* Frame::find(const std::string& name) const
+	{
+		for (auto it = locals.rbegin(); it != locals.rend(); ++it)
+		{
+			if (*it->name == name) return &it->value;
+		}
 		return nullptr;
 	}
 
-	std::unique_ptr<Variable> eval_expr_atom(const Token& tk)
+	Slot eval_expr_atom(Interpreter& interp, const Token& tk)
 	{
 		switch (tk.type)
 		{
 		case Token::Type::INT:
-			return std::make_unique<Int>(Int(tk.i_value));
+			return Slot(tk.i_value);
 		case Token::Type::FLOAT:
-			return std::make_unique<Float>(Float(tk.f_value));
+			return Slot(tk.f_value);
 		case Token::Type::STRING:
-			return std::make_unique<String>(String(tk.symbol));
+			return Slot::from_variable(std::make_unique<String>(tk.symbol));
+		case Token::Type::ERROR:
+			return eval::fail(interp, tk.symbol);
 		case Token::Type::SYMBOL:
 		{
-			if (tk.symbol == "define")
+			if (interp.frame != nullptr)
 			{
-				return std::make_unique<Define>(Define());
+				if (auto local = interp.frame->find(tk.symbol)) return *local;
 			}
-			if (tk.symbol == "if")
+			if (auto builtin = find_builtin(tk.symbol))
 			{
-				return std::make_unique<If>(If());
+				return Slot::from_variable(std::make_unique<Builtin>(builtin));
 			}
-			auto it = env.env_map.find(tk.symbol);
-			if (it == env.env_map.end())
+			auto var = interp.env.find(tk.symbol);
+			if (var == nullptr)
 			{
 				// Symbol is not in the current environment
-				return std::make_unique<Symbol>(Symbol(tk.symbol));
+				return Slot::from_variable(std::make_unique<Symbol>(tk.symbol));
 			}
-			return it->second->copy();
+			return Slot::from_variable(*var);
 		}
 		}
-		return nullptr;
+		return Slot();
 	}
 
-	std::unique_ptr<Variable> eval_expr_list(std::vector<ASTExpr>* exprs)
+	Slot eval_expr_list(Interpreter& interp, const std::vector<ASTExpr>* exprs)
 	{
 		if ((*exprs).size() == 0)
 		{
-			std::cout << "Empty list encountered" << std::endl;
-			return nullptr;
+			return eval::fail(interp, "Empty list encountered");
 		}
 
-		if ((*exprs)[0].type != ASTExpr::Type::ATOM)
+		const ASTExpr& head = (*exprs)[0];
+		Span<const ASTExpr> args((*exprs).data() + 1, (*exprs).size() - 1);
+
+		const BuiltinEntry* builtin = nullptr;
+		Variable* fn = nullptr;
+		Slot head_value;	// Keeps a procedure produced by the head expression alive for the call
+
+		if (head.type == ASTExpr::Type::ATOM && head.leaf.type == Token::Type::SYMBOL)
 		{
-			std::cout << "List must begin with a symbol" << std::endl;
-			return nullptr;
-		}
+			auto& name = head.leaf.symbol;
 
-		std::unique_ptr<Variable> fn = eval_expr_atom((*exprs)[0].leaf);
+			if (name == "define") return define(interp, args);
+			if (name == "if") return conditional(interp, args);
+			if (name == "lambda") return lambda(interp, args);
+			if (name == "begin") return sequence(interp, args);
+			if (name == "future") return future(interp, args);
+			if (name == "time") return timed(interp, args);
+			if (name == "guard") return guard(interp, args);
 
-		std::vector<ASTExpr> args;
+			// Locals come first so parameters can shadow built-ins, then the registry, then definitions
+			auto local = interp.frame != nullptr ? interp.frame->find(name) : nullptr;
 
-		for (int i = 1; i < (*exprs).size(); ++i) args.push_back(std::move((*exprs)[i]));
+			if (local != nullptr)
+			{
+				if (local->type == Variable::Type::PROCEDURE) fn = local->boxed;
+			}
+			else if ((builtin = find_builtin(name)) == nullptr)
+			{
+				// Called in place, definitions never replace an existing binding so it stays alive
+				auto var = interp.env.find(name);
+				if (var != nullptr && var->type == Variable::Type::PROCEDURE) fn = const_cast<Variable*>(var);
+			}
 
-		if (fn->type == Variable::Type::DEFINITION)
+			if (builtin == nullptr && fn == nullptr)
+			{
+				return eval::fail(interp, "Unknown argument encountered in first list position: ", name);
+			}
+		}
+		else if (head.type == ASTExpr::Type::LIST)
 		{
-			return define(&args);
+			head_value = eval_slot(interp, &head);
+			if (interp.escape != nullptr) return Slot();
+			if (head_value.type != Variable::Type::PROCEDURE)
+			{
+				return eval::fail(interp, "List must begin with a symbol or a procedure");
+			}
+			fn = head_value.boxed;
 		}
-		if (fn->type == Variable::Type::CONDITIONAL || fn->type == Variable::Type::PROCEDURE)
+		else
 		{
-			return fn->call(&args);
+			return eval::fail(interp, "List must begin with a symbol or a procedure");
 		}
-		
-		std::cout << "Unknown argument encountered in first list position: " << static_cast<Symbol*>(fn.get())->value << std::endl;
-		return nullptr;
+
+		ArgFrame frame;
+
+		for (std::size_t i = 0; i < args.size(); i++)
+		{
+			auto value = eval_slot(interp, &args[i]);
+			if (interp.escape != nullptr) return Slot();
+			if (value.type == Variable::Type::INVALID)
+			{
+				// Such as the result of vector-set!, which has no value to pass on
+				auto name = head.type == ASTExpr::Type::ATOM ? std::string_view(head.leaf.symbol) : std::string_view("procedure");
+				return eval::fail(interp, "Argument ", i + 1, " of ", name, " has no value");
+			}
+			frame.push_back(std::move(value));
+		}
+		if (builtin != nullptr)
+		{
+			profile::Frame profiled(builtin->name);
+			SCHEME_INSTRUMENT_CALL(builtin->name);
+			return builtin->fn(interp, frame.span());
+		}
+		return fn->call(interp, frame.span());
 	}
 
-	std::unique_ptr<Variable> eval_expr(ASTExpr* expr)
+	Slot eval_slot(Interpreter& interp, const ASTExpr* expr)
 	{
 		switch ((*expr).type)
 		{
 		case ASTExpr::Type::ATOM:
-			return eval_expr_atom((*expr).leaf);
+			return eval_expr_atom(interp, (*expr).leaf);
 		case ASTExpr::Type::LIST:
-			return eval_expr_list(&(*expr).children);
+			return eval_expr_list(interp, &(*expr).children);
 		default:
-			std::cout << "Invalid ASTExpr encountered" << std::endl;
-			return nullptr;
+			return eval::fail(interp, "Invalid ASTExpr encountered");
+		}
+	}
+
+	std::unique_ptr<Variable> eval_expr(Interpreter& interp, const ASTExpr* expr)
+	{
+		return eval_slot(interp, expr).into_variable();
+	}
+
+	/**
+	 * Evaluates every top-level form of a piece of source text, each in a region of its own
+	 *
+	 * @param on_result: called with the value of each form while its region is alive, and whether it is the last form
+	 * @param stop_at_exit: whether a bare `exit` form ends the evaluation
+	 * @param raised: if given, receives the first error nothing catches, which ends the evaluation instead of being printed
+	 * @returns false if an `exit` form was reached
+	*/
+	template<typename OnResult>
+	static bool eval_forms(Interpreter& interp, const std::string& source, bool stop_at_exit, OnResult&& on_result, Slot* raised = nullptr)
+	{
+		std::vector<Token> tokens;
+		{
+			trace::Phase phase("tokenize");
+			tokens = tokenize(source);
+		}
+		std::vector<ASTExpr> forms;
+		{
+			trace::Phase phase("construct_ast");
+			forms = construct_program(std::move(tokens));
 		}
+
+		for (std::size_t i = 0; i < forms.size(); i++)
+		{
+			auto& form = forms[i];
+			if (stop_at_exit && form.type == ASTExpr::Type::ATOM && form.leaf.type == Token::Type::SYMBOL && form.leaf.symbol == "exit")
+			{
+				return false;
+			}
+
+			region::Scope scope;
+			trace::Phase phase("eval_expr");
+			// An error nothing catches abandons the rest of its form and is reported once
+			Slot uncaught;
+			auto value = catch_uncaught(interp, uncaught, [&]() { return eval_slot(interp, &form); });
+			if (uncaught.type != Variable::Type::INVALID && raised != nullptr)
+			{
+				*raised = std::move(uncaught);
+				return true;
+			}
+			if (uncaught.type != Variable::Type::INVALID)
+			{
+				write_uncaught(std::cout, uncaught);
+				std::cout << '\n';
+			}
+			on_result(value, i + 1 == forms.size());
+		}
+		return true;
+	}
+
+	Slot eval_source(Interpreter& interp, const std::string& source)
+	{
+		Slot result;
+		eval_forms(interp, source, false, [&result](Slot& value, bool last)
+		{
+			// Values of the earlier forms die with their region, leaving it free to be reused
+			if (last) result = std::move(value);
+		});
+		return result;
 	}
 
-	void eval_file(ASTExpr* expr)
+	Slot eval_source(Interpreter& interp, const std::string& source, Slot& raised)
 	{
-		std::cout << "NOT IMPLEMENTED: Evaluating a file" << std::endl;
+		Slot result;
+		eval_forms(interp, source, false, [&result](Slot& value, bool last)
+		{
+			if (last) result = std::move(value);
+		}, &raised);
+		return result;
+	}
+
+	bool eval_file(Interpreter& interp, const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "Could not open file: " << path << '\n';
+			return false;
+		}
+
+		std::stringstream source;
+		source << file.rdbuf();
+		eval_source(interp, source.str());
+		return true;
 	}
 
-	void repl()
+	void repl(Interpreter& interp)
 	{
 		std::cout << "A Scheme interpreter by @ncvetan\nEnter 'exit' to close the program\n";
 		while (true)
 		{
 			std::string line;
 			std::cout << ">> ";
-			std::getline(std::cin, line);
-			if (line == "exit") break;
-			
-			auto ast = construct_ast(std::move(tokenize(line)));
-			auto result = eval_expr(&ast);
+			if (!std::getline(std::cin, line)) break;
+
+			bool more = eval_forms(interp, line, true, [](Slot& result, bool)
+			{
+				if (result.type != Variable::Type::INVALID) print_slot(result);
+			});
+			if (!more) break;
+		}
+	}
 
-			if (result != nullptr)
+	void FormScanner::scan(const std::string& text)
+	{
+		for (; scanned < text.size(); scanned++)
+		{
+			char c = text[scanned];
+			if (in_comment)
+			{
+				in_comment = c != '\n';
+				if (!in_comment && depth == 0) complete = scanned + 1;
+				continue;
+			}
+			if (in_string)
 			{
-				print_variable(std::move(result));
+				in_string = c != '"';
+				continue;
+			}
+
+			switch (c)
+			{
+			case '"':
+				in_string = true;
+				if (depth == 0) in_atom = true;
+				break;
+			case ';':
+				end_atom();
+				in_comment = true;
+				break;
+			case '(':
+				// Ends an atom written right before it
+				end_atom();
+				if (depth == 0) complete = scanned;
+				depth++;
+				break;
+			case ')':
+				// A stray closing bracket is left for the parser to report
+				end_atom();
+				if (depth > 0) depth--;
+				if (depth == 0)
+				{
+					complete = scanned + 1;
+					ends.push_back(complete);
+				}
+				break;
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+				end_atom();
+				if (depth == 0) complete = scanned + 1;
+				break;
+			default:
+				if (depth == 0) in_atom = true;
+				break;
 			}
 		}
 	}
+
+	void FormScanner::end_atom()
+	{
+		if (!in_atom) return;
+		ends.push_back(scanned);
+		in_atom = false;
+	}
+
+	void FormScanner::consume(std::size_t count)
+	{
+		scanned -= count;
+		complete -= count;
+
+		std::size_t kept = 0;
+		for (auto end : ends)
+		{
+			if (end > count) ends[kept++] = end - count;
+		}
+		ends.resize(kept);
+	}
+
+	bool pipeline(Interpreter& interp, int fd, std::ostream& out)
+	{
+		std::string pending;
+		FormScanner scanner;
+		std::unique_ptr<char[]> block(new char[pipeline_block_size]);
+
+		auto print = [&out](Slot& result, bool)
+		{
+			if (result.type == Variable::Type::INVALID) return;
+			write_slot(out, result);
+			out << '\n';
+		};
+
+		while (true)
+		{
+			// Results so far are written out before waiting, so a consumer downstream is never left behind
+			out.flush();
+			auto count = read(fd, block.get(), pipeline_block_size);
+			if (count < 0 && errno == EINTR) continue;
+			if (count < 0)
+			{
+				std::cout << "Could not read the input: " << std::strerror(errno) << '\n';
+				return false;
+			}
+			if (count == 0) break;
+
+			pending.append(block.get(), count);
+			scanner.scan(pending);
+			if (scanner.complete == 0) continue;
+
+			// Forms are parsed and evaluated one at a time, so a syntax error is reported after the results before it
+			std::size_t start = 0;
+			for (auto end : scanner.ends)
+			{
+				if (end > scanner.complete) break;
+				if (!eval_forms(interp, pending.substr(start, end - start), true, print)) return true;
+				start = end;
+			}
+			pending.erase(0, scanner.complete);
+			scanner.consume(scanner.complete);
+		}
+
+		// The input may end right after its last form, or part way through one, which the parser reports
+		eval_forms(interp, pending, true, print);
+		out.flush();
+		return true;
+	}
+}
+
+namespace environment
+{
+	using eval::Frame;
+
+	Closure::Closure(std::shared_ptr<const Code> code, std::vector<Binding> captured) :
+		VarCopy(Variable::Type::PROCEDURE), code(std::move(code)), captured(std::move(captured)) {}
+
+	Slot Closure::call(Interpreter& interp, Span<Slot> args)
+	{
+		if (args.size() != code->params.size())
+		{
+			return eval::fail(interp, "Procedure expects ", code->params.size(), " arguments, received: ", args.size());
+		}
+
+		char marker;
+		if (interp.depth >= interp.max_depth || reinterpret_cast<std::uintptr_t>(&marker) < interp.stack_floor)
+		{
+			return eval::fail(interp, "Procedure calls nested too deeply, ", interp.depth, " calls were in progress");
+		}
+
+		Frame frame;
+		frame.locals.reserve(captured.size() + args.size());
+		for (auto& binding : captured) frame.locals.push_back({ &binding.name, binding.value });
+		for (std::size_t i = 0; i < args.size(); i++) frame.locals.push_back({ &code->params[i], std::move(args[i]) });
+
+		Frame* caller = interp.frame;
+		interp.frame = &frame;
+		interp.depth++;
+		std::string_view label = name.empty() ? std::string_view("lambda") : name;
+		profile::Frame profiled(label);
+		trace::Call traced(label);
+		SCHEME_INSTRUMENT_CALL(label);
+
+		Slot result;
+		for (auto& expr : code->body)
+		{
+			result = eval::eval_slot(interp, &expr);
+			if (interp.escape != nullptr) break;
+		}
+
+		interp.depth--;
+		interp.frame = caller;
+		return result;
+	}
 }
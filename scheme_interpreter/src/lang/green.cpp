@@ -0,0 +1,508 @@
+#include <lang/green.hpp>
+#include <lang/condition.hpp>
+#include <lang/output.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace green
+{
+
+	Scheduler::Scheduler(Interpreter& interp) : interp(interp)
+	{
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	}
+
+	Scheduler::~Scheduler()
+	{
+		for (auto fiber : fibers)
+		{
+			munmap(fiber->stack, stack_size);
+			delete fiber;
+		}
+		if (epoll_fd >= 0) close(epoll_fd);
+	}
+
+	Fiber* Scheduler::current() const noexcept
+	{
+		return running;
+	}
+
+	bool Scheduler::in_root() const noexcept
+	{
+		return running == &root;
+	}
+
+	void Scheduler::entry(unsigned int high, unsigned int low)
+	{
+		auto self = reinterpret_cast<Scheduler*>((static_cast<std::uintptr_t>(high) << 32) | low);
+		Fiber* fiber = self->running;
+
+		// A thread that raises an error nothing in it catches ends there, like a top-level form
+		Slot raised;
+		eval::catch_uncaught(self->interp, raised, [&]() { return fiber->procedure.boxed->call(self->interp, Span<Slot>()); });
+		if (raised.type != Variable::Type::INVALID)
+		{
+			eval::write_uncaught(std::cout, raised);
+			std::cout << '\n';
+		}
+		fiber->procedure = Slot();
+		fiber->done = true;
+
+		// Never resumed, the root frees the stack once it is back in control
+		self->suspend();
+	}
+
+	void Scheduler::spawn(Slot procedure)
+	{
+		auto fiber = new Fiber();
+		fiber->procedure = std::move(procedure);
+
+		// Stacks are only committed as they are touched, and the lowest page is left unmapped to catch overflow
+		fiber->stack = mmap(nullptr, stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+		if (fiber->stack == MAP_FAILED)
+		{
+			std::cout << "Could not allocate a green thread stack: " << std::strerror(errno) << '\n';
+			delete fiber;
+			return;
+		}
+		mprotect(fiber->stack, 4096, PROT_NONE);
+
+		// Calls in the thread raise before they reach the unmapped page
+		fiber->max_depth = eval::depth_limit(stack_size - 4096);
+		fiber->stack_floor = reinterpret_cast<std::uintptr_t>(fiber->stack) + 4096 + eval::stack_reserve_bytes;
+
+		getcontext(&fiber->context);
+		fiber->context.uc_stack.ss_sp = fiber->stack;
+		fiber->context.uc_stack.ss_size = stack_size;
+		fiber->context.uc_link = nullptr;
+
+		auto self = reinterpret_cast<std::uintptr_t>(this);
+		makecontext(&fiber->context, reinterpret_cast<void (*)()>(&Scheduler::entry), 2,
+			static_cast<unsigned int>(self >> 32), static_cast<unsigned int>(self & 0xffffffffu));
+
+		fibers.insert(fiber);
+		ready.push_back(fiber);
+	}
+
+	void Scheduler::resume(Fiber* fiber)
+	{
+		// Each thread has its own chain of calls, so the interpreter's innermost frame, handlers and depth are swapped along with the stack
+		root.frame = interp.frame;
+		interp.frame = fiber->frame;
+		std::swap(interp.handlers, fiber->handlers);
+		swap_depth(fiber);
+		running = fiber;
+		auto root_calls = profile::switch_stack(&fiber->calls);
+
+		swapcontext(&root.context, &fiber->context);
+
+		profile::switch_stack(root_calls);
+		fiber->frame = interp.frame;
+		interp.frame = root.frame;
+		std::swap(interp.handlers, fiber->handlers);
+		swap_depth(fiber);
+		running = &root;
+
+		if (fiber->done)
+		{
+			fibers.erase(fiber);
+			munmap(fiber->stack, stack_size);
+			delete fiber;
+		}
+	}
+
+	void Scheduler::swap_depth(Fiber* fiber)
+	{
+		std::swap(interp.depth, fiber->depth);
+		std::swap(interp.max_depth, fiber->max_depth);
+		std::swap(interp.stack_floor, fiber->stack_floor);
+	}
+
+	void Scheduler::suspend()
+	{
+		swapcontext(&running->context, &root.context);
+	}
+
+	void Scheduler::yield()
+	{
+		if (!in_root())
+		{
+			ready.push_back(running);
+			suspend();
+			return;
+		}
+
+		poll(0);
+		for (std::size_t n = ready.size(); n > 0 && !ready.empty(); n--)
+		{
+			auto fiber = ready.front();
+			ready.pop_front();
+			resume(fiber);
+		}
+	}
+
+	bool Scheduler::park()
+	{
+		if (!in_root())
+		{
+			suspend();
+			return true;
+		}
+
+		root.woken = false;
+		return run_until([this]() { return root.woken; });
+	}
+
+	void Scheduler::wake(Fiber* fiber)
+	{
+		if (fiber == &root) root.woken = true;
+		else ready.push_back(fiber);
+	}
+
+	bool Scheduler::run_until(const std::function<bool()>& done)
+	{
+		while (!done())
+		{
+			if (!ready.empty())
+			{
+				auto fiber = ready.front();
+				ready.pop_front();
+				resume(fiber);
+			}
+			else if (fd_waiters > 0)
+			{
+				poll(-1);
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Scheduler::run()
+	{
+		run_until([]() { return false; });
+	}
+
+	bool Scheduler::wait_fd(int fd, std::uint32_t events)
+	{
+		epoll_event event{};
+		event.events = events | EPOLLONESHOT;
+		event.data.fd = fd;
+
+		// One shot registrations stay in the set disarmed, so later waits re-arm them instead of adding them again
+		auto known = registered.find(fd);
+		if (known != registered.end() && known->second != nullptr)
+		{
+			errno = EBUSY;
+			return false;
+		}
+		if (epoll_ctl(epoll_fd, known != registered.end() ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) != 0) return false;
+		registered[fd] = running;
+
+		fd_waiters++;
+		Fiber* self = running;
+		if (!park()) return false;
+
+		if (self->fd_closed)
+		{
+			self->fd_closed = false;
+			errno = EBADF;
+			return false;
+		}
+		return true;
+	}
+
+	void Scheduler::forget_fd(int fd)
+	{
+		auto known = registered.find(fd);
+		if (known == registered.end()) return;
+
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+		if (known->second != nullptr)
+		{
+			// The waiting thread would otherwise never be woken, and the scheduler would wait on an empty set for good
+			known->second->fd_closed = true;
+			fd_waiters--;
+			wake(known->second);
+		}
+		registered.erase(known);
+	}
+
+	void Scheduler::poll(int timeout)
+	{
+		if (fd_waiters == 0) return;
+
+		epoll_event events[64];
+		int count = epoll_wait(epoll_fd, events, 64, timeout);
+
+		for (int i = 0; i < count; i++)
+		{
+			auto& waiter = registered[events[i].data.fd];
+			fd_waiters--;
+			wake(waiter);
+			waiter = nullptr;
+		}
+	}
+
+	Scheduler& scheduler_for(Interpreter& interp)
+	{
+		if (interp.scheduler == nullptr) interp.scheduler = std::make_shared<Scheduler>(interp);
+		return *interp.scheduler;
+	}
+}
+
+namespace environment
+{
+	Channel::Channel(green::Scheduler* owner, std::size_t capacity) : VarCopy(Variable::Type::CHANNEL), state(std::make_shared<State>())
+	{
+		state->owner = owner;
+		state->ring.resize(capacity);
+	}
+
+	Slot Channel::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "Channel variable is not callable");
+	}
+
+	namespace builtins
+	{
+		using Type = Variable::Type;
+
+		Slot spawn(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1 || args[0].type != Type::PROCEDURE)
+			{
+				return eval::fail(interp, "Spawn procedure expects a procedure of no arguments");
+			}
+			green::scheduler_for(interp).spawn(std::move(args[0]));
+			return Slot();
+		}
+
+		Slot yield(Interpreter& interp, Span<Slot> args)
+		{
+			green::scheduler_for(interp).yield();
+			return Slot();
+		}
+
+		Slot run_threads(Interpreter& interp, Span<Slot> args)
+		{
+			auto& scheduler = green::scheduler_for(interp);
+			if (!scheduler.in_root())
+			{
+				return eval::fail(interp, "Run threads procedure can only be called outside of a green thread");
+			}
+			scheduler.run();
+			return Slot();
+		}
+
+		/**
+		 * Reads the channel argument, which must belong to the calling interpreter
+		*/
+		static Channel::State* get_channel(Interpreter& interp, const Slot& slot, const char* name)
+		{
+			if (slot.type != Type::CHANNEL)
+			{
+				eval::fail(interp, name, " procedure received an invalid argument type: ", get_type_as_string(slot.type));
+				return nullptr;
+			}
+
+			auto state = static_cast<Channel*>(slot.boxed)->state.get();
+			if (state->owner != &green::scheduler_for(interp))
+			{
+				eval::fail(interp, name, " procedure received a channel of another interpreter");
+				return nullptr;
+			}
+			return state;
+		}
+
+		Slot make_channel(Interpreter& interp, Span<Slot> args)
+		{
+			// There is no rendezvous channel, a sender always leaves its value in the buffer
+			if (args.size() != 1 || args[0].type != Type::INT || args[0].i_value < 1)
+			{
+				return eval::fail(interp, "Make channel procedure expects a capacity of at least 1");
+			}
+			return Slot::from_variable(std::make_unique<Channel>(&green::scheduler_for(interp), args[0].i_value));
+		}
+
+		Slot channel_send(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2)
+			{
+				return eval::fail(interp, "Channel send procedure expects 2 arguments");
+			}
+
+			auto channel = get_channel(interp, args[0], "Channel send");
+			if (channel == nullptr) return Slot();
+
+			auto& scheduler = green::scheduler_for(interp);
+			while (channel->count == channel->ring.size())
+			{
+				channel->senders.push_back(scheduler.current());
+				if (!scheduler.park())
+				{
+					// Leaving the entry behind would let a later wake up go to a thread that is no longer waiting
+					channel->senders.pop_back();
+					return eval::fail(interp, "Channel send would wait forever, no thread is left to receive");
+				}
+			}
+
+			channel->ring[(channel->head + channel->count) % channel->ring.size()] = std::move(args[1]);
+			channel->count++;
+
+			if (!channel->receivers.empty())
+			{
+				scheduler.wake(channel->receivers.front());
+				channel->receivers.pop_front();
+			}
+			return Slot();
+		}
+
+		Slot channel_receive(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1)
+			{
+				return eval::fail(interp, "Channel receive procedure expects 1 argument");
+			}
+
+			auto channel = get_channel(interp, args[0], "Channel receive");
+			if (channel == nullptr) return Slot();
+
+			auto& scheduler = green::scheduler_for(interp);
+			while (channel->count == 0)
+			{
+				channel->receivers.push_back(scheduler.current());
+				if (!scheduler.park())
+				{
+					// Leaving the entry behind would let a later wake up go to a thread that is no longer waiting
+					channel->receivers.pop_back();
+					return eval::fail(interp, "Channel receive would wait forever, no thread is left to send");
+				}
+			}
+
+			Slot value = std::move(channel->ring[channel->head]);
+			channel->head = (channel->head + 1) % channel->ring.size();
+			channel->count--;
+
+			if (!channel->senders.empty())
+			{
+				scheduler.wake(channel->senders.front());
+				channel->senders.pop_front();
+			}
+			return value;
+		}
+
+		Slot make_pipe(Interpreter& interp, Span<Slot> args)
+		{
+			int fds[2];
+			if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+			{
+				return eval::fail(interp, "Could not create a pipe: ", std::strerror(errno));
+			}
+
+			auto vec = std::make_unique<Vector>(2, Slot(fds[0]));
+			vec->set(1, Slot(fds[1]));
+			return Slot::from_variable(std::move(vec));
+		}
+
+		Slot open_file(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2 || args[0].type != Type::STRING || args[1].type != Type::STRING)
+			{
+				return eval::fail(interp, "Open file procedure expects a path and a mode of \"r\", \"w\" or \"a\"");
+			}
+
+			auto& mode = static_cast<String*>(args[1].boxed)->value;
+			int flags = O_NONBLOCK | O_CLOEXEC;
+			if (mode == "r") flags |= O_RDONLY;
+			else if (mode == "w") flags |= O_WRONLY | O_CREAT | O_TRUNC;
+			else if (mode == "a") flags |= O_WRONLY | O_CREAT | O_APPEND;
+			else
+			{
+				return eval::fail(interp, "Open file procedure received an invalid mode: ", mode);
+			}
+
+			auto& path = static_cast<String*>(args[0].boxed)->value;
+			int fd = open(path.c_str(), flags, 0644);
+			if (fd < 0)
+			{
+				return eval::fail(interp, "Could not open ", path, ": ", std::strerror(errno));
+			}
+			return Slot(fd);
+		}
+
+		Slot fd_read(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2 || args[0].type != Type::INT || args[1].type != Type::INT || args[1].i_value < 0)
+			{
+				return eval::fail(interp, "Fd read procedure expects a descriptor and a byte count");
+			}
+
+			std::string data(args[1].i_value, '\0');
+			while (true)
+			{
+				auto res = read(args[0].i_value, data.data(), data.size());
+				if (res >= 0)
+				{
+					// A short read is returned as is, an empty string means end of file
+					data.resize(res);
+					return Slot::from_variable(std::make_unique<String>(std::move(data)));
+				}
+				if (errno == EINTR) continue;
+				if (errno != EAGAIN || !green::scheduler_for(interp).wait_fd(args[0].i_value, EPOLLIN)) break;
+			}
+
+			return eval::fail(interp, "Could not read from descriptor ", args[0].i_value, ": ", std::strerror(errno));
+		}
+
+		Slot fd_write(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2 || args[0].type != Type::INT || args[1].type != Type::STRING)
+			{
+				return eval::fail(interp, "Fd write procedure expects a descriptor and a string");
+			}
+
+			auto& data = static_cast<String*>(args[1].boxed)->value;
+			std::size_t written = 0;
+
+			// Keeps what the interpreter printed ahead of what is written straight to the same descriptor
+			if (args[0].i_value == STDOUT_FILENO) output::flush();
+
+			while (written < data.size())
+			{
+				auto res = write(args[0].i_value, data.data() + written, data.size() - written);
+				if (res >= 0)
+				{
+					written += res;
+					continue;
+				}
+				if (errno == EINTR) continue;
+				if (errno != EAGAIN || !green::scheduler_for(interp).wait_fd(args[0].i_value, EPOLLOUT))
+				{
+					return eval::fail(interp, "Could not write to descriptor ", args[0].i_value, ": ", std::strerror(errno));
+				}
+			}
+			return Slot(static_cast<int>(written));
+		}
+
+		Slot fd_close(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1 || args[0].type != Type::INT)
+			{
+				return eval::fail(interp, "Fd close procedure expects a descriptor");
+			}
+
+			green::scheduler_for(interp).forget_fd(args[0].i_value);
+			close(args[0].i_value);
+			return Slot();
+		}
+	}
+}
@@ -0,0 +1,296 @@
+#include <lang/hash_table.hpp>
+#include <lang/condition.hpp>
+#include <lang/evaluate.hpp>
+#include <lang/region.hpp>
+
+namespace environment
+{
+
+	static constexpr std::size_t min_capacity = 8;
+	static constexpr std::size_t not_found = static_cast<std::size_t>(-1);
+
+	HashTable::HashTable(Equivalence equivalence, std::size_t capacity) : VarCopy(Variable::Type::HASH_TABLE), table(std::make_shared<Table>())
+	{
+		table->equivalence = equivalence;
+		table->outlives_form.store(!region::active(), std::memory_order_relaxed);
+		reserve(capacity);
+	}
+
+	std::size_t HashTable::size() const noexcept
+	{
+		return table->count;
+	}
+
+	std::size_t HashTable::find_index(const Slot& key, std::uint32_t hash) const
+	{
+		auto& entries = table->entries;
+		if (entries.empty()) return not_found;
+
+		std::size_t mask = entries.size() - 1;
+		std::size_t idx = hash & mask;
+
+		for (std::uint32_t probe = 1; ; probe++)
+		{
+			const Entry& entry = entries[idx];
+
+			// An empty entry, or one closer to home than we are, means the key would already have been placed
+			if (entry.probe < probe) return not_found;
+			if (entry.hash == hash && slots_equivalent(entry.key, key, table->equivalence)) return idx;
+
+			idx = (idx + 1) & mask;
+		}
+	}
+
+	const Slot* HashTable::find(const Slot& key) const
+	{
+		auto idx = find_index(key, static_cast<std::uint32_t>(hash_slot(key, table->equivalence)));
+		if (idx == not_found) return nullptr;
+		return &table->entries[idx].value;
+	}
+
+	void HashTable::insert(Slot key, Slot value)
+	{
+		auto hash = static_cast<std::uint32_t>(hash_slot(key, table->equivalence));
+
+		auto idx = find_index(key, hash);
+		if (idx != not_found)
+		{
+			table->entries[idx].value = std::move(value);
+			return;
+		}
+
+		// Only a new key can take the table past its load limit
+		reserve(table->count + 1);
+		insert_hashed(std::move(key), std::move(value), hash);
+	}
+
+	void HashTable::insert_hashed(Slot key, Slot value, std::uint32_t hash)
+	{
+		auto& entries = table->entries;
+		std::size_t mask = entries.size() - 1;
+		std::size_t idx = hash & mask;
+
+		Entry carry{ hash, 1, std::move(key), std::move(value) };
+
+		while (true)
+		{
+			Entry& entry = entries[idx];
+
+			if (entry.probe == 0)
+			{
+				entry = std::move(carry);
+				table->count++;
+				return;
+			}
+			// Take the place of entries that are closer to their home bucket, then carry on placing them
+			if (entry.probe < carry.probe) std::swap(entry, carry);
+
+			idx = (idx + 1) & mask;
+			carry.probe++;
+		}
+	}
+
+	bool HashTable::erase(const Slot& key)
+	{
+		auto idx = find_index(key, static_cast<std::uint32_t>(hash_slot(key, table->equivalence)));
+		if (idx == not_found) return false;
+
+		auto& entries = table->entries;
+		std::size_t mask = entries.size() - 1;
+		std::size_t next = (idx + 1) & mask;
+
+		while (entries[next].probe > 1)
+		{
+			entries[idx] = std::move(entries[next]);
+			entries[idx].probe--;
+			idx = next;
+			next = (next + 1) & mask;
+		}
+
+		entries[idx] = Entry();
+		table->count--;
+		return true;
+	}
+
+	void HashTable::reserve(std::size_t count)
+	{
+		// Robin Hood probing keeps probe lengths short up to a load factor of 7/8
+		std::size_t capacity = table->entries.size();
+		std::size_t new_capacity = capacity == 0 ? min_capacity : capacity;
+		while (count * 8 > new_capacity * 7) new_capacity *= 2;
+
+		if (new_capacity == capacity) return;
+
+		std::vector<Entry> old_entries(new_capacity);
+		old_entries.swap(table->entries);
+		table->count = 0;
+
+		for (auto& entry : old_entries)
+		{
+			if (entry.probe != 0) insert_hashed(std::move(entry.key), std::move(entry.value), entry.hash);
+		}
+	}
+
+	Slot HashTable::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "Hash table variable is not callable");
+	}
+
+	namespace builtins
+	{
+		using Type = Variable::Type;
+
+		Slot make_hash_table(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() > 1)
+			{
+				return eval::fail(interp, "Make hash table procedure expects an optional equivalence procedure");
+			}
+
+			if (args.empty()) return Slot::from_variable(std::make_unique<HashTable>(Equivalence::EQUAL));
+
+			auto builtin = args[0].type == Type::PROCEDURE ? dynamic_cast<Builtin*>(args[0].boxed) : nullptr;
+			auto fn = builtin != nullptr ? builtin->entry->fn : nullptr;
+			Equivalence equivalence;
+
+			if (fn == is_eq) equivalence = Equivalence::EQ;
+			else if (fn == is_eqv) equivalence = Equivalence::EQV;
+			else if (fn == is_equal) equivalence = Equivalence::EQUAL;
+			else if (fn == is_string_equal) equivalence = Equivalence::STRING;
+			else
+			{
+				return eval::fail(interp, "Make hash table procedure expects one of eq?, eqv?, equal?, or string=?");
+			}
+			return Slot::from_variable(std::make_unique<HashTable>(equivalence));
+		}
+
+		/**
+		 * Checks that a key can be used with a table, string tables only accept strings
+		*/
+		static bool valid_key(Interpreter& interp, const HashTable& table, const Slot& key)
+		{
+			if (table.table->equivalence == Equivalence::STRING && key.type != Variable::Type::STRING)
+			{
+				eval::fail(interp, "Hash table created with string=? expects string keys, received: ", get_type_as_string(key.type));
+				return false;
+			}
+			return true;
+		}
+
+		Slot hash_table_set(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 3)
+			{
+				return eval::fail(interp, "Hash table set procedure expects a hash table, a key, and a value");
+			}
+
+			if (args[0].type != Type::HASH_TABLE)
+			{
+				return eval::fail(interp, "Hash table set procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+
+			auto table = static_cast<HashTable*>(args[0].boxed);
+
+			if (!valid_key(interp, *table, args[1])) return Slot();
+			if (table->table->frozen.load(std::memory_order_acquire) != 0)
+			{
+				return eval::fail(interp, "Hash table set procedure cannot change a frozen hash table, other threads may be reading it");
+			}
+
+			if (table->table->outlives_form.load(std::memory_order_relaxed))
+			{
+				region::promote(args[1]);
+				region::promote(args[2]);
+			}
+			table->insert(std::move(args[1]), std::move(args[2]));
+			return Slot();
+		}
+
+		/**
+		 * Looks up a key, falling back to the third argument when `has_default` is set
+		*/
+		static Slot ref(Interpreter& interp, Span<Slot> args, bool has_default)
+		{
+			if (args.size() != (has_default ? 3 : 2))
+			{
+				return eval::fail(interp, "Hash table ref procedure expects a hash table, a key", (has_default ? ", and a default value" : ""));
+			}
+
+			if (args[0].type != Type::HASH_TABLE)
+			{
+				return eval::fail(interp, "Hash table ref procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+
+			auto table = static_cast<HashTable*>(args[0].boxed);
+
+			if (!valid_key(interp, *table, args[1])) return Slot();
+
+			auto value = table->find(args[1]);
+			if (value != nullptr) return *value;
+			if (has_default) return std::move(args[2]);
+
+			return eval::fail(interp, "Hash table does not contain the given key");
+		}
+
+		Slot hash_table_ref(Interpreter& interp, Span<Slot> args)
+		{
+			return ref(interp, args, false);
+		}
+
+		Slot hash_table_ref_default(Interpreter& interp, Span<Slot> args)
+		{
+			return ref(interp, args, true);
+		}
+
+		Slot hash_table_delete(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2)
+			{
+				return eval::fail(interp, "Hash table delete procedure expects a hash table and a key");
+			}
+
+			if (args[0].type != Type::HASH_TABLE)
+			{
+				return eval::fail(interp, "Hash table delete procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+
+			auto table = static_cast<HashTable*>(args[0].boxed);
+			if (table->table->frozen.load(std::memory_order_acquire) != 0)
+			{
+				return eval::fail(interp, "Hash table delete procedure cannot change a frozen hash table, other threads may be reading it");
+			}
+			table->erase(args[1]);
+			return Slot();
+		}
+
+		Slot hash_table_exists(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2)
+			{
+				return eval::fail(interp, "Hash table exists procedure expects a hash table and a key");
+			}
+
+			if (args[0].type != Type::HASH_TABLE)
+			{
+				return eval::fail(interp, "Hash table exists procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+
+			return Slot(static_cast<HashTable*>(args[0].boxed)->find(args[1]) != nullptr);
+		}
+
+		Slot hash_table_size(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1)
+			{
+				return eval::fail(interp, "Hash table size procedure expects 1 argument");
+			}
+
+			if (args[0].type != Type::HASH_TABLE)
+			{
+				return eval::fail(interp, "Hash table size procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+			return Slot(static_cast<int>(static_cast<HashTable*>(args[0].boxed)->size()));
+		}
+	}
+
+}
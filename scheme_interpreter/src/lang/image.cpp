@@ -0,0 +1,769 @@
+#include <lang/image.hpp>
+#include <lang/hash_table.hpp>
+#include <lang/persistent.hpp>
+#include <lang/region.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace image
+{
+
+	/**
+	 * Layout of an image, every offset counted from the start of the file:
+	 *
+	 * header: magic, version, byte order mark, entry count, index capacity and offset, object count and
+	 *     offset, file size
+	 * entries: name followed by the encoded value, one per definition
+	 * object bodies: vectors and hash tables, referred to from values by id
+	 * object table: offset of each object body, indexed by id
+	 * index: open addressed hash table of (hash of name, entry offset) pairs, offset zero marks an empty bucket
+	*/
+	constexpr char magic[8] = { 'S', 'C', 'M', 'I', 'M', 'A', 'G', 'E' };
+	constexpr std::uint32_t version = 1;
+	constexpr std::uint32_t byte_order = 0x01020304;
+	constexpr std::size_t header_size = 64;
+	constexpr std::size_t bucket_size = 16;
+	constexpr unsigned max_depth = 1024;		// Deeper nesting than this is taken to be a corrupt file
+
+	enum class Tag : std::uint8_t
+	{
+		INVALID,
+		INT,
+		FLOAT,
+		BOOL,
+		STRING,
+		SYMBOL,
+		OBJECT,
+		PERSISTENT_VECTOR,
+		PERSISTENT_MAP,
+		BUILTIN,
+		CLOSURE
+	};
+
+	enum class ObjectKind : std::uint8_t
+	{
+		VECTOR,
+		HASH_TABLE
+	};
+
+	enum class NodeKind : std::uint8_t
+	{
+		LIST,
+		ATOM
+	};
+
+	/**
+	 * FNV-1a, fixed here rather than std::hash so that an image reads the same in any build
+	*/
+	static std::uint64_t hash_name(std::string_view name)
+	{
+		std::uint64_t hash = 14695981039346656037ull;
+		for (unsigned char c : name)
+		{
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	/**
+	 * Encodes values into the bytes of an image
+	*/
+	class Encoder
+	{
+	public:
+		std::string out;
+		std::vector<const Variable*> objects;	// Vectors and hash tables in id order, bodies written after the entries
+		bool ok = true;
+
+		template<typename T>
+		void put(T value)
+		{
+			out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+
+		template<typename T>
+		void put_at(std::size_t offset, T value)
+		{
+			std::memcpy(out.data() + offset, &value, sizeof(value));
+		}
+
+		void put_string(std::string_view value)
+		{
+			put(static_cast<std::uint32_t>(value.size()));
+			out.append(value);
+		}
+
+		void align()
+		{
+			out.resize((out.size() + 7) & ~std::size_t(7), '\0');
+		}
+
+		void put_slot(const Slot& slot)
+		{
+			switch (slot.type)
+			{
+			case Variable::Type::INVALID:
+				put(Tag::INVALID);
+				break;
+			case Variable::Type::INT:
+				put(Tag::INT);
+				put(static_cast<std::int32_t>(slot.i_value));
+				break;
+			case Variable::Type::FLOAT:
+				put(Tag::FLOAT);
+				put(slot.f_value);
+				break;
+			case Variable::Type::BOOL:
+				put(Tag::BOOL);
+				put(static_cast<std::uint8_t>(slot.b_value));
+				break;
+			default:
+				put_variable(*slot.boxed);
+				break;
+			}
+		}
+
+		void put_variable(const Variable& var)
+		{
+			switch (var.type)
+			{
+			case Variable::Type::INT:
+				put(Tag::INT);
+				put(static_cast<std::int32_t>(static_cast<const Int&>(var).value));
+				break;
+			case Variable::Type::FLOAT:
+				put(Tag::FLOAT);
+				put(static_cast<const Float&>(var).value);
+				break;
+			case Variable::Type::BOOL:
+				put(Tag::BOOL);
+				put(static_cast<std::uint8_t>(static_cast<const Bool&>(var).value));
+				break;
+			case Variable::Type::STRING:
+				put(Tag::STRING);
+				put_string(static_cast<const String&>(var).value);
+				break;
+			case Variable::Type::SYMBOL:
+				put(Tag::SYMBOL);
+				put_string(static_cast<const Symbol&>(var).value);
+				break;
+			case Variable::Type::VECTOR:
+				put(Tag::OBJECT);
+				put(object_id(static_cast<const Vector&>(var).buffer.get(), var));
+				break;
+			case Variable::Type::HASH_TABLE:
+				put(Tag::OBJECT);
+				put(object_id(static_cast<const HashTable&>(var).table.get(), var));
+				break;
+			case Variable::Type::PERSISTENT_VECTOR:
+			{
+				auto& vec = static_cast<const PersistentVector&>(var);
+				put(Tag::PERSISTENT_VECTOR);
+				put(static_cast<std::uint64_t>(vec.size()));
+				for (std::size_t i = 0; i < vec.size(); i++) put_slot(vec.at(i));
+				break;
+			}
+			case Variable::Type::PERSISTENT_MAP:
+			{
+				auto& map = static_cast<const PersistentMap&>(var);
+				put(Tag::PERSISTENT_MAP);
+				put(static_cast<std::uint64_t>(map.size()));
+				map.for_each([this](const Slot& key, const Slot& value) {
+					put_slot(key);
+					put_slot(value);
+				});
+				break;
+			}
+			case Variable::Type::PROCEDURE:
+			{
+				if (auto builtin = dynamic_cast<const Builtin*>(&var))
+				{
+					put(Tag::BUILTIN);
+					put_string(builtin->entry->name);
+					break;
+				}
+
+				auto closure = dynamic_cast<const Closure*>(&var);
+				if (closure == nullptr)
+				{
+					fail(var);
+					break;
+				}
+
+				put(Tag::CLOSURE);
+				put(static_cast<std::uint32_t>(closure->code->params.size()));
+				for (auto& param : closure->code->params) put_string(param);
+				put(static_cast<std::uint32_t>(closure->code->body.size()));
+				for (auto& expr : closure->code->body) put_ast(expr);
+				put(static_cast<std::uint32_t>(closure->captured.size()));
+				for (auto& binding : closure->captured)
+				{
+					put_string(binding.name);
+					put_slot(binding.value);
+				}
+				break;
+			}
+			default:
+				fail(var);
+				break;
+			}
+		}
+
+		void put_ast(const ASTExpr& expr)
+		{
+			if (expr.type == ASTExpr::Type::LIST)
+			{
+				put(NodeKind::LIST);
+				put(static_cast<std::uint32_t>(expr.children.size()));
+				for (auto& child : expr.children) put_ast(child);
+				return;
+			}
+
+			put(NodeKind::ATOM);
+			put(static_cast<std::uint8_t>(expr.leaf.type));
+			switch (expr.leaf.type)
+			{
+			case Token::Type::SYMBOL:
+			case Token::Type::STRING:
+			case Token::Type::ERROR:
+				put_string(expr.leaf.symbol);
+				break;
+			case Token::Type::INT:
+				put(static_cast<std::int32_t>(expr.leaf.i_value));
+				break;
+			case Token::Type::FLOAT:
+				put(expr.leaf.f_value);
+				break;
+			default:
+				break;
+			}
+		}
+
+		void put_object(const Variable& var)
+		{
+			if (var.type == Variable::Type::VECTOR)
+			{
+				auto& vec = static_cast<const Vector&>(var);
+				put(ObjectKind::VECTOR);
+				put(static_cast<std::uint64_t>(vec.size()));
+				for (std::size_t i = 0; i < vec.size(); i++) put_slot(vec.at(i));
+				return;
+			}
+
+			auto& table = *static_cast<const HashTable&>(var).table;
+			put(ObjectKind::HASH_TABLE);
+			put(static_cast<std::uint8_t>(table.equivalence));
+			put(static_cast<std::uint64_t>(table.count));
+			for (auto& entry : table.entries)
+			{
+				if (entry.probe == 0) continue;
+				put_slot(entry.key);
+				put_slot(entry.value);
+			}
+		}
+
+	private:
+		std::unordered_map<const void*, std::uint64_t> ids;		// Keyed by the storage that copies of a container share
+
+		std::uint64_t object_id(const void* storage, const Variable& var)
+		{
+			auto [it, inserted] = ids.emplace(storage, objects.size());
+			if (inserted) objects.push_back(&var);
+			return it->second;
+		}
+
+		void fail(const Variable& var)
+		{
+			if (ok) std::cout << "Cannot write a value of type " << get_var_type_as_string(var) << " to an image\n";
+			ok = false;
+		}
+	};
+
+	bool dump_image(const Environment& env, const std::string& path)
+	{
+		// Definitions in a layer hide any of the same name further down
+		std::vector<std::pair<std::string, const Variable*>> definitions;
+		std::unordered_set<std::string> seen;
+		for (auto layer = &env; layer != nullptr; layer = layer->parent.get())
+		{
+			for (auto& [name, var] : layer->env_map)
+			{
+				if (seen.insert(name).second) definitions.emplace_back(name, var.get());
+			}
+			if (layer->image == nullptr) continue;
+
+			layer->image->for_each_name([&](std::string_view name) {
+				std::string key(name);
+				if (seen.insert(key).second) definitions.emplace_back(key, layer->image->find(key));
+			});
+		}
+		// Sorted so the same definitions always give the same file
+		std::sort(definitions.begin(), definitions.end(), [](auto& lhs, auto& rhs) { return lhs.first < rhs.first; });
+
+		Encoder enc;
+		enc.out.resize(header_size, '\0');
+
+		std::vector<std::uint64_t> entry_offsets;
+		entry_offsets.reserve(definitions.size());
+		for (auto& [name, var] : definitions)
+		{
+			entry_offsets.push_back(enc.out.size());
+			enc.put_string(name);
+			if (var == nullptr) enc.put(Tag::INVALID);
+			else enc.put_variable(*var);
+		}
+
+		// Writing a body can find more objects, which are appended and written in turn
+		std::vector<std::uint64_t> object_offsets;
+		for (std::size_t id = 0; id < enc.objects.size(); id++)
+		{
+			object_offsets.push_back(enc.out.size());
+			enc.put_object(*enc.objects[id]);
+		}
+		if (!enc.ok) return false;
+
+		enc.align();
+		std::uint64_t object_offset = enc.out.size();
+		for (auto offset : object_offsets) enc.put(offset);
+
+		std::uint64_t capacity = 8;
+		while (capacity < definitions.size() * 2) capacity *= 2;
+
+		std::uint64_t index_offset = enc.out.size();
+		enc.out.resize(index_offset + capacity * bucket_size, '\0');
+		std::vector<bool> used(capacity, false);
+		for (std::size_t i = 0; i < definitions.size(); i++)
+		{
+			auto hash = hash_name(definitions[i].first);
+			auto bucket = hash & (capacity - 1);
+			while (used[bucket]) bucket = (bucket + 1) & (capacity - 1);
+			used[bucket] = true;
+
+			enc.put_at(index_offset + bucket * bucket_size, hash);
+			enc.put_at(index_offset + bucket * bucket_size + 8, entry_offsets[i]);
+		}
+
+		std::memcpy(enc.out.data(), magic, sizeof(magic));
+		enc.put_at<std::uint32_t>(8, version);
+		enc.put_at<std::uint32_t>(12, byte_order);
+		enc.put_at<std::uint64_t>(16, definitions.size());
+		enc.put_at<std::uint64_t>(24, capacity);
+		enc.put_at<std::uint64_t>(32, index_offset);
+		enc.put_at<std::uint64_t>(40, enc.objects.size());
+		enc.put_at<std::uint64_t>(48, object_offset);
+		enc.put_at<std::uint64_t>(56, enc.out.size());
+
+		// Written beside the target and renamed over it, so a running server never maps half an image
+		std::string temp_path = path + ".tmp";
+		int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		bool written = fd >= 0;
+		for (std::size_t done = 0; written && done < enc.out.size();)
+		{
+			auto res = write(fd, enc.out.data() + done, enc.out.size() - done);
+			if (res < 0 && errno == EINTR) continue;
+			written = res > 0;
+			if (written) done += static_cast<std::size_t>(res);
+		}
+		if (fd >= 0 && close(fd) != 0) written = false;
+
+		if (!written || rename(temp_path.c_str(), path.c_str()) != 0)
+		{
+			std::cout << "Could not write image " << path << ": " << std::strerror(errno) << '\n';
+			unlink(temp_path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Decodes values from a mapped image. Reads past the end of the file leave `ok` false instead of
+	 * going out of bounds, so a damaged image is reported rather than crashing the interpreter
+	*/
+	class Decoder
+	{
+	public:
+		bool ok = true;
+
+		Decoder(const Image& image, std::uint64_t offset) : image(image), pos(offset) {}
+
+		template<typename T>
+		T get()
+		{
+			T value{};
+			if (!ok || pos > image.length || image.length - pos < sizeof(T))
+			{
+				ok = false;
+				return value;
+			}
+			std::memcpy(&value, image.data + pos, sizeof(T));
+			pos += sizeof(T);
+			return value;
+		}
+
+		std::string_view get_string()
+		{
+			auto size = get<std::uint32_t>();
+			if (!ok || image.length - pos < size)
+			{
+				ok = false;
+				return {};
+			}
+			std::string_view value(image.data + pos, size);
+			pos += size;
+			return value;
+		}
+
+		/**
+		 * Reads an element count, each element taking at least one byte of what is left of the file
+		*/
+		template<typename T>
+		std::size_t get_count()
+		{
+			auto count = get<T>();
+			if (!ok || count > image.length - pos)
+			{
+				ok = false;
+				return 0;
+			}
+			return static_cast<std::size_t>(count);
+		}
+
+		Slot get_slot(unsigned depth)
+		{
+			return Slot::from_variable(get_variable(depth));
+		}
+
+		std::unique_ptr<Variable> get_variable(unsigned depth)
+		{
+			if (depth > max_depth) ok = false;
+
+			auto tag = get<Tag>();
+			if (!ok) return nullptr;
+
+			switch (tag)
+			{
+			case Tag::INVALID:
+				return nullptr;
+			case Tag::INT:
+				return std::make_unique<Int>(get<std::int32_t>());
+			case Tag::FLOAT:
+				return std::make_unique<Float>(get<double>());
+			case Tag::BOOL:
+				return std::make_unique<Bool>(get<std::uint8_t>() != 0);
+			case Tag::STRING:
+				return std::make_unique<String>(std::string(get_string()));
+			case Tag::SYMBOL:
+				return std::make_unique<Symbol>(std::string(get_string()));
+			case Tag::OBJECT:
+			{
+				auto id = get<std::uint64_t>();
+				if (!ok || id >= image.object_count)
+				{
+					ok = false;
+					return nullptr;
+				}
+				auto object = image.decode_object(id, depth + 1);
+				if (object == nullptr) ok = false;
+				return object;
+			}
+			case Tag::PERSISTENT_VECTOR:
+			{
+				auto vec = std::make_unique<PersistentVector>();
+				auto count = get_count<std::uint64_t>();
+				for (std::size_t i = 0; i < count && ok; i++) *vec = vec->push(get_slot(depth + 1));
+				return vec;
+			}
+			case Tag::PERSISTENT_MAP:
+			{
+				auto map = std::make_unique<PersistentMap>();
+				auto count = get_count<std::uint64_t>();
+				for (std::size_t i = 0; i < count && ok; i++)
+				{
+					Slot key = get_slot(depth + 1);
+					*map = map->set(std::move(key), get_slot(depth + 1));
+				}
+				return map;
+			}
+			case Tag::BUILTIN:
+			{
+				auto entry = find_builtin(get_string());
+				if (entry == nullptr)
+				{
+					ok = false;
+					return nullptr;
+				}
+				return std::make_unique<Builtin>(entry);
+			}
+			case Tag::CLOSURE:
+			{
+				auto code = std::make_shared<Closure::Code>();
+				code->params.resize(get_count<std::uint32_t>());
+				for (auto& param : code->params) param = get_string();
+
+				auto body_size = get_count<std::uint32_t>();
+				for (std::size_t i = 0; i < body_size && ok; i++) code->body.push_back(get_ast(depth + 1));
+
+				std::vector<Binding> captured(get_count<std::uint32_t>());
+				for (auto& binding : captured)
+				{
+					binding.name = get_string();
+					binding.value = get_slot(depth + 1);
+				}
+				return std::make_unique<Closure>(std::move(code), std::move(captured));
+			}
+			default:
+				ok = false;
+				return nullptr;
+			}
+		}
+
+		ASTExpr get_ast(unsigned depth)
+		{
+			if (depth > max_depth) ok = false;
+
+			auto kind = get<NodeKind>();
+			if (!ok) return ASTExpr();
+
+			if (kind == NodeKind::LIST)
+			{
+				ASTExpr expr = make_astexpr<ASTExpr::Type::LIST>();
+				auto count = get_count<std::uint32_t>();
+				for (std::size_t i = 0; i < count && ok; i++) expr.children.push_back(get_ast(depth + 1));
+				return expr;
+			}
+
+			auto type = static_cast<Token::Type>(get<std::uint8_t>());
+			ASTExpr expr = make_astexpr<ASTExpr::Type::ATOM>();
+			switch (type)
+			{
+			case Token::Type::SYMBOL:
+			case Token::Type::STRING:
+			case Token::Type::ERROR:
+				expr.leaf = make_token(type);
+				expr.leaf.symbol = get_string();
+				break;
+			case Token::Type::INT:
+				expr.leaf = make_token(type);
+				expr.leaf.i_value = get<std::int32_t>();
+				break;
+			case Token::Type::FLOAT:
+				expr.leaf = make_token(type);
+				expr.leaf.f_value = get<double>();
+				break;
+			default:
+				ok = false;
+				break;
+			}
+			return expr;
+		}
+
+	private:
+		const Image& image;
+		std::uint64_t pos;
+	};
+
+	template<typename T>
+	static T read_at(const char* data, std::size_t offset)
+	{
+		T value;
+		std::memcpy(&value, data + offset, sizeof(T));
+		return value;
+	}
+
+	std::shared_ptr<const Image> Image::open(const std::string& path)
+	{
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat info;
+		if (fd < 0 || fstat(fd, &info) != 0)
+		{
+			std::cout << "Could not open image " << path << ": " << std::strerror(errno) << '\n';
+			if (fd >= 0) close(fd);
+			return nullptr;
+		}
+
+		std::shared_ptr<Image> image(new Image());
+		image->length = static_cast<std::size_t>(info.st_size);
+		if (image->length >= header_size)
+		{
+			void* mapped = mmap(nullptr, image->length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped != MAP_FAILED) image->data = static_cast<const char*>(mapped);
+		}
+		close(fd);
+
+		auto data = image->data;
+		auto length = image->length;
+		bool valid = data != nullptr && std::memcmp(data, magic, sizeof(magic)) == 0 && read_at<std::uint32_t>(data, 8) == version &&
+			read_at<std::uint32_t>(data, 12) == byte_order && read_at<std::uint64_t>(data, 56) == length;
+
+		if (valid)
+		{
+			image->entry_count = read_at<std::uint64_t>(data, 16);
+			image->index_capacity = read_at<std::uint64_t>(data, 24);
+			auto index_offset = read_at<std::uint64_t>(data, 32);
+			image->object_count = read_at<std::uint64_t>(data, 40);
+			auto object_offset = read_at<std::uint64_t>(data, 48);
+
+			auto capacity = image->index_capacity;
+			valid = capacity > 0 && (capacity & (capacity - 1)) == 0 && image->entry_count < capacity &&
+				capacity <= length / bucket_size && index_offset <= length - capacity * bucket_size &&
+				image->object_count <= length / 8 && object_offset <= length - image->object_count * 8;
+
+			image->index = data + index_offset;
+			image->objects = data + object_offset;
+		}
+
+		if (!valid)
+		{
+			std::cout << "Not a valid image: " << path << '\n';
+			return nullptr;
+		}
+
+		// Lookups jump around the file, reading ahead would mostly fetch pages nobody asks for
+		madvise(const_cast<char*>(data), length, MADV_RANDOM);
+
+		image->decoded = std::make_unique<std::atomic<Variable*>[]>(image->index_capacity);
+		image->decoded_objects.resize(image->object_count);
+		return image;
+	}
+
+	Image::~Image()
+	{
+		if (decoded != nullptr)
+		{
+			for (std::uint64_t i = 0; i < index_capacity; i++) delete decoded[i].load(std::memory_order_relaxed);
+		}
+		if (data != nullptr) munmap(const_cast<char*>(data), length);
+	}
+
+	const Variable* Image::find(const std::string& name) const
+	{
+		auto hash = hash_name(name);
+		auto mask = index_capacity - 1;
+
+		for (auto bucket = hash & mask, probes = std::uint64_t(0); probes < index_capacity; bucket = (bucket + 1) & mask, probes++)
+		{
+			auto offset = read_at<std::uint64_t>(index, bucket * bucket_size + 8);
+			if (offset == 0) return nullptr;
+			if (read_at<std::uint64_t>(index, bucket * bucket_size) != hash) continue;
+
+			Decoder dec(*this, offset);
+			if (dec.get_string() != name || !dec.ok) continue;
+
+			if (auto var = decoded[bucket].load(std::memory_order_acquire)) return var;
+
+			// Decoding is done once per definition, so one lock for the whole image is enough
+			std::lock_guard<std::mutex> lock(decode_mutex);
+			if (auto var = decoded[bucket].load(std::memory_order_relaxed)) return var;
+
+			// Decoded values are kept for the life of the image, so they are never carved out of the caller's region
+			region::HeapScope heap;
+			pending_objects.clear();
+			auto var = dec.get_variable(0);
+			if (!dec.ok || var == nullptr)
+			{
+				// Containers that did decode may still refer to one that did not, so none of them are kept
+				for (auto pending : pending_objects) decoded_objects[pending].reset();
+				pending_objects.clear();
+				std::cout << "Image definition of " << name << " is damaged\n";
+				return nullptr;
+			}
+			pending_objects.clear();
+			if (frozen) frozen_objects.add(*var);
+			decoded[bucket].store(var.get(), std::memory_order_release);
+			return var.release();
+		}
+		return nullptr;
+	}
+
+	std::unique_ptr<Variable> Image::decode_object(std::uint64_t id, unsigned depth) const
+	{
+		// Containers are registered before their elements are decoded, so cycles lead back to them
+		if (decoded_objects[id] != nullptr) return decoded_objects[id]->copy();
+
+		Decoder dec(*this, read_at<std::uint64_t>(objects, id * 8));
+		auto kind = dec.get<ObjectKind>();
+
+		if (kind == ObjectKind::VECTOR)
+		{
+			auto size = dec.get_count<std::uint64_t>();
+			auto vec = std::make_unique<Vector>(size, Slot());
+			auto& target = *vec;
+			decoded_objects[id] = std::move(vec);
+			pending_objects.push_back(id);
+			for (std::size_t i = 0; i < size && dec.ok; i++) target.set(i, dec.get_slot(depth + 1));
+		}
+		else if (kind == ObjectKind::HASH_TABLE)
+		{
+			auto equivalence = dec.get<std::uint8_t>();
+			auto count = dec.get_count<std::uint64_t>();
+			if (equivalence > static_cast<std::uint8_t>(Equivalence::STRING)) return nullptr;
+			auto table = std::make_unique<HashTable>(static_cast<Equivalence>(equivalence), count);
+			auto& target = *table;
+			decoded_objects[id] = std::move(table);
+			pending_objects.push_back(id);
+			for (std::size_t i = 0; i < count && dec.ok; i++)
+			{
+				Slot key = dec.get_slot(depth + 1);
+				target.insert(std::move(key), dec.get_slot(depth + 1));
+			}
+		}
+		else dec.ok = false;
+
+		// A half filled container must not be handed to later definitions that refer to it
+		if (!dec.ok)
+		{
+			decoded_objects[id].reset();
+			return nullptr;
+		}
+		return decoded_objects[id]->copy();
+	}
+
+	std::size_t Image::size() const noexcept
+	{
+		return static_cast<std::size_t>(entry_count);
+	}
+
+	void Image::for_each_name(const std::function<void(std::string_view)>& fn) const
+	{
+		for (std::uint64_t bucket = 0; bucket < index_capacity; bucket++)
+		{
+			auto offset = read_at<std::uint64_t>(index, bucket * bucket_size + 8);
+			if (offset == 0) continue;
+
+			Decoder dec(*this, offset);
+			auto name = dec.get_string();
+			if (dec.ok) fn(name);
+		}
+	}
+
+	void Image::freeze() const
+	{
+		std::lock_guard<std::mutex> lock(decode_mutex);
+		if (frozen) return;
+
+		// Definitions hold copies of these, sharing their storage, so freezing them covers every definition decoded so far
+		for (auto& object : decoded_objects)
+		{
+			if (object != nullptr) frozen_objects.add(*object);
+		}
+		frozen = true;
+	}
+
+	std::shared_ptr<const Environment> load_image(const std::string& path)
+	{
+		auto opened = Image::open(path);
+		if (opened == nullptr) return nullptr;
+
+		auto layer = std::make_shared<Environment>();
+		layer->image = std::move(opened);
+		return layer;
+	}
+}
@@ -0,0 +1,206 @@
+#include <lang/instrument.hpp>
+#include <lang/condition.hpp>
+#include <lang/region.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace instrument
+{
+
+	struct Totals
+	{
+		std::uint64_t calls = 0;
+		std::uint64_t nanoseconds = 0;
+		std::uint64_t allocations = 0;
+	};
+
+	struct Entry
+	{
+		std::string_view name;
+		Totals totals;
+	};
+
+#ifdef SCHEME_INSTRUMENT
+	struct Counters
+	{
+		// Written by the owning thread, read by whoever asks for the statistics
+		std::atomic<std::uint64_t> calls{ 0 };
+		std::atomic<std::uint64_t> nanoseconds{ 0 };
+		std::atomic<std::uint64_t> allocations{ 0 };
+		std::size_t active = 0;		// Calls in progress on the owning thread
+	};
+
+	/**
+	 * Counters of one thread. Names are built-in names, interned procedure names or literals, so they
+	 * outlive every table
+	*/
+	struct ThreadTable
+	{
+		std::mutex mutex;		// Held to add a name, and by other threads to read the table
+		std::unordered_map<std::string_view, Counters> counts;
+
+		ThreadTable();
+
+		~ThreadTable();
+	};
+
+	/**
+	 * Every live thread's table, and the totals of the threads that have exited
+	*/
+	struct Registry
+	{
+		std::mutex mutex;
+		std::vector<ThreadTable*> tables;
+		std::unordered_map<std::string_view, Totals> retired;
+	};
+
+	static Registry& registry()
+	{
+		// Never destroyed, threads may still exit after static destruction begins
+		static auto instance = new Registry();
+		return *instance;
+	}
+
+	static thread_local ThreadTable local;
+
+	ThreadTable::ThreadTable()
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.tables.push_back(this);
+	}
+
+	ThreadTable::~ThreadTable()
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.tables.erase(std::find(reg.tables.begin(), reg.tables.end(), this));
+
+		for (auto& [name, counters] : counts)
+		{
+			auto& totals = reg.retired[name];
+			totals.calls += counters.calls.load(std::memory_order_relaxed);
+			totals.nanoseconds += counters.nanoseconds.load(std::memory_order_relaxed);
+			totals.allocations += counters.allocations.load(std::memory_order_relaxed);
+		}
+	}
+
+	static std::size_t allocation_count()
+	{
+		auto& counts = region::stats();
+		return counts.region_allocations + counts.heap_allocations;
+	}
+
+	Call::Call(std::string_view name)
+	{
+		// Only this thread changes the table, so finding a name needs no lock, adding one does
+		auto it = local.counts.find(name);
+		if (it == local.counts.end())
+		{
+			std::lock_guard<std::mutex> lock(local.mutex);
+			it = local.counts.try_emplace(name).first;
+		}
+		counters = &it->second;
+		counters->calls.fetch_add(1, std::memory_order_relaxed);
+		outermost = counters->active++ == 0;
+		if (outermost)
+		{
+			allocations = allocation_count();
+			start = std::chrono::steady_clock::now();
+		}
+	}
+
+	Call::~Call()
+	{
+		counters->active--;
+		if (!outermost) return;
+
+		auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+		counters->nanoseconds.fetch_add(elapsed.count(), std::memory_order_relaxed);
+		counters->allocations.fetch_add(allocation_count() - allocations, std::memory_order_relaxed);
+	}
+
+	static std::vector<Entry> snapshot()
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		std::unordered_map<std::string_view, Totals> merged = reg.retired;
+
+		for (auto table : reg.tables)
+		{
+			std::lock_guard<std::mutex> table_lock(table->mutex);
+			for (auto& [name, counters] : table->counts)
+			{
+				auto& totals = merged[name];
+				totals.calls += counters.calls.load(std::memory_order_relaxed);
+				totals.nanoseconds += counters.nanoseconds.load(std::memory_order_relaxed);
+				totals.allocations += counters.allocations.load(std::memory_order_relaxed);
+			}
+		}
+
+		std::vector<Entry> entries;
+		entries.reserve(merged.size());
+		for (auto& [name, totals] : merged) entries.push_back({ name, totals });
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+		{
+			return a.totals.nanoseconds != b.totals.nanoseconds ? a.totals.nanoseconds > b.totals.nanoseconds : a.name < b.name;
+		});
+		return entries;
+	}
+#else
+	static std::vector<Entry> snapshot()
+	{
+		return {};
+	}
+#endif
+
+	void print_stats(std::ostream& out)
+	{
+		if (!enabled)
+		{
+			out << "Runtime statistics are only collected in builds configured with -DSCHEME_INSTRUMENT=ON\n";
+			return;
+		}
+
+		out << std::left << std::setw(28) << "Procedure" << std::right << std::setw(12) << "Calls"
+			<< std::setw(14) << "Time (us)" << std::setw(14) << "Allocations" << "\n";
+		for (auto& entry : snapshot())
+		{
+			out << std::left << std::setw(28) << entry.name << std::right << std::setw(12) << entry.totals.calls
+				<< std::setw(14) << entry.totals.nanoseconds / 1000 << std::setw(14) << entry.totals.allocations << "\n";
+		}
+	}
+}
+
+namespace environment
+{
+	namespace builtins
+	{
+		Slot runtime_stats(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 0)
+			{
+				return eval::fail(interp, "Runtime stats procedure expects no arguments");
+			}
+
+			auto entries = instrument::snapshot();
+			auto result = std::make_unique<Vector>(entries.size(), Slot());
+			for (std::size_t i = 0; i < entries.size(); i++)
+			{
+				auto& totals = entries[i].totals;
+				auto row = std::make_unique<Vector>(4, Slot());
+				row->set(0, Slot::from_variable(std::make_unique<String>(std::string(entries[i].name))));
+				row->set(1, Slot(static_cast<int>(std::min<std::uint64_t>(totals.calls, INT32_MAX))));
+				row->set(2, Slot(static_cast<int>(std::min<std::uint64_t>(totals.nanoseconds / 1000, INT32_MAX))));
+				row->set(3, Slot(static_cast<int>(std::min<std::uint64_t>(totals.allocations, INT32_MAX))));
+				result->set(i, Slot::from_variable(std::move(row)));
+			}
+			return Slot::from_variable(std::move(result));
+		}
+	}
+}
@@ -1,12 +1,18 @@
 ﻿#include <lang/lexer.hpp>
+#include <lang/memstats.hpp>
 #include <cassert>
+#include <charconv>
 
 namespace lexer
 {
-	Token::Token() {}
+	Token::Token()
+	{
+		memstats::token_created();
+	}
 
 	Token::Token(Token&& other) noexcept
 	{
+		memstats::token_created();
 		type = other.type;
 
 		switch (other.type)
@@ -21,6 +27,7 @@ namespace lexer
 			new (&symbol) std::string(std::move(other.symbol));
 			break;
 		case Type::STRING:
+		case Type::ERROR:
 			new (&symbol) std::string(std::move(other.symbol));
 			break;
 		case Type::INT:
@@ -36,6 +43,7 @@ namespace lexer
 
 	Token::~Token()
 	{
+		memstats::token_destroyed();
 		switch (type)
 		{
 		case Type::INVALID:
@@ -48,6 +56,7 @@ namespace lexer
 			symbol.~basic_string();
 			break;
 		case Type::STRING:
+		case Type::ERROR:
 			symbol.~basic_string();
 			break;
 		case Type::INT:
@@ -83,6 +92,7 @@ namespace lexer
 			case Token::Type::SYMBOL:
 				return lhs.symbol == rhs.symbol;
 			case Token::Type::STRING:
+			case Token::Type::ERROR:
 				return lhs.symbol == rhs.symbol;
 			case Token::Type::INT:
 				return lhs.i_value == rhs.i_value;
@@ -110,6 +120,7 @@ namespace lexer
 			case Token::Type::SYMBOL:
 				return lhs.symbol != rhs.symbol;
 			case Token::Type::STRING:
+			case Token::Type::ERROR:
 				return lhs.symbol != rhs.symbol;
 			case Token::Type::INT:
 				return lhs.i_value != rhs.i_value;
@@ -122,7 +133,10 @@ namespace lexer
 		return true;
 	}
 
-	Token::Token(Token::Type type) : type(type) {}
+	Token::Token(Token::Type type) : type(type)
+	{
+		memstats::token_created();
+	}
 
 	Token make_token(Token::Type type)
 	{
@@ -140,6 +154,7 @@ namespace lexer
 			new (&token.symbol) std::string();
 			break;
 		case Token::Type::STRING:
+		case Token::Type::ERROR:
 			new (&token.symbol) std::string();
 			break;
 		case Token::Type::INT:
@@ -207,20 +222,37 @@ namespace lexer
 		return token;
 	}
 
+	/**
+	 * Token standing in for text that could not be read, so the error is raised where it is evaluated
+	*/
+	static Token make_error_token(std::string message)
+	{
+		Token token = make_token(Token::Type::ERROR);
+		token.symbol = std::move(message);
+		return token;
+	}
+
 	Token create_token_from_string(const std::string& token_text)
 	{
 		int i = 0;
 		while (token_text[i] == '-') i++;
 		if (isdigit(token_text[i]))
 		{
-			if (token_text.find('.') == std::string::npos)
+			auto first = token_text.data();
+			auto last = first + token_text.size();
+
+			if (token_text.find_first_of(".eE") == std::string::npos)
 			{
 				Token token = std::move(make_token<Token::Type::INT>());
-				token.i_value = std::stoi(token_text);
+				auto [end, error] = std::from_chars(first, last, token.i_value);
+				if (error == std::errc::result_out_of_range) return make_error_token("Integer literal is out of range: " + token_text);
+				if (error != std::errc() || end != last) return make_error_token("Invalid number literal: " + token_text);
 				return token;
 			}
 			Token token = std::move(make_token<Token::Type::FLOAT>());
-			token.f_value = std::stod(token_text);
+			auto [end, error] = std::from_chars(first, last, token.f_value);
+			if (error == std::errc::result_out_of_range) return make_error_token("Float literal is out of range: " + token_text);
+			if (error != std::errc() || end != last) return make_error_token("Invalid number literal: " + token_text);
 			return token;
 		}
 		Token token = std::move(make_token<Token::Type::SYMBOL>());
@@ -244,6 +276,12 @@ namespace lexer
 				break;
 			case '\n':
 				break;
+			case '\r':
+				break;
+			case ';':
+				// Comments run to the end of the line
+				while (i + 1 < raw_text.length() && raw_text.at(i + 1) != '\n') i++;
+				break;
 			case '(':
 				output.push_back(std::move(make_token<Token::Type::LRB>()));
 				break;
@@ -284,6 +322,9 @@ namespace lexer
 					switch (raw_text.at(i))
 					{
 					case ' ':
+					case '\t':
+					case '\n':
+					case '\r':
 					{
 						output.push_back(create_token_from_string(raw_text.substr(start, i - start)));
 						done = true;
@@ -308,6 +349,8 @@ namespace lexer
 						i++;
 					}
 				}
+				// The atom runs up to the end of the input
+				if (!done) output.push_back(create_token_from_string(raw_text.substr(start, i - start)));
 			}
 			}
 		}
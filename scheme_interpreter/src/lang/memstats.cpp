@@ -0,0 +1,305 @@
+#include <lang/memstats.hpp>
+#include <lang/condition.hpp>
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+namespace memstats
+{
+
+	std::atomic<bool> enabled{ false };
+
+	struct Totals
+	{
+		std::uint64_t created[kind_count] = {};
+		std::uint64_t destroyed[kind_count] = {};
+		std::int64_t bytes = 0;
+		std::uint64_t forms = 0;
+		std::uint64_t largest_form_peak = 0;
+	};
+
+	/**
+	 * Counts of one thread. Only the owning thread writes them, so increments are plain loads and stores
+	 * rather than read-modify-writes, and the atomics only keep readers on other threads well defined.
+	 * The block is constant initialized so counting never goes through a thread-local guard, and joins
+	 * the registry the first time it is used
+	*/
+	struct Block
+	{
+		std::atomic<std::uint64_t> created[kind_count] = {};
+		std::atomic<std::uint64_t> destroyed[kind_count] = {};
+		std::atomic<std::int64_t> bytes{ 0 };		// Allocated minus freed by this thread, which may go negative
+		std::atomic<std::uint64_t> forms{ 0 };
+		std::atomic<std::uint64_t> largest_form_peak{ 0 };
+		std::atomic<std::uint64_t> last_form_peak{ 0 };
+
+		std::int64_t form_base = 0;
+		std::int64_t form_peak = 0;
+		bool registered = false;
+	};
+
+	/**
+	 * Adds the thread's block to the registry, and moves its counts to the retired totals when the
+	 * thread exits
+	*/
+	struct Registration
+	{
+		Registration();
+
+		~Registration();
+	};
+
+	struct Registry
+	{
+		std::mutex mutex;
+		std::vector<Block*> blocks;
+		Totals retired;
+	};
+
+	static Registry& registry()
+	{
+		// Never destroyed, variables may still be freed after static destruction begins
+		static auto instance = new Registry();
+		return *instance;
+	}
+
+	static thread_local Block local;
+	static thread_local bool exited = false;	// Set once the block has been retired, counts then go straight to the registry
+
+	Registration::Registration()
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.blocks.push_back(&local);
+		local.registered = true;
+	}
+
+	Registration::~Registration()
+	{
+		exited = true;
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.blocks.erase(std::find(reg.blocks.begin(), reg.blocks.end(), &local));
+
+		auto& created = local.created;
+		auto& destroyed = local.destroyed;
+
+		for (std::size_t i = 0; i < kind_count; i++)
+		{
+			reg.retired.created[i] += created[i].load(std::memory_order_relaxed);
+			reg.retired.destroyed[i] += destroyed[i].load(std::memory_order_relaxed);
+		}
+		reg.retired.bytes += local.bytes.load(std::memory_order_relaxed);
+		reg.retired.forms += local.forms.load(std::memory_order_relaxed);
+		reg.retired.largest_form_peak = std::max(reg.retired.largest_form_peak, local.largest_form_peak.load(std::memory_order_relaxed));
+	}
+
+	/**
+	 * The thread's block, joining the registry on first use
+	*/
+	static Block& block() noexcept
+	{
+		if (!local.registered)
+		{
+			static thread_local Registration registration;
+		}
+		return local;
+	}
+
+	template<typename T>
+	static void bump(std::atomic<T>& counter, T by) noexcept
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+	}
+
+	void enable() noexcept
+	{
+		enabled.store(true);
+	}
+
+	void count_created(std::size_t kind) noexcept
+	{
+		if (exited)
+		{
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			registry().retired.created[kind]++;
+			return;
+		}
+		bump(block().created[kind], std::uint64_t(1));
+	}
+
+	void count_destroyed(std::size_t kind) noexcept
+	{
+		if (exited)
+		{
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			registry().retired.destroyed[kind]++;
+			return;
+		}
+		bump(block().destroyed[kind], std::uint64_t(1));
+	}
+
+	void count_allocated(std::size_t size) noexcept
+	{
+		if (exited)
+		{
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			registry().retired.bytes += size;
+			return;
+		}
+		auto& counts = block();
+		std::int64_t bytes = counts.bytes.load(std::memory_order_relaxed) + static_cast<std::int64_t>(size);
+		counts.bytes.store(bytes, std::memory_order_relaxed);
+		if (bytes > counts.form_peak) counts.form_peak = bytes;
+	}
+
+	void count_freed(std::size_t size) noexcept
+	{
+		if (exited)
+		{
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			registry().retired.bytes -= size;
+			return;
+		}
+		bump(block().bytes, -static_cast<std::int64_t>(size));
+	}
+
+	void form_started() noexcept
+	{
+		if (exited || !enabled.load(std::memory_order_relaxed)) return;
+		local.form_base = local.bytes.load(std::memory_order_relaxed);
+		local.form_peak = local.form_base;
+	}
+
+	void form_finished() noexcept
+	{
+		if (exited || !enabled.load(std::memory_order_relaxed)) return;
+		auto peak = current_form_peak();
+		local.last_form_peak.store(peak, std::memory_order_relaxed);
+		if (peak > local.largest_form_peak.load(std::memory_order_relaxed)) local.largest_form_peak.store(peak, std::memory_order_relaxed);
+		bump(local.forms, std::uint64_t(1));
+	}
+
+	std::uint64_t current_form_peak() noexcept
+	{
+		if (exited) return 0;
+		return static_cast<std::uint64_t>(std::max<std::int64_t>(0, local.form_peak - local.form_base));
+	}
+
+	Snapshot snapshot()
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		Totals totals = reg.retired;
+
+		for (auto block : reg.blocks)
+		{
+			for (std::size_t i = 0; i < kind_count; i++)
+			{
+				totals.created[i] += block->created[i].load(std::memory_order_relaxed);
+				totals.destroyed[i] += block->destroyed[i].load(std::memory_order_relaxed);
+			}
+			totals.bytes += block->bytes.load(std::memory_order_relaxed);
+			totals.forms += block->forms.load(std::memory_order_relaxed);
+			totals.largest_form_peak = std::max(totals.largest_form_peak, block->largest_form_peak.load(std::memory_order_relaxed));
+		}
+
+		auto count = [&totals](std::size_t kind)
+		{
+			return Count{ static_cast<std::int64_t>(totals.created[kind] - totals.destroyed[kind]), totals.created[kind] };
+		};
+
+		Snapshot snap;
+		for (std::size_t i = 0; i < type_count; i++) snap.variables[i] = count(i);
+		snap.tokens = count(token_kind);
+		snap.exprs = count(expr_kind);
+		snap.variable_bytes = totals.bytes;
+		snap.forms = totals.forms;
+		snap.largest_form_peak = totals.largest_form_peak;
+		snap.last_form_peak = exited ? 0 : local.last_form_peak.load(std::memory_order_relaxed);
+		return snap;
+	}
+
+	void print_stats(std::ostream& out)
+	{
+		if (!enabled.load())
+		{
+			out << "Memory statistics are only collected when counting is enabled with --mem-stats\n";
+			return;
+		}
+
+		auto snap = snapshot();
+		auto row = [&out](const std::string& name, const Count& count)
+		{
+			out << std::left << std::setw(20) << name << std::right << std::setw(14) << count.live << std::setw(14) << count.total << "\n";
+		};
+
+		out << std::left << std::setw(20) << "Object" << std::right << std::setw(14) << "Live" << std::setw(14) << "Total" << "\n";
+		for (std::size_t i = 0; i < type_count; i++)
+		{
+			if (snap.variables[i].total > 0) row(environment::get_type_as_string(static_cast<Variable::Type>(i)), snap.variables[i]);
+		}
+		row("Token", snap.tokens);
+		row("ASTExpr", snap.exprs);
+
+		out << "Variable storage     " << snap.variable_bytes << " bytes live\n"
+			<< "Form peak            " << snap.largest_form_peak << " bytes largest, " << snap.last_form_peak
+			<< " bytes last, over " << snap.forms << " forms\n";
+	}
+}
+
+namespace environment
+{
+	namespace builtins
+	{
+		/**
+		 * Clamps a count to the range of an integer slot
+		*/
+		static Slot count_slot(std::int64_t value)
+		{
+			return Slot(static_cast<int>(std::clamp<std::int64_t>(value, INT32_MIN, INT32_MAX)));
+		}
+
+		static Slot stats_row(const std::string& name, std::int64_t first, std::int64_t second)
+		{
+			auto row = std::make_unique<Vector>(3, Slot());
+			row->set(0, Slot::from_variable(std::make_unique<String>(name)));
+			row->set(1, count_slot(first));
+			row->set(2, count_slot(second));
+			return Slot::from_variable(std::move(row));
+		}
+
+		Slot memory_stats(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 0)
+			{
+				return eval::fail(interp, "Memory stats procedure expects no arguments");
+			}
+			if (!memstats::enabled.load())
+			{
+				std::cout << "Memory statistics are only collected when counting is enabled with --mem-stats\n";
+				return Slot::from_variable(std::make_unique<Vector>(0, Slot()));
+			}
+
+			auto snap = memstats::snapshot();
+			std::vector<Slot> rows;
+			for (std::size_t i = 0; i < memstats::type_count; i++)
+			{
+				auto& count = snap.variables[i];
+				if (count.total == 0) continue;
+				auto name = get_type_as_string(static_cast<Variable::Type>(i));
+				rows.push_back(stats_row(name, count.live, static_cast<std::int64_t>(count.total)));
+			}
+			rows.push_back(stats_row("Token", snap.tokens.live, static_cast<std::int64_t>(snap.tokens.total)));
+			rows.push_back(stats_row("ASTExpr", snap.exprs.live, static_cast<std::int64_t>(snap.exprs.total)));
+			rows.push_back(stats_row("Form peak bytes", static_cast<std::int64_t>(memstats::current_form_peak()),
+				static_cast<std::int64_t>(snap.largest_form_peak)));
+
+			auto result = std::make_unique<Vector>(rows.size(), Slot());
+			for (std::size_t i = 0; i < rows.size(); i++) result->set(i, std::move(rows[i]));
+			return Slot::from_variable(std::move(result));
+		}
+	}
+}
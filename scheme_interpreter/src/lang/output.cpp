@@ -0,0 +1,59 @@
+#include <lang/output.hpp>
+#include <lang/condition.hpp>
+#include <charconv>
+#include <cstdio>
+#include <iostream>
+
+namespace output
+{
+
+	void configure(bool interactive)
+	{
+		if (interactive)
+		{
+			std::setvbuf(stdout, nullptr, _IOLBF, BUFSIZ);
+			return;
+		}
+
+		// Standard output lives until the process exits, so its buffer does too
+		static char buffer[batch_buffer_size];
+		std::setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+	}
+
+	void flush()
+	{
+		std::cout.flush();
+		std::fflush(stdout);
+	}
+
+	void write_int(std::ostream& out, int value)
+	{
+		char digits[16];
+		auto res = std::to_chars(digits, digits + sizeof(digits), value);
+		out.write(digits, res.ptr - digits);
+	}
+
+	void write_float(std::ostream& out, double value)
+	{
+		// General notation with six significant digits is what an ostream writes by default
+		char digits[32];
+		auto res = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6);
+		out.write(digits, res.ptr - digits);
+	}
+}
+
+namespace environment
+{
+	namespace builtins
+	{
+		Slot flush_output(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 0)
+			{
+				return eval::fail(interp, "Flush output procedure expects no arguments");
+			}
+			output::flush();
+			return Slot();
+		}
+	}
+}
@@ -0,0 +1,712 @@
+#include <lang/parallel.hpp>
+#include <lang/condition.hpp>
+#include <lang/instrument.hpp>
+#include <lang/persistent.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace parallel
+{
+
+	TaskDeque::TaskDeque()
+	{
+		for (auto& task : tasks) task.store(nullptr, std::memory_order_relaxed);
+	}
+
+	bool TaskDeque::push(Task* task)
+	{
+		auto b = bottom.load(std::memory_order_relaxed);
+		auto t = top.load(std::memory_order_acquire);
+		if (b - t >= static_cast<std::int64_t>(capacity)) return false;
+
+		// Publishes the task, and everything written to it, to any thief that sees the new bottom
+		tasks[b % capacity].store(task, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	Task* TaskDeque::pop()
+	{
+		auto b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto t = top.load(std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		Task* task = tasks[b % capacity].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			// Last task, race any thief for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) task = nullptr;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return task;
+	}
+
+	Task* TaskDeque::steal()
+	{
+		auto t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto b = bottom.load(std::memory_order_acquire);
+		if (t >= b) return nullptr;
+
+		Task* task = tasks[t % capacity].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+		return task;
+	}
+
+	bool TaskDeque::empty() const
+	{
+		return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Process-wide pool. Every thread that takes part, workers and callers alike, claims a deque of its
+	 * own on first use and gives it back when it exits
+	*/
+	class Pool
+	{
+	public:
+		static constexpr std::size_t max_deques = 64;
+		static constexpr std::size_t no_deque = max_deques;
+
+		// Never destroyed, the workers sleep for the life of the process
+		static Pool& instance()
+		{
+			static Pool* pool = new Pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+			return *pool;
+		}
+
+		std::size_t concurrency() const noexcept
+		{
+			return worker_count + 1;
+		}
+
+		/**
+		 * Deque owned by the calling thread, or null if every deque is taken
+		*/
+		TaskDeque* local();
+
+		/**
+		 * Queues a task on the calling thread's deque, running it straight away if there is no room
+		*/
+		void submit(Task* task);
+
+		/**
+		 * Runs queued tasks, stolen ones included, until `pending` drops to zero
+		*/
+		void wait(const std::atomic<std::size_t>& pending);
+
+		void release(std::size_t idx);
+
+	private:
+		explicit Pool(std::size_t workers);
+
+		std::size_t claim();
+
+		Task* find_work(TaskDeque* own);
+
+		bool work_available() const;
+
+		void worker_loop();
+
+		std::size_t worker_count;
+		std::unique_ptr<TaskDeque[]> deques;
+		std::atomic<bool> in_use[max_deques];
+		std::atomic<std::size_t> deques_seen{ 0 };	// One past the highest deque ever claimed, bounds the search for work
+
+		std::atomic<std::size_t> sleeping{ 0 };
+		std::mutex mutex;
+		std::condition_variable wake;
+	};
+
+	/**
+	 * Deque claimed by the current thread, handed back to the pool when the thread exits
+	*/
+	struct DequeClaim
+	{
+		std::size_t idx = Pool::no_deque;
+		bool tried = false;
+
+		~DequeClaim()
+		{
+			if (idx != Pool::no_deque) Pool::instance().release(idx);
+		}
+	};
+
+	static thread_local DequeClaim claimed;
+
+	Pool::Pool(std::size_t workers) : worker_count(workers), deques(new TaskDeque[max_deques])
+	{
+		for (auto& flag : in_use) flag.store(false, std::memory_order_relaxed);
+		for (std::size_t i = 0; i < worker_count; i++) std::thread(&Pool::worker_loop, this).detach();
+	}
+
+	std::size_t Pool::claim()
+	{
+		for (std::size_t i = 0; i < max_deques; i++)
+		{
+			bool expected = false;
+			if (in_use[i].compare_exchange_strong(expected, true))
+			{
+				auto seen = deques_seen.load();
+				while (seen < i + 1 && !deques_seen.compare_exchange_weak(seen, i + 1)) {}
+				return i;
+			}
+		}
+		return no_deque;
+	}
+
+	void Pool::release(std::size_t idx)
+	{
+		in_use[idx].store(false);
+	}
+
+	TaskDeque* Pool::local()
+	{
+		if (!claimed.tried)
+		{
+			claimed.tried = true;
+			claimed.idx = claim();
+		}
+		return claimed.idx != no_deque ? &deques[claimed.idx] : nullptr;
+	}
+
+	void Pool::submit(Task* task)
+	{
+		auto own = local();
+		if (own == nullptr || !own->push(task))
+		{
+			task->run();
+			delete task;
+			return;
+		}
+
+		if (sleeping.load() > 0)
+		{
+			// Taking the lock orders the notify after a sleeper's last look for work
+			{ std::lock_guard<std::mutex> lock(mutex); }
+			wake.notify_one();
+		}
+	}
+
+	Task* Pool::find_work(TaskDeque* own)
+	{
+		if (own != nullptr)
+		{
+			if (auto task = own->pop()) return task;
+		}
+
+		// Thieves start at different victims so they do not all contend on the same deque
+		static thread_local std::size_t next_victim = std::hash<std::thread::id>()(std::this_thread::get_id());
+		auto count = deques_seen.load(std::memory_order_acquire);
+
+		for (std::size_t i = 0; i < count; i++)
+		{
+			auto& victim = deques[(next_victim + i) % count];
+			if (&victim == own) continue;
+			if (auto task = victim.steal())
+			{
+				next_victim += i;
+				return task;
+			}
+		}
+		next_victim++;
+		return nullptr;
+	}
+
+	bool Pool::work_available() const
+	{
+		auto count = deques_seen.load(std::memory_order_acquire);
+		for (std::size_t i = 0; i < count; i++)
+		{
+			if (!deques[i].empty()) return true;
+		}
+		return false;
+	}
+
+	void Pool::wait(const std::atomic<std::size_t>& pending)
+	{
+		auto own = local();
+
+		while (pending.load(std::memory_order_acquire) != 0)
+		{
+			if (auto task = find_work(own))
+			{
+				task->run();
+				delete task;
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	void Pool::worker_loop()
+	{
+		auto own = local();
+		std::size_t idle = 0;
+
+		while (true)
+		{
+			if (auto task = find_work(own))
+			{
+				task->run();
+				delete task;
+				idle = 0;
+				continue;
+			}
+
+			// Spin briefly since splits arrive in bursts, then sleep. The timeout bounds the cost of a missed wake up
+			if (++idle < 64)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			sleeping++;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				if (!work_available()) wake.wait_for(lock, std::chrono::milliseconds(10));
+			}
+			sleeping--;
+			idle = 0;
+		}
+	}
+
+	std::size_t concurrency()
+	{
+		return Pool::instance().concurrency();
+	}
+
+	/**
+	 * State of one parallel_for call, lives on the caller's stack until every chunk has finished
+	*/
+	struct Loop
+	{
+		const std::function<void(std::size_t, std::size_t)>* body;
+		std::size_t grain;
+		std::atomic<std::size_t> pending{ 1 };
+	};
+
+	static void run_range(Loop& loop, std::size_t begin, std::size_t end);
+
+	struct RangeTask : Task
+	{
+		Loop* loop;
+		std::size_t begin;
+		std::size_t end;
+
+		RangeTask(Loop* loop, std::size_t begin, std::size_t end) : loop(loop), begin(begin), end(end) {}
+
+		void run() override
+		{
+			run_range(*loop, begin, end);
+		}
+	};
+
+	static void run_range(Loop& loop, std::size_t begin, std::size_t end)
+	{
+		auto& pool = Pool::instance();
+		auto own = pool.local();
+
+		while (end - begin > loop.grain)
+		{
+			if (own != nullptr && own->empty())
+			{
+				// Nothing queued here for thieves, so give them the upper half
+				std::size_t mid = begin + (end - begin) / 2;
+				loop.pending.fetch_add(1, std::memory_order_relaxed);
+				pool.submit(new RangeTask(&loop, mid, end));
+				end = mid;
+				continue;
+			}
+
+			(*loop.body)(begin, begin + loop.grain);
+			begin += loop.grain;
+		}
+		if (begin != end) (*loop.body)(begin, end);
+
+		// Last use of the loop, the caller may return as soon as the count reaches zero
+		loop.pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	void submit(Task* task)
+	{
+		Pool::instance().submit(task);
+	}
+
+	void wait(const std::atomic<std::size_t>& pending)
+	{
+		Pool::instance().wait(pending);
+	}
+
+	void parallel_for(std::size_t count, std::size_t grain, const std::function<void(std::size_t, std::size_t)>& body)
+	{
+		if (count == 0) return;
+
+		Loop loop;
+		loop.body = &body;
+		loop.grain = std::max<std::size_t>(grain, 1);
+
+		run_range(loop, 0, count);
+		Pool::instance().wait(loop.pending);
+	}
+}
+
+namespace environment
+{
+	void FutureState::run()
+	{
+		if (started.exchange(true)) return;
+
+		Interpreter interp;
+		interp.env.parent = std::move(globals);
+
+		eval::Frame frame;
+		if (!captured.empty())
+		{
+			for (auto& binding : captured) frame.locals.push_back({ &binding.name, binding.value });
+			interp.frame = &frame;
+		}
+
+		value = eval::catch_uncaught(interp, raised, [&]() { return eval::eval_slot(interp, &expr); });
+
+		// Nothing reads the inputs again, let go of the snapshot before anyone touches the result
+		interp.frame = nullptr;
+		frame.locals.clear();
+		captured.clear();
+		interp.env.parent.reset();
+		frozen.release();
+
+		pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	Future::Future(std::shared_ptr<FutureState> state) : VarCopy(Variable::Type::FUTURE), state(std::move(state)) {}
+
+	Slot Future::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "Future variable is not callable");
+	}
+
+	struct FutureTask : parallel::Task
+	{
+		std::shared_ptr<FutureState> state;
+
+		FutureTask(std::shared_ptr<FutureState> state) : state(std::move(state)) {}
+
+		void run() override
+		{
+			state->run();
+		}
+	};
+
+	namespace builtins
+	{
+		using Type = Variable::Type;
+
+		/**
+		 * Read-only access to the elements of either kind of vector
+		*/
+		struct Elements
+		{
+			const Vector* vec = nullptr;
+			const PersistentVector* persistent = nullptr;
+
+			std::size_t size() const
+			{
+				return vec != nullptr ? vec->size() : persistent->size();
+			}
+
+			const Slot& at(std::size_t idx) const
+			{
+				return vec != nullptr ? vec->at(idx) : persistent->at(idx);
+			}
+		};
+
+		static bool get_elements(const Slot& slot, Elements& elements)
+		{
+			if (slot.type == Type::VECTOR) elements.vec = static_cast<const Vector*>(slot.boxed);
+			else if (slot.type == Type::PERSISTENT_VECTOR) elements.persistent = static_cast<const PersistentVector*>(slot.boxed);
+			else return false;
+			return true;
+		}
+
+		/**
+		 * Freezes what the workers can reach, the caller's definitions, the values the procedure captured
+		 * and the elements. The vector holding the elements is only read by the caller, so it stays writable
+		 *
+		 * @returns the snapshot of the definitions the workers run on top of
+		*/
+		static std::shared_ptr<const Environment> freeze_inputs(Interpreter& interp, Freeze& frozen, const Variable& fn, const Elements& elements)
+		{
+			auto globals = interp.env.snapshot();
+			if (globals != nullptr) frozen.add(*globals);
+			frozen.add(fn);
+			for (std::size_t i = 0; i < elements.size(); i++)
+			{
+				if (elements.at(i).is_boxed()) frozen.add(*elements.at(i).boxed);
+			}
+			return globals;
+		}
+
+		static std::size_t grain_for(std::size_t count)
+		{
+			return std::max<std::size_t>(1, count / (parallel::concurrency() * 32));
+		}
+
+		/**
+		 * Error raised on a worker that nothing there caught, the one of the lowest element kept so the
+		 * caller sees the same error however the work was spread
+		*/
+		struct Failure
+		{
+			std::mutex mutex;
+			std::size_t index = SIZE_MAX;
+			Slot raised;
+			std::atomic<bool> failed{ false };
+
+			void record(std::size_t at, Slot value)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (at < index)
+				{
+					index = at;
+					raised = std::move(value);
+				}
+				failed.store(true, std::memory_order_relaxed);
+			}
+		};
+
+		/**
+		 * Calls `fn` on every element, storing each result at the index of its element. Errors are
+		 * caught on the workers and recorded in `failure`, for the caller to raise again
+		 *
+		 * @returns false if any call raised an error, or returned no value where one was needed
+		*/
+		static bool map_elements(Interpreter& interp, Variable& fn, const Elements& elements, std::vector<Slot>* results, Failure& failure)
+		{
+			// Each chunk gets an interpreter of its own on top of a snapshot of the caller's definitions,
+			// which stay frozen only until every call has returned
+			Freeze frozen;
+			auto globals = freeze_inputs(interp, frozen, fn, elements);
+
+			parallel::parallel_for(elements.size(), grain_for(elements.size()), [&](std::size_t begin, std::size_t end) {
+				Interpreter worker;
+				worker.env.parent = globals;
+
+				for (std::size_t i = begin; i < end && !failure.failed.load(std::memory_order_relaxed); i++)
+				{
+					Slot arg = elements.at(i);
+					Slot raised;
+					auto result = eval::catch_uncaught(worker, raised, [&]() { return fn.call(worker, Span<Slot>(&arg, 1)); });
+					if (raised.type != Type::INVALID) failure.record(i, std::move(raised));
+					else if (results != nullptr && result.type == Type::INVALID) failure.record(i, Slot());
+					if (results != nullptr) (*results)[i] = std::move(result);
+				}
+			});
+			return !failure.failed;
+		}
+
+		/**
+		 * Raises the error a worker recorded in the caller, where its handlers can see it
+		*/
+		static Slot raise_failure(Interpreter& interp, Failure& failure, const char* procedure)
+		{
+			if (failure.raised.type != Type::INVALID) return eval::raise(interp, std::move(failure.raised));
+			return eval::fail(interp, procedure, " procedure expects a procedure that returns a value, element ", failure.index, " gave none");
+		}
+
+		Slot pmap(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2)
+			{
+				return eval::fail(interp, "Parallel map procedure expects 2 arguments, a procedure and a vector");
+			}
+
+			Elements elements;
+			if (args[0].type != Type::PROCEDURE || !get_elements(args[1], elements))
+			{
+				return eval::fail(interp, "Parallel map procedure received an invalid argument type: ", get_type_as_string(args[0].type), ", ", get_type_as_string(args[1].type));
+			}
+
+			std::vector<Slot> results(elements.size());
+			Failure failure;
+			if (!map_elements(interp, *args[0].boxed, elements, &results, failure)) return raise_failure(interp, failure, "Parallel map");
+
+			if (elements.persistent != nullptr)
+			{
+				auto vec = std::make_unique<PersistentVector>();
+				for (auto& result : results) *vec = vec->push(std::move(result));
+				return Slot::from_variable(std::move(vec));
+			}
+
+			auto vec = std::make_unique<Vector>(0, Slot());
+			for (auto& result : results) vec->buffer->boxed_count += result.is_boxed();
+			vec->buffer->slots = std::move(results);
+			return Slot::from_variable(std::move(vec));
+		}
+
+		Slot pfor_each(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2)
+			{
+				return eval::fail(interp, "Parallel for-each procedure expects 2 arguments, a procedure and a vector");
+			}
+
+			Elements elements;
+			if (args[0].type != Type::PROCEDURE || !get_elements(args[1], elements))
+			{
+				return eval::fail(interp, "Parallel for-each procedure received an invalid argument type: ", get_type_as_string(args[0].type), ", ", get_type_as_string(args[1].type));
+			}
+
+			Failure failure;
+			if (!map_elements(interp, *args[0].boxed, elements, nullptr, failure)) return raise_failure(interp, failure, "Parallel for-each");
+			return Slot();
+		}
+
+		Slot preduce(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 3)
+			{
+				return eval::fail(interp, "Parallel reduce procedure expects 3 arguments, a procedure, an initial value and a vector");
+			}
+
+			Elements elements;
+			if (args[0].type != Type::PROCEDURE || !get_elements(args[2], elements))
+			{
+				return eval::fail(interp, "Parallel reduce procedure received an invalid argument type: ", get_type_as_string(args[0].type), ", ", get_type_as_string(args[2].type));
+			}
+
+			auto& fn = *args[0].boxed;
+			std::size_t count = elements.size();
+
+			// Block boundaries depend only on the length, so an associative procedure combines the same
+			// values in the same order however the blocks end up spread across threads
+			std::size_t block = std::max<std::size_t>(16, (count + 255) / 256);
+			std::size_t blocks = (count + block - 1) / block;
+			std::vector<Slot> partials(blocks);
+			Failure failure;
+			Freeze frozen;
+			auto globals = freeze_inputs(interp, frozen, fn, elements);
+
+			parallel::parallel_for(blocks, 1, [&](std::size_t first, std::size_t last) {
+				Interpreter worker;
+				worker.env.parent = globals;
+
+				for (std::size_t b = first; b < last && !failure.failed.load(std::memory_order_relaxed); b++)
+				{
+					std::size_t end = std::min(count, (b + 1) * block);
+					Slot acc = elements.at(b * block);
+
+					std::size_t i = b * block + 1;
+					Slot raised;
+					for (; i < end && acc.type != Type::INVALID; i++)
+					{
+						Slot pair[2] = { std::move(acc), elements.at(i) };
+						acc = eval::catch_uncaught(worker, raised, [&]() { return fn.call(worker, Span<Slot>(pair, 2)); });
+					}
+					if (acc.type == Type::INVALID) failure.record(i - 1, std::move(raised));
+					partials[b] = std::move(acc);
+				}
+			});
+			frozen.release();
+			if (failure.failed) return raise_failure(interp, failure, "Parallel reduce");
+
+			Slot acc = std::move(args[1]);
+			for (std::size_t b = 0; b < blocks; b++)
+			{
+				Slot pair[2] = { std::move(acc), std::move(partials[b]) };
+				acc = fn.call(interp, Span<Slot>(pair, 2));
+				if (interp.escape != nullptr) return Slot();
+				if (acc.type == Type::INVALID)
+				{
+					return eval::fail(interp, "Parallel reduce procedure expects a procedure that returns a value, combining block ", b, " gave none");
+				}
+			}
+			return acc;
+		}
+
+		Slot touch(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1)
+			{
+				return eval::fail(interp, "Touch procedure expects 1 argument");
+			}
+
+			// Touching anything other than a future gives the value back unchanged
+			if (args[0].type != Type::FUTURE) return std::move(args[0]);
+
+			auto& state = *static_cast<Future*>(args[0].boxed)->state;
+
+			// Runs the future here if no thread has picked it up yet, otherwise helps with other work until it is done
+			state.run();
+			parallel::wait(state.pending);
+
+			// The error is raised where the value was asked for, so the toucher's handlers see it
+			if (state.raised.type != Type::INVALID) return eval::raise(interp, state.raised);
+			return state.value;
+		}
+	}
+}
+
+namespace eval
+{
+	/**
+	 * Freezes the definitions an expression names, along with those named by the bodies of the
+	 * closures they lead to
+	 *
+	 * @param names: names already looked at, which also ends recursion between closures
+	*/
+	static void freeze_named(Freeze& frozen, const Environment* globals, const ASTExpr& expr, std::unordered_set<std::string_view>& names,
+		const std::function<void(const Closure&)>& on_closure)
+	{
+		if (expr.type == ASTExpr::Type::LIST)
+		{
+			for (auto& child : expr.children) freeze_named(frozen, globals, child, names, on_closure);
+			return;
+		}
+		if (globals == nullptr || expr.leaf.type != Token::Type::SYMBOL || !names.insert(expr.leaf.symbol).second) return;
+
+		if (auto var = globals->find(expr.leaf.symbol)) frozen.add(*var, on_closure);
+	}
+
+	Slot future(Interpreter& interp, Span<const ASTExpr> args)
+	{
+		SCHEME_INSTRUMENT_CALL("future");
+
+		if (args.size() != 1)
+		{
+			return eval::fail(interp, "Future expects a single expression");
+		}
+
+		auto state = std::make_shared<FutureState>();
+		state->expr = copy_ast(args[0]);
+		state->globals = interp.env.snapshot();
+		state->captured = capture_locals(interp);
+
+		// Only what the expression can reach is frozen, until it has been evaluated
+		std::unordered_set<std::string_view> names;
+		std::function<void(const Closure&)> on_closure;
+		on_closure = [&](const Closure& closure) {
+			for (auto& expr : closure.code->body) freeze_named(state->frozen, state->globals.get(), expr, names, on_closure);
+		};
+		for (auto& binding : state->captured)
+		{
+			names.insert(binding.name);
+			if (binding.value.is_boxed()) state->frozen.add(*binding.value.boxed, on_closure);
+		}
+		freeze_named(state->frozen, state->globals.get(), state->expr, names, on_closure);
+
+		parallel::submit(new FutureTask(state));
+		return Slot::from_variable(std::make_unique<Future>(std::move(state)));
+	}
+}
@@ -1,4 +1,5 @@
 ﻿#include <lang/parser.hpp>
+#include <lang/memstats.hpp>
 #include <cassert>
 
 using namespace lexer;
@@ -6,10 +7,14 @@ using namespace lexer;
 namespace parser
 {
 
-	ASTExpr::ASTExpr() {}
+	ASTExpr::ASTExpr()
+	{
+		memstats::expr_created();
+	}
 
 	ASTExpr::ASTExpr(ASTExpr&& other) noexcept
 	{
+		memstats::expr_created();
 		type = other.type;
 
 		switch (other.type)
@@ -29,6 +34,7 @@ namespace parser
 
 	ASTExpr::~ASTExpr()
 	{
+		memstats::expr_destroyed();
 		switch (type)
 		{
 		case Type::INVALID:
@@ -73,7 +79,10 @@ namespace parser
 	}
 
 
-	ASTExpr::ASTExpr(Type type) : type(type) {}
+	ASTExpr::ASTExpr(Type type) : type(type)
+	{
+		memstats::expr_created();
+	}
 
 	template<>
 	ASTExpr make_astexpr<ASTExpr::Type::INVALID>()
@@ -101,16 +110,61 @@ namespace parser
 
 	ASTExpr construct_ast(std::vector<Token>&& token_arr)
 	{
-		if (token_arr[0].type != Token::Type::LRB)
+		if (token_arr.empty() || token_arr[0].type != Token::Type::LRB)
 		{
-			std::cout << "Program must begin with an opening bracket" << std::endl;
-			// Handle errors here...
+			std::cout << "Program must begin with an opening bracket\n";
+			return ASTExpr();
 		}
 
 		ASTExpr ast = std::move(parse_expr(std::next(token_arr.begin()), std::prev(token_arr.end())));
 		return ast;
 	}
 
+	Iter find_closing_bracket(Iter start, Iter end)
+	{
+		int depth = 0;
+		for (Iter it = start; it != end; it = std::next(it))
+		{
+			if (it->type == Token::Type::LRB) depth++;
+			else if (it->type == Token::Type::RRB && --depth == 0) return it;
+		}
+		return end;
+	}
+
+	std::vector<ASTExpr> construct_program(std::vector<Token>&& token_arr)
+	{
+		std::vector<ASTExpr> forms;
+		Iter start = token_arr.begin();
+
+		while (start != token_arr.end())
+		{
+			if (start->type == Token::Type::LRB)
+			{
+				Iter close = find_closing_bracket(start, token_arr.end());
+				if (close == token_arr.end())
+				{
+					std::cout << "Expression is missing a closing bracket\n";
+					break;
+				}
+				forms.push_back(parse_expr(std::next(start), close));
+				start = std::next(close);
+			}
+			else if (start->type == Token::Type::RRB)
+			{
+				std::cout << "Unexpected closing bracket encountered\n";
+				start = std::next(start);
+			}
+			else
+			{
+				ASTExpr atom = make_astexpr<ASTExpr::Type::ATOM>();
+				atom.leaf = std::move(*start);
+				forms.push_back(std::move(atom));
+				start = std::next(start);
+			}
+		}
+		return forms;
+	}
+
 	ASTExpr parse_expr(Iter start, Iter end)
 	{
 		ASTExpr expr = make_astexpr<ASTExpr::Type::LIST>();
@@ -119,15 +173,13 @@ namespace parser
 		{	
 			if (start->type == Token::Type::LRB)	// New expression encountered
 			{
-				Iter next_end = start;
-				while (next_end->type != Token::Type::RRB)
-				{
-					next_end = std::next(next_end);	// Find closing bracket
-				}
+				Iter next_end = find_closing_bracket(start, end);
 				expr.children.push_back(parse_expr(std::next(start), next_end));
 				start = next_end;
+				if (start != end) start = std::next(start);
 			}
-			else if (start->type == Token::Type::SYMBOL || start->type == Token::Type::INT || start->type == Token::Type::FLOAT || start->type == Token::Type::STRING)
+			else if (start->type == Token::Type::SYMBOL || start->type == Token::Type::INT || start->type == Token::Type::FLOAT || start->type == Token::Type::STRING ||
+				start->type == Token::Type::ERROR)
 			{
 				ASTExpr sub_expr = make_astexpr<ASTExpr::Type::ATOM>();
 				sub_expr.leaf = std::move(*start);
@@ -143,6 +195,44 @@ namespace parser
 		return expr;
 	}
 
+	ASTExpr copy_ast(const ASTExpr& expr)
+	{
+		switch (expr.type)
+		{
+		case ASTExpr::Type::LIST:
+		{
+			ASTExpr copy = make_astexpr<ASTExpr::Type::LIST>();
+			copy.children.reserve(expr.children.size());
+			for (auto& child : expr.children) copy.children.push_back(copy_ast(child));
+			return copy;
+		}
+		case ASTExpr::Type::ATOM:
+		{
+			ASTExpr copy = make_astexpr<ASTExpr::Type::ATOM>();
+			copy.leaf = make_token(expr.leaf.type);
+			switch (expr.leaf.type)
+			{
+			case Token::Type::SYMBOL:
+			case Token::Type::STRING:
+			case Token::Type::ERROR:
+				copy.leaf.symbol = expr.leaf.symbol;
+				break;
+			case Token::Type::INT:
+				copy.leaf.i_value = expr.leaf.i_value;
+				break;
+			case Token::Type::FLOAT:
+				copy.leaf.f_value = expr.leaf.f_value;
+				break;
+			default:
+				break;
+			}
+			return copy;
+		}
+		default:
+			return ASTExpr();
+		}
+	}
+
 	void print_ast_expr(const ASTExpr& expr, int level)
 	{
 		if (expr.type == ASTExpr::Type::LIST)
@@ -0,0 +1,567 @@
+#include <lang/persistent.hpp>
+#include <lang/condition.hpp>
+#include <lang/evaluate.hpp>
+#include <bitset>
+
+namespace environment
+{
+
+	using VecNode = PersistentVector::Node;
+	using MapNode = PersistentMap::Node;
+	using MapEntry = PersistentMap::Entry;
+
+	static constexpr unsigned hash_bits = sizeof(std::size_t) * 8;
+
+	static const std::shared_ptr<const VecNode>& empty_vec_node()
+	{
+		static const std::shared_ptr<const VecNode> node = std::make_shared<VecNode>();
+		return node;
+	}
+
+	PersistentVector::PersistentVector() : VarCopy(Variable::Type::PERSISTENT_VECTOR), root(empty_vec_node()), tail(empty_vec_node()) {}
+
+	std::size_t PersistentVector::size() const noexcept
+	{
+		return count;
+	}
+
+	std::size_t PersistentVector::tail_offset() const noexcept
+	{
+		return count < width ? 0 : ((count - 1) >> bits) << bits;
+	}
+
+	const Slot& PersistentVector::at(std::size_t idx) const noexcept
+	{
+		if (idx >= tail_offset()) return tail->values[idx & mask];
+
+		const Node* node = root.get();
+		for (unsigned level = shift; level > 0; level -= bits)
+		{
+			node = node->children[(idx >> level) & mask].get();
+		}
+		return node->values[idx & mask];
+	}
+
+	static std::shared_ptr<const VecNode> set_in_node(unsigned level, const VecNode& node, std::size_t idx, Slot value)
+	{
+		auto res = std::make_shared<VecNode>(node);
+
+		if (level == 0)
+		{
+			res->values[idx & PersistentVector::mask] = std::move(value);
+		}
+		else
+		{
+			auto sub_idx = (idx >> level) & PersistentVector::mask;
+			res->children[sub_idx] = set_in_node(level - PersistentVector::bits, *node.children[sub_idx], idx, std::move(value));
+		}
+		return res;
+	}
+
+	PersistentVector PersistentVector::set(std::size_t idx, Slot value) const
+	{
+		PersistentVector res = *this;
+
+		if (idx >= tail_offset())
+		{
+			auto new_tail = std::make_shared<Node>(*tail);
+			new_tail->values[idx & mask] = std::move(value);
+			res.tail = std::move(new_tail);
+		}
+		else
+		{
+			res.root = set_in_node(shift, *root, idx, std::move(value));
+		}
+		return res;
+	}
+
+	static std::shared_ptr<const VecNode> new_path(unsigned level, std::shared_ptr<const VecNode> node)
+	{
+		if (level == 0) return node;
+
+		auto res = std::make_shared<VecNode>();
+		res->children.push_back(new_path(level - PersistentVector::bits, std::move(node)));
+		return res;
+	}
+
+	std::shared_ptr<const PersistentVector::Node> PersistentVector::push_tail(unsigned level, const Node& parent, std::shared_ptr<const Node> tail_node) const
+	{
+		auto res = std::make_shared<Node>();
+		res->children = parent.children;
+
+		auto sub_idx = ((count - 1) >> level) & mask;
+		std::shared_ptr<const Node> to_insert;
+
+		if (level == bits) to_insert = std::move(tail_node);
+		else if (sub_idx < parent.children.size()) to_insert = push_tail(level - bits, *parent.children[sub_idx], std::move(tail_node));
+		else to_insert = new_path(level - bits, std::move(tail_node));
+
+		if (sub_idx < res->children.size()) res->children[sub_idx] = std::move(to_insert);
+		else res->children.push_back(std::move(to_insert));
+		return res;
+	}
+
+	PersistentVector PersistentVector::push(Slot value) const
+	{
+		PersistentVector res = *this;
+		res.count++;
+
+		if (count - tail_offset() < width)
+		{
+			auto new_tail = std::make_shared<Node>(*tail);
+			new_tail->values.push_back(std::move(value));
+			res.tail = std::move(new_tail);
+			return res;
+		}
+
+		// The tail is full, so it moves into the trie and a new tail is started
+		if ((count >> bits) > (std::size_t(1) << shift))
+		{
+			auto new_root = std::make_shared<Node>();
+			new_root->children.push_back(root);
+			new_root->children.push_back(new_path(shift, tail));
+			res.root = std::move(new_root);
+			res.shift = shift + bits;
+		}
+		else
+		{
+			res.root = push_tail(shift, *root, tail);
+		}
+
+		auto new_tail = std::make_shared<Node>();
+		new_tail->values.push_back(std::move(value));
+		res.tail = std::move(new_tail);
+		return res;
+	}
+
+	Slot PersistentVector::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "Persistent vector variable is not callable");
+	}
+
+	PersistentMap::PersistentMap() : VarCopy(Variable::Type::PERSISTENT_MAP) {}
+
+	std::size_t PersistentMap::size() const noexcept
+	{
+		return count;
+	}
+
+	static std::uint32_t hash_fragment(std::size_t hash, unsigned shift)
+	{
+		return static_cast<std::uint32_t>(hash >> shift) & 31;
+	}
+
+	static std::size_t entry_index(std::uint32_t bitmap, std::uint32_t bit)
+	{
+		return std::bitset<32>(bitmap & (bit - 1)).count();
+	}
+
+	const Slot* PersistentMap::find(const Slot& key) const
+	{
+		auto hash = hash_slot(key, Equivalence::EQUAL);
+		const Node* node = root.get();
+
+		for (unsigned shift = 0; node != nullptr; shift += 5)
+		{
+			if (node->collision)
+			{
+				for (auto& entry : node->entries)
+				{
+					if (slots_equivalent(entry.key, key, Equivalence::EQUAL)) return &entry.value;
+				}
+				return nullptr;
+			}
+
+			std::uint32_t bit = 1u << hash_fragment(hash, shift);
+			if ((node->bitmap & bit) == 0) return nullptr;
+
+			const Entry& entry = node->entries[entry_index(node->bitmap, bit)];
+			if (entry.child == nullptr)
+			{
+				if (entry.hash == hash && slots_equivalent(entry.key, key, Equivalence::EQUAL)) return &entry.value;
+				return nullptr;
+			}
+			node = entry.child.get();
+		}
+		return nullptr;
+	}
+
+	/**
+	 * Builds the smallest sub-trie that separates two pairs whose hashes agree up to `shift`
+	*/
+	static std::shared_ptr<const MapNode> make_pair_node(unsigned shift, MapEntry first, MapEntry second)
+	{
+		auto node = std::make_shared<MapNode>();
+
+		if (shift >= hash_bits)
+		{
+			// Every bit of the hash has been used, the keys can only be told apart by comparing them
+			node->collision = true;
+			node->entries.push_back(std::move(first));
+			node->entries.push_back(std::move(second));
+			return node;
+		}
+
+		auto first_frag = hash_fragment(first.hash, shift);
+		auto second_frag = hash_fragment(second.hash, shift);
+
+		if (first_frag == second_frag)
+		{
+			MapEntry entry;
+			entry.child = make_pair_node(shift + 5, std::move(first), std::move(second));
+			node->bitmap = 1u << first_frag;
+			node->entries.push_back(std::move(entry));
+			return node;
+		}
+
+		node->bitmap = (1u << first_frag) | (1u << second_frag);
+		if (first_frag > second_frag) std::swap(first, second);
+		node->entries.push_back(std::move(first));
+		node->entries.push_back(std::move(second));
+		return node;
+	}
+
+	static std::shared_ptr<const MapNode> set_in_node(const MapNode* node, unsigned shift, MapEntry pair, bool& added)
+	{
+		if (node == nullptr)
+		{
+			auto res = std::make_shared<MapNode>();
+			res->bitmap = 1u << hash_fragment(pair.hash, shift);
+			res->entries.push_back(std::move(pair));
+			added = true;
+			return res;
+		}
+
+		auto res = std::make_shared<MapNode>(*node);
+
+		if (node->collision)
+		{
+			for (auto& entry : res->entries)
+			{
+				if (slots_equivalent(entry.key, pair.key, Equivalence::EQUAL))
+				{
+					entry.value = std::move(pair.value);
+					return res;
+				}
+			}
+			res->entries.push_back(std::move(pair));
+			added = true;
+			return res;
+		}
+
+		std::uint32_t bit = 1u << hash_fragment(pair.hash, shift);
+		auto idx = entry_index(node->bitmap, bit);
+
+		if ((node->bitmap & bit) == 0)
+		{
+			res->bitmap |= bit;
+			res->entries.insert(res->entries.begin() + idx, std::move(pair));
+			added = true;
+			return res;
+		}
+
+		MapEntry& entry = res->entries[idx];
+
+		if (entry.child != nullptr)
+		{
+			entry.child = set_in_node(entry.child.get(), shift + 5, std::move(pair), added);
+		}
+		else if (entry.hash == pair.hash && slots_equivalent(entry.key, pair.key, Equivalence::EQUAL))
+		{
+			entry.value = std::move(pair.value);
+		}
+		else
+		{
+			MapEntry split;
+			split.child = make_pair_node(shift + 5, std::move(entry), std::move(pair));
+			entry = std::move(split);
+			added = true;
+		}
+		return res;
+	}
+
+	PersistentMap PersistentMap::set(Slot key, Slot value) const
+	{
+		Entry pair;
+		pair.hash = hash_slot(key, Equivalence::EQUAL);
+		pair.key = std::move(key);
+		pair.value = std::move(value);
+
+		bool added = false;
+		PersistentMap res = *this;
+		res.root = set_in_node(root.get(), 0, std::move(pair), added);
+		if (added) res.count++;
+		return res;
+	}
+
+	/**
+	 * Removes a key from a sub-trie. Returns the original node when the key is absent, and null when the
+	 * node is left empty
+	*/
+	static std::shared_ptr<const MapNode> erase_in_node(const std::shared_ptr<const MapNode>& node, unsigned shift, std::size_t hash, const Slot& key, bool& removed)
+	{
+		if (node->collision)
+		{
+			for (std::size_t i = 0; i < node->entries.size(); i++)
+			{
+				if (!slots_equivalent(node->entries[i].key, key, Equivalence::EQUAL)) continue;
+
+				removed = true;
+				if (node->entries.size() == 1) return nullptr;
+
+				auto res = std::make_shared<MapNode>(*node);
+				res->entries.erase(res->entries.begin() + i);
+				return res;
+			}
+			return node;
+		}
+
+		std::uint32_t bit = 1u << hash_fragment(hash, shift);
+		if ((node->bitmap & bit) == 0) return node;
+
+		auto idx = entry_index(node->bitmap, bit);
+		const MapEntry& entry = node->entries[idx];
+
+		if (entry.child == nullptr)
+		{
+			if (entry.hash != hash || !slots_equivalent(entry.key, key, Equivalence::EQUAL)) return node;
+
+			removed = true;
+			if (node->entries.size() == 1) return nullptr;
+
+			auto res = std::make_shared<MapNode>(*node);
+			res->bitmap &= ~bit;
+			res->entries.erase(res->entries.begin() + idx);
+			return res;
+		}
+
+		auto child = erase_in_node(entry.child, shift + 5, hash, key, removed);
+		if (!removed) return node;
+
+		auto res = std::make_shared<MapNode>(*node);
+
+		if (child == nullptr)
+		{
+			if (node->entries.size() == 1) return nullptr;
+			res->bitmap &= ~bit;
+			res->entries.erase(res->entries.begin() + idx);
+		}
+		else if (child->entries.size() == 1 && child->entries[0].child == nullptr)
+		{
+			// A sub-trie holding a single pair is folded back into its parent
+			res->entries[idx] = child->entries[0];
+		}
+		else
+		{
+			res->entries[idx].child = std::move(child);
+		}
+		return res;
+	}
+
+	PersistentMap PersistentMap::erase(const Slot& key) const
+	{
+		if (root == nullptr) return *this;
+
+		bool removed = false;
+		PersistentMap res = *this;
+		res.root = erase_in_node(root, 0, hash_slot(key, Equivalence::EQUAL), key, removed);
+		if (removed) res.count--;
+		return res;
+	}
+
+	static void for_each_in_node(const MapNode& node, const std::function<void(const Slot&, const Slot&)>& fn)
+	{
+		for (auto& entry : node.entries)
+		{
+			if (entry.child != nullptr) for_each_in_node(*entry.child, fn);
+			else fn(entry.key, entry.value);
+		}
+	}
+
+	void PersistentMap::for_each(const std::function<void(const Slot&, const Slot&)>& fn) const
+	{
+		if (root != nullptr) for_each_in_node(*root, fn);
+	}
+
+	Slot PersistentMap::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "Persistent map variable is not callable");
+	}
+
+	namespace builtins
+	{
+		using Type = Variable::Type;
+
+		Slot persistent_vector(Interpreter& interp, Span<Slot> args)
+		{
+			auto vec = std::make_unique<PersistentVector>();
+
+			for (auto& arg : args)
+			{
+				*vec = vec->push(std::move(arg));
+			}
+			return Slot::from_variable(std::move(vec));
+		}
+
+		Slot persistent_vector_length(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1)
+			{
+				return eval::fail(interp, "Persistent vector length procedure expects 1 argument");
+			}
+
+			if (args[0].type != Type::PERSISTENT_VECTOR)
+			{
+				return eval::fail(interp, "Persistent vector length procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+			return Slot(static_cast<int>(static_cast<PersistentVector*>(args[0].boxed)->size()));
+		}
+
+		Slot persistent_vector_ref(Interpreter& interp, Span<Slot> args)
+		{
+			std::size_t idx;
+
+			if (args.size() != 2 || args[0].type != Type::PERSISTENT_VECTOR || !get_index(args[1], idx))
+			{
+				return eval::fail(interp, "Persistent vector ref procedure expects a persistent vector and an index");
+			}
+
+			auto vec = static_cast<PersistentVector*>(args[0].boxed);
+			if (idx >= vec->size())
+			{
+				return eval::fail(interp, "Persistent vector index out of range: ", args[1].i_value);
+			}
+			return vec->at(idx);
+		}
+
+		Slot persistent_vector_set(Interpreter& interp, Span<Slot> args)
+		{
+			std::size_t idx;
+
+			if (args.size() != 3 || args[0].type != Type::PERSISTENT_VECTOR || !get_index(args[1], idx))
+			{
+				return eval::fail(interp, "Persistent vector set procedure expects a persistent vector, an index, and a value");
+			}
+
+			auto vec = static_cast<PersistentVector*>(args[0].boxed);
+			if (idx >= vec->size())
+			{
+				return eval::fail(interp, "Persistent vector index out of range: ", args[1].i_value);
+			}
+			return Slot::from_variable(std::make_unique<PersistentVector>(vec->set(idx, std::move(args[2]))));
+		}
+
+		Slot persistent_vector_push(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2)
+			{
+				return eval::fail(interp, "Persistent vector push procedure expects a persistent vector and a value");
+			}
+
+			if (args[0].type != Type::PERSISTENT_VECTOR)
+			{
+				return eval::fail(interp, "Persistent vector push procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+
+			auto vec = static_cast<PersistentVector*>(args[0].boxed);
+			return Slot::from_variable(std::make_unique<PersistentVector>(vec->push(std::move(args[1]))));
+		}
+
+		Slot persistent_map(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() % 2 != 0)
+			{
+				return eval::fail(interp, "Persistent map procedure expects alternating keys and values");
+			}
+
+			auto map = std::make_unique<PersistentMap>();
+
+			for (size_t i = 0; i < args.size(); i += 2)
+			{
+				*map = map->set(std::move(args[i]), std::move(args[i + 1]));
+			}
+			return Slot::from_variable(std::move(map));
+		}
+
+		Slot persistent_map_count(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1)
+			{
+				return eval::fail(interp, "Persistent map count procedure expects 1 argument");
+			}
+
+			if (args[0].type != Type::PERSISTENT_MAP)
+			{
+				return eval::fail(interp, "Persistent map count procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+			return Slot(static_cast<int>(static_cast<PersistentMap*>(args[0].boxed)->size()));
+		}
+
+		Slot persistent_map_ref(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2 && args.size() != 3)
+			{
+				return eval::fail(interp, "Persistent map ref procedure expects a persistent map, a key, and an optional default value");
+			}
+
+			if (args[0].type != Type::PERSISTENT_MAP)
+			{
+				return eval::fail(interp, "Persistent map ref procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+
+			auto value = static_cast<PersistentMap*>(args[0].boxed)->find(args[1]);
+			if (value != nullptr) return *value;
+			if (args.size() == 3) return std::move(args[2]);
+
+			return eval::fail(interp, "Persistent map does not contain the given key");
+		}
+
+		Slot persistent_map_set(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 3)
+			{
+				return eval::fail(interp, "Persistent map set procedure expects a persistent map, a key, and a value");
+			}
+
+			if (args[0].type != Type::PERSISTENT_MAP)
+			{
+				return eval::fail(interp, "Persistent map set procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+
+			auto map = static_cast<PersistentMap*>(args[0].boxed);
+			return Slot::from_variable(std::make_unique<PersistentMap>(map->set(std::move(args[1]), std::move(args[2]))));
+		}
+
+		Slot persistent_map_delete(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2)
+			{
+				return eval::fail(interp, "Persistent map delete procedure expects a persistent map and a key");
+			}
+
+			if (args[0].type != Type::PERSISTENT_MAP)
+			{
+				return eval::fail(interp, "Persistent map delete procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+
+			auto map = static_cast<PersistentMap*>(args[0].boxed);
+			return Slot::from_variable(std::make_unique<PersistentMap>(map->erase(args[1])));
+		}
+
+		Slot persistent_map_contains(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2)
+			{
+				return eval::fail(interp, "Persistent map contains procedure expects a persistent map and a key");
+			}
+
+			if (args[0].type != Type::PERSISTENT_MAP)
+			{
+				return eval::fail(interp, "Persistent map contains procedure received an invalid argument type: ", get_type_as_string(args[0].type));
+			}
+
+			return Slot(static_cast<PersistentMap*>(args[0].boxed)->find(args[1]) != nullptr);
+		}
+	}
+
+}
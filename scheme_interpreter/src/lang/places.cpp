@@ -0,0 +1,413 @@
+#include <lang/places.hpp>
+#include <lang/condition.hpp>
+#include <lang/hash_table.hpp>
+#include <lang/image.hpp>
+#include <lang/persistent.hpp>
+#include <lang/region.hpp>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace places
+{
+
+	static void futex_wait(std::atomic<std::uint32_t>* addr, std::uint32_t expected)
+	{
+		syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+	}
+
+	static void futex_wake(std::atomic<std::uint32_t>* addr)
+	{
+		syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(addr), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+	}
+
+	Mailbox::Mailbox()
+	{
+		// The queue always holds a node before the oldest message, so producers never see it empty
+		auto stub = new Node();
+		head.store(stub, std::memory_order_relaxed);
+		tail = stub;
+	}
+
+	Mailbox::~Mailbox()
+	{
+		while (tail != nullptr)
+		{
+			auto next = tail->next.load(std::memory_order_relaxed);
+			delete tail;
+			tail = next;
+		}
+	}
+
+	void Mailbox::push(Slot message)
+	{
+		auto node = new Node();
+		node->value = std::move(message);
+
+		auto prev = head.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+
+		// Pairs with the fence in pop, either the consumer sees the message or this sees it waiting
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed))
+		{
+			signal.fetch_add(1, std::memory_order_relaxed);
+			futex_wake(&signal);
+		}
+	}
+
+	bool Mailbox::try_pop(Slot& message)
+	{
+		auto next = tail->next.load(std::memory_order_acquire);
+		if (next == nullptr) return false;
+
+		// The node holding the message becomes the new stub
+		message = std::move(next->value);
+		delete tail;
+		tail = next;
+		return true;
+	}
+
+	Slot Mailbox::pop()
+	{
+		Slot message;
+
+		// Replies often arrive within a few microseconds, much sooner than a sleep and wake up take
+		for (int spin = 0; spin < 64; spin++)
+		{
+			if (try_pop(message)) return message;
+			std::this_thread::yield();
+		}
+
+		while (true)
+		{
+			auto seen = signal.load(std::memory_order_relaxed);
+			waiting.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if (try_pop(message)) break;
+			futex_wait(&signal, seen);
+			if (try_pop(message)) break;
+		}
+		waiting.store(false, std::memory_order_relaxed);
+		return message;
+	}
+
+	PlaceThread::~PlaceThread()
+	{
+		// The last reference may be dropped by the place's own thread, which cannot join itself
+		if (thread.joinable()) thread.detach();
+	}
+
+	/**
+	 * Whether a value can be shared between places as it is, which holds when nothing reachable from it can be changed
+	*/
+	static bool is_immutable(const Slot& slot)
+	{
+		switch (slot.type)
+		{
+		case Variable::Type::INT:
+		case Variable::Type::FLOAT:
+		case Variable::Type::BOOL:
+		case Variable::Type::STRING:
+		case Variable::Type::SYMBOL:
+			return true;
+		case Variable::Type::PERSISTENT_VECTOR:
+		{
+			auto& vec = *static_cast<const PersistentVector*>(slot.boxed);
+			for (std::size_t i = 0; i < vec.size(); i++)
+			{
+				if (!is_immutable(vec.at(i))) return false;
+			}
+			return true;
+		}
+		case Variable::Type::PERSISTENT_MAP:
+		{
+			bool immutable = true;
+			static_cast<const PersistentMap*>(slot.boxed)->for_each([&](const Slot& key, const Slot& value) {
+				if (immutable && (!is_immutable(key) || !is_immutable(value))) immutable = false;
+			});
+			return immutable;
+		}
+		default:
+			return false;
+		}
+	}
+
+	using CopyMap = std::unordered_map<const void*, Slot>;
+
+	static bool copy_slot(const Slot& value, Slot& copy, CopyMap& copied)
+	{
+		switch (value.type)
+		{
+		case Variable::Type::INT:
+		case Variable::Type::FLOAT:
+		case Variable::Type::BOOL:
+		case Variable::Type::STRING:
+		case Variable::Type::SYMBOL:
+		case Variable::Type::PLACE_CHANNEL:
+			copy = value;
+			return true;
+		case Variable::Type::VECTOR:
+		{
+			auto& vec = *static_cast<const Vector*>(value.boxed);
+
+			// Copies of a vector share its buffer, and so do the copies of the copy
+			auto found = copied.find(vec.buffer.get());
+			if (found != copied.end())
+			{
+				copy = found->second;
+				return true;
+			}
+
+			auto& slot = copied[vec.buffer.get()] = Slot::from_variable(std::make_unique<Vector>(vec.size(), Slot()));
+			auto& target = *static_cast<Vector*>(slot.boxed);
+
+			for (std::size_t i = 0; i < vec.size(); i++)
+			{
+				Slot element;
+				if (!copy_slot(vec.at(i), element, copied)) return false;
+				target.set(i, std::move(element));
+			}
+			copy = slot;
+			return true;
+		}
+		case Variable::Type::HASH_TABLE:
+		{
+			auto& table = *static_cast<const HashTable*>(value.boxed);
+
+			auto found = copied.find(table.table.get());
+			if (found != copied.end())
+			{
+				copy = found->second;
+				return true;
+			}
+
+			auto& slot = copied[table.table.get()] = Slot::from_variable(std::make_unique<HashTable>(table.table->equivalence, table.size()));
+			auto& target = *static_cast<HashTable*>(slot.boxed);
+
+			for (auto& entry : table.table->entries)
+			{
+				if (entry.probe == 0) continue;
+
+				Slot key, val;
+				if (!copy_slot(entry.key, key, copied) || !copy_slot(entry.value, val, copied)) return false;
+				target.insert(std::move(key), std::move(val));
+			}
+			copy = slot;
+			return true;
+		}
+		case Variable::Type::PERSISTENT_VECTOR:
+		{
+			if (is_immutable(value))
+			{
+				copy = value;
+				return true;
+			}
+
+			auto& vec = *static_cast<const PersistentVector*>(value.boxed);
+			auto result = std::make_unique<PersistentVector>();
+			for (std::size_t i = 0; i < vec.size(); i++)
+			{
+				Slot element;
+				if (!copy_slot(vec.at(i), element, copied)) return false;
+				*result = result->push(std::move(element));
+			}
+			copy = Slot::from_variable(std::move(result));
+			return true;
+		}
+		case Variable::Type::PERSISTENT_MAP:
+		{
+			if (is_immutable(value))
+			{
+				copy = value;
+				return true;
+			}
+
+			auto result = std::make_unique<PersistentMap>();
+			bool ok = true;
+			static_cast<const PersistentMap*>(value.boxed)->for_each([&](const Slot& key, const Slot& val) {
+				Slot key_copy, val_copy;
+				if (ok && copy_slot(key, key_copy, copied) && copy_slot(val, val_copy, copied)) *result = result->set(std::move(key_copy), std::move(val_copy));
+				else ok = false;
+			});
+			copy = Slot::from_variable(std::move(result));
+			return ok;
+		}
+		case Variable::Type::PROCEDURE:
+		{
+			if (dynamic_cast<const Builtin*>(value.boxed) != nullptr)
+			{
+				copy = value;
+				return true;
+			}
+
+			// The code of a closure never changes once created, only the values it captured need copying
+			auto closure = dynamic_cast<const Closure*>(value.boxed);
+			if (closure == nullptr) return false;
+
+			std::vector<Binding> captured;
+			for (auto& binding : closure->captured)
+			{
+				Slot val;
+				if (!copy_slot(binding.value, val, copied)) return false;
+				captured.push_back({ binding.name, std::move(val) });
+			}
+			copy = Slot::from_variable(std::make_unique<Closure>(closure->code, std::move(captured)));
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+	bool copy_message(const Slot& value, Slot& copy)
+	{
+		CopyMap copied;
+		return copy_slot(value, copy, copied);
+	}
+
+	void copy_globals(const Environment& env, Environment& target)
+	{
+		std::unordered_set<std::string> seen;
+		std::vector<std::shared_ptr<const image::Image>> images;
+		CopyMap copied;		// One for every definition, so definitions that shared a vector still share the copy
+
+		for (auto layer = &env; layer != nullptr; layer = layer->parent.get())
+		{
+			for (auto& [name, var] : layer->env_map)
+			{
+				if (!seen.insert(name).second) continue;
+
+				Slot copy;
+				if (copy_slot(Slot::from_variable(*var), copy, copied)) target.env_map.emplace(name, region::promote(copy.into_variable()));
+			}
+			if (layer->image == nullptr) continue;
+
+			// An image is read-only once frozen, so it is shared rather than decoded and copied. Names it
+			// defines hide those of the layers below, just as they did for the creator
+			layer->image->freeze();
+			layer->image->for_each_name([&](std::string_view name) { seen.emplace(name); });
+			images.push_back(layer->image);
+		}
+
+		for (auto it = images.rbegin(); it != images.rend(); ++it)
+		{
+			auto layer = std::make_shared<Environment>();
+			layer->image = *it;
+			layer->parent = std::move(target.parent);
+			layer->freeze_values();
+			target.parent = std::move(layer);
+		}
+	}
+}
+
+namespace environment
+{
+	PlaceChannel::PlaceChannel(std::shared_ptr<places::Mailbox> in, std::shared_ptr<places::Mailbox> out, std::shared_ptr<places::PlaceThread> thread) :
+		VarCopy(Variable::Type::PLACE_CHANNEL), in(std::move(in)), out(std::move(out)), thread(std::move(thread)) {}
+
+	Slot PlaceChannel::call(Interpreter& interp, Span<Slot> args)
+	{
+		return eval::fail(interp, "Place channel variable is not callable");
+	}
+
+	namespace builtins
+	{
+		using Type = Variable::Type;
+
+		Slot place(Interpreter& interp, Span<Slot> args)
+		{
+			Slot procedure;
+			if (args.size() != 1 || args[0].type != Type::PROCEDURE || !places::copy_message(args[0], procedure))
+			{
+				return eval::fail(interp, "Place procedure expects a procedure of one argument that can be sent to another place");
+			}
+
+			auto to_place = std::make_shared<places::Mailbox>();
+			auto from_place = std::make_shared<places::Mailbox>();
+			auto state = std::make_shared<places::PlaceThread>();
+
+			// The place gets its own copy of the creator's definitions as they are now, later ones stay invisible to it
+			Environment globals;
+			places::copy_globals(interp.env, globals);
+
+			state->thread = std::thread([state, globals = std::move(globals), to_place, from_place, procedure = std::move(procedure)]() mutable {
+				Interpreter place_interp;
+				place_interp.env = std::move(globals);
+
+				Slot channel = Slot::from_variable(std::make_unique<PlaceChannel>(to_place, from_place, nullptr));
+				// Only read once the thread has been joined. An error nothing in the place catches ends it, like a top-level form
+				Slot raised;
+				state->result = eval::catch_uncaught(place_interp, raised, [&]() { return procedure.boxed->call(place_interp, Span<Slot>(&channel, 1)); });
+				if (raised.type != Type::INVALID)
+				{
+					// Written in one piece so it does not interleave with other threads' output
+					std::ostringstream report;
+					eval::write_uncaught(report, raised);
+					report << '\n';
+					std::cout << report.str();
+				}
+			});
+
+			return Slot::from_variable(std::make_unique<PlaceChannel>(from_place, to_place, state));
+		}
+
+		Slot place_send(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 2 || args[0].type != Type::PLACE_CHANNEL)
+			{
+				return eval::fail(interp, "Place send procedure expects a place channel and a value");
+			}
+
+			Slot message;
+			if (!places::copy_message(args[1], message))
+			{
+				return eval::fail(interp, "Place send procedure cannot send a value of type: ", get_type_as_string(args[1].type));
+			}
+
+			static_cast<PlaceChannel*>(args[0].boxed)->out->push(std::move(message));
+			return Slot();
+		}
+
+		Slot place_receive(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1 || args[0].type != Type::PLACE_CHANNEL)
+			{
+				return eval::fail(interp, "Place receive procedure expects a place channel");
+			}
+			return static_cast<PlaceChannel*>(args[0].boxed)->in->pop();
+		}
+
+		Slot place_wait(Interpreter& interp, Span<Slot> args)
+		{
+			if (args.size() != 1 || args[0].type != Type::PLACE_CHANNEL || static_cast<PlaceChannel*>(args[0].boxed)->thread == nullptr)
+			{
+				return eval::fail(interp, "Place wait procedure expects a place channel returned by place");
+			}
+
+			auto& state = *static_cast<PlaceChannel*>(args[0].boxed)->thread;
+			std::lock_guard<std::mutex> lock(state.join_mutex);
+
+			if (state.thread.joinable())
+			{
+				if (state.thread.get_id() == std::this_thread::get_id())
+				{
+					return eval::fail(interp, "A place cannot wait for itself");
+				}
+				state.thread.join();
+			}
+
+			// Several places may wait on the same one, so each gets a copy of the result to itself
+			if (state.result.type == Type::INVALID) return Slot();
+			Slot result;
+			if (!places::copy_message(state.result, result))
+			{
+				return eval::fail(interp, "Place wait procedure cannot return a value of type: ", get_type_as_string(state.result.type));
+			}
+			return result;
+		}
+	}
+}
@@ -0,0 +1,238 @@
+#include <lang/profile.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/time.h>
+#include <thread>
+#include <unordered_set>
+
+namespace profile
+{
+
+	constexpr std::size_t sample_capacity = 1024;
+	constexpr auto drain_interval = std::chrono::milliseconds(50);
+
+	std::atomic<bool> active{ false };
+
+	// Both are constant initialized, so the signal handler can touch them on any thread
+	static thread_local Stack own;
+	static thread_local Stack* current = nullptr;
+
+	enum SampleState : std::uint8_t
+	{
+		EMPTY,
+		WRITING,
+		READY,
+	};
+
+	struct Sample
+	{
+		std::atomic<std::uint8_t> state{ EMPTY };
+		std::size_t depth = 0;
+		bool truncated = false;
+		std::string_view frames[max_depth];
+	};
+
+	/**
+	 * Everything shared between the signal handler, the thread folding samples together, and start and stop
+	*/
+	struct Profiler
+	{
+		std::unique_ptr<Sample[]> samples{ new Sample[sample_capacity] };
+		std::atomic<std::size_t> next{ 0 };
+		std::atomic<std::size_t> dropped{ 0 };		// Samples that found their slot still waiting to be folded
+
+		std::map<std::string, std::size_t> counts;	// Only touched by whoever holds `drain_mutex`
+		std::mutex drain_mutex;
+
+		std::thread drainer;
+		std::mutex stop_mutex;
+		std::condition_variable stop_cv;
+		bool stopping = false;
+	};
+
+	static std::atomic<Profiler*> running{ nullptr };
+	static std::atomic<int> handlers_running{ 0 };		// Lets stop wait out handlers still holding the profiler
+
+	Stack* switch_stack(Stack* stack) noexcept
+	{
+		Stack* previous = current;
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		current = stack;
+		return previous;
+	}
+
+	void Frame::push(std::string_view name) noexcept
+	{
+		stack = current != nullptr ? current : &own;
+		std::size_t depth = stack->depth;
+		if (depth < max_depth) stack->frames[depth] = name;
+
+		// The handler only runs on this thread, so it is enough that the name lands before the depth grows
+		std::atomic_signal_fence(std::memory_order_release);
+		stack->depth = depth + 1;
+	}
+
+	void Frame::pop() noexcept
+	{
+		std::atomic_signal_fence(std::memory_order_release);
+		stack->depth--;
+	}
+
+	std::string_view intern(const std::string& name)
+	{
+		// Never destroyed, frames may still refer to names while the process exits
+		static auto names = new std::unordered_set<std::string>();
+		static std::mutex names_mutex;
+
+		std::lock_guard<std::mutex> lock(names_mutex);
+		return *names->insert(name).first;
+	}
+
+	static void on_sample(int)
+	{
+		int saved_errno = errno;
+		handlers_running.fetch_add(1);
+		auto profiler = running.load();
+		Stack* stack = current != nullptr ? current : &own;
+		std::size_t depth = stack->depth;
+		std::atomic_signal_fence(std::memory_order_acquire);
+
+		// Time spent outside any procedure, including on threads that never run Scheme code, is not sampled
+		if (profiler != nullptr && depth > 0)
+		{
+			auto& sample = profiler->samples[profiler->next.fetch_add(1, std::memory_order_relaxed) % sample_capacity];
+			std::uint8_t expected = EMPTY;
+			if (sample.state.compare_exchange_strong(expected, WRITING, std::memory_order_acquire))
+			{
+				sample.depth = std::min(depth, max_depth);
+				sample.truncated = depth > max_depth;
+				std::copy(stack->frames, stack->frames + sample.depth, sample.frames);
+				sample.state.store(READY, std::memory_order_release);
+			}
+			else
+			{
+				profiler->dropped.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		handlers_running.fetch_sub(1, std::memory_order_release);
+		errno = saved_errno;
+	}
+
+	/**
+	 * Folds every finished sample into the counts and frees its slot for the handler
+	*/
+	static void drain(Profiler& profiler)
+	{
+		std::lock_guard<std::mutex> lock(profiler.drain_mutex);
+		std::string key;
+
+		for (std::size_t i = 0; i < sample_capacity; i++)
+		{
+			auto& sample = profiler.samples[i];
+			if (sample.state.load(std::memory_order_acquire) != READY) continue;
+
+			key.clear();
+			for (std::size_t j = 0; j < sample.depth; j++)
+			{
+				if (j > 0) key += ';';
+				key += sample.frames[j];
+			}
+			if (sample.truncated) key += ";[truncated]";
+
+			profiler.counts[key]++;
+			sample.state.store(EMPTY, std::memory_order_release);
+		}
+	}
+
+	static void set_timer(int hz)
+	{
+		itimerval timer{};
+		if (hz > 0)
+		{
+			timer.it_interval.tv_usec = std::max(1, 1000000 / hz);
+			timer.it_value = timer.it_interval;
+		}
+		setitimer(ITIMER_PROF, &timer, nullptr);
+	}
+
+	bool start(int hz)
+	{
+		if (running.load() != nullptr || hz <= 0) return false;
+
+		auto profiler = new Profiler();
+		profiler->drainer = std::thread([profiler]()
+		{
+			std::unique_lock<std::mutex> lock(profiler->stop_mutex);
+			while (!profiler->stop_cv.wait_for(lock, drain_interval, [profiler]() { return profiler->stopping; }))
+			{
+				drain(*profiler);
+			}
+		});
+
+		struct sigaction action{};
+		action.sa_handler = on_sample;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		if (sigaction(SIGPROF, &action, nullptr) != 0)
+		{
+			std::cout << "Could not install the profiler's signal handler\n";
+			{
+				std::lock_guard<std::mutex> lock(profiler->stop_mutex);
+				profiler->stopping = true;
+			}
+			profiler->stop_cv.notify_one();
+			profiler->drainer.join();
+			delete profiler;
+			return false;
+		}
+
+		running.store(profiler, std::memory_order_release);
+		active.store(true);
+		set_timer(hz);
+		return true;
+	}
+
+	bool stop(const std::string& path)
+	{
+		auto profiler = running.load();
+		if (profiler == nullptr) return false;
+
+		// A signal already on its way must not find the default action, which ends the process
+		set_timer(0);
+		signal(SIGPROF, SIG_IGN);
+		active.store(false);
+		running.store(nullptr);
+		while (handlers_running.load() > 0) std::this_thread::yield();
+
+		{
+			std::lock_guard<std::mutex> lock(profiler->stop_mutex);
+			profiler->stopping = true;
+		}
+		profiler->stop_cv.notify_one();
+		profiler->drainer.join();
+		drain(*profiler);
+
+		std::ofstream out(path);
+		for (auto& [stack, count] : profiler->counts) out << stack << ' ' << count << '\n';
+		out.close();
+
+		bool written = static_cast<bool>(out);
+		if (!written) std::cout << "Could not write the profile to " << path << '\n';
+		if (auto dropped = profiler->dropped.load())
+		{
+			std::cout << "Profiler dropped " << dropped << " samples that could not be folded in time\n";
+		}
+
+		delete profiler;
+		return written;
+	}
+}
@@ -0,0 +1,314 @@
+#include <lang/region.hpp>
+#include <lang/hash_table.hpp>
+#include <lang/memstats.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace region
+{
+
+	constexpr std::size_t chunk_size = 64 * 1024;
+	constexpr std::size_t alignment = alignof(std::max_align_t);
+	constexpr std::size_t largest_allocation = chunk_size / 8;		// Anything bigger goes to the heap rather than waste a chunk
+	constexpr unsigned max_promote_depth = 64;
+
+	/**
+	 * Block that variables are carved out of, followed in memory by the space it hands out
+	*/
+	struct Chunk
+	{
+		// Frees minus nothing until the chunk is retired, when the number carved out is added. Whoever then
+		// brings it to zero hands the chunk back
+		std::atomic<std::int64_t> refs{ 0 };
+		std::size_t allocated = 0;		// Only touched by the thread allocating from the chunk
+		std::size_t used = 0;
+	};
+
+	constexpr std::size_t data_offset = (sizeof(Chunk) + alignment - 1) & ~(alignment - 1);
+
+	/**
+	 * Placed in front of every variable, with a null chunk for one allocated from the heap
+	*/
+	struct alignas(std::max_align_t) Header
+	{
+		Chunk* chunk;
+		std::size_t size;		// Including the header
+	};
+
+	static_assert(sizeof(Header) == alignment, "the size fits in the padding the header already had");
+
+	struct ThreadRegion
+	{
+		Chunk* current = nullptr;
+		Chunk* spare = nullptr;		// Kept when a chunk is handed back, so a steady workload stops asking the heap for more
+		unsigned depth = 0;
+		unsigned heap_depth = 0;
+		Stats stats;
+
+		~ThreadRegion();
+	};
+
+	static thread_local ThreadRegion local;
+	static thread_local bool exited = false;	// Set once `local` is gone, for variables destroyed later in thread exit
+
+	static std::size_t round_up(std::size_t size)
+	{
+		return (size + alignment - 1) & ~(alignment - 1);
+	}
+
+	static void recycle(Chunk* chunk)
+	{
+		if (!exited && local.spare == nullptr)
+		{
+			chunk->refs.store(0, std::memory_order_relaxed);
+			chunk->allocated = 0;
+			chunk->used = 0;
+			local.spare = chunk;
+			return;
+		}
+		chunk->~Chunk();
+		std::free(chunk);
+	}
+
+	static void retire(Chunk* chunk)
+	{
+		auto allocated = static_cast<std::int64_t>(chunk->allocated);
+		if (chunk->refs.fetch_add(allocated, std::memory_order_acq_rel) + allocated == 0) recycle(chunk);
+	}
+
+	ThreadRegion::~ThreadRegion()
+	{
+		exited = true;
+		if (spare != nullptr) recycle(spare);
+		if (current != nullptr) retire(current);
+	}
+
+	static Chunk* next_chunk(ThreadRegion& region)
+	{
+		if (region.current != nullptr)
+		{
+			region.stats.chunks_retired++;
+			retire(region.current);
+		}
+
+		if (region.spare != nullptr)
+		{
+			region.current = region.spare;
+			region.spare = nullptr;
+			return region.current;
+		}
+
+		void* memory = std::malloc(chunk_size);
+		if (memory == nullptr) throw std::bad_alloc();
+		region.stats.chunks_allocated++;
+		region.current = new (memory) Chunk();
+		return region.current;
+	}
+
+	void* allocate(std::size_t size)
+	{
+		std::size_t total = sizeof(Header) + round_up(size);
+		memstats::bytes_allocated(total);
+
+		if (!exited && local.depth > 0 && local.heap_depth == 0 && total <= largest_allocation)
+		{
+			auto chunk = local.current;
+			if (chunk == nullptr || data_offset + chunk->used + total > chunk_size) chunk = next_chunk(local);
+
+			char* memory = reinterpret_cast<char*>(chunk) + data_offset + chunk->used;
+			chunk->used += total;
+			chunk->allocated++;
+			local.stats.region_allocations++;
+			local.stats.region_bytes += total;
+
+			new (memory) Header{ chunk, total };
+			return memory + sizeof(Header);
+		}
+
+		if (!exited)
+		{
+			local.stats.heap_allocations++;
+			local.stats.heap_bytes += total;
+		}
+		char* memory = static_cast<char*>(::operator new(total));
+		new (memory) Header{ nullptr, total };
+		return memory + sizeof(Header);
+	}
+
+	void deallocate(void* ptr) noexcept
+	{
+		if (ptr == nullptr) return;
+
+		auto header = reinterpret_cast<Header*>(static_cast<char*>(ptr) - sizeof(Header));
+		auto chunk = header->chunk;
+		memstats::bytes_freed(header->size);
+		if (chunk == nullptr)
+		{
+			::operator delete(header);
+			return;
+		}
+
+		// Only a retired chunk can reach one, until then the count stays at or below zero
+		if (chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) recycle(chunk);
+	}
+
+	bool in_region(const environment::Variable* var) noexcept
+	{
+		auto header = reinterpret_cast<const Header*>(reinterpret_cast<const char*>(var) - sizeof(Header));
+		return header->chunk != nullptr;
+	}
+
+	bool active() noexcept
+	{
+		return !exited && local.depth > 0 && local.heap_depth == 0;
+	}
+
+	Scope::Scope() noexcept
+	{
+		if (!exited && local.depth++ == 0) memstats::form_started();
+	}
+
+	Scope::~Scope()
+	{
+		if (exited || --local.depth > 0) return;
+
+		memstats::form_finished();
+		local.stats.forms++;
+		auto chunk = local.current;
+		if (chunk == nullptr) return;
+
+		// Nothing but this thread can free into the chunk once its count shows every variable is gone
+		if (static_cast<std::int64_t>(chunk->allocated) + chunk->refs.load(std::memory_order_acquire) == 0)
+		{
+			chunk->refs.store(0, std::memory_order_relaxed);
+			chunk->allocated = 0;
+			chunk->used = 0;
+			local.stats.resets++;
+			return;
+		}
+
+		local.current = nullptr;
+		local.stats.chunks_retired++;
+		retire(chunk);
+	}
+
+	HeapScope::HeapScope() noexcept
+	{
+		if (!exited) local.heap_depth++;
+	}
+
+	HeapScope::~HeapScope()
+	{
+		if (!exited) local.heap_depth--;
+	}
+
+	using environment::Variable;
+
+	static void promote_contents(Variable& var, unsigned depth);
+
+	static void promote_slot(environment::Slot& slot, unsigned depth)
+	{
+		if (!slot.is_boxed()) return;
+
+		if (in_region(slot.boxed))
+		{
+			HeapScope heap;
+			Variable* copy = slot.boxed->copy().release();
+			delete slot.boxed;
+			slot.boxed = copy;
+			local.stats.promotions++;
+		}
+		promote_contents(*slot.boxed, depth + 1);
+	}
+
+	/**
+	 * Marks a container as outliving its form, so what is stored in it later is promoted as well
+	*/
+	static void outlive_form(std::atomic<bool>& outlives_form)
+	{
+		if (!outlives_form.load(std::memory_order_relaxed)) outlives_form.store(true, std::memory_order_relaxed);
+	}
+
+	static void promote_contents(Variable& var, unsigned depth)
+	{
+		if (depth > max_promote_depth) return;
+
+		// Elements are only replaced in containers that no other value, and so no other thread, can see
+		switch (var.type)
+		{
+		case Variable::Type::VECTOR:
+		{
+			auto& buffer = static_cast<environment::Vector&>(var).buffer;
+			outlive_form(buffer->outlives_form);
+			if (buffer.use_count() != 1) return;
+			for (auto& slot : buffer->slots) promote_slot(slot, depth);
+			break;
+		}
+		case Variable::Type::HASH_TABLE:
+		{
+			// Copies hash the same as the originals, vectors by their shared buffer and everything else by value
+			auto& table = static_cast<environment::HashTable&>(var).table;
+			outlive_form(table->outlives_form);
+			if (table.use_count() != 1) return;
+			for (auto& entry : table->entries)
+			{
+				if (entry.probe == 0) continue;
+				promote_slot(entry.key, depth);
+				promote_slot(entry.value, depth);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	std::unique_ptr<Variable> promote(std::unique_ptr<Variable> var)
+	{
+		if (var == nullptr) return var;
+
+		if (in_region(var.get()))
+		{
+			HeapScope heap;
+			var = var->copy();
+			local.stats.promotions++;
+		}
+		promote_contents(*var, 0);
+		return var;
+	}
+
+	void promote(environment::Slot& slot)
+	{
+		promote_slot(slot, 0);
+	}
+
+	const Stats& stats() noexcept
+	{
+		return local.stats;
+	}
+
+	void print_stats(std::ostream& out)
+	{
+		auto& counts = local.stats;
+		out << "Region allocations   " << counts.region_allocations << " (" << counts.region_bytes / 1024 << " KB)\n"
+			<< "Heap allocations     " << counts.heap_allocations << " (" << counts.heap_bytes / 1024 << " KB)\n"
+			<< "Promotions           " << counts.promotions << "\n"
+			<< "Forms                " << counts.forms << ", " << counts.resets << " reset in place\n"
+			<< "Chunks allocated     " << counts.chunks_allocated << ", " << counts.chunks_retired << " retired\n";
+	}
+}
+
+namespace environment
+{
+	void* Variable::operator new(std::size_t size)
+	{
+		return region::allocate(size);
+	}
+
+	void Variable::operator delete(void* ptr) noexcept
+	{
+		region::deallocate(ptr);
+	}
+}
@@ -0,0 +1,509 @@
+#include <lang/server.hpp>
+#include <lang/condition.hpp>
+#include <lang/output.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace server
+{
+
+	constexpr int stall_timeout_ms = 5000;
+
+	/**
+	 * Reads exactly `size` bytes, retrying short reads
+	*/
+	static bool read_all(int fd, char* data, std::size_t size)
+	{
+		while (size > 0)
+		{
+			auto res = recv(fd, data, size, 0);
+			if (res < 0 && errno == EINTR) continue;
+			if (res <= 0) return false;
+			data += res;
+			size -= static_cast<std::size_t>(res);
+		}
+		return true;
+	}
+
+	/**
+	 * Writes exactly `size` bytes, retrying short writes. A peer that has gone away is reported as a
+	 * failure rather than raising SIGPIPE
+	*/
+	static bool write_all(int fd, const char* data, std::size_t size)
+	{
+		while (size > 0)
+		{
+			auto res = send(fd, data, size, MSG_NOSIGNAL);
+			if (res < 0 && errno == EINTR) continue;
+
+			// The server's sockets are non-blocking, a client that stops reading for long is given up on
+			if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				pollfd writable{ fd, POLLOUT, 0 };
+				if (poll(&writable, 1, stall_timeout_ms) > 0) continue;
+				return false;
+			}
+			if (res <= 0) return false;
+			data += res;
+			size -= static_cast<std::size_t>(res);
+		}
+		return true;
+	}
+
+	bool read_frame(int fd, std::string& payload)
+	{
+		unsigned char header[4];
+		if (!read_all(fd, reinterpret_cast<char*>(header), sizeof(header))) return false;
+
+		std::uint32_t size = (std::uint32_t(header[0]) << 24) | (std::uint32_t(header[1]) << 16) | (std::uint32_t(header[2]) << 8) | header[3];
+		if (size > max_frame_size) return false;
+
+		payload.resize(size);
+		return read_all(fd, payload.data(), size);
+	}
+
+	bool write_frame(int fd, const std::string& payload)
+	{
+		if (payload.size() > max_frame_size) return false;
+
+		auto size = static_cast<std::uint32_t>(payload.size());
+		unsigned char header[4] = {
+			static_cast<unsigned char>(size >> 24),
+			static_cast<unsigned char>(size >> 16),
+			static_cast<unsigned char>(size >> 8),
+			static_cast<unsigned char>(size)
+		};
+		return write_all(fd, reinterpret_cast<const char*>(header), sizeof(header)) && write_all(fd, payload.data(), payload.size());
+	}
+
+	/**
+	 * Creates a Unix domain socket listening on `path`, replacing any file already there
+	 *
+	 * @returns the socket, or -1 after printing the error
+	*/
+	static int listen_on(const std::string& path)
+	{
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path))
+		{
+			std::cout << "Socket path is too long: " << path << '\n';
+			return -1;
+		}
+		std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			std::cout << "Could not create server socket: " << std::strerror(errno) << '\n';
+			return -1;
+		}
+
+		unlink(path.c_str());
+		if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+		{
+			std::cout << "Could not listen on " << path << ": " << std::strerror(errno) << '\n';
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	/**
+	 * Gives up on a client that stalls halfway through a frame, or sits idle between requests, for long
+	*/
+	static void set_receive_timeout(int fd)
+	{
+		timeval timeout{ stall_timeout_ms / 1000, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	}
+
+	/**
+	 * Appends whatever has arrived on a non-blocking socket, stopping early once a whole frame of the
+	 * largest size could be held
+	 *
+	 * @returns false once the peer has closed the connection or it failed
+	*/
+	static bool receive_available(int fd, std::string& received)
+	{
+		char buffer[16384];
+		while (received.size() < max_frame_size + 4)
+		{
+			auto res = recv(fd, buffer, sizeof(buffer), 0);
+			if (res > 0)
+			{
+				received.append(buffer, static_cast<std::size_t>(res));
+				continue;
+			}
+			if (res < 0 && errno == EINTR) continue;
+			return res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+		return true;
+	}
+
+	/**
+	 * Takes the frame at the front of the received bytes, if all of it has arrived
+	 *
+	 * @returns 1 if a frame was taken, 0 if more bytes are needed, or -1 if the frame is too large
+	*/
+	static int take_frame(std::string& received, std::string& payload)
+	{
+		if (received.size() < 4) return 0;
+
+		auto header = reinterpret_cast<const unsigned char*>(received.data());
+		std::uint32_t size = (std::uint32_t(header[0]) << 24) | (std::uint32_t(header[1]) << 16) | (std::uint32_t(header[2]) << 8) | header[3];
+		if (size > max_frame_size) return -1;
+		if (received.size() - 4 < size) return 0;
+
+		payload.assign(received, 4, size);
+		received.erase(0, 4 + std::size_t(size));
+		return 1;
+	}
+
+	std::string eval_request(eval::Interpreter& interp, const std::shared_ptr<const Environment>& globals, const std::string& source)
+	{
+		// Definitions never outlive the request that made them, including any a future moved into a snapshot layer
+		interp.env.env_map.clear();
+		interp.env.parent = globals;
+
+		Slot raised;
+		auto result = eval::eval_source(interp, source, raised);
+
+		// The client is told about an error it did not catch, rather than the server's own output
+		std::ostringstream out;
+		if (raised.type != Variable::Type::INVALID)
+		{
+			out << "#<error ";
+			eval::write_uncaught(out, raised);
+			out << ">";
+			return out.str();
+		}
+		if (result.type == Variable::Type::INVALID) return "";
+
+		eval::write_slot(out, result);
+		return out.str();
+	}
+
+	Server::Server(std::string socket_path, std::size_t workers, std::shared_ptr<const Environment> globals) :
+		socket_path(std::move(socket_path)), worker_count(std::max<std::size_t>(workers, 1)), globals(std::move(globals))
+	{
+		if (this->globals != nullptr) this->globals->freeze_values();
+	}
+
+	Server::~Server()
+	{
+		stop();
+	}
+
+	bool Server::start()
+	{
+		listen_fd = listen_on(socket_path);
+		if (listen_fd < 0) return false;
+
+		if (pipe(wake_fds) != 0)
+		{
+			std::cout << "Could not create server socket: " << std::strerror(errno) << '\n';
+			return false;
+		}
+
+		poller = std::thread(&Server::poll_loop, this);
+		for (std::size_t i = 0; i < worker_count; i++) workers.emplace_back(&Server::worker_loop, this);
+		return true;
+	}
+
+	void Server::stop()
+	{
+		if (stopping.exchange(true)) return;
+
+		wake();
+		job_ready.notify_all();
+		if (poller.joinable()) poller.join();
+		for (auto& worker : workers) worker.join();
+
+		for (auto& job : rearm) close(job.fd);
+		for (int fd : { listen_fd, wake_fds[0], wake_fds[1] })
+		{
+			if (fd >= 0) close(fd);
+		}
+		if (listen_fd >= 0) unlink(socket_path.c_str());
+	}
+
+	void Server::wake()
+	{
+		if (wake_fds[1] < 0) return;
+
+		char byte = 0;
+		while (write(wake_fds[1], &byte, 1) < 0 && errno == EINTR) {}
+	}
+
+	void Server::poll_loop()
+	{
+		using Clock = std::chrono::steady_clock;
+
+		struct Connection
+		{
+			std::string received;	// Bytes of the next request that have arrived so far
+			Clock::time_point since;	// When the first of them arrived
+		};
+
+		std::unordered_map<int, Connection> idle;	// Connections waiting for their next request
+		std::vector<pollfd> fds;
+
+		// Hands the connection's next request to the workers if all of it has arrived, otherwise leaves it
+		// waiting for more. A connection that broke or sent a frame that is too large is closed
+		auto dispatch = [this, &idle](int fd, Connection& conn, bool open) {
+			Job job{ fd, "", "" };
+			int taken = take_frame(conn.received, job.payload);
+			if (taken == 0 && open)
+			{
+				idle.emplace(fd, std::move(conn));
+				return;
+			}
+			if (taken <= 0)
+			{
+				close(fd);
+				return;
+			}
+
+			job.received = std::move(conn.received);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				jobs.push_back(std::move(job));
+			}
+			job_ready.notify_one();
+		};
+
+		while (!stopping)
+		{
+			fds.clear();
+			fds.push_back({ wake_fds[0], POLLIN, 0 });
+			fds.push_back({ listen_fd, POLLIN, 0 });
+			bool partial = false;
+			for (auto& [fd, conn] : idle)
+			{
+				fds.push_back({ fd, POLLIN, 0 });
+				partial = partial || !conn.received.empty();
+			}
+
+			// Waking up now and then lets requests that stalled halfway be given up on
+			if (poll(fds.data(), fds.size(), partial ? stall_timeout_ms / 5 : -1) < 0)
+			{
+				if (errno == EINTR) continue;
+				break;
+			}
+
+			if (fds[0].revents & POLLIN)
+			{
+				// Wakeups only say to look at the queue, so how many were read does not matter
+				char buffer[64];
+				while (read(wake_fds[0], buffer, sizeof(buffer)) < 0 && errno == EINTR) {}
+
+				std::vector<Job> ready;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					ready.swap(rearm);
+				}
+				// A request that arrived along with the last one is handed out straight away
+				for (auto& job : ready)
+				{
+					Connection conn{ std::move(job.received), Clock::now() };
+					dispatch(job.fd, conn, true);
+				}
+			}
+
+			if (fds[1].revents & POLLIN)
+			{
+				int client = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+				if (client >= 0) idle.emplace(client, Connection{});
+			}
+
+			for (std::size_t i = 2; i < fds.size(); i++)
+			{
+				if (fds[i].revents == 0) continue;
+
+				int fd = fds[i].fd;
+				auto node = idle.extract(fd);
+				auto& conn = node.mapped();
+
+				bool had_bytes = !conn.received.empty();
+				bool open = (fds[i].revents & POLLIN) && receive_available(fd, conn.received);
+				if (!had_bytes) conn.since = Clock::now();
+				dispatch(fd, conn, open);
+			}
+
+			auto now = Clock::now();
+			for (auto it = idle.begin(); it != idle.end();)
+			{
+				if (it->second.received.empty() || now - it->second.since < std::chrono::milliseconds(stall_timeout_ms))
+				{
+					++it;
+					continue;
+				}
+				close(it->first);
+				it = idle.erase(it);
+			}
+		}
+
+		for (auto& [fd, conn] : idle) close(fd);
+	}
+
+	void Server::worker_loop()
+	{
+		eval::Interpreter interp;
+
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				job_ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty()) return;
+
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			auto response = eval_request(interp, globals, job.payload);
+
+			if (!write_frame(job.fd, response))
+			{
+				close(job.fd);
+				continue;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job.payload.clear();
+				rearm.push_back(std::move(job));
+			}
+			wake();
+		}
+	}
+
+	PreforkServer::PreforkServer(std::string socket_path, std::size_t workers, std::shared_ptr<const Environment> globals) :
+		socket_path(std::move(socket_path)), worker_count(std::max<std::size_t>(workers, 1)), globals(std::move(globals)) {}
+
+	PreforkServer::~PreforkServer()
+	{
+		stop();
+	}
+
+	bool PreforkServer::start()
+	{
+		listen_fd = listen_on(socket_path);
+		if (listen_fd < 0) return false;
+
+		for (std::size_t i = 0; i < worker_count; i++)
+		{
+			pid_t pid = fork_worker();
+			if (pid < 0)
+			{
+				stop();
+				return false;
+			}
+			pids.push_back(pid);
+		}
+		return true;
+	}
+
+	pid_t PreforkServer::fork_worker()
+	{
+		// A worker would otherwise write out a copy of whatever the parent had buffered
+		output::flush();
+		pid_t pid = fork();
+		if (pid < 0) std::cout << "Could not fork a worker: " << std::strerror(errno) << '\n';
+		if (pid == 0) worker_main();
+		return pid;
+	}
+
+	void PreforkServer::worker_main()
+	{
+		// The parent blocks these to wait for them, a worker should simply end on them
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGTERM);
+		sigaddset(&signals, SIGCHLD);
+		pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+
+		eval::Interpreter interp;
+		std::string payload;
+
+		while (true)
+		{
+			int client = accept(listen_fd, nullptr, nullptr);
+			if (client < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED) continue;
+				_exit(1);
+			}
+			set_receive_timeout(client);
+
+			while (read_frame(client, payload))
+			{
+				if (!write_frame(client, eval_request(interp, globals, payload))) break;
+			}
+			close(client);
+			std::cout.flush();
+		}
+	}
+
+	std::size_t PreforkServer::reap()
+	{
+		std::size_t replaced = 0;
+		int status;
+		pid_t pid;
+
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+		{
+			auto found = std::find(pids.begin(), pids.end(), pid);
+			if (found != pids.end()) *found = -1;
+		}
+
+		// Also retries workers that could not be forked the last time round
+		for (auto& worker : pids)
+		{
+			if (worker < 0 && !stopping && (worker = fork_worker()) > 0) replaced++;
+		}
+		return replaced;
+	}
+
+	void PreforkServer::stop()
+	{
+		if (stopping) return;
+		stopping = true;
+
+		for (pid_t pid : pids)
+		{
+			if (pid > 0) kill(pid, SIGTERM);
+		}
+		for (pid_t pid : pids)
+		{
+			if (pid > 0) while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+		}
+		pids.clear();
+
+		if (listen_fd >= 0)
+		{
+			close(listen_fd);
+			unlink(socket_path.c_str());
+			listen_fd = -1;
+		}
+	}
+
+	const std::vector<pid_t>& PreforkServer::worker_pids() const noexcept
+	{
+		return pids;
+	}
+}
@@ -0,0 +1,262 @@
+#include <lang/trace.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+namespace trace
+{
+
+	constexpr std::size_t ring_capacity = 8192;
+	constexpr auto flush_interval = std::chrono::milliseconds(50);
+
+	std::atomic<bool> active{ false };
+	std::atomic<std::int64_t> call_threshold{ -1 };
+
+	struct Event
+	{
+		std::string_view name;
+		const char* category;
+		std::int64_t start;
+		std::int64_t end;
+	};
+
+	/**
+	 * Single producer, single consumer ring of one thread's events. The owning thread only moves `head`
+	 * and the writer only moves `tail`, so a slot is never read and written at once
+	*/
+	struct Ring
+	{
+		Event events[ring_capacity];
+		std::atomic<std::size_t> head{ 0 };
+		std::atomic<std::size_t> tail{ 0 };
+		std::atomic<std::size_t> dropped{ 0 };
+		std::atomic<bool> retired{ false };		// Set when the thread exits, the ring goes once it is drained
+		std::uint32_t tid = 0;
+		std::string label;
+	};
+
+	struct Registry
+	{
+		std::mutex mutex;
+		std::vector<std::shared_ptr<Ring>> rings;
+		std::uint32_t next_tid = 1;
+	};
+
+	static Registry& registry()
+	{
+		// Never destroyed, threads may still exit after static destruction begins
+		static auto instance = new Registry();
+		return *instance;
+	}
+
+	/**
+	 * The calling thread's ring, retired when the thread exits
+	*/
+	struct RingHandle
+	{
+		std::shared_ptr<Ring> ring;
+
+		~RingHandle()
+		{
+			if (ring != nullptr) ring->retired.store(true, std::memory_order_release);
+		}
+	};
+
+	static thread_local RingHandle local;
+
+	static Ring& local_ring(const char* label = nullptr)
+	{
+		if (local.ring == nullptr)
+		{
+			auto ring = std::make_shared<Ring>();
+			auto& reg = registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			ring->tid = reg.next_tid++;
+			ring->label = label != nullptr ? label : "thread " + std::to_string(ring->tid);
+			reg.rings.push_back(ring);
+			local.ring = std::move(ring);
+		}
+		return *local.ring;
+	}
+
+	void record(std::string_view name, const char* category, std::int64_t start, std::int64_t end) noexcept
+	{
+		auto& ring = local_ring();
+		std::size_t head = ring.head.load(std::memory_order_relaxed);
+		if (head - ring.tail.load(std::memory_order_acquire) == ring_capacity)
+		{
+			ring.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		ring.events[head % ring_capacity] = Event{ name, category, start, end };
+		ring.head.store(head + 1, std::memory_order_release);
+	}
+
+	/**
+	 * Moves events from the rings into the file, on a thread of its own while tracing is active
+	*/
+	struct Writer
+	{
+		std::ofstream out;
+		std::int64_t origin = 0;
+		int pid = 0;
+		bool first = true;
+		std::unordered_set<std::uint32_t> named;		// Threads whose name has been written
+		std::size_t dropped = 0;
+
+		std::thread thread;
+		std::mutex stop_mutex;
+		std::condition_variable stop_cv;
+		bool stopping = false;
+	};
+
+	static std::unique_ptr<Writer> writer;
+
+	static void write_string(std::ostream& out, std::string_view text)
+	{
+		out << '"';
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\') out << '\\' << c;
+			else if (static_cast<unsigned char>(c) < 0x20)
+			{
+				char escaped[8];
+				std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				out << escaped;
+			}
+			else out << c;
+		}
+		out << '"';
+	}
+
+	static void separate(Writer& w)
+	{
+		if (!w.first) w.out << ",\n";
+		w.first = false;
+	}
+
+	static void write_events(Writer& w, Ring& ring)
+	{
+		if (w.named.insert(ring.tid).second)
+		{
+			separate(w);
+			w.out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << w.pid << ",\"tid\":" << ring.tid << ",\"args\":{\"name\":";
+			write_string(w.out, ring.label);
+			w.out << "}}";
+		}
+
+		std::size_t tail = ring.tail.load(std::memory_order_relaxed);
+		std::size_t head = ring.head.load(std::memory_order_acquire);
+		char times[64];
+		for (; tail != head; tail++)
+		{
+			auto& event = ring.events[tail % ring_capacity];
+			separate(w);
+			w.out << "{\"name\":";
+			write_string(w.out, event.name);
+			std::snprintf(times, sizeof(times), ",\"ts\":%.3f,\"dur\":%.3f", (event.start - w.origin) / 1000.0, (event.end - event.start) / 1000.0);
+			w.out << ",\"cat\":\"" << event.category << "\",\"ph\":\"X\"" << times << ",\"pid\":" << w.pid << ",\"tid\":" << ring.tid << "}";
+		}
+		ring.tail.store(tail, std::memory_order_release);
+	}
+
+	/**
+	 * Writes every ring's waiting events, and lets go of rings whose thread has exited once they are empty
+	*/
+	static void flush(Writer& w)
+	{
+		std::vector<std::shared_ptr<Ring>> rings;
+		{
+			auto& reg = registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			rings = reg.rings;
+		}
+
+		for (auto& ring : rings)
+		{
+			bool retired = ring->retired.load(std::memory_order_acquire);
+			if (ring->head.load(std::memory_order_acquire) != ring->tail.load(std::memory_order_relaxed) || !w.named.count(ring->tid))
+			{
+				write_events(w, *ring);
+			}
+			w.dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+
+			// Nothing is added to a retired ring, so once written out it can go
+			if (retired)
+			{
+				auto& reg = registry();
+				std::lock_guard<std::mutex> lock(reg.mutex);
+				reg.rings.erase(std::find(reg.rings.begin(), reg.rings.end(), ring));
+			}
+		}
+		w.out.flush();
+	}
+
+	bool start(const std::string& path, std::int64_t threshold)
+	{
+		if (writer != nullptr) return false;
+
+		auto w = std::make_unique<Writer>();
+		w->out.open(path);
+		if (!w->out)
+		{
+			std::cout << "Could not create the trace file " << path << '\n';
+			return false;
+		}
+		w->pid = static_cast<int>(getpid());
+		w->origin = now();
+		w->out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+		// Events left over from an earlier trace belong to that trace
+		{
+			auto& reg = registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			for (auto& ring : reg.rings) ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+		}
+		local_ring("main");
+
+		call_threshold.store(threshold < 0 ? -1 : threshold * 1000);
+		writer = std::move(w);
+		writer->thread = std::thread([w = writer.get()]()
+		{
+			std::unique_lock<std::mutex> lock(w->stop_mutex);
+			while (!w->stop_cv.wait_for(lock, flush_interval, [w]() { return w->stopping; })) flush(*w);
+		});
+		active.store(true);
+		return true;
+	}
+
+	bool stop()
+	{
+		if (writer == nullptr) return false;
+		active.store(false);
+
+		{
+			std::lock_guard<std::mutex> lock(writer->stop_mutex);
+			writer->stopping = true;
+		}
+		writer->stop_cv.notify_one();
+		writer->thread.join();
+		flush(*writer);
+
+		writer->out << "\n]}\n";
+		writer->out.close();
+		bool written = static_cast<bool>(writer->out);
+		if (!written) std::cout << "Could not write the trace file\n";
+		if (writer->dropped > 0)
+		{
+			std::cout << "Trace dropped " << writer->dropped << " events that arrived faster than they could be written\n";
+		}
+
+		writer.reset();
+		return written;
+	}
+}
@@ -1,11 +1,56 @@
+#include "../include/lang/continuation.hpp"
 #include "../include/lang/evaluate.hpp"
+#include "../include/lang/green.hpp"
+#include "../include/lang/hash_table.hpp"
+#include "../include/lang/image.hpp"
+#include "../include/lang/instrument.hpp"
+#include "../include/lang/memstats.hpp"
+#include "../include/lang/output.hpp"
+#include "../include/lang/parallel.hpp"
+#include "../include/lang/persistent.hpp"
+#include "../include/lang/places.hpp"
+#include "../include/lang/profile.hpp"
+#include "../include/lang/region.hpp"
+#include "../include/lang/server.hpp"
+#include "../include/lang/trace.hpp"
 #include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <thread>
 
 using namespace eval;
 using namespace environment;
 using namespace parser;
 using namespace lexer;
 
+// Counts heap allocations so tests can check that hot paths stay off the heap
+static std::atomic<std::size_t> allocation_count{ 0 };
+
+void* operator new(std::size_t size)
+{
+	allocation_count++;
+	if (void* ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
 // TESTING THAT A TOKEN CAN BE PROPERLY CONSTRUCTED FROM A GIVEN STRING
 // ====================================================================
 TEST(LexerTests, create_token_from_str_case1) {
@@ -45,6 +90,19 @@ TEST(LexerTests, create_token_from_str_case6) {
 	EXPECT_NE(std::move(lexer::create_token_from_string("testing")), token);
 }
 
+TEST(LexerTests, create_token_from_str_case7) {
+	lexer::Token token = lexer::make_token(lexer::Token::Type::ERROR);
+	token.symbol = "Integer literal is out of range: 99999999999999999999";
+	EXPECT_EQ(std::move(lexer::create_token_from_string("99999999999999999999")), token);
+
+	token.symbol = "Invalid number literal: --5";
+	EXPECT_EQ(std::move(lexer::create_token_from_string("--5")), token);
+
+	lexer::Token negative = lexer::make_token<lexer::Token::Type::INT>();
+	negative.i_value = -5;
+	EXPECT_EQ(std::move(lexer::create_token_from_string("-5")), negative);
+}
+
 // TESTING THAT AN ASTEXPR CAN BE PROPERLY CONSTRUCTED FROM A TOKEN ARRAY
 // ======================================================================
 TEST(ParserTests, construct_ast_case1) {
@@ -257,12 +315,25 @@ TEST(ParserTests, construct_ast_case5) {
 }
 
 
+TEST(ParserTests, construct_program_case1) {
+
+	auto forms = parser::construct_program(tokenize("(define a (+ 1 (* 2 (- 5 3))))\n; comment\n(f a)\n\t42"));
+
+	ASSERT_EQ(forms.size(), 3);
+	ASSERT_EQ(forms[0].children.size(), 3);
+	EXPECT_EQ(forms[0].children[2].children[2].children.size(), 3);
+	EXPECT_EQ(forms[1].children.size(), 2);
+	EXPECT_EQ(forms[2].type, parser::ASTExpr::Type::ATOM);
+	EXPECT_EQ(forms[2].leaf.i_value, 42);
+}
+
 // TESTING THE EVALUATOR AND STANDARD PROCEDURES
 
 TEST(EvalTests, eval_expr_case1) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(+ 54 53)")));
-	auto res = eval::eval_expr(&ast);
+	auto res = eval::eval_expr(interp, &ast);
 
 	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Int>(environment::Int(107));
 
@@ -271,8 +342,9 @@ TEST(EvalTests, eval_expr_case1) {
 
 TEST(EvalTests, eval_expr_case2) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(+ -20 10)")));
-	auto res = eval::eval_expr(&ast);
+	auto res = eval::eval_expr(interp, &ast);
 	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Int>(environment::Int(-10));
 
 	EXPECT_EQ(*res.get(), *expected.get());
@@ -280,8 +352,9 @@ TEST(EvalTests, eval_expr_case2) {
 
 TEST(EvalTests, eval_expr_case3) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(+ (- 30 20) (+ 15 10))")));
-	auto res = eval::eval_expr(&ast);
+	auto res = eval::eval_expr(interp, &ast);
 
 	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Int>(environment::Int(35));
 
@@ -290,8 +363,9 @@ TEST(EvalTests, eval_expr_case3) {
 
 TEST(EvalTests, eval_expr_case4) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(+ -30.25 20)")));
-	auto res = eval::eval_expr(&ast);
+	auto res = eval::eval_expr(interp, &ast);
 
 	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Float>(environment::Float(-10.25));
 
@@ -300,8 +374,9 @@ TEST(EvalTests, eval_expr_case4) {
 
 TEST(EvalTests, eval_expr_case5) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(* 5 10 5)")));
-	auto res = eval::eval_expr(&ast);
+	auto res = eval::eval_expr(interp, &ast);
 
 	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Int>(environment::Int(250));
 
@@ -310,8 +385,9 @@ TEST(EvalTests, eval_expr_case5) {
 
 TEST(EvalTests, eval_expr_case6) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(* 10 (- 15 5) (/ 10 2) (/ 15 2.5))")));
-	auto res = eval::eval_expr(&ast);
+	auto res = eval::eval_expr(interp, &ast);
 
 	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Float>(environment::Float(3000));
 
@@ -320,8 +396,9 @@ TEST(EvalTests, eval_expr_case6) {
 
 TEST(EvalTests, eval_expr_case7) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(> 10 5)")));
-	auto expr = eval::eval_expr(&ast);
+	auto expr = eval::eval_expr(interp, &ast);
 	auto res = static_cast<Bool*>(expr.get())->value;
 
 	EXPECT_EQ(res, true);
@@ -329,8 +406,9 @@ TEST(EvalTests, eval_expr_case7) {
 
 TEST(EvalTests, eval_expr_case8) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(> 5 10)")));
-	auto expr = eval::eval_expr(&ast);
+	auto expr = eval::eval_expr(interp, &ast);
 	auto res = static_cast<Bool*>(expr.get())->value;
 
 	EXPECT_EQ(res, false);
@@ -338,8 +416,9 @@ TEST(EvalTests, eval_expr_case8) {
 
 TEST(EvalTests, eval_expr_case9) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(> 5 5)")));
-	auto expr = eval::eval_expr(&ast);
+	auto expr = eval::eval_expr(interp, &ast);
 	auto res = static_cast<Bool*>(expr.get())->value;
 
 	EXPECT_EQ(res, false);
@@ -347,8 +426,9 @@ TEST(EvalTests, eval_expr_case9) {
 
 TEST(EvalTests, eval_expr_case10) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(>= 5 5)")));
-	auto expr = eval::eval_expr(&ast);
+	auto expr = eval::eval_expr(interp, &ast);
 	auto res = static_cast<Bool*>(expr.get())->value;
 
 	EXPECT_EQ(res, true);
@@ -357,8 +437,9 @@ TEST(EvalTests, eval_expr_case10) {
 
 TEST(EvalTests, eval_expr_case11) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(= 5 5)")));
-	auto expr = eval::eval_expr(&ast);
+	auto expr = eval::eval_expr(interp, &ast);
 	auto res = static_cast<Bool*>(expr.get())->value;
 
 	EXPECT_EQ(res, true);
@@ -366,8 +447,9 @@ TEST(EvalTests, eval_expr_case11) {
 
 TEST(EvalTests, eval_expr_case12) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(= 6 5)")));
-	auto expr = eval::eval_expr(&ast);
+	auto expr = eval::eval_expr(interp, &ast);
 	auto res = static_cast<Bool*>(expr.get())->value;
 
 	EXPECT_EQ(res, false);
@@ -375,8 +457,9 @@ TEST(EvalTests, eval_expr_case12) {
 
 TEST(EvalTests, eval_expr_case13) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(= \"TESTSTR1\" \"TESTSTR2\")")));
-	auto expr = eval::eval_expr(&ast);
+	auto expr = eval::eval_expr(interp, &ast);
 	auto res = static_cast<Bool*>(expr.get())->value;
 
 	EXPECT_EQ(res, false);
@@ -384,8 +467,9 @@ TEST(EvalTests, eval_expr_case13) {
 
 TEST(EvalTests, eval_expr_case14) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(= \"TESTSTR1\" \"TESTSTR1\")")));
-	auto expr = eval::eval_expr(&ast);
+	auto expr = eval::eval_expr(interp, &ast);
 	auto res = static_cast<Bool*>(expr.get())->value;
 
 	EXPECT_EQ(res, true);
@@ -393,8 +477,9 @@ TEST(EvalTests, eval_expr_case14) {
 
 TEST(EvalTests, eval_expr_case15) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(abs -15)")));
-	auto res = eval::eval_expr(&ast);
+	auto res = eval::eval_expr(interp, &ast);
 	
 	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Int>(environment::Int(15));
 
@@ -403,10 +488,1498 @@ TEST(EvalTests, eval_expr_case15) {
 
 TEST(EvalTests, eval_expr_case16) {
 
+	Interpreter interp;
 	auto ast = construct_ast(std::move(tokenize("(abs -15.05)")));
-	auto res = eval::eval_expr(&ast);
+	auto res = eval::eval_expr(interp, &ast);
 
 	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Float>(environment::Float(15.05));
 
 	EXPECT_EQ(*res.get(), *expected.get());
+}
+
+TEST(EvalTests, eval_slot_no_allocations) {
+
+	Interpreter interp;
+	auto ast = construct_ast(std::move(tokenize("(+ 1 2 3)")));
+
+	// Instrumented builds allocate the counters of a procedure the first time it is called
+	if (instrument::enabled) eval::eval_slot(interp, &ast);
+
+	std::size_t before = allocation_count;
+	auto res = eval::eval_slot(interp, &ast);
+	std::size_t allocations = allocation_count - before;
+
+	EXPECT_EQ(allocations, 0);
+	EXPECT_EQ(res.type, Variable::Type::INT);
+	EXPECT_EQ(res.i_value, 6);
+}
+
+TEST(EvalTests, eval_slot_overflow_frame) {
+
+	Interpreter interp;
+	auto ast = construct_ast(std::move(tokenize("(+ 1 2 3 4 5 6 7 8 9 10)")));
+	auto res = eval::eval_slot(interp, &ast);
+
+	EXPECT_EQ(res.type, Variable::Type::INT);
+	EXPECT_EQ(res.i_value, 55);
+}
+
+TEST(EvalTests, time_case1) {
+
+	Interpreter interp;
+	auto ast = construct_ast(std::move(tokenize("(time (vector 1 2 3))")));
+
+	testing::internal::CaptureStdout();
+	auto res = eval::eval_slot(interp, &ast);
+	auto report = testing::internal::GetCapturedStdout();
+
+	// The value passes through unchanged, and the vector's allocation is reported
+	ASSERT_EQ(res.type, Variable::Type::VECTOR);
+	EXPECT_EQ(static_cast<Vector*>(res.boxed)->size(), 3);
+	EXPECT_EQ(report.rfind("real time: ", 0), 0) << report;
+	EXPECT_NE(report.find("cpu time: "), std::string::npos) << report;
+	EXPECT_NE(report.find(" in 1 objects"), std::string::npos) << report;
+}
+
+TEST(EvalTests, write_numbers_case1) {
+
+	// Numbers are formatted without the stream, but must read exactly as the stream would write them
+	for (double value : { 0.0, -2.5, 3.14159265, 1e-7, 123456789.0, 1e21, 0.1 + 0.2 })
+	{
+		std::ostringstream expected, written;
+		expected << value;
+		output::write_float(written, value);
+		EXPECT_EQ(written.str(), expected.str());
+	}
+	for (int value : { 0, -1, 42, INT32_MIN, INT32_MAX })
+	{
+		std::ostringstream expected, written;
+		expected << value;
+		output::write_int(written, value);
+		EXPECT_EQ(written.str(), expected.str());
+	}
+}
+
+// TESTING THE PIPELINE MODE
+// ============================
+TEST(PipelineTests, form_scanner_case1) {
+
+	eval::FormScanner scanner;
+	std::string text = "(define square\n  (lambda (x) ; (unbalanced\n";
+	scanner.scan(text);
+	EXPECT_EQ(scanner.complete, 0);
+
+	text += "(* x x)))  \")(\" 4";
+	scanner.scan(text);
+	EXPECT_EQ(text.substr(0, scanner.complete), "(define square\n  (lambda (x) ; (unbalanced\n(* x x)))  \")(\" ");
+
+	// The trailing atom is only complete once something follows it
+	text.erase(0, scanner.complete);
+	scanner.consume(scanner.complete);
+	EXPECT_EQ(scanner.complete, 0);
+	text += "2(";
+	scanner.scan(text);
+	EXPECT_EQ(text.substr(0, scanner.complete), "42");
+	EXPECT_EQ(scanner.ends, std::vector<std::size_t>({ 2 }));
+}
+
+TEST(PipelineTests, pipeline_case1) {
+
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	std::string input = "(define add\n (lambda (a b)\n  (+ a b)))\n(add 1\n 2) (add 0.5 0.25)\n\n\"text\" 7\n(vector 1\n2)";
+	ASSERT_EQ(write(fds[1], input.data(), input.size()), static_cast<ssize_t>(input.size()));
+	close(fds[1]);
+
+	Interpreter interp;
+	std::ostringstream out;
+	EXPECT_TRUE(eval::pipeline(interp, fds[0], out));
+	close(fds[0]);
+
+	// No prompts, and one line per form with a value, the definition having none
+	EXPECT_EQ(out.str(), "3\n0.75\ntext\n7\n#(1 2)\n");
+}
+
+TEST(PipelineTests, pipeline_order_case1) {
+
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	std::string input = "(+ 1 2)\n)\n(+ 3 4)\n";
+	ASSERT_EQ(write(fds[1], input.data(), input.size()), static_cast<ssize_t>(input.size()));
+	close(fds[1]);
+
+	Interpreter interp;
+	testing::internal::CaptureStdout();
+	EXPECT_TRUE(eval::pipeline(interp, fds[0], std::cout));
+	auto output = testing::internal::GetCapturedStdout();
+	close(fds[0]);
+
+	// A syntax error is reported in its place among the results
+	EXPECT_EQ(output, "3\nUnexpected closing bracket encountered\n7\n");
+}
+
+TEST(PipelineTests, pipeline_exit_case1) {
+
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	std::string input = "(+ 1 1)\nexit\n(+ 2 2)\n";
+	ASSERT_EQ(write(fds[1], input.data(), input.size()), static_cast<ssize_t>(input.size()));
+	close(fds[1]);
+
+	Interpreter interp;
+	std::ostringstream out;
+	EXPECT_TRUE(eval::pipeline(interp, fds[0], out));
+	close(fds[0]);
+	EXPECT_EQ(out.str(), "2\n");
+}
+
+// TESTING INTERPRETER ISOLATION
+// ==============================
+static std::unique_ptr<environment::Variable> eval_str(Interpreter& interp, const std::string& text)
+{
+	auto ast = construct_ast(std::move(tokenize(text)));
+	return eval::eval_expr(interp, &ast);
+}
+
+TEST(InterpreterTests, isolated_environments_case1) {
+
+	Interpreter first;
+	Interpreter second;
+	eval_str(first, "(define shared_name 1)");
+	eval_str(second, "(define shared_name 2)");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(first, "(+ shared_name 0)").get())->value, 1);
+	EXPECT_EQ(static_cast<Int*>(eval_str(second, "(+ shared_name 0)").get())->value, 2);
+	EXPECT_EQ(first.env.env_map.size(), 1);
+}
+
+TEST(InterpreterTests, interpreter_per_thread_case1) {
+
+	std::vector<int> results(4, 0);
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < 4; i++)
+	{
+		threads.emplace_back([i, &results]() {
+			Interpreter interp;
+			eval_str(interp, "(define counter " + std::to_string(i) + ")");
+			for (int j = 0; j < 1000; j++) eval_str(interp, "(hash-table-size (make-hash-table))");
+			results[i] = static_cast<Int*>(eval_str(interp, "(* counter 10)").get())->value;
+		});
+	}
+	for (auto& thread : threads) thread.join();
+
+	EXPECT_EQ(results, std::vector<int>({ 0, 10, 20, 30 }));
+}
+
+// TESTING THE BUILT-IN REGISTRY
+// ==============================
+TEST(BuiltinTests, find_builtin_case1) {
+
+	auto car = find_builtin("car");
+	auto cons = find_builtin("cons");
+
+	ASSERT_NE(car, nullptr);
+	ASSERT_NE(cons, nullptr);
+	EXPECT_EQ(car->name, "car");
+	EXPECT_EQ(cons->name, "cons");
+	EXPECT_NE(car->fn, cons->fn);
+	EXPECT_EQ(find_builtin("persistent-map-contains?")->name, "persistent-map-contains?");
+	EXPECT_EQ(find_builtin("not-a-builtin"), nullptr);
+	EXPECT_EQ(find_builtin(""), nullptr);
+}
+
+TEST(BuiltinTests, builtin_as_value_case1) {
+
+	Interpreter interp;
+	auto def = construct_ast(std::move(tokenize("(define builtin_plus +)")));
+	eval::eval_expr(interp, &def);
+
+	auto ast = construct_ast(std::move(tokenize("(builtin_plus 40 2)")));
+	auto res = eval::eval_slot(interp, &ast);
+
+	EXPECT_EQ(res.type, Variable::Type::INT);
+	EXPECT_EQ(res.i_value, 42);
+}
+
+TEST(BuiltinTests, string_append_case1) {
+
+	Interpreter interp;
+	auto res = eval_str(interp, "(string-append \"ab\" \"\" \"cd\")");
+
+	ASSERT_NE(res, nullptr);
+	ASSERT_EQ(res->type, Variable::Type::STRING);
+	EXPECT_EQ(static_cast<String*>(res.get())->value, "abcd");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(string-length (string-append \"ab\" \"cd\"))").get())->value, 4);
+	EXPECT_EQ(eval_str(interp, "(string-append \"ab\" 1)"), nullptr);
+}
+
+// TESTING PROCEDURES
+// ==================
+TEST(ProcedureTests, lambda_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(fib 15)").get())->value, 610);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "((lambda (x y) (* x y)) 6 7)").get())->value, 42);
+	EXPECT_EQ(eval_str(interp, "(fib 1 2)"), nullptr);
+}
+
+TEST(ProcedureTests, closure_capture_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define make_adder (lambda (x) (lambda (y) (+ x y))))");
+	eval_str(interp, "(define add_three (make_adder 3))");
+	eval_str(interp, "(define scaled (lambda (a) (define b (* a 2)) (begin a (+ a b))))");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(add_three 4)").get())->value, 7);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(scaled 5)").get())->value, 15);
+	// Parameters shadow built-ins and locals never leak into the global environment
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "((lambda (length) (* length 2)) 4)").get())->value, 8);
+	EXPECT_EQ(interp.env.find("b"), nullptr);
+}
+
+TEST(ProcedureTests, escape_continuation_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define haystack (make-vector 1000 0))");
+	eval_str(interp, "(vector-set! haystack 700 5)");
+	eval_str(interp, "(define search (lambda (return i) (if (= i (vector-length haystack)) -1 (begin (if (= (vector-ref haystack i) 5) (return i) 0) (search return (+ i 1))))))");
+
+	// Escaping skips the rest of the search, including the recursive call after the match
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(call/ec (lambda (return) (search return 0)))").get())->value, 700);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(call/ec (lambda (outer) (+ 1 (call/ec (lambda (inner) (outer 10))))))").get())->value, 10);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(+ 1 (call/cc (lambda (k) (+ 100 (k 2)))))").get())->value, 3);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(call/cc (lambda (k) 5))").get())->value, 5);
+	EXPECT_EQ(interp.escape, nullptr);
+}
+
+TEST(ProcedureTests, escape_continuation_case2) {
+
+	Interpreter interp;
+	eval_str(interp, "(define saved (call/ec (lambda (k) k)))");
+
+	// Continuations cannot be re-entered once the call that captured them has returned
+	EXPECT_EQ(eval_str(interp, "(saved 1)"), nullptr);
+	EXPECT_EQ(interp.escape, nullptr);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(+ 1 2)").get())->value, 3);
+}
+
+TEST(ProcedureTests, guard_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define safe-div (lambda (a b) (guard (e ((error-object? e) -1)) (/ a b))))");
+
+	// Errors of built-ins are conditions a guard can catch, and a value raised by hand passes through as is
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(safe-div 10 2)").get())->value, 5);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(safe-div 10 0)").get())->value, -1);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(guard (e ((= e 1) 10) (else (+ e 1))) (+ 1 (raise 41)))").get())->value, 42);
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(guard (e (else (error-object-message e))) (error \"bad input\" 1 2))").get())->value, "bad input");
+
+	auto irritants = eval_str(interp, "(guard (e (else (error-object-irritants e))) (error \"bad input\" 1 2))");
+	ASSERT_NE(irritants, nullptr);
+	ASSERT_EQ(irritants->type, Variable::Type::VECTOR);
+	EXPECT_EQ(static_cast<Vector*>(irritants.get())->size(), 2);
+
+	// A value no clause accepts goes on to the next guard out
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(guard (outer (else (* outer 2))) (guard (inner ((= inner 0) 0)) (raise 4)))").get())->value, 8);
+
+	// Uncaught, a raise reports the error and produces no value without leaving an escape behind
+	testing::internal::CaptureStdout();
+	EXPECT_EQ(eval_str(interp, "(% 1 0)"), nullptr);
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "Modulo procedure failed: integer division by zero\n");
+	EXPECT_EQ(interp.escape, nullptr);
+	EXPECT_TRUE(interp.handlers.empty());
+}
+
+TEST(ProcedureTests, uncaught_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define log (make-vector 1 0))");
+
+	// An uncaught error abandons the rest of its top-level form, and is reported once
+	testing::internal::CaptureStdout();
+	EXPECT_EQ(eval::eval_source(interp, "(begin (/ 1 0) 5)").type, Variable::Type::INVALID);
+	EXPECT_EQ(eval::eval_source(interp, "(if (/ 1 0) 1 2)").type, Variable::Type::INVALID);
+	EXPECT_EQ(eval::eval_source(interp, "(begin (vector-set! log 0 1) (raise 7) (vector-set! log 0 2))").type, Variable::Type::INVALID);
+	EXPECT_EQ(testing::internal::GetCapturedStdout(),
+		"Divide procedure failed: integer division by zero\nDivide procedure failed: integer division by zero\nUncaught raise: 7\n");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref log 0)").get())->value, 1);
+
+	// The same goes for a green thread, which ends there while the others carry on
+	testing::internal::CaptureStdout();
+	eval_str(interp, "(spawn (lambda () (vector-set! log 0 (/ 1 0)) (vector-set! log 0 3)))");
+	eval_str(interp, "(spawn (lambda () (yield) (vector-set! log 0 (+ (vector-ref log 0) 10))))");
+	eval_str(interp, "(run-threads)");
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "Divide procedure failed: integer division by zero\n");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref log 0)").get())->value, 11);
+	EXPECT_EQ(interp.escape, nullptr);
+	EXPECT_TRUE(interp.handlers.empty());
+}
+
+TEST(ProcedureTests, no_value_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define v (vector 0))");
+
+	// A call with an argument that has no value is an error a guard can catch, rather than vanishing
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(guard (e (#t (error-object-message e))) (+ 1 (vector-set! v 0 1)))").get())->value,
+		"Argument 2 of + has no value");
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(guard (e (#t (error-object-message e))) ((lambda (x) x) (vector-set! v 0 1)))").get())->value,
+		"Argument 1 of procedure has no value");
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(guard (e (#t (error-object-message e))) (define w (vector-set! v 0 1)))").get())->value,
+		"Define expects a value for w, but its expression has none");
+
+	// An error raised by an argument is reported once, and not again as an argument without a value
+	testing::internal::CaptureStdout();
+	eval::eval_source(interp, "(+ 1 (/ 1 0))");
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "Divide procedure failed: integer division by zero\n");
+}
+
+TEST(ProcedureTests, depth_limit_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define f (lambda (n) (if (= n 0) 0 (+ 1 (f (- n 1))))))");
+	eval_str(interp, "(define g (lambda (n) (if (= n 0) 0 (+ 1 (+ 1 (+ 1 (+ 1 (+ 1 (+ 1 (g (- n 1)))))))))))");
+
+	// Recursion past what the stack holds raises a condition instead of overflowing it
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(f 500)").get())->value, 500);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(guard (e (#t (error-object? e))) (f 100000))").get())->value, true);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(guard (e (#t (error-object? e))) (g 100000))").get())->value, true);
+	EXPECT_EQ(interp.depth, 0);
+
+	// The interpreter is usable afterwards, and an unguarded overflow ends the form with a report
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(f 500)").get())->value, 500);
+	Slot raised;
+	eval::eval_source(interp, "(f 100000)", raised);
+	EXPECT_NE(raised.type, Variable::Type::INVALID);
+	EXPECT_EQ(interp.escape, nullptr);
+}
+
+TEST(ProcedureTests, number_literal_case1) {
+
+	Interpreter interp;
+
+	// A number that does not fit is an error raised where it is evaluated
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(guard (e (#t (error-object-message e))) (+ 1 99999999999999999999))").get())->value,
+		"Integer literal is out of range: 99999999999999999999");
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(guard (e (#t (error-object-message e))) 1.5.5)").get())->value,
+		"Invalid number literal: 1.5.5");
+	EXPECT_EQ(static_cast<Float*>(eval_str(interp, "(+ 1e3 0.5)").get())->value, 1000.5);
+
+	testing::internal::CaptureStdout();
+	EXPECT_EQ(server::eval_request(interp, nullptr, "(+ 1 99999999999999999999)"), "#<error Integer literal is out of range: 99999999999999999999>");
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+}
+
+TEST(ProcedureTests, exception_handler_case1) {
+
+	Interpreter interp;
+
+	// The handler's value replaces a continuable raise, and escaping from it abandons the thunk
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(with-exception-handler (lambda (e) (* e 2)) (lambda () (+ 1 (raise-continuable 20))))").get())->value, 41);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(call/ec (lambda (k) (with-exception-handler (lambda (e) (k 7)) (lambda () (+ 1 (vector-ref (vector) 0))))))").get())->value, 7);
+
+	// Returning from a non-continuable raise is itself an error, raised to the handlers outside
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(guard (e (else (error-object-message e))) (with-exception-handler (lambda (e) 0) (lambda () (raise 1))))").get())->value,
+		"Exception handler returned from a non-continuable raise");
+	EXPECT_EQ(interp.escape, nullptr);
+	EXPECT_TRUE(interp.handlers.empty());
+}
+
+// TESTING PARALLEL PRIMITIVES
+// ===========================
+TEST(ParallelTests, task_deque_case1) {
+
+	struct CountTask : parallel::Task
+	{
+		std::atomic<int>* runs;
+		void run() override { (*runs)++; }
+	};
+
+	constexpr int task_count = 20000;
+	std::vector<std::atomic<int>> runs(task_count);
+	std::vector<CountTask> tasks(task_count);
+	for (int i = 0; i < task_count; i++) tasks[i].runs = &runs[i];
+
+	parallel::TaskDeque deque;
+	std::atomic<bool> done{ false };
+	std::vector<std::thread> thieves;
+
+	for (int i = 0; i < 3; i++)
+	{
+		thieves.emplace_back([&]() {
+			while (!done)
+			{
+				if (auto task = deque.steal()) task->run();
+			}
+		});
+	}
+
+	// The owner pushes in bursts and pops them back, racing the thieves for the last task
+	int next = 0;
+	while (next < task_count)
+	{
+		for (int i = 0; i < 64 && next < task_count; i++)
+		{
+			ASSERT_TRUE(deque.push(&tasks[next++]));
+		}
+		for (int i = 0; i < 64; i++)
+		{
+			if (auto task = deque.pop()) task->run();
+		}
+	}
+	while (auto task = deque.pop()) task->run();
+	while (!deque.empty()) std::this_thread::yield();
+	done = true;
+	for (auto& thief : thieves) thief.join();
+
+	for (int i = 0; i < task_count; i++) EXPECT_EQ(runs[i].load(), 1) << "task " << i;
+}
+
+TEST(ParallelTests, parallel_for_case1) {
+
+	std::vector<std::atomic<int>> visits(5000);
+
+	// Nested loops run on the same pool, the inner one from whichever thread picked up the chunk
+	parallel::parallel_for(50, 1, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; i++)
+		{
+			parallel::parallel_for(100, 4, [&](std::size_t inner_begin, std::size_t inner_end) {
+				for (std::size_t j = inner_begin; j < inner_end; j++) visits[i * 100 + j]++;
+			});
+		}
+	});
+
+	for (auto& visit : visits) EXPECT_EQ(visit.load(), 1);
+}
+
+TEST(ParallelTests, pmap_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define offset 1000)");
+	eval_str(interp, "(define items (make-vector 2000 0))");
+	eval_str(interp, "(define fill (lambda (i) (if (< i 2000) (begin (vector-set! items i i) (fill (+ i 1))) 0)))");
+	eval_str(interp, "(fill 0)");
+
+	auto res = eval_str(interp, "(pmap (lambda (x) (+ (* x x) offset)) items)");
+	ASSERT_NE(res, nullptr);
+	ASSERT_EQ(res->type, Variable::Type::VECTOR);
+
+	auto& vec = *static_cast<Vector*>(res.get());
+	ASSERT_EQ(vec.size(), 2000);
+	for (int i = 0; i < 2000; i++) EXPECT_EQ(vec.at(i).i_value, i * i + 1000);
+
+	auto persistent = eval_str(interp, "(pmap (lambda (s) (string=? s \"b\")) (persistent-vector \"a\" \"b\"))");
+	ASSERT_EQ(persistent->type, Variable::Type::PERSISTENT_VECTOR);
+	EXPECT_FALSE(static_cast<PersistentVector*>(persistent.get())->at(0).b_value);
+	EXPECT_TRUE(static_cast<PersistentVector*>(persistent.get())->at(1).b_value);
+
+	// A failing call fails the whole map
+	EXPECT_EQ(eval_str(interp, "(pmap (lambda (x) (vector-ref items 9999)) items)"), nullptr);
+}
+
+TEST(ParallelTests, preduce_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define ones (make-vector 10000 1))");
+	eval_str(interp, "(define halves (make-vector 10000 0.1))");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(preduce + 5 ones)").get())->value, 10005);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(preduce + 5 (vector))").get())->value, 5);
+
+	// Floating point addition is not associative, so equal results show the grouping is fixed
+	double first = static_cast<Float*>(eval_str(interp, "(preduce + 0.0 halves)").get())->value;
+	for (int i = 0; i < 10; i++)
+	{
+		EXPECT_EQ(static_cast<Float*>(eval_str(interp, "(preduce + 0.0 halves)").get())->value, first);
+	}
+}
+
+TEST(ParallelTests, future_touch_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define pfib (lambda (n) (if (< n 2) n (begin (define a (future (pfib (- n 1)))) (+ (pfib (- n 2)) (touch a))))))");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(pfib 16)").get())->value, 987);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(touch ((lambda (x) (future (* x 2))) 21))").get())->value, 42);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(touch 7)").get())->value, 7);
+}
+
+TEST(ParallelTests, future_isolation_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define base 1)");
+	eval_str(interp, "(define early (future (+ base 1)))");
+	eval_str(interp, "(define late (future later_name))");
+	eval_str(interp, "(define later_name 3)");
+	eval_str(interp, "(define defines (future (define inner 1)))");
+
+	// Definitions made after the future was created are not visible to it, and its own stay with it
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(touch early)").get())->value, 2);
+	EXPECT_EQ(eval_str(interp, "(touch late)")->type, Variable::Type::SYMBOL);
+	EXPECT_EQ(eval_str(interp, "(touch defines)"), nullptr);
+	EXPECT_EQ(interp.env.find("inner"), nullptr);
+	EXPECT_NE(interp.env.find("base"), nullptr);
+	EXPECT_NE(interp.env.find("later_name"), nullptr);
+}
+
+TEST(ParallelTests, errors_case1) {
+
+	Interpreter interp;
+	auto caught = [&](const std::string& body) {
+		auto result = eval_str(interp, "(guard (e ((error-object? e) (error-object-message e)) (else e)) " + body + ")");
+		return result != nullptr && result->type == Variable::Type::STRING ? static_cast<String*>(result.get())->value : std::string();
+	};
+
+	// An error on a worker is raised again in the caller, where a guard can catch it
+	testing::internal::CaptureStdout();
+	EXPECT_EQ(caught("(pmap (lambda (x) (/ 1 x)) (vector 1 0 2))"), "Divide procedure failed: integer division by zero");
+	EXPECT_EQ(caught("(pfor-each (lambda (x) (/ 1 x)) (vector 1 0 2))"), "Divide procedure failed: integer division by zero");
+	EXPECT_EQ(caught("(preduce (lambda (a b) (/ a b)) 1 (make-vector 100 0))"), "Divide procedure failed: integer division by zero");
+	EXPECT_EQ(caught("(touch (future (/ 1 0)))"), "Divide procedure failed: integer division by zero");
+	EXPECT_EQ(caught("(pmap (lambda (x) (vector-set! (vector 0) 0 x)) (vector 1 2))"),
+		"Parallel map procedure expects a procedure that returns a value, element 0 gave none");
+
+	// The error of the lowest element is the one raised, however the work was spread
+	eval_str(interp, "(define fill (lambda (v i) (if (< i (vector-length v)) (begin (vector-set! v i i) (fill v (+ i 1))) v)))");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(guard (e (#t e)) (pmap (lambda (x) (raise x)) (fill (make-vector 1000 0) 0)))").get())->value, 0);
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+}
+
+TEST(ParallelTests, frozen_globals_case1) {
+
+	Interpreter interp;
+	auto message = [&](const std::string& body) {
+		auto result = eval_str(interp, "(guard (e ((error-object? e) (error-object-message e))) " + body + ")");
+		return result != nullptr && result->type == Variable::Type::STRING ? static_cast<String*>(result.get())->value : std::string();
+	};
+	eval_str(interp, "(define counts (vector 0))");
+	eval_str(interp, "(define other (make-hash-table))");
+
+	// What a future can reach is read-only until it has been evaluated, for both sides, and nothing else is
+	eval_str(interp, "(define f (future (vector-set! counts 0 1)))");
+	eval_str(interp, "(hash-table-set! other 1 1)");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(hash-table-size other)").get())->value, 1);
+	EXPECT_EQ(message("(touch f)"), "Vector set procedure cannot change a frozen vector, other threads may be reading it");
+	eval_str(interp, "(vector-set! counts 0 3)");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref counts 0)").get())->value, 3);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(touch (future (vector-ref counts 0)))").get())->value, 3);
+	eval_str(interp, "(vector-set! counts 0 4)");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref counts 0)").get())->value, 4);
+
+	// The definitions are frozen while the workers run, and writable again once the call returns
+	eval_str(interp, "(define out (make-vector 4 0))");
+	EXPECT_EQ(message("(pfor-each (lambda (i) (vector-set! out i i)) (vector 0 1 2 3))"),
+		"Vector set procedure cannot change a frozen vector, other threads may be reading it");
+	eval_str(interp, "(vector-set! out 0 9)");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref out 0)").get())->value, 9);
+
+	// Elements handed to pmap are frozen for the call, the vector holding them is not frozen at all
+	eval_str(interp, "(define first-of (lambda (row) (vector-ref row 0)))");
+	eval_str(interp, "(define replace (lambda (rows) (pmap first-of rows) (vector-set! rows 0 5) (vector-ref rows 0)))");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(replace (vector (vector 1) (vector 2)))").get())->value, 5);
+	eval_str(interp, "(define change (lambda (rows) (pmap first-of rows) (vector-set! (vector-ref rows 1) 0 7) (vector-ref (vector-ref rows 1) 0)))");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(change (vector (vector 1) (vector 2)))").get())->value, 7);
+}
+
+// TESTING GREEN THREADS
+// =====================
+TEST(GreenTests, channel_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define ch (make-channel 2))");
+	eval_str(interp, "(spawn (lambda () (channel-send! ch 1) (channel-send! ch 2) (channel-send! ch 3)))");
+
+	// The sender fills the channel and waits for room while the receiver drains it
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(+ (channel-receive ch) (channel-receive ch) (channel-receive ch))").get())->value, 6);
+	// Nothing is left that could send, so waiting would never end
+	EXPECT_EQ(eval_str(interp, "(channel-receive ch)"), nullptr);
+	EXPECT_EQ(eval_str(interp, "(make-channel 0)"), nullptr);
+}
+
+TEST(GreenTests, many_threads_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define results (make-channel 16))");
+	eval_str(interp, "(define start (lambda (i) (if (< i 2000) (begin (spawn (lambda () (yield) (channel-send! results i))) (start (+ i 1))) 0)))");
+	eval_str(interp, "(define total (lambda (i acc) (if (< i 2000) (total (+ i 1) (+ acc (channel-receive results))) acc)))");
+	eval_str(interp, "(start 0)");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(total 0 0)").get())->value, 1999000);
+}
+
+TEST(GreenTests, deep_recursion_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define results (make-channel 4))");
+	eval_str(interp, "(define f (lambda (n) (if (= n 0) 0 (+ 1 (f (- n 1))))))");
+
+	// A green thread recurses as deep as the main stack allows, and past that it raises instead of overflowing
+	eval_str(interp, "(spawn (lambda () (channel-send! results (f 1500))))");
+	eval_str(interp, "(spawn (lambda () (channel-send! results (guard (e (#t (error-object? e))) (f 100000)))))");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(channel-receive results)").get())->value, 1500);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(channel-receive results)").get())->value, true);
+	EXPECT_EQ(interp.depth, 0);
+}
+
+TEST(GreenTests, pipe_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define p (make-pipe))");
+	eval_str(interp, "(define done (make-channel 1))");
+	eval_str(interp, "(spawn (lambda () (channel-send! done (fd-read (vector-ref p 0) 5))))");
+	eval_str(interp, "(spawn (lambda () (yield) (fd-write (vector-ref p 1) \"hello\")))");
+
+	// The reader waits on epoll until the writer, scheduled after it, fills the pipe
+	auto res = eval_str(interp, "(channel-receive done)");
+	ASSERT_NE(res, nullptr);
+	EXPECT_EQ(static_cast<String*>(res.get())->value, "hello");
+
+	eval_str(interp, "(fd-close (vector-ref p 0))");
+	eval_str(interp, "(fd-close (vector-ref p 1))");
+}
+
+TEST(GreenTests, close_while_waiting_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define p (make-pipe))");
+	eval_str(interp, "(define done (make-channel 2))");
+	eval_str(interp, "(spawn (lambda () (channel-send! done (guard (e ((error-object? e) \"closed\")) (fd-read (vector-ref p 0) 10)))))");
+	eval_str(interp, "(spawn (lambda () (fd-close (vector-ref p 0))))");
+
+	// Closing the descriptor wakes the reader with an error instead of leaving the scheduler waiting for good
+	eval_str(interp, "(run-threads)");
+	auto res = eval_str(interp, "(channel-receive done)");
+	ASSERT_NE(res, nullptr);
+	EXPECT_EQ(static_cast<String*>(res.get())->value, "closed");
+
+	eval_str(interp, "(fd-close (vector-ref p 1))");
+}
+
+// TESTING PLACES
+// ==============
+TEST(PlaceTests, mailbox_case1) {
+
+	constexpr int producers = 4;
+	constexpr int per_producer = 20000;
+	places::Mailbox mailbox;
+	std::vector<std::thread> threads;
+
+	for (int p = 0; p < producers; p++)
+	{
+		threads.emplace_back([&, p]() {
+			for (int i = 0; i < per_producer; i++) mailbox.push(Slot(p * per_producer + i));
+		});
+	}
+
+	// Messages from one producer arrive in the order they were sent
+	std::vector<int> last(producers, -1);
+	for (int i = 0; i < producers * per_producer; i++)
+	{
+		Slot message = mailbox.pop();
+		int producer = message.i_value / per_producer;
+		EXPECT_GT(message.i_value % per_producer, last[producer]);
+		last[producer] = message.i_value % per_producer;
+	}
+	for (auto& thread : threads) thread.join();
+
+	Slot extra;
+	EXPECT_FALSE(mailbox.try_pop(extra));
+}
+
+TEST(PlaceTests, copy_message_case1) {
+
+	Interpreter interp;
+	auto vec = eval_str(interp, "(vector 1 \"two\" (vector 3))");
+	auto persistent = eval_str(interp, "(persistent-vector 1 2 3)");
+	Slot vec_slot = Slot::from_variable(std::move(vec));
+	Slot persistent_slot = Slot::from_variable(std::move(persistent));
+
+	// Vectors are copied, so nothing changed afterwards reaches the copy
+	Slot vec_copy;
+	ASSERT_TRUE(places::copy_message(vec_slot, vec_copy));
+	auto& original = *static_cast<Vector*>(vec_slot.boxed);
+	auto& copied = *static_cast<Vector*>(vec_copy.boxed);
+	EXPECT_NE(original.buffer, copied.buffer);
+	EXPECT_NE(static_cast<Vector*>(original.at(2).boxed)->buffer, static_cast<Vector*>(copied.at(2).boxed)->buffer);
+	EXPECT_EQ(static_cast<String*>(copied.at(1).boxed)->value, "two");
+
+	// Immutable persistent vectors are shared as they are
+	Slot persistent_copy;
+	ASSERT_TRUE(places::copy_message(persistent_slot, persistent_copy));
+	EXPECT_EQ(static_cast<PersistentVector*>(persistent_copy.boxed)->tail, static_cast<PersistentVector*>(persistent_slot.boxed)->tail);
+
+	Slot future_copy;
+	EXPECT_FALSE(places::copy_message(Slot::from_variable(eval_str(interp, "(future 1)")), future_copy));
+}
+
+TEST(PlaceTests, place_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define factor 2)");
+	eval_str(interp, "(define p (place (lambda (ch) (place-send! ch (* factor (vector-ref (place-receive ch) 0))) 99)))");
+	eval_str(interp, "(place-send! p (vector 21))");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(place-receive p)").get())->value, 42);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(place-wait p)").get())->value, 99);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(place-wait p)").get())->value, 99);
+}
+
+TEST(PlaceTests, place_globals_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define v (make-vector 1 0))");
+	eval_str(interp, "(define same v)");
+	eval_str(interp, "(define p (place (lambda (ch) (vector-set! v 0 42) (vector-ref same 0))))");
+
+	// The place changes its own copy of the globals, which keeps the sharing between them
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(place-wait p)").get())->value, 42);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref v 0)").get())->value, 0);
+	eval_str(interp, "(vector-set! v 0 7)");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref same 0)").get())->value, 7);
+}
+
+TEST(PlaceTests, place_wait_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define p (place (lambda (ch) (vector 1 2))))");
+
+	// Every wait gets a copy of the result, so waiters never share its storage
+	eval_str(interp, "(define first (place-wait p))");
+	eval_str(interp, "(define second (place-wait p))");
+	eval_str(interp, "(vector-set! first 0 9)");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref second 0)").get())->value, 1);
+
+	// An error the place does not catch ends it, and is reported once
+	testing::internal::CaptureStdout();
+	eval_str(interp, "(define failing (place (lambda (ch) (/ 1 0) 5)))");
+	EXPECT_EQ(eval_str(interp, "(place-wait failing)"), nullptr);
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "Divide procedure failed: integer division by zero\n");
+}
+
+// TESTING REGIONS
+// ===============
+TEST(RegionTests, reset_case1) {
+
+	{
+		// Makes sure this thread already has a chunk to reuse
+		region::Scope scope;
+		Slot::from_variable(std::make_unique<String>("warm up"));
+	}
+	auto before = region::stats();
+
+	for (int i = 0; i < 1000; i++)
+	{
+		region::Scope scope;
+		auto value = Slot::from_variable(std::make_unique<String>("temporary"));
+		EXPECT_TRUE(region::in_region(value.boxed));
+	}
+	auto after = region::stats();
+
+	EXPECT_EQ(after.region_allocations - before.region_allocations, 1000);
+	EXPECT_EQ(after.resets - before.resets, 1000);
+	EXPECT_EQ(after.chunks_allocated, before.chunks_allocated);
+	EXPECT_FALSE(region::in_region(std::make_unique<String>("outside").get()));
+}
+
+TEST(RegionTests, escape_case1) {
+
+	Slot kept;
+	{
+		region::Scope scope;
+		kept = Slot::from_variable(std::make_unique<String>("escaped"));
+	}
+	{
+		// A later form cannot reuse the chunk while the escaped value is alive
+		region::Scope scope;
+		for (int i = 0; i < 10000; i++) Slot::from_variable(std::make_unique<String>("overwrite"));
+	}
+	EXPECT_EQ(static_cast<String*>(kept.boxed)->value, "escaped");
+
+	// The last value of a retired chunk may be freed by another thread
+	std::thread([value = std::move(kept)]() mutable { value = Slot(); }).join();
+}
+
+TEST(RegionTests, promote_case1) {
+
+	Interpreter interp;
+	auto before = region::stats();
+	eval_source(interp, "(define v (vector \"a\" (vector \"b\"))) (define s \"c\")");
+
+	auto& vec = *static_cast<Vector*>(interp.env.env_map["v"].get());
+	auto& inner = *static_cast<Vector*>(vec.at(1).boxed);
+	EXPECT_FALSE(region::in_region(&vec));
+	EXPECT_FALSE(region::in_region(vec.at(0).boxed));
+	EXPECT_FALSE(region::in_region(&inner));
+	EXPECT_FALSE(region::in_region(inner.at(0).boxed));
+	EXPECT_FALSE(region::in_region(interp.env.env_map["s"].get()));
+	EXPECT_EQ(region::stats().promotions - before.promotions, 5);
+}
+
+TEST(RegionTests, promote_stored_case1) {
+
+	Interpreter interp;
+	eval_source(interp, "(define v (make-vector 4 0)) (define h (make-hash-table)) (define w (make-vector 2 0))");
+	eval_source(interp, "(vector-set! v 0 \"a\") (vector-fill! v \"b\" 1 3) (vector-copy! v 3 (vector \"c\"))");
+	eval_source(interp, "(hash-table-set! h \"k\" \"d\")");
+	auto before = region::stats();
+
+	// Values stored in a defined container are promoted, so the forms that made them leave their chunk free
+	for (int i = 0; i < 1000; i++) eval_source(interp, "(hash-table-set! h " + std::to_string(i) + " \"x\") (vector-set! w 0 \"y\")");
+	auto after = region::stats();
+	EXPECT_EQ(after.resets - before.resets, 2000);
+	EXPECT_EQ(after.chunks_allocated, before.chunks_allocated);
+
+	auto& vec = *static_cast<Vector*>(interp.env.env_map["v"].get());
+	for (std::size_t i = 0; i < vec.size(); i++) EXPECT_FALSE(region::in_region(vec.at(i).boxed));
+	auto& table = *static_cast<HashTable*>(interp.env.env_map["h"].get());
+	for (auto& entry : table.table->entries)
+	{
+		if (entry.probe == 0) continue;
+		if (entry.key.is_boxed()) EXPECT_FALSE(region::in_region(entry.key.boxed));
+		EXPECT_FALSE(region::in_region(entry.value.boxed));
+	}
+
+	// A container that only lives for its form keeps what is stored in it in the region
+	before = region::stats();
+	eval_source(interp, "(vector-set! (make-vector 1 0) 0 \"z\")");
+	EXPECT_EQ(region::stats().promotions, before.promotions);
+}
+
+// TESTING VECTORS
+// ===============
+TEST(VectorTests, vector_ref_case1) {
+
+	Interpreter interp;
+	auto ast = construct_ast(std::move(tokenize("(vector-ref (make-vector 3 7) 2)")));
+	auto res = eval::eval_expr(interp, &ast);
+
+	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Int>(environment::Int(7));
+
+	EXPECT_EQ(*res.get(), *expected.get());
+}
+
+TEST(VectorTests, vector_ref_case2) {
+
+	Interpreter interp;
+	auto ast = construct_ast(std::move(tokenize("(vector-ref (vector 1 2 3) 3)")));
+	auto res = eval::eval_expr(interp, &ast);
+
+	EXPECT_EQ(res, nullptr);
+}
+
+TEST(VectorTests, vector_set_case1) {
+
+	Interpreter interp;
+	auto def = construct_ast(std::move(tokenize("(define vec_set_1 (make-vector 4 0))")));
+	eval::eval_expr(interp, &def);
+
+	auto set = construct_ast(std::move(tokenize("(vector-set! vec_set_1 1 (* 2.5 2))")));
+	eval::eval_expr(interp, &set);
+
+	auto ast = construct_ast(std::move(tokenize("(vector-ref vec_set_1 1)")));
+	auto res = eval::eval_expr(interp, &ast);
+
+	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Float>(environment::Float(5.0));
+
+	EXPECT_EQ(*res.get(), *expected.get());
+}
+
+TEST(VectorTests, vector_fill_case1) {
+
+	Interpreter interp;
+	auto def = construct_ast(std::move(tokenize("(define vec_fill_1 (vector 1 2 3 4))")));
+	eval::eval_expr(interp, &def);
+
+	auto fill = construct_ast(std::move(tokenize("(vector-fill! vec_fill_1 9 1 3)")));
+	eval::eval_expr(interp, &fill);
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref vec_fill_1 0)").get())->value, 1);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref vec_fill_1 1)").get())->value, 9);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref vec_fill_1 2)").get())->value, 9);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref vec_fill_1 3)").get())->value, 4);
+}
+
+TEST(VectorTests, vector_copy_case1) {
+
+	Interpreter interp;
+	auto def = construct_ast(std::move(tokenize("(define vec_copy_1 (vector 1 2 3 4 5))")));
+	eval::eval_expr(interp, &def);
+
+	// Overlapping copy within the same vector
+	auto copy = construct_ast(std::move(tokenize("(vector-copy! vec_copy_1 1 vec_copy_1 0 4)")));
+	eval::eval_expr(interp, &copy);
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref vec_copy_1 0)").get())->value, 1);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref vec_copy_1 1)").get())->value, 1);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref vec_copy_1 2)").get())->value, 2);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref vec_copy_1 3)").get())->value, 3);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref vec_copy_1 4)").get())->value, 4);
+}
+
+TEST(VectorTests, vector_copy_case2) {
+
+	Interpreter interp;
+	auto def = construct_ast(std::move(tokenize("(define vec_copy_2 (vector \"a\" \"b\" \"c\"))")));
+	eval::eval_expr(interp, &def);
+
+	auto copy = construct_ast(std::move(tokenize("(vector-copy! vec_copy_2 0 vec_copy_2 1)")));
+	eval::eval_expr(interp, &copy);
+
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(vector-ref vec_copy_2 0)").get())->value, "b");
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(vector-ref vec_copy_2 1)").get())->value, "c");
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(vector-ref vec_copy_2 2)").get())->value, "c");
+}
+
+TEST(VectorTests, cyclic_vector_case1) {
+
+	Interpreter interp;
+	eval_source(interp, "(define v (make-vector 2 0)) (vector-set! v 0 v) (define w (make-vector 2 0)) (vector-set! w 0 w)");
+	eval_source(interp, "(define u (make-vector 2 0)) (vector-set! u 0 u) (vector-set! u 1 1)");
+
+	// A vector inside itself is written as ... instead of forever
+	std::ostringstream out;
+	eval::write_slot(out, eval_source(interp, "(vector 1 v)"));
+	EXPECT_EQ(out.str(), "#(1 #(... 0))");
+
+	// Comparing and hashing follow the cycle only as far as they need to
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(equal? v w)").get())->value, true);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(equal? v u)").get())->value, false);
+	eval_source(interp, "(define h (make-hash-table)) (hash-table-set! h v 5)");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(hash-table-ref h w)").get())->value, 5);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(hash-table-exists? h u)").get())->value, false);
+}
+
+// TESTING HASH TABLES
+// ===================
+TEST(HashTableTests, hash_table_ref_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define table_ref_1 (make-hash-table))");
+	eval_str(interp, "(hash-table-set! table_ref_1 \"one\" 1)");
+	eval_str(interp, "(hash-table-set! table_ref_1 2 2.5)");
+
+	std::unique_ptr<environment::Variable> expected1 = std::make_unique<environment::Int>(environment::Int(1));
+	std::unique_ptr<environment::Variable> expected2 = std::make_unique<environment::Float>(environment::Float(2.5));
+
+	EXPECT_EQ(*eval_str(interp, "(hash-table-ref table_ref_1 \"one\")").get(), *expected1.get());
+	EXPECT_EQ(*eval_str(interp, "(hash-table-ref table_ref_1 2)").get(), *expected2.get());
+	EXPECT_EQ(eval_str(interp, "(hash-table-ref table_ref_1 3)"), nullptr);
+}
+
+TEST(HashTableTests, hash_table_ref_case2) {
+
+	Interpreter interp;
+	eval_str(interp, "(define table_ref_2 (make-hash-table eqv?))");
+
+	std::unique_ptr<environment::Variable> expected = std::make_unique<environment::Int>(environment::Int(-1));
+
+	EXPECT_EQ(*eval_str(interp, "(hash-table-ref/default table_ref_2 5 -1)").get(), *expected.get());
+}
+
+TEST(HashTableTests, hash_table_delete_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define table_delete_1 (make-hash-table string=?))");
+	eval_str(interp, "(hash-table-set! table_delete_1 \"a\" 1)");
+	eval_str(interp, "(hash-table-set! table_delete_1 \"b\" 2)");
+	eval_str(interp, "(hash-table-delete! table_delete_1 \"a\")");
+
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(hash-table-exists? table_delete_1 \"a\")").get())->value, false);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(hash-table-exists? table_delete_1 \"b\")").get())->value, true);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(hash-table-size table_delete_1)").get())->value, 1);
+}
+
+TEST(HashTableTests, hash_table_equal_case1) {
+
+	Interpreter interp;
+	eval_str(interp, "(define table_equal_1 (make-hash-table equal?))");
+	eval_str(interp, "(hash-table-set! table_equal_1 (vector 1 2) 3)");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(hash-table-ref table_equal_1 (vector 1 2))").get())->value, 3);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(equal? (vector 1 2) (vector 1 2))").get())->value, true);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(eqv? (vector 1 2) (vector 1 2))").get())->value, false);
+}
+
+TEST(HashTableTests, hash_table_float_keys_case1) {
+
+	// eqv? and the key hash must agree on signed zeros and NaN
+	Interpreter interp;
+	eval_str(interp, "(define table_float_1 (make-hash-table eqv?))");
+	eval_str(interp, "(define nan (/ 0.0 0.0))");
+	eval_str(interp, "(hash-table-set! table_float_1 0.0 1)");
+	eval_str(interp, "(hash-table-set! table_float_1 nan 2)");
+
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(eqv? 0.0 -0.0)").get())->value, false);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(eqv? nan nan)").get())->value, true);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(hash-table-ref/default table_float_1 0.0 -1)").get())->value, 1);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(hash-table-ref/default table_float_1 -0.0 -1)").get())->value, -1);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(hash-table-ref/default table_float_1 nan -1)").get())->value, 2);
+}
+
+TEST(HashTableTests, hash_table_erase_case1) {
+
+	// Erasing shifts later entries back, every remaining key must stay reachable
+	environment::HashTable table(environment::Equivalence::EQV);
+
+	for (int i = 0; i < 1000; i++) table.insert(environment::Slot(i), environment::Slot(i * 2));
+	for (int i = 0; i < 1000; i += 2) EXPECT_TRUE(table.erase(environment::Slot(i)));
+
+	EXPECT_EQ(table.size(), 500);
+	for (int i = 0; i < 1000; i++)
+	{
+		auto value = table.find(environment::Slot(i));
+		if (i % 2 == 0)
+		{
+			EXPECT_EQ(value, nullptr);
+			continue;
+		}
+		ASSERT_NE(value, nullptr);
+		EXPECT_EQ(value->i_value, i * 2);
+	}
+}
+
+TEST(HashTableTests, hash_table_update_case1) {
+
+	// Fill the table right up to its load limit
+	environment::HashTable table(environment::Equivalence::EQV);
+	table.insert(environment::Slot(0), environment::Slot(0));
+	std::size_t capacity = table.table->entries.size();
+	for (int i = 1; (table.size() + 1) * 8 <= capacity * 7; i++) table.insert(environment::Slot(i), environment::Slot(i));
+
+	// Replacing the value of a key already present needs no more room
+	table.insert(environment::Slot(0), environment::Slot(100));
+	EXPECT_EQ(table.table->entries.size(), capacity);
+	EXPECT_EQ(table.find(environment::Slot(0))->i_value, 100);
+
+	table.insert(environment::Slot(-1), environment::Slot(-1));
+	EXPECT_GT(table.table->entries.size(), capacity);
+}
+
+// TESTING PERSISTENT VECTORS AND MAPS
+// ===================================
+TEST(PersistentTests, persistent_vector_case1) {
+
+	environment::PersistentVector vec;
+	for (int i = 0; i < 5000; i++) vec = vec.push(environment::Slot(i));
+
+	auto updated = vec.set(1234, environment::Slot(-1));
+
+	ASSERT_EQ(vec.size(), 5000);
+	ASSERT_EQ(updated.size(), 5000);
+	for (int i = 0; i < 5000; i++) EXPECT_EQ(vec.at(i).i_value, i);
+	EXPECT_EQ(updated.at(1234).i_value, -1);
+	EXPECT_EQ(updated.at(1235).i_value, 1235);
+
+	// Only the path to the changed leaf is copied, the first subtree is shared between versions
+	EXPECT_EQ(vec.root->children[0], updated.root->children[0]);
+	EXPECT_NE(vec.root, updated.root);
+}
+
+TEST(PersistentTests, persistent_map_case1) {
+
+	environment::PersistentMap map;
+	for (int i = 0; i < 3000; i++) map = map.set(environment::Slot(i), environment::Slot(i * 3));
+
+	auto erased = map;
+	for (int i = 0; i < 3000; i += 3) erased = erased.erase(environment::Slot(i));
+
+	ASSERT_EQ(map.size(), 3000);
+	ASSERT_EQ(erased.size(), 2000);
+	for (int i = 0; i < 3000; i++)
+	{
+		ASSERT_NE(map.find(environment::Slot(i)), nullptr);
+		EXPECT_EQ(map.find(environment::Slot(i))->i_value, i * 3);
+		EXPECT_EQ(erased.find(environment::Slot(i)) == nullptr, i % 3 == 0);
+	}
+}
+
+TEST(PersistentTests, persistent_map_case2) {
+
+	Interpreter interp;
+	eval_str(interp, "(define pmap_case_2 (persistent-map \"a\" 1 \"b\" 2))");
+	eval_str(interp, "(define pmap_case_2_next (persistent-map-set pmap_case_2 \"a\" 10))");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(persistent-map-ref pmap_case_2 \"a\")").get())->value, 1);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(persistent-map-ref pmap_case_2_next \"a\")").get())->value, 10);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(persistent-map-count pmap_case_2_next)").get())->value, 2);
+	EXPECT_EQ(static_cast<Bool*>(eval_str(interp, "(persistent-map-contains? (persistent-map-delete pmap_case_2 \"b\") \"b\")").get())->value, false);
+}
+
+TEST(PersistentTests, persistent_vector_case2) {
+
+	Interpreter interp;
+	eval_str(interp, "(define pvec_case_2 (persistent-vector 1 2 3))");
+	eval_str(interp, "(define pvec_case_2_next (persistent-vector-push pvec_case_2 4))");
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(persistent-vector-length pvec_case_2)").get())->value, 3);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(persistent-vector-length pvec_case_2_next)").get())->value, 4);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(persistent-vector-ref (persistent-vector-set pvec_case_2 0 9) 0)").get())->value, 9);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(persistent-vector-ref pvec_case_2 0)").get())->value, 1);
+}
+
+// TESTING IMAGES
+// ==============
+TEST(ImageTests, round_trip_case1) {
+
+	Interpreter source;
+	eval_source(source, "(define n 40) (define name \"scheme\") (define shared (vector 1 2)) (define pair (vector shared shared))");
+	eval_source(source, "(define cycle (vector 0)) (vector-set! cycle 0 cycle) (define table (make-hash-table)) (hash-table-set! table \"k\" shared)");
+	eval_source(source, "(define pm (persistent-map \"a\" 1.5)) (define add-n (lambda (x) (+ x n))) (define plus +)");
+
+	std::string path = "/tmp/scheme_image_test_" + std::to_string(getpid()) + ".img";
+	ASSERT_TRUE(image::dump_image(source.env, path));
+
+	Interpreter interp;
+	interp.env.parent = image::load_image(path);
+	ASSERT_NE(interp.env.parent, nullptr);
+	EXPECT_EQ(interp.env.parent->image->size(), 9);
+
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(add-n 2)").get())->value, 42);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(plus n 1)").get())->value, 41);
+	EXPECT_EQ(static_cast<String*>(eval_str(interp, "(vector-ref (vector name) 0)").get())->value, "scheme");
+	EXPECT_EQ(static_cast<Float*>(eval_str(interp, "(persistent-map-ref pm \"a\")").get())->value, 1.5);
+
+	// Definitions that shared a vector still share it, and so do the vectors inside a cycle
+	eval_str(interp, "(vector-set! shared 0 7)");
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref (vector-ref pair 1) 0)").get())->value, 7);
+	EXPECT_EQ(static_cast<Int*>(eval_str(interp, "(vector-ref (hash-table-ref table \"k\") 0)").get())->value, 7);
+	EXPECT_TRUE(static_cast<Bool*>(eval_str(interp, "(eq? cycle (vector-ref cycle 0))").get())->value);
+
+	// An image layer can itself be written out again
+	ASSERT_TRUE(image::dump_image(interp.env, path));
+	Interpreter reloaded;
+	reloaded.env.parent = image::load_image(path);
+	ASSERT_NE(reloaded.env.parent, nullptr);
+	EXPECT_EQ(static_cast<Int*>(eval_str(reloaded, "(vector-ref shared 0)").get())->value, 7);
+	unlink(path.c_str());
+}
+
+TEST(ImageTests, invalid_image_case1) {
+
+	std::string path = "/tmp/scheme_image_invalid_" + std::to_string(getpid()) + ".img";
+
+	Interpreter source;
+	eval_source(source, "(define f (future 1))");
+	EXPECT_FALSE(image::dump_image(source.env, path));
+
+	// A file cut short is rejected when it is opened
+	Interpreter valid;
+	eval_source(valid, "(define n 1)");
+	ASSERT_TRUE(image::dump_image(valid.env, path));
+	ASSERT_EQ(truncate(path.c_str(), 40), 0);
+	EXPECT_EQ(image::load_image(path), nullptr);
+	unlink(path.c_str());
+}
+
+TEST(ImageTests, invalid_image_case2) {
+
+	std::string path = "/tmp/scheme_image_damaged_" + std::to_string(getpid()) + ".img";
+
+	Interpreter source;
+	eval_source(source, "(define first (vector 1 \"marker\")) (define second first)");
+	ASSERT_TRUE(image::dump_image(source.env, path));
+
+	// Damage the tag of the vector's string element, which sits before the string's length
+	std::string contents;
+	{
+		std::ifstream in(path, std::ios::binary);
+		contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	auto marker = contents.find("marker");
+	ASSERT_NE(marker, std::string::npos);
+	contents[marker - 5] = static_cast<char>(0xEE);
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out << contents;
+	}
+
+	// Both definitions share the vector, and neither gets it back half decoded
+	Interpreter interp;
+	interp.env.parent = image::load_image(path);
+	ASSERT_NE(interp.env.parent, nullptr);
+	testing::internal::CaptureStdout();
+	EXPECT_EQ(interp.env.parent->image->find("first"), nullptr);
+	EXPECT_EQ(interp.env.parent->image->find("second"), nullptr);
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "Image definition of first is damaged\nImage definition of second is damaged\n");
+	unlink(path.c_str());
+}
+
+// TESTING THE PROFILER
+// ====================
+TEST(ProfileTests, collapsed_stacks_case1) {
+
+	Interpreter interp;
+	eval_source(interp, "(define profiled-fib (lambda (n) (if (< n 2) n (+ (profiled-fib (- n 1)) (profiled-fib (- n 2))))))");
+	eval_source(interp, "(define profiled-main (lambda () (profiled-fib 22)))");
+
+	std::string path = "/tmp/scheme_profile_test_" + std::to_string(getpid()) + ".folded";
+	ASSERT_TRUE(profile::start());
+	EXPECT_FALSE(profile::start());
+	eval_source(interp, "(profiled-main)");
+	ASSERT_TRUE(profile::stop(path));
+
+	// Every stack starts at the outermost procedure, and the procedures are named after their definitions
+	std::ifstream file(path);
+	std::string line;
+	std::size_t samples = 0;
+	bool in_fib = false;
+	while (std::getline(file, line))
+	{
+		EXPECT_EQ(line.rfind("profiled-main", 0), 0) << line;
+		in_fib = in_fib || line.find(";profiled-fib;profiled-fib") != std::string::npos;
+		samples += std::stoul(line.substr(line.rfind(' ') + 1));
+	}
+	EXPECT_GT(samples, 0);
+	EXPECT_TRUE(in_fib);
+	EXPECT_FALSE(profile::stop(path));
+	unlink(path.c_str());
+}
+
+// TESTING THE TRACE EXPORT
+// ============================
+TEST(TraceTests, chrome_events_case1) {
+
+	Interpreter interp;
+	eval_source(interp, "(define traced-square (lambda (x) (* x x)))");
+
+	std::string path = "/tmp/scheme_trace_test_" + std::to_string(getpid()) + ".json";
+	ASSERT_TRUE(trace::start(path, 0));
+	EXPECT_FALSE(trace::start(path, 0));
+	eval_source(interp, "(traced-square 3) (traced-square 4)");
+	std::thread([]() { Interpreter other; eval_source(other, "(+ 1 2)"); }).join();
+	ASSERT_TRUE(trace::stop());
+	EXPECT_FALSE(trace::stop());
+
+	std::ifstream file(path);
+	std::stringstream contents;
+	contents << file.rdbuf();
+	auto json = contents.str();
+	unlink(path.c_str());
+
+	// Each phase is recorded once per source or form, and calls above the zero threshold all are
+	auto count = [&json](const std::string& text)
+	{
+		std::size_t found = 0;
+		for (auto pos = json.find(text); pos != std::string::npos; pos = json.find(text, pos + 1)) found++;
+		return found;
+	};
+	EXPECT_EQ(json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0), 0);
+	EXPECT_NE(json.find("]}"), std::string::npos);
+	EXPECT_EQ(count("\"name\":\"tokenize\""), 2);
+	EXPECT_EQ(count("\"name\":\"construct_ast\""), 2);
+	EXPECT_EQ(count("\"name\":\"eval_expr\""), 3);
+	EXPECT_EQ(count("\"name\":\"traced-square\",\"cat\":\"procedure\""), 2);
+	EXPECT_EQ(count("\"ph\":\"M\""), 2);
+	EXPECT_EQ(count("\"name\":\"main\""), 1);
+}
+
+// TESTING THE INSTRUMENTATION
+// ============================
+TEST(InstrumentTests, runtime_stats_case1) {
+
+	Interpreter interp;
+	eval_source(interp, "(define stats-square (lambda (x) (* x x))) (stats-square 2) (stats-square 3) (stats-square 4)");
+
+	auto res = eval_str(interp, "(runtime-stats)");
+	ASSERT_NE(res, nullptr);
+	ASSERT_EQ(res->type, Variable::Type::VECTOR);
+	auto rows = static_cast<Vector*>(res.get());
+
+	// Builds without instrumentation collect nothing
+	if (!instrument::enabled)
+	{
+		EXPECT_EQ(rows->size(), 0);
+		return;
+	}
+
+	int square_calls = 0;
+	int multiply_calls = 0;
+	for (std::size_t i = 0; i < rows->size(); i++)
+	{
+		auto row = static_cast<Vector*>(rows->at(i).boxed);
+		auto& name = static_cast<String*>(row->at(0).boxed)->value;
+		if (name == "stats-square") square_calls = row->at(1).i_value;
+		if (name == "*") multiply_calls = row->at(1).i_value;
+	}
+	EXPECT_EQ(square_calls, 3);
+	EXPECT_GE(multiply_calls, 3);
+}
+
+TEST(InstrumentTests, memory_stats_case1) {
+
+	memstats::enable();
+	Interpreter interp;
+	auto before = memstats::snapshot();
+	auto vectors = static_cast<std::size_t>(Variable::Type::VECTOR);
+	auto strings = static_cast<std::size_t>(Variable::Type::STRING);
+
+	eval_source(interp, "(define kept (vector 1 2 3)) (vector-length (make-vector 200 \"s\"))");
+	auto after = memstats::snapshot();
+
+	// The defined vector is still alive, every string filling the temporary one is gone
+	EXPECT_EQ(after.variables[vectors].live - before.variables[vectors].live, 1);
+	EXPECT_GE(after.variables[strings].total - before.variables[strings].total, 200);
+	EXPECT_EQ(after.variables[strings].live, before.variables[strings].live);
+	EXPECT_GT(after.tokens.total, before.tokens.total);
+	EXPECT_GT(after.exprs.total, before.exprs.total);
+	EXPECT_EQ(after.forms - before.forms, 2);
+	EXPECT_GE(after.largest_form_peak, 200 * sizeof(String));
+
+	auto res = eval_str(interp, "(memory-stats)");
+	ASSERT_NE(res, nullptr);
+	auto rows = static_cast<Vector*>(res.get());
+	ASSERT_GT(rows->size(), 0);
+	auto last = static_cast<Vector*>(rows->at(rows->size() - 1).boxed);
+	EXPECT_EQ(static_cast<String*>(last->at(0).boxed)->value, "Form peak bytes");
+}
+
+// TESTING THE SERVER
+// ==================
+static int connect_to(const std::string& path)
+{
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+TEST(ServerTests, serve_requests_case1) {
+
+	Interpreter prelude;
+	eval_source(prelude, "(define base 40) (define table (persistent-map \"k\" 2))");
+	auto globals = std::make_shared<const Environment>(std::move(prelude.env));
+
+	std::string path = "/tmp/scheme_server_test_" + std::to_string(getpid()) + ".sock";
+	server::Server server(path, 2, globals);
+	ASSERT_TRUE(server.start());
+
+	std::vector<std::thread> clients;
+	std::vector<std::string> responses(4);
+
+	for (int i = 0; i < 4; i++)
+	{
+		clients.emplace_back([&, i]() {
+			int fd = connect_to(path);
+			std::string request = "(define mine " + std::to_string(i) + ") (+ base (persistent-map-ref table \"k\") mine)";
+			for (int j = 0; j < 20 && fd >= 0; j++)
+			{
+				if (!server::write_frame(fd, request) || !server::read_frame(fd, responses[i])) break;
+			}
+			if (fd >= 0) close(fd);
+		});
+	}
+	for (auto& client : clients) client.join();
+	server.stop();
+
+	EXPECT_EQ(responses, std::vector<std::string>({ "42", "43", "44", "45" }));
+}
+
+TEST(ServerTests, stalled_client_case1) {
+
+	std::string path = "/tmp/scheme_server_stalled_" + std::to_string(getpid()) + ".sock";
+	server::Server server(path, 1, nullptr);
+	ASSERT_TRUE(server.start());
+
+	// A client that stops halfway through a frame holds up nobody else
+	int stalled = connect_to(path);
+	ASSERT_GE(stalled, 0);
+	const char partial[] = { 0, 0, 0, 7, '(', '+', ' ' };
+	ASSERT_EQ(send(stalled, partial, sizeof(partial), 0), static_cast<ssize_t>(sizeof(partial)));
+
+	int fd = connect_to(path);
+	ASSERT_GE(fd, 0);
+	auto start = std::chrono::steady_clock::now();
+	std::string response;
+	EXPECT_TRUE(server::write_frame(fd, "(* 6 7)") && server::read_frame(fd, response));
+	EXPECT_EQ(response, "42");
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+	// The rest of the frame completes the request, and requests sent back to back are answered in order
+	ASSERT_EQ(send(stalled, "1 2)", 4, 0), 4);
+	EXPECT_TRUE(server::read_frame(stalled, response));
+	EXPECT_EQ(response, "3");
+	EXPECT_TRUE(server::write_frame(fd, "1") && server::write_frame(fd, "2"));
+	EXPECT_TRUE(server::read_frame(fd, response));
+	EXPECT_EQ(response, "1");
+	EXPECT_TRUE(server::read_frame(fd, response));
+	EXPECT_EQ(response, "2");
+
+	close(stalled);
+	close(fd);
+	server.stop();
+}
+
+TEST(ServerTests, frozen_globals_case1) {
+
+	Interpreter prelude;
+	eval_source(prelude, "(define counts (vector 0))");
+	auto globals = std::make_shared<const Environment>(std::move(prelude.env));
+
+	std::string path = "/tmp/scheme_server_frozen_" + std::to_string(getpid()) + ".sock";
+	server::Server server(path, 2, globals);
+	ASSERT_TRUE(server.start());
+
+	// Requests share the globals, so they cannot change them
+	std::string response;
+	int fd = connect_to(path);
+	ASSERT_GE(fd, 0);
+	EXPECT_TRUE(server::write_frame(fd, "(vector-set! counts 0 1)") && server::read_frame(fd, response));
+	EXPECT_EQ(response, "#<error Vector set procedure cannot change a frozen vector, other threads may be reading it>");
+	EXPECT_TRUE(server::write_frame(fd, "(vector-ref counts 0)") && server::read_frame(fd, response));
+	EXPECT_EQ(response, "0");
+	close(fd);
+	server.stop();
+}
+
+TEST(ServerTests, error_response_case1) {
+
+	Interpreter interp;
+
+	// An uncaught error ends the request and comes back in the response, with nothing printed by the server
+	testing::internal::CaptureStdout();
+	EXPECT_EQ(server::eval_request(interp, nullptr, "(error \"bad input\" 1 (vector 2)) 5"), "#<error bad input 1 #(2)>");
+	EXPECT_EQ(server::eval_request(interp, nullptr, "(raise 7)"), "#<error Uncaught raise: 7>");
+	EXPECT_EQ(server::eval_request(interp, nullptr, "(guard (e (else 3)) (/ 1 0))"), "3");
+	EXPECT_EQ(server::eval_request(interp, nullptr, "(pmap (lambda (x) (/ 1 x)) (vector 0))"), "#<error Divide procedure failed: integer division by zero>");
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+	EXPECT_EQ(interp.escape, nullptr);
+	EXPECT_TRUE(interp.handlers.empty());
+}
+
+TEST(ServerTests, prefork_case1) {
+
+	Interpreter prelude;
+	eval_source(prelude, "(define base 40) (define counts (vector 0))");
+	auto globals = std::make_shared<const Environment>(std::move(prelude.env));
+
+	std::string path = "/tmp/scheme_prefork_test_" + std::to_string(getpid()) + ".sock";
+	server::PreforkServer server(path, 2, globals);
+	ASSERT_TRUE(server.start());
+	EXPECT_EQ(server.worker_pids().size(), 2);
+
+	std::vector<std::string> responses;
+	for (int i = 0; i < 4; i++)
+	{
+		int fd = connect_to(path);
+		std::string response;
+		std::string request = "(vector-set! counts 0 " + std::to_string(i) + ") (+ base (vector-ref counts 0))";
+		if (fd >= 0 && server::write_frame(fd, request) && server::read_frame(fd, response)) responses.push_back(response);
+		if (fd >= 0) close(fd);
+	}
+	server.stop();
+
+	// Workers change their own copies of the globals, the parent's stay as they were
+	auto counts = static_cast<const Vector*>(globals->find("counts"));
+	EXPECT_EQ(counts->at(0).i_value, 0);
+	EXPECT_EQ(responses, std::vector<std::string>({ "40", "41", "42", "43" }));
 }
\ No newline at end of file